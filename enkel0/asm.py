@@ -13,7 +13,11 @@ ops = [
     'GT',
     'GQ',
     'HALT',
+    'INC',
     'JP',
+    'JPC',
+    'JPCLI',
+    'JPCLL',
     'JPNZ',
     'JPZ',
     'LD',
@@ -25,12 +29,19 @@ ops = [
     'MUL',
     'NEQ',
     'NOP',
+    'OPI',
+    'OPLI',
+    'OPLIST',
+    'OPLL',
+    'OPLLST',
     'OR',
     'PRINT',
     'PRNT',
     'RET',
     'RLOAD',
+    'RLOADL',
     'RSTORE',
+    'RSTOREL',
     'SET',
     'ST',
     'STARG',
@@ -49,7 +60,11 @@ ary = [
     0,      # GT
     0,      # GQ
     0,      # HALT
+    2,      # INC local_reg number
     1,      # JP addr
+    2,      # JPC op addr
+    4,      # JPCLI op local_reg number addr
+    4,      # JPCLL op local_reg local_reg addr
     1,      # JPNZ addr
     1,      # JPZ addr
     1,      # LD local_reg
@@ -61,12 +76,19 @@ ary = [
     0,      # MUL
     0,      # NEQ
     0,      # NOP
+    2,      # OPI op number
+    3,      # OPLI op local_reg number
+    4,      # OPLIST op local_reg number local_reg
+    3,      # OPLL op local_reg local_reg
+    4,      # OPLLST op local_reg local_reg local_reg
     0,      # OR
     0,      # PRINT
     0,      # PRNT
     0,      # RET
     0,      # RLOAD
+    2,      # RLOADL global_reg local_reg
     0,      # RSTORE
+    2,      # RSTOREL global_reg local_reg
     1,      # SET number
     1,      # ST local_reg
     1,      # STARG arg_reg
@@ -75,6 +97,79 @@ ary = [
     0,      # UMIN
     0]      # XOR
 
+# register vm, must be in sync with vmreg.h
+regops = [
+    'ADD',
+    'AND',
+    'CALL',
+    'DIV',
+    'EMIT',
+    'EQ',
+    'GQ',
+    'GT',
+    'HALT',
+    'JP',
+    'JPC',
+    'JPNZ',
+    'JPZ',
+    'LDARG',
+    'LDS',
+    'LOAD',
+    'LQ',
+    'LT',
+    'MOD',
+    'MOV',
+    'MUL',
+    'NEQ',
+    'OR',
+    'PRINT',
+    'RET',
+    'RLOAD',
+    'RSTORE',
+    'SET',
+    'STARG',
+    'STORE',
+    'STS',
+    'SUB',
+    'UMIN',
+    'XOR']
+
+regary = [
+    3,      # ADD reg reg reg
+    3,      # AND reg reg reg
+    1,      # CALL addr
+    3,      # DIV reg reg reg
+    1,      # EMIT reg
+    3,      # EQ reg reg reg
+    3,      # GQ reg reg reg
+    3,      # GT reg reg reg
+    0,      # HALT
+    1,      # JP addr
+    4,      # JPC op reg reg addr
+    2,      # JPNZ reg addr
+    2,      # JPZ reg addr
+    2,      # LDARG reg arg_reg
+    2,      # LDS reg slot
+    2,      # LOAD reg global_reg
+    3,      # LQ reg reg reg
+    3,      # LT reg reg reg
+    3,      # MOD reg reg reg
+    2,      # MOV reg reg
+    3,      # MUL reg reg reg
+    3,      # NEQ reg reg reg
+    3,      # OR reg reg reg
+    1,      # PRINT reg
+    0,      # RET
+    2,      # RLOAD reg reg
+    2,      # RSTORE reg reg
+    2,      # SET reg number
+    2,      # STARG arg_reg reg
+    2,      # STORE global_reg reg
+    2,      # STS slot reg
+    3,      # SUB reg reg reg
+    2,      # UMIN reg reg
+    3]      # XOR reg reg reg
+
 def no_comments(content):
     ncontent = []
     for line in content:
@@ -98,7 +193,8 @@ def to_decimal(number):
     return int(number)
 
 # replace the corresponing opcodes with numbers,
-# and possible arguments
+# and possible arguments (an argument naming an
+# operator, as in "OPLL ADD 1 2", becomes its opcode)
 def parse(line):
     if (line[0] in ops):
         nline = []
@@ -106,8 +202,10 @@ def parse(line):
         code = int(i)
         ar = ary[i]
         nline.append(code)
-        if (ar == 1):
-            nline.append(line[1])
+        for arg in line[1:1 + ar]:
+            if arg in ops:
+                arg = ops.index(arg)
+            nline.append(arg)
         return nline
     else:
         return line
@@ -164,18 +262,21 @@ def main(argv):
     inputfile = ''
     outputfile = ''
     verbose = 0
+    global ops, ary
 
     try:
-        opts, args = getopt.getopt(argv,"vhi:o:",["ifile=","ofile="])
+        opts, args = getopt.getopt(argv,"rvhi:o:",["ifile=","ofile="])
     except getopt.GetoptError:
-        print('asm.py -i <inputfile> -o <outputfile>')
+        print('asm.py [-r] -i <inputfile> -o <outputfile>')
         sys.exit(2)
 
     for opt, arg in opts:
         if opt == '-v':
             verbose = 1
+        if opt == '-r':
+            ops, ary = regops, regary
         if opt == '-h':
-            print('usage: asm.py -i <inputfile> -o <outputfile>')
+            print('usage: asm.py [-r] -i <inputfile> -o <outputfile>')
             sys.exit()
         elif opt in ("-i", "--ifile"):
             inputfile = arg
@@ -0,0 +1,333 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "scan.h"
+#include "symbol.h"
+
+
+// code of a procedure is made relative, with labels
+// numbered from zero "{L3}" and calls by name "{Cname}",
+// so it can be put back at any place. a record in the
+// cache is such code:
+//
+//   enkel cache 1
+//   <number of labels>
+//   <code>
+//
+// the name of the record is the hash of the tokens of
+// the procedure, and the addresses of the globals it
+// uses, as those are still given as numbers in code
+
+#define CACHE_HEADER "enkel cache 1"
+#define CACHE_DEPTH 16
+
+// FNV-1a, 64 bits
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static char* cachedir = NULL;
+static int cachetag = 0;
+
+// procedures being parsed, nested
+static uint64_t hashes[CACHE_DEPTH];
+static int depth = 0;
+
+// key of each procedure, by connect number, 0 if none
+static uint64_t* keys = NULL;
+static int maxkeys = 0;
+
+static uint64_t fnv(uint64_t h, const void* data, size_t length) {
+    const unsigned char* p = (const unsigned char*) data;
+    while (length-- > 0) {
+        h ^= *p++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// mix into all procedures being parsed
+static void mix(const void* data, size_t length) {
+    int i;
+    for (i = 0; i < depth && i < CACHE_DEPTH; i++)
+        hashes[i] = fnv(hashes[i], data, length);
+}
+
+// the tag separates code for different machines
+void setcache(char* directory, int tag) {
+    cachedir = directory;
+    cachetag = tag;
+}
+
+
+// hashing while parsing
+
+void hashbegin(char* identifier) {
+    if (cachedir == NULL)
+        return;
+    if (depth < CACHE_DEPTH) {
+        uint64_t h = fnv(FNV_OFFSET, CACHE_HEADER, strlen(CACHE_HEADER));
+        h = fnv(h, &cachetag, sizeof(cachetag));
+        hashes[depth] = fnv(h, identifier, strlen(identifier) + 1);
+    }
+    depth++;
+}
+
+void hashtoken(int sym, char* text) {
+    if (depth == 0)
+        return;
+    mix(&sym, sizeof(sym));
+    if (sym == IDENT || sym == NUMBER)
+        mix(text, strlen(text) + 1);
+}
+
+void hashsignature(char* identifier, int address) {
+    if (depth == 0)
+        return;
+    mix("@", 1);
+    mix(identifier, strlen(identifier) + 1);
+    mix(&address, sizeof(address));
+}
+
+void hashend(int connect) {
+    if (depth == 0)
+        return;
+    depth--;
+    if (depth >= CACHE_DEPTH)
+        return;
+
+    if (connect >= maxkeys) {
+        int n = maxkeys ? maxkeys : 64;
+        while (n <= connect)
+            n *= 2;
+        uint64_t* k = (uint64_t*) realloc(keys, n * sizeof(uint64_t));
+        if (k == NULL)
+            return;
+        memset(k + maxkeys, 0, (n - maxkeys) * sizeof(uint64_t));
+        keys = k;
+        maxkeys = n;
+    }
+    keys[connect] = hashes[depth] ? hashes[depth] : 1;
+}
+
+
+// relocation
+
+static int isword(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// "L0012" or "C0002", but not part of a longer word
+static int labelat(char* text, size_t i, size_t length, size_t* end, int* number) {
+    size_t j = i + 1;
+    int value = 0;
+
+    if (text[i] != 'L' && text[i] != 'C')
+        return FALSE;
+    if (i > 0 && isword(text[i - 1]))
+        return FALSE;
+    if (j >= length || !isdigit((unsigned char) text[j]))
+        return FALSE;
+    while (j < length && isdigit((unsigned char) text[j]))
+        value = value * 10 + (text[j++] - '0');
+    if (j < length && isword(text[j]))
+        return FALSE;
+
+    *end = j;
+    *number = value;
+    return TRUE;
+}
+
+// all labels in the code of a procedure are its own,
+// calls are only by name if the code is to be kept;
+// the text ends with '\0', as from open_memstream()
+char* relative(char* text, size_t length, int byname, int* nlabels) {
+    int *labels = NULL, maxlabels = 0, number, k;
+    char* code;
+    size_t size, i, end, from;
+    FILE* mem;
+
+    mem = open_memstream(&code, &size);
+    if (mem == NULL)
+        return NULL;
+
+    *nlabels = 0;
+    for (i = from = 0; i < length; ) {
+        i += strcspn(text + i, "LC");
+        if (i >= length)
+            break;
+        if (!labelat(text, i, length, &end, &number)) {
+            i++;
+            continue;
+        }
+        fwrite(text + from, 1, i - from, mem);
+
+        if (text[i] == 'L') {
+            for (k = 0; k < *nlabels; k++)
+                if (labels[k] == number)
+                    break;
+            if (k == *nlabels) {
+                if (k == maxlabels) {
+                    maxlabels = maxlabels ? maxlabels * 2 : 16;
+                    labels = (int*) realloc(labels, maxlabels * sizeof(int));
+                }
+                labels[(*nlabels)++] = number;
+            }
+            fprintf(mem, "{L%d}", k);
+        } else if (byname && connectname(number) != NULL) {
+            fprintf(mem, "{C%s}", connectname(number));
+        } else
+            fwrite(text + i, 1, end - i, mem);
+        i = from = end;
+    }
+    fwrite(text + from, 1, length - from, mem);
+    fclose(mem);
+    free(labels);
+    return code;
+}
+
+// put back relative code, with fresh labels
+int relocate(FILE* out, char* code, int nlabels) {
+    int first = 0, k;
+    char *p, *q;
+
+    for (k = 0; k < nlabels; k++) {
+        int l = labelincrease();
+        if (k == 0)
+            first = l;
+    }
+
+    for (p = code; *p != '\0'; p++) {
+        q = strchr(p, '{');
+        if (q == NULL) {
+            fputs(p, out);
+            break;
+        }
+        fwrite(p, 1, q - p, out);
+        p = q;
+        q = strchr(p, '}');
+        if (q == NULL)
+            return FALSE;
+        *q = '\0';
+        if (p[1] == 'L') {
+            k = atoi(p + 2);
+            if (k < 0 || k >= nlabels)
+                return FALSE;
+            fputs(label(first + k), out);
+        } else if (p[1] == 'C')
+            fputs(connects(getconnectnumber(p + 2)), out);
+        else
+            return FALSE;
+        *q = '}';
+        p = q;
+    }
+    return TRUE;
+}
+
+
+// records
+
+static uint64_t keyof(int connect) {
+    if (cachedir == NULL || connect < 0 || connect >= maxkeys)
+        return 0;
+    return keys[connect];
+}
+
+static char* recordpath(uint64_t key, char* suffix) {
+    size_t length = strlen(cachedir) + 64;
+    char* path = (char*) malloc(length);
+    if (path != NULL)
+        snprintf(path, length, "%s/%016llx%s", cachedir, (unsigned long long) key, suffix);
+    return path;
+}
+
+// every "{..}" a label in range, or a name
+static int wellformed(char* code, int nlabels) {
+    char *p, *q;
+    int k;
+
+    for (p = strchr(code, '{'); p != NULL; p = strchr(q, '{')) {
+        q = strchr(p, '}');
+        if (q == NULL)
+            return FALSE;
+        if (p[1] == 'L') {
+            k = atoi(p + 2);
+            if (k < 0 || k >= nlabels)
+                return FALSE;
+        } else if (p[1] != 'C' || q == p + 2)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// relative code of a procedure, or NULL if not cached
+char* cacheread(int connect, int* nlabels) {
+    uint64_t key = keyof(connect);
+    char *path, *record, *p, *q;
+    long size;
+    FILE* f;
+
+    if (key == 0)
+        return NULL;
+
+    path = recordpath(key, "");
+    f = path ? fopen(path, "r") : NULL;
+    free(path);
+    if (f == NULL)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    record = (size > 0) ? (char*) malloc(size + 1) : NULL;
+    if (record == NULL || fread(record, 1, size, f) != (size_t) size) {
+        free(record);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    record[size] = '\0';
+
+    p = record + strlen(CACHE_HEADER) + 1;
+    if (strncmp(record, CACHE_HEADER "\n", strlen(CACHE_HEADER) + 1) != 0
+            || (*nlabels = (int) strtol(p, &q, 10)) < 0 || q == p || *q != '\n') {
+        free(record);
+        return NULL;
+    }
+    memmove(record, q + 1, strlen(q + 1) + 1);
+    if (!wellformed(record, *nlabels)) {
+        free(record);
+        return NULL;
+    }
+    return record;
+}
+
+// written aside and renamed, so a record is never seen half done
+void cachewrite(int connect, char* code, int nlabels) {
+    uint64_t key = keyof(connect);
+    char suffix[32];
+    char *path, *temp;
+    FILE* f;
+
+    if (key == 0)
+        return;
+
+    snprintf(suffix, sizeof(suffix), ".%d.%d", (int) getpid(), connect);
+    path = recordpath(key, "");
+    temp = recordpath(key, suffix);
+    f = (path && temp) ? fopen(temp, "w") : NULL;
+    if (f != NULL) {
+        fprintf(f, "%s\n%d\n", CACHE_HEADER, nlabels);
+        fputs(code, f);
+        if (fclose(f) == 0)
+            rename(temp, path);
+        else
+            unlink(temp);
+    }
+    free(temp);
+    free(path);
+}
@@ -0,0 +1,28 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdio.h>
+
+// ---------------------------
+// incremental compilation:
+// generated code of procedures, kept
+// in a directory under a hash of their
+// tokens and the globals they depend on,
+// and relocation of such code
+
+// hashing while parsing
+extern void setcache(char* directory, int tag);
+extern void hashbegin(char* identifier);
+extern void hashtoken(int sym, char* text);
+extern void hashsignature(char* identifier, int address);
+extern void hashend(int connect);
+
+// relocation
+extern char* relative(char* text, size_t length, int byname, int* nlabels);
+extern int relocate(FILE* out, char* code, int nlabels);
+
+// records of relative code
+extern char* cacheread(int connect, int* nlabels);
+extern void cachewrite(int connect, char* code, int nlabels);
+
+#endif
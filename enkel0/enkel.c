@@ -4,11 +4,15 @@
 #include <string.h>
 #include <unistd.h> 
 #include <libgen.h>
+#include <getopt.h>
 
 #include "enkel.h"
 #include "scan.h"
 #include "symbol.h"
 #include "error.h"
+#include "ir.h"
+#include "cache.h"
+#include "stats.h"
 
 
 // error
@@ -18,7 +22,7 @@ void buffer() {
 
 // file handling
 FILE* file = NULL;
-options_t options = { 0, 0x0, NULL, NULL };
+options_t options = { 0, 0, 0x0, NULL, NULL, NULL, 0 };
 
 // send file pointer to scan
 void setinputfile(FILE* inputfile) {
@@ -31,7 +35,12 @@ void setinputfile(FILE* inputfile) {
 Symbol sym;
 
 void nextsym() {
+    Phase previous = phase(PHASE_SCAN);
     sym = scan();
+    phase(previous);
+    hashtoken(sym, buf);
+    if (tracking)
+        stats.tokens++;
 
     if (options.verbose != 0) {
         printf("> ");
@@ -76,6 +85,10 @@ node* nnode(int type) {
     if (n == NULL)
         return NULL;
     n->type = type;
+    n->value = 0;
+    n->node1 = n->node2 = n->node3 = NULL;
+    if (tracking)
+        stats.nodes++;
     return n;
 }
 
@@ -112,6 +125,7 @@ node* load() {
     if (globalexist(buf)) {
         n = nnode(FETCH);
         n->value = getglobal(buf);
+        hashsignature(buf, n->value);
         return n;
     }
 
@@ -133,6 +147,7 @@ node* store() {
     if (globalexist(buf)) {
         n = nnode(ASSIGN);
         n->value = getglobal(buf);
+        hashsignature(buf, n->value);
         return n;
     }
 
@@ -384,9 +399,8 @@ node* statement() {
 
     } else if (accept(IFSYM)) {
         n = nnode(IF);
-        int a = labelincrease();
-        int b = labelincrease();
-        n->value = packint(a, b);
+        n->value = labelincrease();
+        labelincrease(); // and the one after
         n->node1 = condition();
         expect(THENSYM);
         n->node2 = statement();
@@ -397,9 +411,8 @@ node* statement() {
 
     } else if (accept(WHILESYM)) {
         n = nnode(WHILE);
-        int a = labelincrease();
-        int b = labelincrease();
-        n->value = packint(a, b);
+        n->value = labelincrease();
+        labelincrease(); // and the one after
         n->node1 = condition();
         expect(DOSYM);
         n->node2 = statement();
@@ -419,18 +432,69 @@ node* statement() {
     return n;
 }
 
+// tail calls
+// a call is in tail position if nothing but the
+// final RET follows it, or only "return rval"
+// (which just stores rval back into itself)
+
+int returnsrval(node* n) {
+    if (n == NULL || n->type != RVAL)
+        return FALSE;
+    if (n->node1 == NULL || n->node1->type != FETCH)
+        return FALSE;
+    return (n->node1->value == getglobal("rval"));
+}
+
+// mark calls in tail position of procedure 'proc',
+// calls to itself jumps back to 'entry' (after params)
+void tailposition(node* n, int proc, int entry) {
+    if (n == NULL)
+        return;
+
+    switch (n->type) {
+
+        case CALLPROC:
+            if (n->value == proc) {
+                n->type = TAILSELF;
+                n->value = entry;
+            } else
+                n->type = TAILCALL;
+            break;
+
+        case IF:
+            tailposition(n->node2, proc, entry);
+            break;
+
+        case IFELSE:
+            tailposition(n->node2, proc, entry);
+            tailposition(n->node3, proc, entry);
+            break;
+
+        case SEQ:
+            if (returnsrval(n->node2))
+                tailposition(n->node1, proc, entry);
+            else
+                tailposition(n->node2, proc, entry);
+            break;
+
+        default:
+            break;
+    }
+}
+
 // flags for setting START
 int startflag = FALSE;
 int startflagset = FALSE;
 
 // procedure = { "procedure" ident "[" {"," ident} "]" ";" block ";" }
 node* procedure() {
-    node *k, *l, *m, *n, *p, *q, *r, *s;
+    node *e, *k, *l, *m, *n, *p, *q, *r, *s;
     n = NULL;
 
     while (accept(PROCSYM)) {
         expect(IDENT);
         pushcurrent(buf);
+        hashbegin(buf);
 
         p = nnode(PROCEDURE);
         p->value = getconnectnumber(buf);
@@ -467,13 +531,22 @@ node* procedure() {
 
         expect(SEMICOLON);
         r = block();
+        hashend(p->value);
         expect(SEMICOLON);
 
+        e = nnode(ENTRY);
+        e->value = labelincrease();
+        tailposition(r, p->value, e->value);
+
         s = nnode(SEQ);
         s->node1 = k; // parameters
-        s->node2 = r; // block
+        s->node2 = e; // entry for self tail calls
 
-        p->node1 = s;
+        q = nnode(SEQ);
+        q->node1 = s;
+        q->node2 = r; // block
+
+        p->node1 = q;
 
         popcurrent();
 
@@ -666,11 +739,245 @@ node* program() {
 // ---------------------------
 // generate instructions for assembler
 // from parse tree
+void compile(node *n);
+
+// arguments of a self tail call go straight to the
+// locals: all are pushed first, then stored in reverse,
+// so no argument sees an already overwritten parameter
+void pushargs(node *n) {
+    if (n == NULL)
+        return;
+    if (n->type == SEQ) {
+        pushargs(n->node1);
+        pushargs(n->node2);
+    } else if (n->type == PARAMASSIGN)
+        compile(n->node1);
+}
+
+void storeargs(node *n) {
+    if (n == NULL)
+        return;
+    if (n->type == SEQ) {
+        storeargs(n->node2);
+        storeargs(n->node1);
+    } else if (n->type == PARAMASSIGN)
+        fprintf(file, "\tST %d\n", n->value);
+}
+
+// instruction selection
+// tiles of the tree which match a fused instruction
+// in the vm are emitted as one, instead of one per node:
+//  op with immediate       a + 1       OPI, OPLI
+//  load-load-op            a + b       OPLL
+//  load-load-op-store      c is a + b  OPLLST, OPLIST
+//  increment variable      j is j + 1  INC
+//  compare-and-branch      if a < b    JPC, JPCLI, JPCLL
+//  array with local index  A.j         RLOADL, RSTOREL
+// fused instructions carry the operator as an argument
+
+// assembler name for operator, or NULL if none
+char* opname(int type) {
+    switch (type) {
+        case ADD:           return "ADD";
+        case AND:           return "AND";
+        case DIVIDE:        return "DIV";
+        case MOD:           return "MOD";
+        case MULTIPLY:      return "MUL";
+        case OR:            return "OR";
+        case SUB:           return "SUB";
+        case XOR:           return "XOR";
+        case EQUAL:         return "EQ";
+        case GREATEEQUAL:   return "GQ";
+        case GREATER:       return "GT";
+        case LESS:          return "LT";
+        case LESSEQUAL:     return "LQ";
+        case NOTEQUAL:      return "NEQ";
+        default:            return NULL;
+    }
+}
+
+// the relation which holds when the given does not
+int negate(int type) {
+    switch (type) {
+        case EQUAL:         return NOTEQUAL;
+        case GREATEEQUAL:   return LESS;
+        case GREATER:       return LESSEQUAL;
+        case LESS:          return GREATEEQUAL;
+        case LESSEQUAL:     return GREATER;
+        case NOTEQUAL:      return EQUAL;
+        default:            return BLANK;
+    }
+}
+
+int islocal(node *n) {
+    return (n != NULL && n->type == LOCALFETCH);
+}
+
+int isnumber(node *n) {
+    return (n != NULL && n->type == INUMBER);
+}
+
+// binary operator with both operands
+int isbinary(node *n) {
+    return (n != NULL && opname(n->type) != NULL
+        && n->node1 != NULL && n->node2 != NULL);
+}
+
+// try to cover n with a fused instruction
+int tile(node *n) {
+    node *a, *b, *e;
+
+    if (n->type == LARRAY && islocal(n->node1)) {
+        fprintf(file, "\tRLOADL %d %d\n", n->value, n->node1->value);
+        return TRUE;
+    }
+
+    if (n->type == SARRAY && islocal(n->node2)) {
+        compile(n->node1);
+        fprintf(file, "\tRSTOREL %d %d\n", n->value, n->node2->value);
+        return TRUE;
+    }
+
+    if (n->type == LOCALASSIGN) {
+        e = n->node1;
+        if (!isbinary(e))
+            return FALSE;
+        a = e->node1;
+        b = e->node2;
+
+        if (islocal(a) && isnumber(b) && a->value == n->value
+            && (e->type == ADD || e->type == SUB)) {
+            fprintf(file, "\tINC %d %d\n", n->value,
+                (e->type == ADD) ? b->value : -b->value);
+            return TRUE;
+        }
+        if (islocal(a) && islocal(b)) {
+            fprintf(file, "\tOPLLST %s %d %d %d\n",
+                opname(e->type), a->value, b->value, n->value);
+            return TRUE;
+        }
+        if (islocal(a) && isnumber(b)) {
+            fprintf(file, "\tOPLIST %s %d %d %d\n",
+                opname(e->type), a->value, b->value, n->value);
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    if (!isbinary(n))
+        return FALSE;
+    a = n->node1;
+    b = n->node2;
+
+    if (islocal(a) && islocal(b)) {
+        fprintf(file, "\tOPLL %s %d %d\n",
+            opname(n->type), a->value, b->value);
+        return TRUE;
+    }
+    if (islocal(a) && isnumber(b)) {
+        fprintf(file, "\tOPLI %s %d %d\n",
+            opname(n->type), a->value, b->value);
+        return TRUE;
+    }
+    if (isnumber(b)) {
+        compile(a);
+        fprintf(file, "\tOPI %s %d\n", opname(n->type), b->value);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// jump to target if condition c is 'when' (TRUE or FALSE)
+void branch(node *c, int when, char *target) {
+    int rel;
+    node *a, *b;
+
+    rel = c->type;
+    if (when == FALSE)
+        rel = negate(rel);
+
+    if (rel == BLANK || !isbinary(c)) {
+        compile(c);
+        fprintf(file, "\t%s :%s\n", (when == FALSE) ? "JPZ" : "JPNZ", target);
+        return;
+    }
+    a = c->node1;
+    b = c->node2;
+
+    if (islocal(a) && islocal(b))
+        fprintf(file, "\tJPCLL %s %d %d :%s\n",
+            opname(rel), a->value, b->value, target);
+    else if (islocal(a) && isnumber(b))
+        fprintf(file, "\tJPCLI %s %d %d :%s\n",
+            opname(rel), a->value, b->value, target);
+    else {
+        compile(a);
+        compile(b);
+        fprintf(file, "\tJPC %s :%s\n", opname(rel), target);
+    }
+}
+
+int cachereused = 0, cachecompiled = 0;
+
+// the code of a procedure is taken from the cache if it
+// is unchanged since it was kept, otherwise it is
+// generated in memory and kept as well
+void compilecached(FILE *out, node *n, void (*generate)(FILE *, node *)) {
+    char *text, *code;
+    size_t length;
+    int nlabels;
+    FILE *mem;
+
+    if (options.cache == NULL) {
+        generate(out, n);
+        return;
+    }
+
+    code = cacheread(n->value, &nlabels);
+    if (code != NULL) {
+        relocate(out, code, nlabels);
+        free(code);
+        cachereused++;
+        return;
+    }
+
+    mem = open_memstream(&text, &length);
+    if (mem == NULL) {
+        generate(out, n);
+        return;
+    }
+    generate(mem, n);
+    fclose(mem);
+
+    code = relative(text, length, TRUE, &nlabels);
+    if (code != NULL)
+        cachewrite(n->value, code, nlabels);
+    free(code);
+    cachecompiled++;
+
+    fwrite(text, 1, length, out);
+    free(text);
+}
+
+void compileprocedure(FILE *out, node *n) {
+    FILE *saved = file;
+
+    file = out;
+    fprintf(file, "\n%s:\t\n", connects(n->value));
+    compile(n->node1);
+    fprintf(file, "\tRET\n");
+    file = saved;
+}
+
 void compile(node *n) {
+    char target[LABEL_MAX];
 
     if (n == NULL)
         return;
 
+    if (tile(n))
+        return;
+
     switch (n->type) {
 
         case ADD:
@@ -707,9 +1014,8 @@ void compile(node *n) {
         case DO:
             fprintf(file, "%s:\n", label(n->value));
             compile(n->node1);
-            compile(n->node2);
-            fprintf(file, "\tJPNZ ");
-            fprintf(file, ":%s\n", label(n->value));
+            strcpy(target, label(n->value));
+            branch(n->node2, TRUE, target);
             break;
 
         case EMIT:
@@ -717,6 +1023,10 @@ void compile(node *n) {
             fprintf(file, "\tEMIT\n");
             break;
 
+        case ENTRY:
+            fprintf(file, "%s:\n", label(n->value));
+            break;
+
         case EQUAL:
             compile(n->node1);
             compile(n->node2);
@@ -740,17 +1050,15 @@ void compile(node *n) {
             break;
 
         case IF:
-            compile(n->node1);
-            fprintf(file, "\tJPZ ");
-            fprintf(file, ":%s\n", labela(n->value));
+            strcpy(target, labela(n->value));
+            branch(n->node1, FALSE, target);
             compile(n->node2);
             fprintf(file, "%s:\n", labela(n->value));
             break;
 
         case IFELSE:
-            compile(n->node1);
-            fprintf(file, "\tJPZ ");
-            fprintf(file, ":%s\n", labela(n->value));
+            strcpy(target, labela(n->value));
+            branch(n->node1, FALSE, target);
             compile(n->node2);
             fprintf(file, "\tJP ");
             fprintf(file, ":%s\n", labelb(n->value));
@@ -838,9 +1146,7 @@ void compile(node *n) {
             break;
 
         case PROCEDURE:
-            fprintf(file, "\n%s:\t\n", connects(n->value));
-            compile(n->node1);
-            fprintf(file, "\tRET\n");
+            compilecached(file, n, compileprocedure);
             break;
 
         case PROG:
@@ -864,6 +1170,7 @@ void compile(node *n) {
             fprintf(file, "\tLOAD %d\n", n->value);
             fprintf(file, "\tADD\n");
             fprintf(file, "\tRSTORE\n");
+            break;
 
         case SEQ:
             compile(n->node1);
@@ -891,6 +1198,19 @@ void compile(node *n) {
             fprintf(file, "\tSUB\n");
             break;
 
+        // reuse the frame of the caller: the callee
+        // returns directly to where we would have returned
+        case TAILCALL:
+            compile(n->node1);
+            fprintf(file, "\tJP :%s\n", connects(n->value));
+            break;
+
+        case TAILSELF:
+            pushargs(n->node1);
+            storeargs(n->node1);
+            fprintf(file, "\tJP :%s\n", label(n->value));
+            break;
+
         case UMINUS:
             compile(n->node1);
             fprintf(file, "\tUMIN\n");
@@ -898,9 +1218,8 @@ void compile(node *n) {
 
         case WHILE:
             fprintf(file, "%s:\n", labela(n->value));
-            compile(n->node1);
-            fprintf(file, "\tJPZ ");
-            fprintf(file, ":%s\n", labelb(n->value));
+            strcpy(target, labelb(n->value));
+            branch(n->node1, FALSE, target);
             compile(n->node2);
             fprintf(file, "\tJP ");
             fprintf(file, ":%s\n", labela(n->value));
@@ -919,12 +1238,67 @@ void compile(node *n) {
     }
 }
 
+void registerprocedure(FILE *out, node *n) {
+    function* f = lowerprocedure(n);
+    Phase previous = phase(PHASE_OPTIMIZE);
+    optimize(f);
+    phase(previous);
+    if (options.flags & 0x04)
+        printfunction(stdout, f);
+    allocate(out, f);
+    sampleheap();
+    freefunction(f);
+    compileregister(out, n->node1);
+}
+
+// register vm: each procedure, and the main program,
+// is lowered to IR in SSA form, optimized (copies,
+// common values, loop invariants, dead code) and
+// allocated to registers by linear scan
+void compileregister(FILE *out, node *n) {
+    function* f;
+    Phase previous;
+
+    if (n == NULL)
+        return;
+
+    switch (n->type) {
+
+        case PROCEDURE:
+            compilecached(out, n, registerprocedure);
+            break;
+
+        case PROG:
+            compileregister(out, n->node1);
+            f = lowermain(n);
+            previous = phase(PHASE_OPTIMIZE);
+            optimize(f);
+            phase(previous);
+            if (options.flags & 0x04)
+                printfunction(stdout, f);
+            allocate(out, f);
+            sampleheap();
+            freefunction(f);
+            break;
+
+        case SEQ:
+            compileregister(out, n->node1);
+            compileregister(out, n->node2);
+            break;
+
+        default:
+            break;
+    }
+}
+
 void usage(char *progname, int opt) {
     fprintf(stderr, USAGE, progname ? progname : DEFAULT_PROGNAME);
     exit(EXIT_FAILURE);
 }
 
 int compiling(options_t *options) {
+    char* emitted = NULL;
+    size_t length = 0;
 
     if (!options) {
         errnum(ERROR_INPUT_OPTIONS);
@@ -937,20 +1311,48 @@ int compiling(options_t *options) {
     }
 
     file = options->output;
+    if (options->stats) {
+        startstats();
+        // code kept in memory, to time the writing apart
+        file = open_memstream(&emitted, &length);
+        if (file == NULL)
+            file = options->output;
+    }
     setinputfile(options->input);
+    if (options->cache)
+        setcache(options->cache, options->registers);
     init(); // rval init
 
     if (options->verbose)
         printf("parsing ..\n");
+    stage(PHASE_PARSE);
     node* n = program();
+    sampleheap();
     if (options->verbose)
         printf("done parsing.\n");    
 
     if (options->verbose)
         printf("compiling ..\n");
-    compile(n);
+    stage(PHASE_CODEGEN);
+    if (options->registers)
+        compileregister(file, n);
+    else
+        compile(n);
+    sampleheap();
+    if (file != options->output) {
+        stage(PHASE_EMIT);
+        fclose(file);
+        fwrite(emitted, 1, length, options->output);
+        fflush(options->output);
+        stats.emitted = (long) length;
+        free(emitted);
+        file = options->output;
+    }
+    stage(PHASE_OTHER);
     if (options->verbose)
         printf("done compiling.\n");
+    if (options->verbose && options->cache)
+        printf("cache: %d procedures reused, %d compiled\n", cachereused, cachecompiled);
 
     if (options->flags & 0x01)
         printglobal();
@@ -960,16 +1362,26 @@ int compiling(options_t *options) {
     destroysymbols();
     deletenodes(n);
 
+    if (options->stats) {
+        stage(PHASE_OTHER);
+        printstats(stderr, options->stats == STATS_JSON);
+    }
+
     return EXIT_SUCCESS;
 }
 
+static struct option longoptions[] = {
+    { "stats", optional_argument, NULL, 's' },
+    { NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char *argv[]) {
     int opt;
     opterr = 0;
     options.input = stdin;
     options.output = stdout;
 
-    while ((opt = getopt(argc, argv, OPTSTR)) != EOF) {
+    while ((opt = getopt_long(argc, argv, OPTSTR, longoptions, NULL)) != EOF) {
         switch(opt) {
             case 'i':
                 if (! (options.input = fopen(optarg, "r")) ) {
@@ -993,6 +1405,23 @@ int main(int argc, char *argv[]) {
                 options.verbose += 1;
                 break;
 
+            case 'r':
+                options.registers = TRUE;
+                break;
+
+            case 'c':
+                options.cache = optarg;
+                break;
+
+            case 's':
+                if (optarg == NULL || strcmp(optarg, "text") == 0)
+                    options.stats = STATS_TEXT;
+                else if (strcmp(optarg, "json") == 0)
+                    options.stats = STATS_JSON;
+                else
+                    usage(basename(argv[0]), opt);
+                break;
+
             case 'h':
             default:
                 usage(basename(argv[0]), opt);
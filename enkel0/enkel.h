@@ -1,15 +1,19 @@
 #ifndef _ENKEL_H
 #define _ENKEL_H
 
+#include <stdint.h>
+
 #define FALSE 0
 #define TRUE 1
 
 #define DEFAULT_PROGNAME "compiler"
-#define USAGE "%s [-v] [-f hexflag] [-i inputfile] [-o outputfile] [-h]"
+#define USAGE "%s [-v] [-r] [-c cachedir] [--stats[=json]] [-f hexflag] [-i inputfile] [-o outputfile] [-h]"
 #define ERR_FOPEN_INPUT "fopen(input, r)"
 #define ERR_FOPEN_OUTPUT "fopen(output, w)"
 #define ERR_COMPILER "compiling error"
-#define OPTSTR "vi:o:f:h"
+#define OPTSTR "vrc:i:o:f:h"
+#define STATS_TEXT 1
+#define STATS_JSON 2
 
 // ---------------------------
 // *internal* parse tree ('AST'),
@@ -25,6 +29,7 @@ typedef enum {
     DIVIDE,
     DO,
     EMIT,
+    ENTRY,
     EQUAL,
     FETCH,
     GREATEEQUAL,
@@ -56,6 +61,8 @@ typedef enum {
     STARTW,
     STARTWC,
     SUB,
+    TAILCALL,
+    TAILSELF,
     UMINUS,
     WHILE,
     XOR
@@ -71,8 +78,11 @@ typedef struct node {
 // file handling
 typedef struct options_t {
     int verbose;
+    int registers;      // code for the register vm
     uint32_t flags;
     FILE *input, *output;
+    char *cache;        // directory of compiled procedures
+    int stats;          // STATS_TEXT or STATS_JSON, 0 if none
 } options_t;
 
 // used in scan
@@ -57,6 +57,9 @@ char* errorstring(int ERROR) {
             return "no previous declaration of local identifier at level";
         case ERROR_PREVIOUS_DECLARATION_LOCAL_IDENT_LEVEL:
             return "previous declaration of local identifier at level";
+// lsra.c
+        case ERROR_REGISTER_SPILL:
+            return "too many values spilled from registers";
 
         default:
             return "unknown error";
@@ -29,9 +29,12 @@ enum {
 	ERROR_PREVIOUS_DECLARATION_GLOBAL_IDENT			= 0x0701,
 	ERROR_NO_PREVIOUS_DECLARATION_GLOBAL_IDENT		= 0x0702,
 	ERROR_PREVIOUS_DECLARATION_LOCAL_IDENT_LEVEL		= 0x0703,
-	ERROR_NO_PREVIOUS_DECLARATION_LOCAL_IDENT_LEVEL		= 0x0704
+	ERROR_NO_PREVIOUS_DECLARATION_LOCAL_IDENT_LEVEL		= 0x0704,
 
-} ERROR;
+// lsra.c
+	ERROR_REGISTER_SPILL					= 0x0801
+
+};
 
 extern void errnum(int error);
 extern int printsymbol(int s);
@@ -0,0 +1,1151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "enkel.h"
+#include "symbol.h"
+#include "ir.h"
+
+// ---------------------------
+// construction of functions,
+// blocks and instructions
+
+static function* newfunction(int label, int nvars) {
+    function* f = (function*) calloc(1, sizeof(function));
+    f->label = label;
+    f->nvars = (nvars > 0) ? nvars : 1;
+    f->undef = -1;
+    return f;
+}
+
+static bblock* newblock(function* f) {
+    bblock* b = (bblock*) calloc(1, sizeof(bblock));
+    b->id = f->nblocks;
+    b->rpo = -1;
+    b->defs = (int*) malloc(sizeof(int) * f->nvars);
+    for (int k = 0; k < f->nvars; k++)
+        b->defs[k] = -1;
+
+    if (f->nblocks == f->maxblocks) {
+        f->maxblocks = f->maxblocks ? 2 * f->maxblocks : 16;
+        f->blocks = (bblock**) realloc(f->blocks, sizeof(bblock*) * f->maxblocks);
+    }
+    f->blocks[f->nblocks++] = b;
+    return b;
+}
+
+int newvreg(function* f) {
+    if (f->nvregs == f->maxvregs) {
+        f->maxvregs = f->maxvregs ? 2 * f->maxvregs : 64;
+        f->alias = (int*) realloc(f->alias, sizeof(int) * f->maxvregs);
+        f->defin = (instr**) realloc(f->defin, sizeof(instr*) * f->maxvregs);
+    }
+    f->alias[f->nvregs] = f->nvregs;
+    f->defin[f->nvregs] = NULL;
+    return f->nvregs++;
+}
+
+instr* newinstr(function* f, IRop op, int dst, int a, int b) {
+    instr* i = (instr*) calloc(1, sizeof(instr));
+    i->op = op;
+    i->dst = dst;
+    i->a = a;
+    i->b = b;
+    if (dst >= 0)
+        f->defin[dst] = i;
+    return i;
+}
+
+static void append(bblock* b, instr* i) {
+    i->block = b;
+    i->prev = b->last;
+    i->next = NULL;
+    if (b->last)
+        b->last->next = i;
+    else
+        b->first = i;
+    b->last = i;
+}
+
+static void prepend(bblock* b, instr* i) {
+    i->block = b;
+    i->prev = NULL;
+    i->next = b->first;
+    if (b->first)
+        b->first->prev = i;
+    else
+        b->last = i;
+    b->first = i;
+}
+
+void insertbefore(instr* at, instr* i) {
+    bblock* b = at->block;
+    i->block = b;
+    i->next = at;
+    i->prev = at->prev;
+    if (at->prev)
+        at->prev->next = i;
+    else
+        b->first = i;
+    at->prev = i;
+}
+
+// unlink (but do not free) an instruction
+static void detach(instr* i) {
+    bblock* b = i->block;
+    if (i->prev)
+        i->prev->next = i->next;
+    else
+        b->first = i->next;
+    if (i->next)
+        i->next->prev = i->prev;
+    else
+        b->last = i->prev;
+    i->prev = i->next = NULL;
+}
+
+void removeinstr(instr* i) {
+    detach(i);
+    free(i->phi);
+    free(i);
+}
+
+static void addedge(bblock* from, bblock* to) {
+    from->succ[from->nsuccs++] = to;
+    if (to->npreds == to->maxpreds) {
+        to->maxpreds = to->maxpreds ? 2 * to->maxpreds : 2;
+        to->preds = (bblock**) realloc(to->preds, sizeof(bblock*) * to->maxpreds);
+    }
+    to->preds[to->npreds++] = from;
+}
+
+// a block on the edge to succ[k], for code only
+// to be run when going that way; it is placed
+// right after 'from' in the order of blocks
+bblock* splitedge(function* f, bblock* from, int k) {
+    bblock* to = from->succ[k];
+    bblock* b = newblock(f);
+
+    from->succ[k] = b;
+    for (int p = 0; p < to->npreds; p++)
+        if (to->preds[p] == from) {
+            to->preds[p] = b;
+            break;
+        }
+    b->preds = (bblock**) malloc(sizeof(bblock*));
+    b->preds[0] = from;
+    b->npreds = b->maxpreds = 1;
+    b->succ[0] = to;
+    b->nsuccs = 1;
+    b->sealed = TRUE;
+    append(b, newinstr(f, IR_JMP, -1, -1, -1));
+
+    f->order = (bblock**) realloc(f->order, sizeof(bblock*) * (f->norder + 1));
+    for (int m = f->norder; m > from->rpo + 1; m--) {
+        f->order[m] = f->order[m - 1];
+        f->order[m]->rpo = m;
+    }
+    f->order[from->rpo + 1] = b;
+    b->rpo = from->rpo + 1;
+    f->norder++;
+    return b;
+}
+
+void freefunction(function* f) {
+    for (int k = 0; k < f->nblocks; k++) {
+        bblock* b = f->blocks[k];
+        instr* i = b->first;
+        while (i) {
+            instr* next = i->next;
+            free(i->phi);
+            free(i);
+            i = next;
+        }
+        free(b->preds);
+        free(b->defs);
+        free(b->doms);
+        free(b->livein);
+        free(b->liveout);
+        free(b);
+    }
+    free(f->blocks);
+    free(f->order);
+    free(f->alias);
+    free(f->defin);
+    free(f);
+}
+
+int resolve(function* f, int v) {
+    if (v < 0)
+        return v;
+    while (f->alias[v] != v)
+        v = f->alias[v] = f->alias[f->alias[v]];
+    return v;
+}
+
+// no side effects, and value depends only on operands
+int purevalue(IRop op) {
+    switch (op) {
+        case IR_ADD: case IR_AND: case IR_CONST: case IR_DIV:
+        case IR_EQ: case IR_GQ: case IR_GT: case IR_LQ: case IR_LT:
+        case IR_MOD: case IR_MUL: case IR_NEG: case IR_NEQ:
+        case IR_OR: case IR_SUB: case IR_XOR:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+// may stop the machine with an error
+static int cantrap(IRop op) {
+    return (op == IR_DIV || op == IR_MOD);
+}
+
+int commutes(IRop op) {
+    switch (op) {
+        case IR_ADD: case IR_AND: case IR_EQ: case IR_MUL:
+        case IR_NEQ: case IR_OR: case IR_XOR:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+static int hasdst(IRop op) {
+    switch (op) {
+        case IR_BR: case IR_CALL: case IR_EMIT: case IR_HALT: case IR_JMP:
+        case IR_PRINT: case IR_RET: case IR_STARG: case IR_STOREA:
+        case IR_STOREG: case IR_TAIL:
+            return FALSE;
+        default:
+            return TRUE;
+    }
+}
+
+// value of uninitialized variables
+static int undefined(function* f) {
+    if (f->undef < 0) {
+        f->undef = newvreg(f);
+        prepend(f->blocks[0], newinstr(f, IR_CONST, f->undef, -1, -1));
+    }
+    return f->undef;
+}
+
+
+// ---------------------------
+// lowering of the parse tree,
+// SSA built while going, after
+// Braun et al., "Simple and Efficient
+// Construction of Static Single
+// Assignment Form" (2013)
+
+static function* fn;   // function being lowered
+static bblock* cur;     // current block
+static bblock* body;    // entry of self tail calls
+
+static int readvar(bblock* b, int var);
+
+static instr* newphi(bblock* b, int var) {
+    instr* p = newinstr(fn, IR_PHI, newvreg(fn), -1, -1);
+    p->var = var;
+    prepend(b, p);
+    return p;
+}
+
+static void phioperands(bblock* b, instr* p) {
+    p->phi = (int*) malloc(sizeof(int) * (b->npreds + 1));
+    for (int k = 0; k < b->npreds; k++)
+        p->phi[k] = readvar(b->preds[k], p->var);
+}
+
+// not defined in block: look in predecessors,
+// where there is more than one a phi is needed,
+// if not all are known yet the phi is completed
+// when the block gets sealed
+static int readvarrec(bblock* b, int var) {
+    instr* p;
+    int v;
+
+    if (!b->sealed) {
+        p = newphi(b, var);
+        v = p->dst;
+    } else if (b->npreds == 0) {
+        v = undefined(fn);
+    } else if (b->npreds == 1) {
+        v = readvar(b->preds[0], var);
+    } else {
+        p = newphi(b, var);
+        b->defs[var] = p->dst;  // break cycles
+        phioperands(b, p);
+        v = p->dst;
+    }
+    b->defs[var] = v;
+    return v;
+}
+
+static int readvar(bblock* b, int var) {
+    if (b->defs[var] >= 0)
+        return b->defs[var];
+    return readvarrec(b, var);
+}
+
+// all predecessors known
+static void seal(bblock* b) {
+    int again = TRUE;
+    b->sealed = TRUE;
+    while (again) {
+        again = FALSE;
+        for (instr* i = b->first; i && i->op == IR_PHI; i = i->next) {
+            if (i->phi == NULL) {
+                phioperands(b, i);
+                again = TRUE;
+            }
+        }
+    }
+}
+
+static int emit(IRop op, int a, int b, int value) {
+    int dst = hasdst(op) ? newvreg(fn) : -1;
+    instr* i = newinstr(fn, op, dst, a, b);
+    i->value = value;
+    append(cur, i);
+    return dst;
+}
+
+static void jump(bblock* to) {
+    emit(IR_JMP, -1, -1, 0);
+    addedge(cur, to);
+}
+
+static void branch(int c, bblock* t, bblock* f) {
+    emit(IR_BR, c, -1, 0);
+    addedge(cur, t);
+    addedge(cur, f);
+}
+
+// code after a return or tail call is never run,
+// but is still lowered into a block without predecessors
+static void deadblock() {
+    cur = newblock(fn);
+    seal(cur);
+}
+
+static IRop irop(int type) {
+    switch (type) {
+        case ADD:           return IR_ADD;
+        case AND:           return IR_AND;
+        case DIVIDE:        return IR_DIV;
+        case EQUAL:         return IR_EQ;
+        case GREATEEQUAL:   return IR_GQ;
+        case GREATER:       return IR_GT;
+        case LESS:          return IR_LT;
+        case LESSEQUAL:     return IR_LQ;
+        case MOD:           return IR_MOD;
+        case MULTIPLY:      return IR_MUL;
+        case NOTEQUAL:      return IR_NEQ;
+        case OR:            return IR_OR;
+        case SUB:           return IR_SUB;
+        case XOR:           return IR_XOR;
+        default:            return IR_NEG;
+    }
+}
+
+static int expr(node* n) {
+    int a, b;
+
+    if (n == NULL)
+        return undefined(fn);
+
+    switch (n->type) {
+
+        case INUMBER:
+            return emit(IR_CONST, -1, -1, n->value);
+
+        case FETCH:
+            return emit(IR_LOADG, -1, -1, n->value);
+
+        case LOCALFETCH:
+            return readvar(cur, n->value);
+
+        case LARRAY:
+            a = expr(n->node1);
+            b = emit(IR_LOADG, -1, -1, n->value);
+            return emit(IR_LOADA, emit(IR_ADD, b, a, 0), -1, 0);
+
+        case UMINUS:
+            return emit(IR_NEG, expr(n->node1), -1, 0);
+
+        default:
+            a = expr(n->node1);
+            b = expr(n->node2);
+            return emit(irop(n->type), a, b, 0);
+    }
+}
+
+// arguments of a call
+static void arguments(node* n) {
+    if (n == NULL)
+        return;
+    if (n->type == SEQ) {
+        arguments(n->node1);
+        arguments(n->node2);
+    } else if (n->type == PARAMASSIGN)
+        emit(IR_STARG, expr(n->node1), -1, n->value);
+}
+
+// arguments of a self tail call are new values
+// of the parameters: all are read before any is written
+static void reassign(node* n, int* values, int* count) {
+    if (n == NULL)
+        return;
+    if (n->type == SEQ) {
+        reassign(n->node1, values, count);
+        reassign(n->node2, values, count);
+    } else if (n->type == PARAMASSIGN) {
+        values[2 * *count] = n->value;
+        values[2 * *count + 1] = expr(n->node1);
+        (*count)++;
+    }
+}
+
+static int countargs(node* n) {
+    if (n == NULL)
+        return 0;
+    if (n->type == SEQ)
+        return countargs(n->node1) + countargs(n->node2);
+    return (n->type == PARAMASSIGN);
+}
+
+static void lower(node* n) {
+    bblock *t, *e, *j;
+    int a, b, c, count;
+    int* values;
+
+    if (n == NULL)
+        return;
+
+    switch (n->type) {
+
+        case ASSIGN:
+            emit(IR_STOREG, expr(n->node1), -1, n->value);
+            break;
+
+        case CALLPROC:
+            arguments(n->node1);
+            emit(IR_CALL, -1, -1, n->value);
+            break;
+
+        case DO:
+            t = newblock(fn);
+            jump(t);
+            cur = t;
+            lower(n->node1);
+            c = expr(n->node2);
+            e = newblock(fn);
+            branch(c, t, e);
+            seal(t);
+            seal(e);
+            cur = e;
+            break;
+
+        case EMIT:
+            emit(IR_EMIT, expr(n->node1), -1, 0);
+            break;
+
+        case ENTRY:
+            body = newblock(fn);
+            jump(body);
+            cur = body;
+            break;
+
+        case IF:
+            c = expr(n->node1);
+            t = newblock(fn);
+            j = newblock(fn);
+            branch(c, t, j);
+            seal(t);
+            cur = t;
+            lower(n->node2);
+            jump(j);
+            seal(j);
+            cur = j;
+            break;
+
+        case IFELSE:
+            c = expr(n->node1);
+            t = newblock(fn);
+            e = newblock(fn);
+            j = newblock(fn);
+            branch(c, t, e);
+            seal(t);
+            seal(e);
+            cur = t;
+            lower(n->node2);
+            jump(j);
+            cur = e;
+            lower(n->node3);
+            jump(j);
+            seal(j);
+            cur = j;
+            break;
+
+        case LOCALASSIGN:
+            cur->defs[n->value] = emit(IR_COPY, expr(n->node1), -1, 0);
+            break;
+
+        case PARAMSTORE:
+            cur->defs[n->value] = emit(IR_PARAM, -1, -1, n->value);
+            break;
+
+        case PRINT:
+            emit(IR_PRINT, expr(n->node1), -1, 0);
+            break;
+
+        case RETURN:
+            emit(IR_RET, -1, -1, 0);
+            deadblock();
+            break;
+
+        case RVAL:
+            emit(IR_STOREG, expr(n->node1), -1, 0);
+            emit(IR_RET, -1, -1, 0);
+            deadblock();
+            break;
+
+        case SARRAY:
+            a = expr(n->node1);
+            b = expr(n->node2);
+            c = emit(IR_LOADG, -1, -1, n->value);
+            emit(IR_STOREA, emit(IR_ADD, c, b, 0), a, 0);
+            break;
+
+        case SEQ:
+            lower(n->node1);
+            lower(n->node2);
+            break;
+
+        case TAILCALL:
+            arguments(n->node1);
+            emit(IR_TAIL, -1, -1, n->value);
+            deadblock();
+            break;
+
+        // the procedure becomes a loop around its body
+        case TAILSELF:
+            count = 0;
+            values = (int*) malloc(sizeof(int) * (2 * countargs(n->node1) + 1));
+            reassign(n->node1, values, &count);
+            for (int k = 0; k < count; k++)
+                cur->defs[values[2 * k]] = values[2 * k + 1];
+            free(values);
+            jump(body);
+            deadblock();
+            break;
+
+        // rotated: the condition is tested before the
+        // loop, and again at its end, jumping back to the
+        // body; a block of its own leads into the loop
+        case WHILE:
+            c = expr(n->node1);
+            t = newblock(fn);
+            e = newblock(fn);
+            branch(c, t, e);
+            seal(t);
+            cur = t;
+            j = newblock(fn);
+            jump(j);
+            cur = j;
+            lower(n->node2);
+            c = expr(n->node1);
+            branch(c, j, e);
+            seal(j);
+            seal(e);
+            cur = e;
+            break;
+
+        // lowered separately: INIT at start of main,
+        // procedures as functions of their own
+        case INIT:
+        case PROCEDURE:
+        default:
+            break;
+    }
+}
+
+// number of local variables and parameters
+static int countvars(node* n) {
+    int m = 0, k;
+
+    if (n == NULL || n->type == PROCEDURE)
+        return 0;
+
+    switch (n->type) {
+        case LOCALASSIGN:
+        case LOCALFETCH:
+        case PARAMASSIGN:
+        case PARAMSTORE:
+            m = n->value + 1;
+            break;
+        default:
+            break;
+    }
+    if ((k = countvars(n->node1)) > m)
+        m = k;
+    if ((k = countvars(n->node2)) > m)
+        m = k;
+    if ((k = countvars(n->node3)) > m)
+        m = k;
+    return m;
+}
+
+function* lowerprocedure(node* n) {
+    fn = newfunction(n->value, countvars(n->node1));
+    cur = newblock(fn);
+    seal(cur);
+    body = NULL;
+
+    lower(n->node1);
+    emit(IR_RET, -1, -1, 0);
+    if (body)
+        seal(body);
+
+    return fn;
+}
+
+// initial values of constants and arrays,
+// wherever they were declared
+static void initialize(node* n) {
+    if (n == NULL)
+        return;
+    if (n->type == INIT)
+        lower(n->node1);
+    else if (n->type == SEQ || n->type == PROCEDURE || n->type == PROG) {
+        initialize(n->node1);
+        initialize(n->node2);
+    }
+}
+
+function* lowermain(node* n) {
+    fn = newfunction(0, countvars(n));
+    cur = newblock(fn);
+    seal(cur);
+    body = NULL;
+
+    initialize(n);
+    lower(n->node1);
+    emit(IR_HALT, -1, -1, 0);
+
+    return fn;
+}
+
+
+// ---------------------------
+// analysis
+
+// depth first, giving reverse postorder
+static void visit(bblock* b, bblock** post, int* n) {
+    b->rpo = -2;
+    for (int k = 0; k < b->nsuccs; k++)
+        if (b->succ[k]->rpo == -1)
+            visit(b->succ[k], post, n);
+    post[(*n)++] = b;
+}
+
+// order reachable blocks, and forget
+// edges from blocks never reached
+static void reachable(function* f) {
+    bblock** post = (bblock**) malloc(sizeof(bblock*) * f->nblocks);
+    int n = 0;
+
+    visit(f->blocks[0], post, &n);
+    free(f->order);
+    f->order = (bblock**) malloc(sizeof(bblock*) * n);
+    f->norder = n;
+    for (int k = 0; k < n; k++) {
+        f->order[k] = post[n - 1 - k];
+        f->order[k]->rpo = k;
+    }
+    free(post);
+
+    for (int k = 0; k < n; k++) {
+        bblock* b = f->order[k];
+        int m = 0;
+        for (int p = 0; p < b->npreds; p++) {
+            if (b->preds[p]->rpo < 0)
+                continue;
+            for (instr* i = b->first; i && i->op == IR_PHI; i = i->next)
+                i->phi[m] = i->phi[p];
+            b->preds[m++] = b->preds[p];
+        }
+        b->npreds = m;
+    }
+}
+
+static bblock* intersect(bblock* a, bblock* b) {
+    while (a != b) {
+        while (a->rpo > b->rpo)
+            a = a->idom;
+        while (b->rpo > a->rpo)
+            b = b->idom;
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple,
+// Fast Dominance Algorithm" (2001)
+static void dominators(function* f) {
+    int changed = TRUE;
+    bblock* entry = f->order[0];
+
+    for (int k = 0; k < f->norder; k++) {
+        f->order[k]->idom = NULL;
+        f->order[k]->ndoms = 0;
+    }
+    entry->idom = entry;
+
+    while (changed) {
+        changed = FALSE;
+        for (int k = 1; k < f->norder; k++) {
+            bblock* b = f->order[k];
+            bblock* d = NULL;
+            for (int p = 0; p < b->npreds; p++) {
+                if (b->preds[p]->idom == NULL)
+                    continue;
+                d = (d == NULL) ? b->preds[p] : intersect(b->preds[p], d);
+            }
+            if (b->idom != d) {
+                b->idom = d;
+                changed = TRUE;
+            }
+        }
+    }
+
+    // children in dominator tree
+    for (int k = 1; k < f->norder; k++)
+        f->order[k]->idom->ndoms++;
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        free(b->doms);
+        b->doms = (bblock**) malloc(sizeof(bblock*) * (b->ndoms + 1));
+        b->ndoms = 0;
+    }
+    for (int k = 1; k < f->norder; k++) {
+        bblock* d = f->order[k]->idom;
+        d->doms[d->ndoms++] = f->order[k];
+    }
+}
+
+static int dominates(bblock* a, bblock* b) {
+    while (b != a && b->idom != b)
+        b = b->idom;
+    return (a == b);
+}
+
+static void resolveall(function* f) {
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i; i = i->next) {
+            i->a = resolve(f, i->a);
+            i->b = resolve(f, i->b);
+            if (i->op == IR_PHI)
+                for (int p = 0; p < b->npreds; p++)
+                    i->phi[p] = resolve(f, i->phi[p]);
+        }
+    }
+}
+
+
+// ---------------------------
+// optimizations
+
+// copy propagation: uses of a copy, or of a phi
+// which has only one value besides itself, are
+// replaced by the value
+static void propagate(function* f) {
+    int changed = TRUE;
+
+    while (changed) {
+        changed = FALSE;
+        for (int k = 0; k < f->norder; k++) {
+            bblock* b = f->order[k];
+            instr* next;
+            for (instr* i = b->first; i; i = next) {
+                next = i->next;
+                if (i->op == IR_COPY) {
+                    f->alias[i->dst] = resolve(f, i->a);
+                    removeinstr(i);
+                    changed = TRUE;
+                } else if (i->op == IR_PHI) {
+                    int same = -1, trivial = TRUE;
+                    for (int p = 0; p < b->npreds; p++) {
+                        int v = resolve(f, i->phi[p]);
+                        if (v == i->dst || v == same)
+                            continue;
+                        if (same >= 0) {
+                            trivial = FALSE;
+                            break;
+                        }
+                        same = v;
+                    }
+                    if (trivial) {
+                        f->alias[i->dst] = (same >= 0) ? same : undefined(f);
+                        removeinstr(i);
+                        changed = TRUE;
+                    }
+                }
+            }
+        }
+    }
+    resolveall(f);
+}
+
+// loads of globals: a global already loaded or stored
+// is known until a call or another store, so loading it
+// again is replaced by the known value; what is known at
+// the end of a block also holds in a block which can
+// only be reached from there
+static void loads(function* f) {
+    int** address = (int**) calloc(f->norder, sizeof(int*));
+    int** known = (int**) calloc(f->norder, sizeof(int*));
+    int* count = (int*) calloc(f->norder, sizeof(int));
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        int n = 0, m;
+        instr* next;
+
+        address[k] = (int*) malloc(sizeof(int) * (f->nvregs + 1));
+        known[k] = (int*) malloc(sizeof(int) * (f->nvregs + 1));
+        if (b->npreds == 1 && b->preds[0]->rpo < k) {
+            n = count[b->preds[0]->rpo];
+            memcpy(address[k], address[b->preds[0]->rpo], sizeof(int) * n);
+            memcpy(known[k], known[b->preds[0]->rpo], sizeof(int) * n);
+        }
+
+        for (instr* i = b->first; i; i = next) {
+            next = i->next;
+            switch (i->op) {
+                case IR_CALL:
+                case IR_TAIL:
+                    n = 0;
+                    break;
+                case IR_LOADG:
+                case IR_STOREG:
+                    for (m = 0; m < n && address[k][m] != i->value; m++)
+                        ;
+                    if (i->op == IR_LOADG && m < n) {
+                        f->alias[i->dst] = resolve(f, known[k][m]);
+                        removeinstr(i);
+                        break;
+                    }
+                    if (m == n)
+                        n++;
+                    address[k][m] = i->value;
+                    known[k][m] = resolve(f, (i->op == IR_LOADG) ? i->dst : i->a);
+                    break;
+                default:
+                    break;
+            }
+        }
+        count[k] = n;
+    }
+
+    for (int k = 0; k < f->norder; k++) {
+        free(address[k]);
+        free(known[k]);
+    }
+    free(count);
+    free(known);
+    free(address);
+    resolveall(f);
+}
+
+// global value numbering: an instruction computing
+// the same as one in a dominating block is replaced
+static instr** table;
+static int ntable, maxtable;
+
+static void number(function* f, bblock* b) {
+    int mark = ntable;
+    instr* next;
+
+    for (instr* i = b->first; i; i = next) {
+        next = i->next;
+        i->a = resolve(f, i->a);
+        i->b = resolve(f, i->b);
+        if (!purevalue(i->op))
+            continue;
+
+        if (commutes(i->op) && i->a > i->b) {
+            int t = i->a;
+            i->a = i->b;
+            i->b = t;
+        }
+
+        instr* found = NULL;
+        for (int k = ntable - 1; k >= 0 && !found; k--) {
+            instr* j = table[k];
+            if (j->op == i->op && j->a == i->a && j->b == i->b
+                && j->value == i->value)
+                found = j;
+        }
+        if (found) {
+            f->alias[i->dst] = found->dst;
+            removeinstr(i);
+            continue;
+        }
+
+        if (ntable == maxtable) {
+            maxtable = maxtable ? 2 * maxtable : 64;
+            table = (instr**) realloc(table, sizeof(instr*) * maxtable);
+        }
+        table[ntable++] = i;
+    }
+
+    for (int k = 0; k < b->ndoms; k++)
+        number(f, b->doms[k]);
+    ntable = mark;
+}
+
+static void valuenumbering(function* f) {
+    ntable = 0;
+    number(f, f->order[0]);
+    free(table);
+    table = NULL;
+    maxtable = 0;
+    resolveall(f);
+}
+
+// loop-invariant code motion: values not changing
+// in a loop are computed once, in the block before
+// its header (when there is a single one)
+static void hoist(function* f, bblock* header, char* inloop) {
+    bblock* pre = NULL;
+    int changed = TRUE, calls = FALSE, nstored = 0;
+    int* stored;
+
+    for (int p = 0; p < header->npreds; p++) {
+        if (inloop[header->preds[p]->rpo])
+            continue;
+        if (pre != NULL)
+            return;
+        pre = header->preds[p];
+    }
+    if (pre == NULL || pre->nsuccs != 1)
+        return;
+
+    // a global is invariant too, if no call
+    // and no store in the loop may change it
+    stored = (int*) malloc(sizeof(int) * (f->nvregs + 1));
+    for (int k = header->rpo; k < f->norder; k++) {
+        if (!inloop[k])
+            continue;
+        for (instr* i = f->order[k]->first; i; i = i->next) {
+            if (i->op == IR_CALL || i->op == IR_TAIL)
+                calls = TRUE;
+            else if (i->op == IR_STOREG)
+                stored[nstored++] = i->value;
+        }
+    }
+
+    while (changed) {
+        changed = FALSE;
+        for (int k = header->rpo; k < f->norder; k++) {
+            if (!inloop[k])
+                continue;
+            instr* next;
+            for (instr* i = f->order[k]->first; i; i = next) {
+                next = i->next;
+                if (i->op == IR_LOADG) {
+                    int m = 0;
+                    while (m < nstored && stored[m] != i->value)
+                        m++;
+                    if (calls || m < nstored)
+                        continue;
+                } else if (!purevalue(i->op) || cantrap(i->op))
+                    continue;
+                if (i->a >= 0 && inloop[f->defin[i->a]->block->rpo])
+                    continue;
+                if (i->b >= 0 && inloop[f->defin[i->b]->block->rpo])
+                    continue;
+                detach(i);
+                insertbefore(pre->last, i);
+                changed = TRUE;
+            }
+        }
+    }
+    free(stored);
+}
+
+// blocks of the natural loop of 'header', entered
+// backwards from each block jumping back to it
+static int loopblocks(function* f, bblock* header, char* inloop) {
+    bblock** work = (bblock**) malloc(sizeof(bblock*) * f->norder);
+    int n = 0, size = 1;
+
+    memset(inloop, 0, f->norder);
+    inloop[header->rpo] = TRUE;
+    for (int p = 0; p < header->npreds; p++) {
+        bblock* l = header->preds[p];
+        if (dominates(header, l) && !inloop[l->rpo]) {
+            inloop[l->rpo] = TRUE;
+            work[n++] = l;
+            size++;
+        }
+    }
+    while (n > 0) {
+        bblock* b = work[--n];
+        for (int p = 0; p < b->npreds; p++) {
+            bblock* q = b->preds[p];
+            if (!inloop[q->rpo]) {
+                inloop[q->rpo] = TRUE;
+                work[n++] = q;
+                size++;
+            }
+        }
+    }
+    free(work);
+    return size;
+}
+
+static void invariants(function* f) {
+    char* inloop = (char*) malloc(f->norder);
+    int* headers = (int*) malloc(sizeof(int) * f->norder);
+    int* sizes = (int*) malloc(sizeof(int) * f->norder);
+    int n = 0;
+
+    // headers: targets of jumps back to a dominator
+    for (int k = 0; k < f->norder; k++) {
+        bblock* h = f->order[k];
+        for (int p = 0; p < h->npreds; p++) {
+            if (dominates(h, h->preds[p])) {
+                headers[n] = k;
+                sizes[n++] = loopblocks(f, h, inloop);
+                break;
+            }
+        }
+    }
+
+    // innermost first, values hoisted from an inner
+    // loop may then move on out of the one around it
+    for (int k = 1; k < n; k++) {
+        for (int m = k; m > 0 && sizes[m - 1] > sizes[m]; m--) {
+            int t = sizes[m]; sizes[m] = sizes[m - 1]; sizes[m - 1] = t;
+            t = headers[m]; headers[m] = headers[m - 1]; headers[m - 1] = t;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        bblock* h = f->order[headers[k]];
+        loopblocks(f, h, inloop);
+        hoist(f, h, inloop);
+    }
+
+    free(sizes);
+    free(headers);
+    free(inloop);
+}
+
+// dead code: values never used, and
+// computed without any side effects
+static void deadcode(function* f) {
+    int* uses = (int*) calloc(f->nvregs, sizeof(int));
+    int changed = TRUE;
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i; i = i->next) {
+            if (i->a >= 0) uses[i->a]++;
+            if (i->b >= 0) uses[i->b]++;
+            if (i->op == IR_PHI)
+                for (int p = 0; p < b->npreds; p++)
+                    uses[i->phi[p]]++;
+        }
+    }
+
+    while (changed) {
+        changed = FALSE;
+        for (int k = 0; k < f->norder; k++) {
+            bblock* b = f->order[k];
+            instr* next;
+            for (instr* i = b->first; i; i = next) {
+                next = i->next;
+                if (i->dst < 0 || uses[i->dst] > 0 || cantrap(i->op))
+                    continue;
+                if (i->a >= 0) uses[i->a]--;
+                if (i->b >= 0) uses[i->b]--;
+                if (i->op == IR_PHI)
+                    for (int p = 0; p < b->npreds; p++)
+                        uses[i->phi[p]]--;
+                if (i->dst == f->undef)
+                    f->undef = -1;
+                removeinstr(i);
+                changed = TRUE;
+            }
+        }
+    }
+    free(uses);
+}
+
+void optimize(function* f) {
+    reachable(f);
+    propagate(f);
+    loads(f);
+    dominators(f);
+    valuenumbering(f);
+    invariants(f);
+    loads(f);
+    valuenumbering(f);
+    deadcode(f);
+}
+
+
+// ---------------------------
+// debug
+
+static char* irname(IRop op) {
+    static char* names[] = {
+        "add", "and", "br", "call", "const", "copy", "div", "emit",
+        "eq", "gq", "gt", "halt", "jmp", "loada", "loadg", "lq", "lt",
+        "mod", "mul", "neg", "neq", "or", "param", "phi", "print",
+        "ret", "starg", "storea", "storeg", "sub", "tail", "xor"
+    };
+    return names[op];
+}
+
+void printfunction(FILE* out, function* f) {
+    fprintf(out, "function %s\n", f->label ? connects(f->label) : "START");
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        fprintf(out, "b%d:", b->id);
+        for (int p = 0; p < b->npreds; p++)
+            fprintf(out, " <b%d", b->preds[p]->id);
+        fprintf(out, "\n");
+        for (instr* i = b->first; i; i = i->next) {
+            fprintf(out, "\t");
+            if (i->dst >= 0)
+                fprintf(out, "v%d = ", i->dst);
+            fprintf(out, "%s", irname(i->op));
+            if (i->op == IR_PHI)
+                for (int p = 0; p < b->npreds; p++)
+                    fprintf(out, " v%d", i->phi[p]);
+            if (i->a >= 0)
+                fprintf(out, " v%d", i->a);
+            if (i->b >= 0)
+                fprintf(out, " v%d", i->b);
+            switch (i->op) {
+                case IR_CONST: case IR_LOADG: case IR_PARAM:
+                case IR_STARG: case IR_STOREG:
+                    fprintf(out, " %d", i->value);
+                    break;
+                case IR_CALL: case IR_TAIL:
+                    fprintf(out, " %s", connects(i->value));
+                    break;
+                default:
+                    break;
+            }
+            for (int s = 0; s < b->nsuccs && i == b->last; s++)
+                fprintf(out, " b%d", b->succ[s]->id);
+            fprintf(out, "\n");
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef _IR_H
+#define _IR_H
+
+#include <stdio.h>
+
+#include "enkel.h"
+
+// ---------------------------
+// intermediate representation
+// three-address instructions on
+// virtual registers, in blocks of a
+// control-flow graph, in SSA form
+
+typedef enum {
+    IR_ADD,
+    IR_AND,
+    IR_BR,      // branch on a: succ[0] if not zero, else succ[1]
+    IR_CALL,
+    IR_CONST,
+    IR_COPY,
+    IR_DIV,
+    IR_EMIT,
+    IR_EQ,
+    IR_GQ,
+    IR_GT,
+    IR_HALT,
+    IR_JMP,
+    IR_LOADA,   // dst = arrs[a]
+    IR_LOADG,   // dst = vars[value]
+    IR_LQ,
+    IR_LT,
+    IR_MOD,
+    IR_MUL,
+    IR_NEG,
+    IR_NEQ,
+    IR_OR,
+    IR_PARAM,   // dst = args[value]
+    IR_PHI,
+    IR_PRINT,
+    IR_RET,
+    IR_STARG,   // args[value] = a
+    IR_STOREA,  // arrs[a] = b
+    IR_STOREG,  // vars[value] = a
+    IR_SUB,
+    IR_TAIL,    // jump to procedure, reusing frame
+    IR_XOR
+} IRop;
+
+struct bblock;
+
+typedef struct instr {
+    IRop op;
+    int dst;            // virtual register defined, or -1
+    int a, b;           // operands, or -1
+    int value;          // constant, address or label
+    int var;            // variable of a phi
+    int* phi;           // phi operands, one per predecessor
+    struct bblock* block;
+    struct instr *prev, *next;
+} instr;
+
+typedef struct bblock {
+    int id;
+    instr *first, *last;
+    struct bblock** preds;
+    int npreds, maxpreds;
+    struct bblock* succ[2];
+    int nsuccs;
+
+    // construction of SSA
+    int sealed;
+    int* defs;          // current value of each variable
+
+    // analysis
+    int rpo;            // reverse postorder, -1 if unreachable
+    struct bblock* idom;
+    struct bblock** doms; // children in dominator tree
+    int ndoms;
+    unsigned* livein;
+    unsigned* liveout;
+    int from, to;       // linear positions
+    int label;
+} bblock;
+
+typedef struct function {
+    int label;          // connect number, or 0 for START
+    bblock** blocks;
+    int nblocks, maxblocks;
+    bblock** order;      // reachable blocks in reverse postorder
+    int norder;
+    int nvars;
+    int nvregs, maxvregs;
+    int* alias;         // replaced virtual registers
+    instr** defin;      // defining instruction
+    int undef;          // register holding undefined value
+} function;
+
+// ir.c
+extern function* lowerprocedure(node* n);
+extern function* lowermain(node* n);
+extern void optimize(function* f);
+extern void freefunction(function* f);
+extern int purevalue(IRop op);
+extern int commutes(IRop op);
+extern void removeinstr(instr* i);
+extern void insertbefore(instr* at, instr* i);
+extern bblock* splitedge(function* f, bblock* from, int k);
+extern instr* newinstr(function* f, IRop op, int dst, int a, int b);
+extern int newvreg(function* f);
+extern int resolve(function* f, int v);
+extern void printfunction(FILE* out, function* f);
+
+// lsra.c
+extern void allocate(FILE* out, function* f);
+
+// enkel.c
+extern void compileregister(FILE* out, node* n);
+
+#endif
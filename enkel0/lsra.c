@@ -0,0 +1,675 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "enkel.h"
+#include "symbol.h"
+#include "error.h"
+#include "ir.h"
+
+// must be in sync with vmreg.h
+#define REGS 16         // registers in a frame
+#define SLOTS 240       // spill slots in a frame
+#define SCRATCH0 14     // two registers kept free for
+#define SCRATCH1 15     // values loaded from spill slots
+#define ALLOCATABLE 14
+
+// ---------------------------
+// from IR in SSA form to code
+// for the register vm (vmreg.c)
+
+// a compare only used by the branch which ends its
+// block is folded into the branch: BR then has the
+// relation in 'value' and both operands
+static void fusecompares(function* f) {
+    int* uses = (int*) calloc(f->nvregs, sizeof(int));
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i; i = i->next) {
+            if (i->a >= 0) uses[i->a]++;
+            if (i->b >= 0) uses[i->b]++;
+            if (i->op == IR_PHI)
+                for (int p = 0; p < b->npreds; p++)
+                    uses[i->phi[p]]++;
+        }
+    }
+
+    for (int k = 0; k < f->norder; k++) {
+        instr* br = f->order[k]->last;
+        if (br->op != IR_BR || uses[br->a] != 1)
+            continue;
+        instr* c = f->defin[br->a];
+        if (c->block != br->block)
+            continue;
+        switch (c->op) {
+            case IR_EQ: case IR_GQ: case IR_GT:
+            case IR_LQ: case IR_LT: case IR_NEQ:
+                br->value = c->op;
+                br->a = c->a;
+                br->b = c->b;
+                removeinstr(c);
+                break;
+            default:
+                break;
+        }
+    }
+    free(uses);
+}
+
+// the copies of phis along one edge are done in parallel:
+// one is emitted when no other still reads what it writes,
+// a cycle (a swap) is broken by saving one value first
+static void parallelcopy(function* f, instr* at, int* dst, int* src, int n) {
+    int k, m;
+
+    while (n > 0) {
+        for (k = 0; k < n; k++) {
+            if (dst[k] == src[k])
+                break;
+            for (m = 0; m < n; m++)
+                if (m != k && src[m] == dst[k])
+                    break;
+            if (m == n)
+                break;
+        }
+
+        if (k < n) {
+            if (dst[k] != src[k])
+                insertbefore(at, newinstr(f, IR_COPY, dst[k], src[k], -1));
+            dst[k] = dst[n - 1];
+            src[k] = src[n - 1];
+            n--;
+        } else {
+            int t = newvreg(f);
+            insertbefore(at, newinstr(f, IR_COPY, t, dst[0], -1));
+            for (m = 0; m < n; m++)
+                if (src[m] == dst[0])
+                    src[m] = t;
+        }
+    }
+}
+
+// out of SSA: a phi becomes copies at the end of each
+// predecessor; where a predecessor also branches elsewhere
+// the copies go in a block of their own on the edge, or
+// they could overwrite a value still needed on the other way
+static void phicopies(function* f) {
+    int n = f->norder;
+    bblock** blocks = (bblock**) malloc(sizeof(bblock*) * n);
+    memcpy(blocks, f->order, sizeof(bblock*) * n);
+
+    for (int k = 0; k < n; k++) {
+        bblock* b = blocks[k];
+        int nphis = 0;
+        for (instr* i = b->first; i && i->op == IR_PHI; i = i->next)
+            nphis++;
+        if (nphis == 0)
+            continue;
+
+        int* dst = (int*) malloc(sizeof(int) * nphis);
+        int* src = (int*) malloc(sizeof(int) * nphis);
+        for (int p = 0; p < b->npreds; p++) {
+            bblock* from = b->preds[p];
+            int m = 0;
+            for (instr* i = b->first; i && i->op == IR_PHI; i = i->next) {
+                if (i->dst == i->phi[p])
+                    continue;
+                dst[m] = i->dst;
+                src[m++] = i->phi[p];
+            }
+            if (m == 0)
+                continue;
+            if (from->nsuccs > 1)
+                from = splitedge(f, from, (from->succ[0] == b) ? 0 : 1);
+            parallelcopy(f, from->last, dst, src, m);
+        }
+        free(src);
+        free(dst);
+
+        while (b->first && b->first->op == IR_PHI)
+            removeinstr(b->first);
+    }
+    free(blocks);
+}
+
+#define SET(s, v) ((s)[(v) >> 5] |= (1u << ((v) & 31)))
+#define HAS(s, v) ((s)[(v) >> 5] & (1u << ((v) & 31)))
+
+// index of 'from' among the predecessors of 'b'
+static int predindex(bblock* b, bblock* from) {
+    for (int p = 0; p < b->npreds; p++)
+        if (b->preds[p] == from)
+            return p;
+    return -1;
+}
+
+// live variables, by blocks: phis define at the
+// top of their block, and use an operand at the
+// end of the predecessor it comes from
+static void liveness(function* f) {
+    int words = (f->nvregs + 31) / 32;
+    unsigned* gen = (unsigned*) calloc(words * f->norder, sizeof(unsigned));
+    unsigned* kill = (unsigned*) calloc(words * f->norder, sizeof(unsigned));
+    unsigned* phiuse = (unsigned*) calloc(words * f->norder, sizeof(unsigned));
+    int changed = TRUE;
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        unsigned* g = gen + k * words;
+        unsigned* d = kill + k * words;
+        free(b->livein);
+        free(b->liveout);
+        b->livein = (unsigned*) calloc(words, sizeof(unsigned));
+        b->liveout = (unsigned*) calloc(words, sizeof(unsigned));
+        for (instr* i = b->first; i; i = i->next) {
+            if (i->a >= 0 && !HAS(d, i->a)) SET(g, i->a);
+            if (i->b >= 0 && !HAS(d, i->b)) SET(g, i->b);
+            if (i->dst >= 0) SET(d, i->dst);
+        }
+        for (int s = 0; s < b->nsuccs; s++) {
+            int p = predindex(b->succ[s], b);
+            for (instr* i = b->succ[s]->first; i && i->op == IR_PHI; i = i->next)
+                SET(phiuse + k * words, i->phi[p]);
+        }
+    }
+
+    while (changed) {
+        changed = FALSE;
+        for (int k = f->norder - 1; k >= 0; k--) {
+            bblock* b = f->order[k];
+            unsigned* g = gen + k * words;
+            unsigned* d = kill + k * words;
+            for (int w = 0; w < words; w++) {
+                unsigned out = phiuse[k * words + w];
+                for (int s = 0; s < b->nsuccs; s++)
+                    out |= b->succ[s]->livein[w];
+                unsigned in = g[w] | (out & ~d[w]);
+                if (in != b->livein[w] || out != b->liveout[w])
+                    changed = TRUE;
+                b->livein[w] = in;
+                b->liveout[w] = out;
+            }
+        }
+    }
+    free(phiuse);
+    free(gen);
+    free(kill);
+}
+
+// coalescing: a phi and its operands are given one name,
+// when none of them is live where another is defined,
+// so their copies vanish; with a single interval for
+// each register linear scan could not do this itself
+static int* rep;
+static int* member;
+
+static int findrep(int v) {
+    while (rep[v] != v)
+        v = rep[v] = rep[rep[v]];
+    return v;
+}
+
+static void coalesce(function* f) {
+    int n = f->nvregs, m = 0;
+    int words = (n + 31) / 32;
+    int* index = (int*) malloc(sizeof(int) * n);
+    unsigned* live = (unsigned*) malloc(sizeof(unsigned) * words);
+
+    liveness(f);
+
+    // only registers in phis are considered
+    for (int v = 0; v < n; v++)
+        index[v] = -1;
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i && i->op == IR_PHI; i = i->next) {
+            if (index[i->dst] < 0) index[i->dst] = m++;
+            for (int p = 0; p < b->npreds; p++)
+                if (index[i->phi[p]] < 0) index[i->phi[p]] = m++;
+        }
+    }
+    if (m == 0) {
+        free(live);
+        free(index);
+        return;
+    }
+
+    // interference: live where the other is defined
+    int mwords = (m + 31) / 32;
+    unsigned* graph = (unsigned*) calloc((size_t) m * mwords, sizeof(unsigned));
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        memcpy(live, b->liveout, sizeof(unsigned) * words);
+        for (int s = 0; s < b->nsuccs; s++) {
+            int p = predindex(b->succ[s], b);
+            for (instr* i = b->succ[s]->first; i && i->op == IR_PHI; i = i->next)
+                SET(live, i->phi[p]);
+        }
+        for (instr* i = b->last; i; i = i->prev) {
+            if (i->dst >= 0) {
+                if (index[i->dst] >= 0)
+                    for (int v = 0; v < n; v++)
+                        if (v != i->dst && index[v] >= 0 && HAS(live, v)) {
+                            SET(graph + index[i->dst] * mwords, index[v]);
+                            SET(graph + index[v] * mwords, index[i->dst]);
+                        }
+                if (i->op != IR_PHI)
+                    live[i->dst >> 5] &= ~(1u << (i->dst & 31));
+            }
+            if (i->a >= 0) SET(live, i->a);
+            if (i->b >= 0) SET(live, i->b);
+        }
+    }
+
+    rep = (int*) malloc(sizeof(int) * n);
+    member = (int*) malloc(sizeof(int) * n);
+    for (int v = 0; v < n; v++) {
+        rep[v] = v;
+        member[v] = -1;
+    }
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i && i->op == IR_PHI; i = i->next) {
+            for (int p = 0; p < b->npreds; p++) {
+                int x = findrep(i->dst), y = findrep(i->phi[p]);
+                int clash = FALSE;
+                if (x == y)
+                    continue;
+                for (int u = x; u >= 0 && !clash; u = member[u])
+                    for (int v = y; v >= 0 && !clash; v = member[v])
+                        clash = HAS(graph + index[u] * mwords, index[v]) != 0;
+                if (clash)
+                    continue;
+                // join the list of members of y after x
+                int last = x;
+                while (member[last] >= 0)
+                    last = member[last];
+                member[last] = y;
+                rep[y] = x;
+            }
+        }
+    }
+
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        for (instr* i = b->first; i; i = i->next) {
+            if (i->dst >= 0) i->dst = findrep(i->dst);
+            if (i->a >= 0) i->a = findrep(i->a);
+            if (i->b >= 0) i->b = findrep(i->b);
+            if (i->op == IR_PHI)
+                for (int p = 0; p < b->npreds; p++)
+                    i->phi[p] = findrep(i->phi[p]);
+        }
+    }
+
+    free(member);
+    free(rep);
+    free(graph);
+    free(live);
+    free(index);
+}
+
+// ---------------------------
+// linear scan, after Poletto and Sarkar,
+// "Linear Scan Register Allocation" (1999):
+// each register gets one interval, from first
+// to last position where it is live
+
+static int *start, *end, *reg, *slot, *hint;
+static int nslots;
+
+static void extend(int v, int pos) {
+    if (v < 0)
+        return;
+    if (pos < start[v]) start[v] = pos;
+    if (pos > end[v]) end[v] = pos;
+}
+
+// uses are at even positions, definitions after
+// them, so an operand ending where a value starts
+// can give its register away
+static void intervals(function* f) {
+    int pos = 0;
+
+    for (int v = 0; v < f->nvregs; v++) {
+        start[v] = INT_MAX;
+        end[v] = -1;
+    }
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        b->from = pos;
+        for (instr* i = b->first; i; i = i->next) {
+            extend(i->a, pos);
+            extend(i->b, pos);
+            extend(i->dst, pos + 1);
+            if (i->op == IR_COPY) {
+                hint[i->dst] = i->a;
+                hint[i->a] = i->dst;
+            }
+            pos += 2;
+        }
+        b->to = pos;
+        for (int v = 0; v < f->nvregs; v++) {
+            if (HAS(b->livein, v)) extend(v, b->from);
+            if (HAS(b->liveout, v)) extend(v, b->to);
+        }
+    }
+}
+
+static int bystart(const void* x, const void* y) {
+    return start[*(const int*) x] - start[*(const int*) y];
+}
+
+static void spill(int v) {
+    if (nslots == SLOTS) {
+        errnum(ERROR_REGISTER_SPILL);
+        exit(EXIT_FAILURE);
+    }
+    slot[v] = nslots++;
+    reg[v] = -1;
+}
+
+static void linearscan(function* f) {
+    int* sorted = (int*) malloc(sizeof(int) * (f->nvregs + 1));
+    int active[ALLOCATABLE];
+    int free_[ALLOCATABLE];
+    int n = 0, nactive = 0;
+
+    for (int r = 0; r < ALLOCATABLE; r++)
+        free_[r] = TRUE;
+    for (int v = 0; v < f->nvregs; v++) {
+        reg[v] = slot[v] = -1;
+        if (end[v] >= 0)
+            sorted[n++] = v;
+    }
+    qsort(sorted, n, sizeof(int), bystart);
+
+    for (int k = 0; k < n; k++) {
+        int v = sorted[k];
+
+        // expire old intervals
+        int m = 0;
+        for (int a = 0; a < nactive; a++) {
+            if (end[active[a]] < start[v])
+                free_[reg[active[a]]] = TRUE;
+            else
+                active[m++] = active[a];
+        }
+        nactive = m;
+
+        if (nactive == ALLOCATABLE) {
+            // spill the one ending last
+            int last = 0;
+            for (int a = 1; a < nactive; a++)
+                if (end[active[a]] > end[active[last]])
+                    last = a;
+            if (end[active[last]] > end[v]) {
+                reg[v] = reg[active[last]];
+                spill(active[last]);
+                active[last] = v;
+            } else
+                spill(v);
+            continue;
+        }
+
+        int h = hint[v];
+        if (h >= 0 && reg[h] >= 0 && free_[reg[h]])
+            reg[v] = reg[h];
+        else
+            for (int r = 0; reg[v] < 0; r++)
+                if (free_[r])
+                    reg[v] = r;
+        free_[reg[v]] = FALSE;
+        active[nactive++] = v;
+    }
+    free(sorted);
+}
+
+
+// ---------------------------
+// emit code
+
+static char* vmname(IRop op) {
+    switch (op) {
+        case IR_ADD:    return "ADD";
+        case IR_AND:    return "AND";
+        case IR_DIV:    return "DIV";
+        case IR_EQ:     return "EQ";
+        case IR_GQ:     return "GQ";
+        case IR_GT:     return "GT";
+        case IR_LQ:     return "LQ";
+        case IR_LT:     return "LT";
+        case IR_MOD:    return "MOD";
+        case IR_MUL:    return "MUL";
+        case IR_NEQ:    return "NEQ";
+        case IR_OR:     return "OR";
+        case IR_SUB:    return "SUB";
+        case IR_XOR:    return "XOR";
+        default:        return "NOP";
+    }
+}
+
+static IRop negation(IRop op) {
+    switch (op) {
+        case IR_EQ:     return IR_NEQ;
+        case IR_NEQ:    return IR_EQ;
+        case IR_LT:     return IR_GQ;
+        case IR_GQ:     return IR_LT;
+        case IR_GT:     return IR_LQ;
+        case IR_LQ:     return IR_GT;
+        default:        return op;
+    }
+}
+
+// register holding operand, loaded if spilled
+static int use(FILE* out, int v, int scratch) {
+    if (slot[v] >= 0) {
+        fprintf(out, "\tLDS %d %d\n", scratch, slot[v]);
+        return scratch;
+    }
+    return reg[v];
+}
+
+// register to put a result in, stored by 'spilled'
+static int def(int v) {
+    return (slot[v] >= 0) ? SCRATCH0 : reg[v];
+}
+
+static void spilled(FILE* out, int v) {
+    if (slot[v] >= 0)
+        fprintf(out, "\tSTS %d %d\n", slot[v], SCRATCH0);
+}
+
+static void copy(FILE* out, int d, int s) {
+    if (slot[d] >= 0 && slot[s] >= 0) {
+        fprintf(out, "\tLDS %d %d\n", SCRATCH0, slot[s]);
+        fprintf(out, "\tSTS %d %d\n", slot[d], SCRATCH0);
+    } else if (slot[d] >= 0)
+        fprintf(out, "\tSTS %d %d\n", slot[d], reg[s]);
+    else if (slot[s] >= 0)
+        fprintf(out, "\tLDS %d %d\n", reg[d], slot[s]);
+    else if (reg[d] != reg[s])
+        fprintf(out, "\tMOV %d %d\n", reg[d], reg[s]);
+}
+
+// a block doing nothing but jump is not emitted,
+// whoever jumps to it goes directly where it goes
+static int empty(bblock* b) {
+    return (b->first == b->last && b->first->op == IR_JMP && b->rpo > 0);
+}
+
+static bblock* target(bblock* b) {
+    for (int n = 0; empty(b) && n < 64; n++)
+        b = b->succ[0];
+    return b;
+}
+
+// jump to 'to' if condition of branch is 'when'
+static void condjump(FILE* out, instr* br, int when, bblock* to) {
+    int a = use(out, br->a, SCRATCH0);
+    if (br->b >= 0) {
+        int b = use(out, br->b, SCRATCH1);
+        IRop op = when ? br->value : negation(br->value);
+        fprintf(out, "\tJPC %s %d %d :%s\n", vmname(op), a, b, label(to->label));
+    } else
+        fprintf(out, "\t%s %d :%s\n", when ? "JPNZ" : "JPZ", a, label(to->label));
+}
+
+static void instruction(FILE* out, instr* i, bblock* next) {
+    int a, b, d;
+    bblock *bl = i->block, *t, *e;
+
+    switch (i->op) {
+
+        case IR_ADD: case IR_AND: case IR_DIV: case IR_EQ: case IR_GQ:
+        case IR_GT: case IR_LQ: case IR_LT: case IR_MOD: case IR_MUL:
+        case IR_NEQ: case IR_OR: case IR_SUB: case IR_XOR:
+            a = use(out, i->a, SCRATCH0);
+            b = use(out, i->b, SCRATCH1);
+            d = def(i->dst);
+            fprintf(out, "\t%s %d %d %d\n", vmname(i->op), d, a, b);
+            spilled(out, i->dst);
+            break;
+
+        case IR_BR:
+            t = target(bl->succ[0]);
+            e = target(bl->succ[1]);
+            if (next == e)
+                condjump(out, i, TRUE, t);
+            else if (next == t)
+                condjump(out, i, FALSE, e);
+            else {
+                condjump(out, i, TRUE, t);
+                fprintf(out, "\tJP :%s\n", label(e->label));
+            }
+            break;
+
+        case IR_CALL:
+            fprintf(out, "\tCALL :%s\n", connects(i->value));
+            break;
+
+        case IR_CONST:
+            d = def(i->dst);
+            fprintf(out, "\tSET %d %d\n", d, i->value);
+            spilled(out, i->dst);
+            break;
+
+        case IR_COPY:
+            copy(out, i->dst, i->a);
+            break;
+
+        case IR_EMIT:
+            fprintf(out, "\tEMIT %d\n", use(out, i->a, SCRATCH0));
+            break;
+
+        case IR_HALT:
+            fprintf(out, "\tHALT\n");
+            break;
+
+        case IR_JMP:
+            t = target(bl->succ[0]);
+            if (next != t)
+                fprintf(out, "\tJP :%s\n", label(t->label));
+            break;
+
+        case IR_LOADA:
+            a = use(out, i->a, SCRATCH0);
+            d = def(i->dst);
+            fprintf(out, "\tRLOAD %d %d\n", d, a);
+            spilled(out, i->dst);
+            break;
+
+        case IR_LOADG:
+            d = def(i->dst);
+            fprintf(out, "\tLOAD %d %d\n", d, i->value);
+            spilled(out, i->dst);
+            break;
+
+        case IR_NEG:
+            a = use(out, i->a, SCRATCH0);
+            d = def(i->dst);
+            fprintf(out, "\tUMIN %d %d\n", d, a);
+            spilled(out, i->dst);
+            break;
+
+        case IR_PARAM:
+            d = def(i->dst);
+            fprintf(out, "\tLDARG %d %d\n", d, i->value);
+            spilled(out, i->dst);
+            break;
+
+        case IR_PRINT:
+            fprintf(out, "\tPRINT %d\n", use(out, i->a, SCRATCH0));
+            break;
+
+        case IR_RET:
+            fprintf(out, "\tRET\n");
+            break;
+
+        case IR_STARG:
+            fprintf(out, "\tSTARG %d %d\n", i->value, use(out, i->a, SCRATCH0));
+            break;
+
+        case IR_STOREA:
+            a = use(out, i->a, SCRATCH0);
+            b = use(out, i->b, SCRATCH1);
+            fprintf(out, "\tRSTORE %d %d\n", a, b);
+            break;
+
+        case IR_STOREG:
+            fprintf(out, "\tSTORE %d %d\n", i->value, use(out, i->a, SCRATCH0));
+            break;
+
+        case IR_TAIL:
+            fprintf(out, "\tJP :%s\n", connects(i->value));
+            break;
+
+        default:
+            break;
+    }
+}
+
+void allocate(FILE* out, function* f) {
+    fusecompares(f);
+    coalesce(f);
+    phicopies(f);
+    liveness(f);
+
+    start = (int*) malloc(sizeof(int) * f->nvregs);
+    end = (int*) malloc(sizeof(int) * f->nvregs);
+    reg = (int*) malloc(sizeof(int) * f->nvregs);
+    slot = (int*) malloc(sizeof(int) * f->nvregs);
+    hint = (int*) malloc(sizeof(int) * f->nvregs);
+    for (int v = 0; v < f->nvregs; v++)
+        hint[v] = -1;
+    nslots = 0;
+
+    intervals(f);
+    linearscan(f);
+
+    fprintf(out, "\n%s:\n", f->label ? connects(f->label) : "START");
+    for (int k = 0; k < f->norder; k++)
+        f->order[k]->label = labelincrease();
+    for (int k = 0; k < f->norder; k++) {
+        bblock* b = f->order[k];
+        bblock* next = NULL;
+        if (empty(b))
+            continue;
+        for (int m = k + 1; m < f->norder && next == NULL; m++)
+            if (!empty(f->order[m]))
+                next = f->order[m];
+        if (k > 0)
+            fprintf(out, "%s:\n", label(b->label));
+        for (instr* i = b->first; i; i = i->next)
+            instruction(out, i, next);
+    }
+
+    free(hint);
+    free(slot);
+    free(reg);
+    free(end);
+    free(start);
+}
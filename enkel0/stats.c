@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// mallinfo2() came with glibc 2.33
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include "stats.h"
+
+
+// switching phase happens often (around each token, and
+// each search in the symbol tables), so it only reads the
+// wall clock; cpu time is read at a stage, and shared out
+// among the phases since the last stage by their wall time
+
+stats_t stats;
+
+// only kept with --stats
+int tracking = 0;
+
+static Phase current = PHASE_OTHER;
+static double last;             // wall, at last switch
+static double laststage;        // cpu, at last stage
+static double since[PHASES];    // wall since last stage
+
+static char* names[PHASES] = {
+    "other", "scan", "parse", "symbols", "optimize", "codegen", "emit"
+};
+
+static double wallclock() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double cpuclock() {
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void startstats() {
+    memset(&stats, 0, sizeof(stats));
+    memset(since, 0, sizeof(since));
+    tracking = 1;
+    current = PHASE_OTHER;
+    last = wallclock();
+    laststage = cpuclock();
+}
+
+// returns the phase left, to go back to
+Phase phase(Phase p) {
+    Phase previous = current;
+    double now;
+
+    if (!tracking)
+        return p;
+    now = wallclock();
+    stats.wall[current] += now - last;
+    since[current] += now - last;
+    last = now;
+    current = p;
+    return previous;
+}
+
+void stage(Phase p) {
+    double cpu, wall = 0.0;
+    int i;
+
+    if (!tracking)
+        return;
+    phase(p);
+    cpu = cpuclock();
+    for (i = 0; i < PHASES; i++)
+        wall += since[i];
+    for (i = 0; i < PHASES; i++) {
+        if (wall > 0.0)
+            stats.cpu[i] += (cpu - laststage) * since[i] / wall;
+        since[i] = 0.0;
+    }
+    laststage = cpu;
+}
+
+// heap in use now, kept if the most so far; without
+// mallinfo2() the peak resident size stands in for it
+void sampleheap() {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 m;
+
+    if (!tracking)
+        return;
+    m = mallinfo2();
+    if (m.uordblks + m.hblkhd > stats.heap)
+        stats.heap = m.uordblks + m.hblkhd;
+#else
+    struct rusage usage;
+    size_t peak;
+
+    if (!tracking)
+        return;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    peak = usage.ru_maxrss;         // bytes
+#else
+    peak = usage.ru_maxrss * 1024;  // kilobytes
+#endif
+    if (peak > stats.heap)
+        stats.heap = peak;
+#endif
+}
+
+void printstats(FILE* out, int json) {
+    struct rusage usage;
+    double wall = 0.0, cpu = 0.0;
+    int i;
+
+    getrusage(RUSAGE_SELF, &usage);
+    for (i = 0; i < PHASES; i++) {
+        wall += stats.wall[i];
+        cpu += stats.cpu[i];
+    }
+
+    if (json) {
+        fprintf(out, "{\n  \"phases\": {\n");
+        for (i = 1; i <= PHASES; i++) {
+            int k = i % PHASES; // other last
+            fprintf(out, "    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }%s\n",
+                names[k], stats.wall[k] * 1000, stats.cpu[k] * 1000, i < PHASES ? "," : "");
+        }
+        fprintf(out, "  },\n");
+        fprintf(out, "  \"total\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f },\n", wall * 1000, cpu * 1000);
+        fprintf(out, "  \"tokens\": %ld,\n", stats.tokens);
+        fprintf(out, "  \"ast_nodes\": %ld,\n", stats.nodes);
+        fprintf(out, "  \"symbol_lookups\": %ld,\n", stats.lookups);
+        fprintf(out, "  \"symbol_probes\": %ld,\n", stats.probes);
+        fprintf(out, "  \"peak_heap_bytes\": %zu,\n", stats.heap);
+        fprintf(out, "  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+        fprintf(out, "  \"bytes_emitted\": %ld\n", stats.emitted);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, "%-10s %10s %10s\n", "phase", "wall ms", "cpu ms");
+    for (i = 1; i <= PHASES; i++) {
+        int k = i % PHASES;
+        fprintf(out, "%-10s %10.3f %10.3f\n", names[k], stats.wall[k] * 1000, stats.cpu[k] * 1000);
+    }
+    fprintf(out, "%-10s %10.3f %10.3f\n", "total", wall * 1000, cpu * 1000);
+    fprintf(out, "tokens          %ld\n", stats.tokens);
+    fprintf(out, "ast nodes       %ld\n", stats.nodes);
+    fprintf(out, "symbol lookups  %ld (%ld entries probed)\n", stats.lookups, stats.probes);
+    fprintf(out, "peak heap       %zu bytes\n", stats.heap);
+    fprintf(out, "peak rss        %ld kB\n", usage.ru_maxrss);
+    fprintf(out, "bytes emitted   %ld\n", stats.emitted);
+}
@@ -0,0 +1,42 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+
+// ---------------------------
+// statistics of a compilation:
+// time spent in each phase, and
+// some counts, for --stats
+
+typedef enum {
+    PHASE_OTHER,
+    PHASE_SCAN,
+    PHASE_PARSE,
+    PHASE_SYMBOLS,
+    PHASE_OPTIMIZE,
+    PHASE_CODEGEN,
+    PHASE_EMIT,
+    PHASES
+} Phase;
+
+typedef struct stats_t {
+    double wall[PHASES];    // seconds
+    double cpu[PHASES];
+    long tokens;
+    long nodes;
+    long lookups;           // searches in symbol tables
+    long probes;            // entries looked at
+    long emitted;           // bytes
+    size_t heap;            // most heap in use, bytes
+} stats_t;
+
+extern stats_t stats;
+extern int tracking;
+
+extern void startstats();
+extern Phase phase(Phase p);
+extern void stage(Phase p);
+extern void sampleheap();
+extern void printstats(FILE* out, int json);
+
+#endif
@@ -1,9 +1,11 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
 #include "symbol.h"
+#include "stats.h"
 
 
 // errors
@@ -11,31 +13,10 @@ void printerr(char *str1, char *str2) {
     fprintf(stderr, " %s='%s'", str1, str2);
 }
 
-// packing numbers in short
-
-int16_t unpacka(int32_t x) {
-   return (int16_t) (((uint32_t) x) >> 16);
-}
-
-int16_t unpackb(int32_t x) {
-   return (int16_t) (((uint32_t) x) & 0xffff);
-}
-
-int32_t pack(int16_t a, int16_t b) {
-   return (int32_t) ((((uint32_t) a) << 16) + (uint32_t) b);
-}
-
-// extern: returns a packed 32-bit int with two 16-bit ints
-int packint(int a, int b) {
-    return (int) pack((int16_t) a, (int16_t) b);
-}
-
-
 // label creation
 // for calls (C0001) and jumps (L0001)
 // sets, checks a label at destination and source
 
-#define LABEL_MAX 6
 char labelarr[LABEL_MAX];
 int labelcount = 1;
 
@@ -80,19 +61,18 @@ int newlabel() {
 }
 
 
-// unpacking labels
-// because limit of only one integer, we pack
-// sometimes two labels in one integer
+// pairs of labels
+// because limit of only one integer, the two labels
+// of "if" and "while" are taken one after the other,
+// and only the first is kept
 
 char* labela(int value) {
-    int a = (int) unpacka((int32_t) value);
-    createlabel(a);
+    createlabel(value);
     return label1();
 }
 
 char* labelb(int value) {
-    int b = (int) unpackb((int32_t) value);
-    createlabel(b);
+    createlabel(value + 1);
     return label1();
 }
 
@@ -123,6 +103,8 @@ void push(snode** head_ref, Type type, char* str1, char* str2, int value) {
 
     // new head
     snode* n = allocatesnode();
+    n->str1 = n->str2 = NULL;
+    n->mark = NULL;
 
     // if str1, copy to new snode
     if (strcmp(str1, "")) {
@@ -156,34 +138,56 @@ void pop(snode* n) {
     n->str1 = t->str1;
     n->str2 = t->str2;
     n->value = t->value;
+    n->mark = t->mark;
     n->next = t->next;
     free(t);
 }
 
 // search operation on snode
 snode* searchid(snode* head, char* identifier) {
+    Phase previous = phase(PHASE_SYMBOLS);
     snode* current = head;
+    long probes = 0;
     while (current != NULL) {
-        if (strcmp(current->str1, identifier) == 0) {
-            return current;
-        }
+        probes++;
+        if (strcmp(current->str1, identifier) == 0)
+            break;
         current = current->next;
     }
-    return NULL;
+    if (tracking) {
+        stats.lookups++;
+        stats.probes += probes;
+    }
+    phase(previous);
+    return current;
 }
 
+// locals of the current level are all pushed after it
+// was entered, there is no need to search further down
+snode* levelstart(char* level);
+
 // search operation on snode
 snode* searchidlevel(snode* head, char* identifier, char* level) {
+    Phase previous = phase(PHASE_SYMBOLS);
     snode* current = head;
-    while (current != NULL) {
+    snode* stop = levelstart(level);
+    long probes = 0;
+    while (current != NULL && current != stop) {
+        probes++;
         if (strcmp(current->str2, level) == 0) {
-             if (strcmp(current->str1, identifier) == 0) {
-                return current;
-            }
+             if (strcmp(current->str1, identifier) == 0)
+                break;
         }
         current = current->next;
     }
-    return NULL;
+    if (current == stop)
+        current = NULL;
+    if (tracking) {
+        stats.lookups++;
+        stats.probes += probes;
+    }
+    phase(previous);
+    return current;
 }
 
 
@@ -215,14 +219,26 @@ int getconnectnumber(char* identifier) {
     return num;
 }
 
+char* connectname(int number) {
+    snode* current = connect;
+    while (current != NULL) {
+        if (current->value == number)
+            return current->str1;
+        current = current->next;
+    }
+    return NULL;
+}
+
 
 // current (procedure) identifier used for/by locals
 // to seperate them, as the can have the same names
 
 snode* currentlevel = NULL;
+extern snode* local;
 
 void pushcurrent(char* identifier) {
     push(&currentlevel, CURRLEVEL, identifier, "", 0);   
+    currentlevel->mark = local;
 }
 
 void popcurrent() {
@@ -236,6 +252,12 @@ char* peekcurrent() {
     return NULL;
 }
 
+snode* levelstart(char* level) {
+    if (currentlevel != NULL && currentlevel->str1 == level)
+        return currentlevel->mark;
+    return NULL;
+}
+
 
 // globals
 // such as constants, vars, or arrays
@@ -302,15 +324,9 @@ void resetlocal() {
 }
 
 int getlocal(char* identifier, char* level) {
-    snode* current = local;
-    while (current != NULL) {
-        if (strcmp(current->str2, level) == 0) {
-            if (strcmp(current->str1, identifier) == 0) {
-                return current->value;
-            }
-        }
-        current = current->next;
-    }
+    snode* tmp = searchidlevel(local, identifier, level);
+    if (tmp != NULL)
+        return tmp->value;
     errnum(ERROR_NO_PREVIOUS_DECLARATION_LOCAL_IDENT_LEVEL);
     printerr("identifier", identifier);
     printerr("level", level);
@@ -4,6 +4,10 @@
 #define TRUE 1
 #define FALSE 0
 
+// length of label incl. terminator, e.g. "L0001"
+// or "L123456"
+#define LABEL_MAX 12
+
 typedef enum {
     CONSTANT_TYPE = 0x10,   // const x = 1, y = 10, z = 100;            --> str1 = (root or ident), str2 = x, value = 1 ..
     ARRAY_TYPE,
@@ -19,6 +23,7 @@ typedef struct snode {
     char* str1;
     char* str2;
     int value;
+    struct snode* mark;     // CURRLEVEL: locals when entered
     struct snode* next;
 } snode;
 
@@ -27,7 +32,6 @@ typedef struct snode {
 
 // label
 extern int labelincrease();
-extern int packint(int a, int b);
 extern char* label(int value);
 extern char* labela(int value);
 extern char* labelb(int value);
@@ -41,6 +45,7 @@ extern char* peekcurrent();
 extern void setconnectnumber(char* identifier, char* label, int number);
 extern int connectexistnumber(char* identifier);
 extern int getconnectnumber(char* identifier);
+extern char* connectname(int number);
 extern char* connects(int value);
 
 // global and constant and array
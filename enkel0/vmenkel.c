@@ -61,8 +61,42 @@ int nextcode(VM* vm) {
 	return vm->code[pc];
 }
 
+// local variable (or parameter) in current frame
+int* local(VM* vm, int offset) {
+	return &vm->locals[vm->fp + (offset * OFF + OFF)];
+}
+
+// binary operators and comparisons, used by the
+// fused instructions which carry the operator as argument
+int alu(int op, int a, int b) {
+	switch (op) {
+		case ADD:	return a + b;
+		case AND:	return a & b;
+		case MOD:	return a % b;
+		case MUL:	return a * b;
+		case OR:	return a | b;
+		case SUB:	return a - b;
+		case XOR:	return a ^ b;
+		case EQ:	return (a == b) ? TRUE : FALSE;
+		case GT:	return (a > b) ? TRUE : FALSE;
+		case GQ:	return (a >= b) ? TRUE : FALSE;
+		case LT:	return (a < b) ? TRUE : FALSE;
+		case LQ:	return (a <= b) ? TRUE : FALSE;
+		case NEQ:	return (a != b) ? TRUE : FALSE;
+		case DIV:
+			if (b == 0) {
+				fprintf(stderr, "Runtime error: division by zero.\n");
+				exit(EXIT_FAILURE);
+			}
+			return (int) div(a, b).quot;
+		default:
+			fprintf(stderr, "Runtime error: unknown operator %d.\n", op);
+			exit(EXIT_FAILURE);
+	}
+}
+
 void run(VM* vm){
-	int v, addr, offset, a, b;
+	int v, addr, offset, op, a, b;
 
 	do {
 		int opcode = nextcode(vm);
@@ -126,10 +160,46 @@ void run(VM* vm){
 			case HALT:
 				return;
 
+			case INC:
+				offset = nextcode(vm);
+				v = nextcode(vm);
+				*local(vm, offset) += v;
+				break;
+
 			case JP:
 				vm->pc = nextcode(vm);
 				break;
 
+			case JPC:
+				op = nextcode(vm);
+				addr = nextcode(vm);
+				b = pop(vm);
+				a = pop(vm);
+				if (alu(op, a, b)) {
+					vm->pc = addr;
+				}
+				break;
+
+			case JPCLI:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = nextcode(vm);
+				addr = nextcode(vm);
+				if (alu(op, a, b)) {
+					vm->pc = addr;
+				}
+				break;
+
+			case JPCLL:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = *local(vm, nextcode(vm));
+				addr = nextcode(vm);
+				if (alu(op, a, b)) {
+					vm->pc = addr;
+				}
+				break;
+
 			case JPNZ:
 				addr = nextcode(vm);
 				v = pop(vm);
@@ -197,6 +267,41 @@ void run(VM* vm){
 			case NOP:
 				break;				
 
+			case OPI:
+				op = nextcode(vm);
+				b = nextcode(vm);
+				a = pop(vm);
+				push(vm, alu(op, a, b));
+				break;
+
+			case OPLI:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = nextcode(vm);
+				push(vm, alu(op, a, b));
+				break;
+
+			case OPLIST:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = nextcode(vm);
+				*local(vm, nextcode(vm)) = alu(op, a, b);
+				break;
+
+			case OPLL:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = *local(vm, nextcode(vm));
+				push(vm, alu(op, a, b));
+				break;
+
+			case OPLLST:
+				op = nextcode(vm);
+				a = *local(vm, nextcode(vm));
+				b = *local(vm, nextcode(vm));
+				*local(vm, nextcode(vm)) = alu(op, a, b);
+				break;
+
 			case OR:
 				b = pop(vm);
 				a = pop(vm);
@@ -225,12 +330,24 @@ void run(VM* vm){
 				push(vm, v);
 				break;
 
+			case RLOADL:
+				addr = nextcode(vm);
+				a = vm->vars[addr] + *local(vm, nextcode(vm));
+				push(vm, vm->arrs[a]);
+				break;
+
 			case RSTORE:
 				a = pop(vm);
 				b = pop(vm);
 				vm->arrs[a] = b;
 				break;
 
+			case RSTOREL:
+				addr = nextcode(vm);
+				a = vm->vars[addr] + *local(vm, nextcode(vm));
+				vm->arrs[a] = pop(vm);
+				break;
+
 			case SET:
 				v = nextcode(vm);
 				push(vm, v);
@@ -26,37 +26,48 @@ enum {
 	ADD,	// 0
 	AND,	// 1
 	CALL,	// 2
-	DIV,	// 4
-	EMIT,	// 5
-	EQ,	// 6
-	GT,	// 7
-	GQ,	// 8
-	HALT,	// 9
+	DIV,	// 3
+	EMIT,	// 4
+	EQ,	// 5
+	GT,	// 6
+	GQ,	// 7
+	HALT,	// 8
+	INC,	// 9
 	JP,	// 10
-	JPNZ,	// 11
-	JPZ,	// 12
-	LD,	// 13
-	LDARG,	// 14
-	LOAD,	// 15
-	LT,	// 16
-	LQ,	// 17
-	MOD,	// 18
-	MUL,	// 19
-	NEQ,	// 20
-	NOP,	// 21
-	OR,	// 22
-	PRINT,	// 23
-	PRNT,	// 24
-	RET,	// 25
-	RLOAD,	// 26
-	RSTORE,	// 27
-	SET,	// 28
-	ST,	// 29
-	STARG,	// 30
-	STORE,	// 31
-	SUB,	// 32
-	UMIN,	// 33
-	XOR	// 34
+	JPC,	// 11
+	JPCLI,	// 12
+	JPCLL,	// 13
+	JPNZ,	// 14
+	JPZ,	// 15
+	LD,	// 16
+	LDARG,	// 17
+	LOAD,	// 18
+	LT,	// 19
+	LQ,	// 20
+	MOD,	// 21
+	MUL,	// 22
+	NEQ,	// 23
+	NOP,	// 24
+	OPI,	// 25
+	OPLI,	// 26
+	OPLIST,	// 27
+	OPLL,	// 28
+	OPLLST,	// 29
+	OR,	// 30
+	PRINT,	// 31
+	PRNT,	// 32
+	RET,	// 33
+	RLOAD,	// 34
+	RLOADL,	// 35
+	RSTORE,	// 36
+	RSTOREL,	// 37
+	SET,	// 38
+	ST,	// 39
+	STARG,	// 40
+	STORE,	// 41
+	SUB,	// 42
+	UMIN,	// 43
+	XOR	// 44
 };
 
 VM* newVM(int* code, int pc, int vars, int args, int arrs, int locals);
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vmreg.h"
+
+// register d, a or b of the current frame
+#define R(r) vm->regs[vm->fp + (r)]
+
+RVM* newRVM(int* code, int pc, int vars, int args, int arrs, int frames) {
+
+	// allocate
+	RVM* vm = (RVM*) malloc(sizeof(RVM));
+	if (vm == NULL)
+		return NULL;
+	vm->vars = (int*) malloc(sizeof(int) * vars);
+	if (vm->vars == NULL)
+		return NULL;
+	vm->args = (int*) malloc(sizeof(int) * args);
+	if (vm->args == NULL)
+		return NULL;
+	vm->arrs = (int*) malloc(sizeof(int) * arrs);
+	if (vm->arrs == NULL)
+		return NULL;
+	vm->regs = (int*) calloc(frames * FRAME, sizeof(int));
+	if (vm->regs == NULL)
+		return NULL;
+	vm->calls = (int*) malloc(sizeof(int) * frames);
+	if (vm->calls == NULL)
+		return NULL;
+
+	// init
+	vm->code = code;
+	vm->pc = pc;
+	vm->fp = 0;
+	vm->cp = 0;
+	vm->frames = frames;
+
+	return vm;
+}
+
+void freeRVM(RVM* vm){
+	if (vm != NULL) {
+		free(vm->calls);
+		free(vm->regs);
+		free(vm->arrs);
+		free(vm->args);
+		free(vm->vars);
+		free(vm);
+	}
+}
+
+int nextcode(RVM* vm) {
+	int pc = (vm->pc)++;
+	return vm->code[pc];
+}
+
+// relation carried as argument by JPC
+int relation(int op, int a, int b) {
+	switch (op) {
+		case EQ:	return (a == b);
+		case GQ:	return (a >= b);
+		case GT:	return (a > b);
+		case LQ:	return (a <= b);
+		case LT:	return (a < b);
+		case NEQ:	return (a != b);
+		default:
+			fprintf(stderr, "Runtime error: unknown relation %d.\n", op);
+			exit(EXIT_FAILURE);
+	}
+}
+
+// instructions name registers: "ADD d a b" is d = a + b
+void run(RVM* vm){
+	int d, a, b, op, addr;
+
+	do {
+		int opcode = nextcode(vm);
+
+		switch (opcode) {
+
+			case ADD:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) + R(b);
+				break;
+
+			case AND:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) & R(b);
+				break;
+
+			// a new frame of registers, the
+			// caller's are left as they are
+			case CALL:
+				addr = nextcode(vm);
+				if (vm->cp + 1 >= vm->frames) {
+					fprintf(stderr, "Runtime error: too deep calls.\n");
+					exit(EXIT_FAILURE);
+				}
+				vm->calls[vm->cp++] = vm->pc;
+				vm->fp += FRAME;
+				vm->pc = addr;
+				break;
+
+			case DIV:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				if (R(b) == 0) {
+					fprintf(stderr, "Runtime error: division by zero.\n");
+					exit(EXIT_FAILURE);
+				}
+				R(d) = (int) div(R(a), R(b)).quot;
+				break;
+
+			case EMIT:
+				a = nextcode(vm);
+				printf("%c", (char) R(a));
+				break;
+
+			case EQ:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) == R(b)) ? TRUE : FALSE;
+				break;
+
+			case GQ:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) >= R(b)) ? TRUE : FALSE;
+				break;
+
+			case GT:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) > R(b)) ? TRUE : FALSE;
+				break;
+
+			case HALT:
+				return;
+
+			case JP:
+				vm->pc = nextcode(vm);
+				break;
+
+			case JPC:
+				op = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				addr = nextcode(vm);
+				if (relation(op, R(a), R(b))) {
+					vm->pc = addr;
+				}
+				break;
+
+			case JPNZ:
+				a = nextcode(vm);
+				addr = nextcode(vm);
+				if (R(a) != 0) {
+					vm->pc = addr;
+				}
+				break;
+
+			case JPZ:
+				a = nextcode(vm);
+				addr = nextcode(vm);
+				if (R(a) == 0) {
+					vm->pc = addr;
+				}
+				break;
+
+			case LDARG:
+				d = nextcode(vm);
+				addr = nextcode(vm);
+				R(d) = vm->args[addr];
+				break;
+
+			// spill slots follow the registers in a frame
+			case LDS:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				R(d) = R(REGS + a);
+				break;
+
+			case LOAD:
+				d = nextcode(vm);
+				addr = nextcode(vm);
+				R(d) = vm->vars[addr];
+				break;
+
+			case LQ:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) <= R(b)) ? TRUE : FALSE;
+				break;
+
+			case LT:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) < R(b)) ? TRUE : FALSE;
+				break;
+
+			case MOD:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) % R(b);
+				break;
+
+			case MOV:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				R(d) = R(a);
+				break;
+
+			case MUL:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) * R(b);
+				break;
+
+			case NEQ:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = (R(a) != R(b)) ? TRUE : FALSE;
+				break;
+
+			case OR:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) | R(b);
+				break;
+
+			case PRINT:
+				a = nextcode(vm);
+				printf("%d\n", R(a));
+				break;
+
+			case RET:
+				vm->fp -= FRAME;
+				vm->pc = vm->calls[--vm->cp];
+				break;
+
+			case RLOAD:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				R(d) = vm->arrs[R(a)];
+				break;
+
+			case RSTORE:
+				a = nextcode(vm);
+				b = nextcode(vm);
+				vm->arrs[R(a)] = R(b);
+				break;
+
+			case SET:
+				d = nextcode(vm);
+				R(d) = nextcode(vm);
+				break;
+
+			case STARG:
+				addr = nextcode(vm);
+				a = nextcode(vm);
+				vm->args[addr] = R(a);
+				break;
+
+			case STORE:
+				addr = nextcode(vm);
+				a = nextcode(vm);
+				vm->vars[addr] = R(a);
+				break;
+
+			case STS:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				R(REGS + d) = R(a);
+				break;
+
+			case SUB:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) - R(b);
+				break;
+
+			case UMIN:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				R(d) = -R(a);
+				break;
+
+			case XOR:
+				d = nextcode(vm);
+				a = nextcode(vm);
+				b = nextcode(vm);
+				R(d) = R(a) ^ R(b);
+				break;
+
+			default:
+				fprintf(stderr, "Runtime error: unknown opcode %d.\n", opcode);
+				exit(EXIT_FAILURE);
+		}
+
+	} while (TRUE);
+}
+
+/* EOF */
@@ -0,0 +1,68 @@
+#ifndef _VMREG_H
+#define _VMREG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REGS 16		// registers in a frame, must be in sync with lsra.c
+#define FRAME 256	// registers and spill slots of a frame
+#define TRUE 1
+#define FALSE 0
+
+typedef struct {
+	int* vars;
+	int* args;
+	int* arrs;
+	int* regs;	// frames of all activations
+	int* calls;	// return addresses
+	int* code;
+	int pc;
+	int fp;
+	int cp;
+	int frames;
+} RVM;
+
+// must be in sync with asm.py
+enum {
+	ADD,	// 0
+	AND,	// 1
+	CALL,	// 2
+	DIV,	// 3
+	EMIT,	// 4
+	EQ,	// 5
+	GQ,	// 6
+	GT,	// 7
+	HALT,	// 8
+	JP,	// 9
+	JPC,	// 10
+	JPNZ,	// 11
+	JPZ,	// 12
+	LDARG,	// 13
+	LDS,	// 14
+	LOAD,	// 15
+	LQ,	// 16
+	LT,	// 17
+	MOD,	// 18
+	MOV,	// 19
+	MUL,	// 20
+	NEQ,	// 21
+	OR,	// 22
+	PRINT,	// 23
+	RET,	// 24
+	RLOAD,	// 25
+	RSTORE,	// 26
+	SET,	// 27
+	STARG,	// 28
+	STORE,	// 29
+	STS,	// 30
+	SUB,	// 31
+	UMIN,	// 32
+	XOR	// 33
+};
+
+RVM* newRVM(int* code, int pc, int vars, int args, int arrs, int frames);
+void freeRVM(RVM* vm);
+void run(RVM* vm);
+
+#endif
+/* EOF */
@@ -0,0 +1,556 @@
+/* for stat(), mmap() and friends */
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "class-heap.h"
+
+#define ARCHIVE_MAGIC 0x41534a50 /* "PJSA" */
+#define ARCHIVE_VERSION 9
+
+/* where an archive asks to be mapped, out of the way of the usual heap and
+ * libraries */
+#define ARCHIVE_BASE ((uintptr_t) 0x20000000 << (sizeof(void *) == 8 ? 12 : 0))
+
+/* Start of an archive. The pointers in the archive hold the addresses they
+ * would have if the archive was mapped at ARCHIVE_BASE. The offsets of all the
+ * pointers are listed after the classes, so that they can be moved wherever
+ * the archive gets mapped otherwise.
+ */
+typedef struct {
+    u4 magic;
+    u4 version;
+    uintptr_t base;
+    size_t size;
+    size_t classes; /* offset of the archived_class_t array */
+    u4 classes_count;
+    size_t relocations; /* offset of the offsets of all pointers */
+    size_t relocations_count;
+} archive_header_t;
+
+/* a class and what its file was like when it was archived */
+typedef struct {
+    class_file_t *clazz; /* the main class comes first */
+    int64_t mtime;
+    int64_t size;
+} archived_class_t;
+
+/* a class to archive, and where its parts went */
+typedef struct {
+    class_file_t *clazz;
+    size_t at;
+    size_t methods;
+    size_t fields;
+    size_t cp_cache;
+    size_t vtable;
+} class_layout_t;
+
+/* the archive being dumped, which moves as it grows */
+static struct {
+    u1 *data;
+    size_t size;
+    size_t capacity;
+    size_t *relocations;
+    size_t relocations_count;
+    size_t relocations_capacity;
+} builder;
+
+/* the classes to dump, as collected by for_each_class() */
+static class_layout_t *layouts;
+static u4 layouts_count, layouts_capacity;
+
+/* the class path the classes to dump are loaded from */
+static char *class_path;
+
+/* the mapped archive */
+static u1 *archive;
+static size_t archive_size;
+
+/* zeroed room in the archive, aligned for pointers, at the returned offset */
+static size_t reserve(size_t size)
+{
+    size_t at = (builder.size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    size_t end = at + size;
+    if (end > builder.capacity) {
+        while (end > builder.capacity)
+            builder.capacity = builder.capacity ? 2 * builder.capacity : 4096;
+        builder.data = realloc(builder.data, builder.capacity);
+        assert(builder.data && "Failed to grow archive");
+    }
+    memset(builder.data + builder.size, 0, end - builder.size);
+    builder.size = end;
+    return at;
+}
+
+static size_t copy(const void *src, size_t size)
+{
+    size_t at = reserve(size);
+    if (size)
+        memcpy(builder.data + at, src, size);
+    return at;
+}
+
+/* store a pointer at an offset of the archive to another offset */
+static void set_pointer(size_t at, size_t target)
+{
+    uintptr_t address = ARCHIVE_BASE + target;
+    memcpy(builder.data + at, &address, sizeof(address));
+    if (builder.relocations_count == builder.relocations_capacity) {
+        builder.relocations_capacity = builder.relocations_capacity
+                                           ? 2 * builder.relocations_capacity
+                                           : 1024;
+        builder.relocations =
+            realloc(builder.relocations,
+                    sizeof(size_t) * builder.relocations_capacity);
+        assert(builder.relocations && "Failed to grow archive");
+    }
+    builder.relocations[builder.relocations_count++] = at;
+}
+
+/* a pointer copied from a class but left out of the archive */
+static void clear_pointer(size_t at)
+{
+    memset(builder.data + at, 0, sizeof(void *));
+}
+
+/* store a pointer into the file of a class, archived at the given offset */
+static void set_file_pointer(size_t at,
+                             class_file_t *clazz,
+                             size_t file,
+                             void *ptr)
+{
+    set_pointer(at, file + ((u1 *) ptr - clazz->file));
+}
+
+static void collect_class(class_file_t *clazz)
+{
+    if (layouts_count == layouts_capacity) {
+        layouts_capacity = layouts_capacity ? 2 * layouts_capacity : 64;
+        layouts = realloc(layouts, sizeof(class_layout_t) * layouts_capacity);
+        assert(layouts && "Failed to allocate archived classes");
+    }
+    layouts[layouts_count++] = (class_layout_t){.clazz = clazz};
+}
+
+static void collect_classes()
+{
+    layouts_count = 0;
+    for_each_class(collect_class);
+}
+
+static class_layout_t *find_layout(class_file_t *clazz)
+{
+    for (u4 i = 0; i < layouts_count; i++) {
+        if (layouts[i].clazz == clazz)
+            return &layouts[i];
+    }
+    assert(0 && "Class missing from archive");
+    return NULL;
+}
+
+/* load the classes named in the constant pool of a class which are found on
+ * the class path */
+static void load_named_classes(class_file_t *clazz)
+{
+    for (u2 i = 1; i <= clazz->constant_pool.count; i++) {
+        const_pool_info *constant = get_constant(&clazz->constant_pool, i);
+        if (constant->tag == CONSTANT_Long) {
+            /* the next entry is unusable */
+            i++;
+            continue;
+        }
+        if (constant->tag != CONSTANT_Class)
+            continue;
+        char *name = find_class_name_from_index(i, clazz);
+        if (name[0] != '[' && !find_class_from_heap(name))
+            load_class(name, class_path);
+    }
+}
+
+static class_file_t *super_class_of(class_file_t *clazz)
+{
+    return find_class_from_heap(
+        find_class_name_from_index(clazz->info->super_class, clazz));
+}
+
+/* resolve the member references of a class to the loaded classes the same
+ * way resolve_method() and resolve_field() would, leaving the others to be
+ * resolved at run time */
+static void resolve_members(class_file_t *clazz)
+{
+    for (u2 i = 1; i <= clazz->constant_pool.count; i++) {
+        const_pool_info *constant = get_constant(&clazz->constant_pool, i);
+        cp_cache_t *entry = &clazz->cp_cache[i];
+        char *name, *descriptor, *class_name;
+
+        switch (constant->tag) {
+        case CONSTANT_Long:
+            i++;
+            break;
+
+        case CONSTANT_MethodRef:
+            class_name =
+                find_method_info_from_index(i, clazz, &name, &descriptor);
+            for (class_file_t *target = find_class_from_heap(class_name);
+                 target && !entry->resolved; target = super_class_of(target)) {
+                method_t *method = find_method(name, descriptor, target);
+                if (method) {
+                    entry->clazz = target;
+                    entry->method = method;
+                    entry->num_params = get_number_of_parameters(method);
+                    entry->vtable_index = find_vtable_index(target, method);
+                    entry->resolved = true;
+                }
+            }
+            break;
+
+        case CONSTANT_FieldRef:
+            class_name =
+                find_field_info_from_index(i, clazz, &name, &descriptor);
+            for (class_file_t *target = find_class_from_heap(class_name);
+                 target && !entry->resolved; target = super_class_of(target)) {
+                field_t *field = find_field(name, descriptor, target);
+                if (field) {
+                    entry->clazz = target;
+                    entry->field = field;
+                    entry->resolved = true;
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/* copy a class and everything it owns into the archive */
+static void archive_class(class_layout_t *layout)
+{
+    class_file_t *clazz = layout->clazz;
+    u2 count = clazz->constant_pool.count;
+
+    size_t at = copy(clazz, sizeof(class_file_t));
+    size_t file = copy(clazz->file, clazz->file_size);
+    set_pointer(at + offsetof(class_file_t, file), file);
+    layout->at = at;
+
+    /* the UTF8 constants are in the file, the others in the values */
+    size_t pool = copy(clazz->constant_pool.constant_pool,
+                       sizeof(const_pool_info) * count);
+    size_t values =
+        copy(clazz->constant_pool.values, sizeof(const_pool_value_t) * count);
+    set_pointer(at + offsetof(class_file_t, constant_pool.constant_pool), pool);
+    set_pointer(at + offsetof(class_file_t, constant_pool.values), values);
+    for (u2 i = 0; i < count; i++) {
+        const_pool_info *constant = &clazz->constant_pool.constant_pool[i];
+        size_t info = pool + i * sizeof(const_pool_info) +
+                      offsetof(const_pool_info, info);
+        if (!constant->info)
+            continue;
+        if (constant->tag == CONSTANT_Utf8)
+            set_file_pointer(info, clazz, file, constant->info);
+        else
+            set_pointer(info, values + (constant->info -
+                                        (u1 *) clazz->constant_pool.values));
+    }
+
+    /* filled in once every class has its place */
+    layout->cp_cache = reserve(sizeof(cp_cache_t) * (count + 1));
+    set_pointer(at + offsetof(class_file_t, cp_cache), layout->cp_cache);
+
+    set_pointer(at + offsetof(class_file_t, info),
+                copy(clazz->info, sizeof(class_info_t)));
+
+    u2 methods_count = 0;
+    while (clazz->methods[methods_count].name)
+        methods_count++;
+    layout->methods = reserve(sizeof(method_t) * (methods_count + 1));
+    memcpy(builder.data + layout->methods, clazz->methods,
+           sizeof(method_t) * methods_count);
+    set_pointer(at + offsetof(class_file_t, methods), layout->methods);
+    for (u2 i = 0; i < methods_count; i++) {
+        method_t *method = &clazz->methods[i];
+        size_t method_at = layout->methods + i * sizeof(method_t);
+        set_file_pointer(method_at + offsetof(method_t, name), clazz, file,
+                         method->name);
+        set_file_pointer(method_at + offsetof(method_t, descriptor), clazz,
+                         file, method->descriptor);
+        set_file_pointer(method_at + offsetof(method_t, code.code), clazz, file,
+                         method->code.code);
+        /* each run decodes the methods it invokes */
+        clear_pointer(method_at + offsetof(method_t, insns));
+        clear_pointer(method_at + offsetof(method_t, ref_maps));
+        clear_pointer(method_at + offsetof(method_t, stack_depths));
+        clear_pointer(method_at + offsetof(method_t, jit));
+        clear_pointer(method_at + offsetof(method_t, inline_caches));
+        clear_pointer(method_at + offsetof(method_t, concat_plans));
+        clear_pointer(method_at + offsetof(method_t, profile));
+        ((method_t *) (builder.data + method_at))->concat_sites = 0;
+    }
+
+    layout->fields = reserve(sizeof(field_t) * (clazz->fields_count + 1));
+    memcpy(builder.data + layout->fields, clazz->fields,
+           sizeof(field_t) * clazz->fields_count);
+    set_pointer(at + offsetof(class_file_t, fields), layout->fields);
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        field_t *field = &clazz->fields[i];
+        size_t field_at = layout->fields + i * sizeof(field_t);
+        clear_pointer(field_at + offsetof(field_t, class_name));
+        set_file_pointer(field_at + offsetof(field_t, name), clazz, file,
+                         field->name);
+        set_file_pointer(field_at + offsetof(field_t, descriptor), clazz, file,
+                         field->descriptor);
+        set_pointer(field_at + offsetof(field_t, static_var),
+                    copy(field->static_var, sizeof(variable_t)));
+    }
+
+    set_pointer(at + offsetof(class_file_t, ref_offsets),
+                copy(clazz->ref_offsets, sizeof(u4) * clazz->ref_fields_count));
+
+    /* filled in once every class has its place */
+    layout->vtable = reserve(sizeof(vtable_entry_t) * clazz->vtable_length);
+    set_pointer(at + offsetof(class_file_t, vtable), layout->vtable);
+
+    bootmethods_attr_t *bootstrap = clazz->bootstrap;
+    if (bootstrap) {
+        size_t bootstrap_at = copy(bootstrap, sizeof(bootmethods_attr_t));
+        size_t methods =
+            copy(bootstrap->bootstrap_methods,
+                 sizeof(bootmethods_t) * bootstrap->num_bootstrap_methods);
+        for (u2 i = 0; i < bootstrap->num_bootstrap_methods; i++) {
+            bootmethods_t *method = &bootstrap->bootstrap_methods[i];
+            set_pointer(methods + i * sizeof(bootmethods_t) +
+                            offsetof(bootmethods_t, bootstrap_arguments),
+                        copy(method->bootstrap_arguments,
+                             sizeof(u2) * method->num_bootstrap_arguments));
+        }
+        set_pointer(bootstrap_at + offsetof(bootmethods_attr_t,
+                                            bootstrap_methods),
+                    methods);
+        set_pointer(at + offsetof(class_file_t, bootstrap), bootstrap_at);
+    }
+
+    clear_pointer(at + offsetof(class_file_t, next));
+    clear_pointer(at + offsetof(class_file_t, prev));
+    clear_pointer(at + offsetof(class_file_t, initializer));
+    class_file_t *archived = (class_file_t *) (builder.data + at);
+    archived->initialized = false;
+    archived->shared = true;
+}
+
+/* point the resolved references of a class to the archived classes. Those
+ * bound to intrinsics are resolved again, as the VM may be mapped elsewhere. */
+static void archive_cp_cache(class_layout_t *layout)
+{
+    class_file_t *clazz = layout->clazz;
+    for (u4 i = 0; i <= clazz->constant_pool.count; i++) {
+        cp_cache_t *entry = &clazz->cp_cache[i];
+        if (!entry->resolved || entry->intrinsic)
+            continue;
+
+        size_t at = layout->cp_cache + i * sizeof(cp_cache_t);
+        cp_cache_t *archived = (cp_cache_t *) (builder.data + at);
+        archived->resolved = true;
+        archived->num_params = entry->num_params;
+        archived->vtable_index = entry->vtable_index;
+        if (!entry->clazz)
+            continue;
+
+        class_layout_t *target = find_layout(entry->clazz);
+        set_pointer(at + offsetof(cp_cache_t, clazz), target->at);
+        if (entry->method) {
+            size_t method = entry->method - entry->clazz->methods;
+            set_pointer(at + offsetof(cp_cache_t, method),
+                        target->methods + method * sizeof(method_t));
+        }
+        if (entry->field) {
+            size_t field = entry->field - entry->clazz->fields;
+            set_pointer(at + offsetof(cp_cache_t, field),
+                        target->fields + field * sizeof(field_t));
+        }
+    }
+}
+
+/* point the vtable of a class to the archived methods */
+static void archive_vtable(class_layout_t *layout)
+{
+    class_file_t *clazz = layout->clazz;
+    for (u2 i = 0; i < clazz->vtable_length; i++) {
+        vtable_entry_t *entry = &clazz->vtable[i];
+        size_t at = layout->vtable + i * sizeof(vtable_entry_t);
+        class_layout_t *target = find_layout(entry->clazz);
+        size_t method = entry->method - entry->clazz->methods;
+        set_pointer(at + offsetof(vtable_entry_t, clazz), target->at);
+        set_pointer(at + offsetof(vtable_entry_t, method),
+                    target->methods + method * sizeof(method_t));
+    }
+}
+
+/* the time and size of the file of a class, which tell whether it changed */
+static bool stat_class_file(class_file_t *clazz,
+                            char *prefix,
+                            archived_class_t *archived)
+{
+    char *path = class_file_path(
+        find_class_name_from_index(clazz->info->this_class, clazz), prefix);
+    struct stat st;
+    int error = stat(path, &st);
+    free(path);
+    if (error)
+        return false;
+    archived->mtime = st.st_mtime;
+    archived->size = st.st_size;
+    return true;
+}
+
+/**
+ * Archive the main class with every class it leads to on the class path.
+ * The member references between these classes are resolved beforehand.
+ *
+ * @param path the archive file to write
+ * @param main_class the loaded and linked main class
+ * @param prefix the class path
+ * @return whether the archive was written
+ */
+bool dump_archive(const char *path, class_file_t *main_class, char *prefix)
+{
+    class_path = prefix;
+
+    /* load the classes named by the loaded ones until no more are found */
+    u4 loaded;
+    do {
+        collect_classes();
+        loaded = layouts_count;
+        for (u4 i = 0; i < loaded; i++)
+            load_named_classes(layouts[i].clazz);
+        collect_classes();
+    } while (layouts_count != loaded);
+
+    for (u4 i = 0; i < layouts_count; i++)
+        resolve_members(layouts[i].clazz);
+    class_layout_t *main_layout = find_layout(main_class);
+    *main_layout = layouts[0];
+    layouts[0].clazz = main_class;
+
+    size_t header = reserve(sizeof(archive_header_t));
+    for (u4 i = 0; i < layouts_count; i++)
+        archive_class(&layouts[i]);
+    for (u4 i = 0; i < layouts_count; i++) {
+        archive_cp_cache(&layouts[i]);
+        archive_vtable(&layouts[i]);
+    }
+
+    bool dumped = true;
+    size_t classes = reserve(sizeof(archived_class_t) * layouts_count);
+    for (u4 i = 0; i < layouts_count; i++) {
+        size_t at = classes + i * sizeof(archived_class_t);
+        set_pointer(at + offsetof(archived_class_t, clazz), layouts[i].at);
+        if (!stat_class_file(layouts[i].clazz, prefix,
+                             (archived_class_t *) (builder.data + at)))
+            dumped = false;
+    }
+    size_t relocations_count = builder.relocations_count;
+    size_t relocations =
+        copy(builder.relocations, sizeof(size_t) * relocations_count);
+
+    archive_header_t *archive_header =
+        (archive_header_t *) (builder.data + header);
+    *archive_header = (archive_header_t){
+        .magic = ARCHIVE_MAGIC,
+        .version = ARCHIVE_VERSION,
+        .base = ARCHIVE_BASE,
+        .size = builder.size,
+        .classes = classes,
+        .classes_count = layouts_count,
+        .relocations = relocations,
+        .relocations_count = relocations_count,
+    };
+
+    FILE *file = dumped ? fopen(path, "wb") : NULL;
+    if (file) {
+        dumped = fwrite(builder.data, 1, builder.size, file) == builder.size;
+        dumped = !fclose(file) && dumped;
+    } else {
+        dumped = false;
+    }
+
+    free(builder.data);
+    free(builder.relocations);
+    free(layouts);
+    return dumped;
+}
+
+/**
+ * Map an archive and add its classes to the class heap, ready to run.
+ *
+ * @param path the archive file
+ * @param prefix the class path, whose class files must not have changed since
+ * the archive was dumped
+ * @return the main class, or NULL if there is no usable archive
+ */
+class_file_t *map_archive(const char *path, char *prefix)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(archive_header_t))
+        data = mmap((void *) ARCHIVE_BASE, st.st_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    archive_header_t *header = data;
+    if (header->magic != ARCHIVE_MAGIC || header->version != ARCHIVE_VERSION ||
+        header->size != (size_t) st.st_size ||
+        header->relocations + sizeof(size_t) * header->relocations_count >
+            header->size) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    /* the pages of the archive are only copied when written to, unless the
+     * archive could not be mapped where it asked to be */
+    uintptr_t delta = (uintptr_t) data - header->base;
+    if (delta) {
+        size_t *relocations = (size_t *) ((u1 *) data + header->relocations);
+        for (size_t i = 0; i < header->relocations_count; i++) {
+            uintptr_t *pointer = (uintptr_t *) ((u1 *) data + relocations[i]);
+            *pointer += delta;
+        }
+    }
+
+    /* a class file changed since the dump makes the archive stale */
+    archived_class_t *classes =
+        (archived_class_t *) ((u1 *) data + header->classes);
+    for (u4 i = 0; i < header->classes_count; i++) {
+        archived_class_t current;
+        if (!stat_class_file(classes[i].clazz, prefix, &current) ||
+            current.mtime != classes[i].mtime ||
+            current.size != classes[i].size) {
+            munmap(data, st.st_size);
+            return NULL;
+        }
+    }
+
+    for (u4 i = 0; i < header->classes_count; i++)
+        add_class(classes[i].clazz);
+    archive = data;
+    archive_size = st.st_size;
+    return classes[0].clazz;
+}
+
+void unmap_archive()
+{
+    if (archive)
+        munmap(archive, archive_size);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "classfile.h"
+
+/* Class-data sharing. An archive keeps the parsed and linked classes of a
+ * program, with their member references resolved, so that a later run maps
+ * them instead of reading and parsing class files.
+ */
+
+bool dump_archive(const char *path, class_file_t *main_class, char *prefix);
+class_file_t *map_archive(const char *path, char *prefix);
+void unmap_archive();
@@ -0,0 +1,35 @@
+/* Allocation: SIZE small objects, each dropped as soon as it is read, then
+ * rounds of an int[5000] and a long[40][40], so that the collector runs
+ * often */
+public class AllocBench {
+    static final int SIZE = 3000000; /* bench.py sets the size */
+    static final int ROUNDS = 500;
+
+    public static void main(String[] args) {
+        long total = 0;
+        for (int i = 0; i < SIZE; i++) {
+            AllocBenchPoint p = new AllocBenchPoint(i, i % 3);
+            total += p.x + p.y;
+        }
+        System.out.println(total);
+
+        for (int i = 0; i < ROUNDS; i++) {
+            int[] big = new int[5000];
+            big[4999] = i;
+            long[][] grid = new long[40][40];
+            grid[39][39] = i;
+            total += big[4999] + grid[39][39];
+        }
+        System.out.println(total);
+    }
+}
+
+class AllocBenchPoint {
+    int x;
+    int y;
+
+    AllocBenchPoint(int x, int y) {
+        this.x = x;
+        this.y = y;
+    }
+}
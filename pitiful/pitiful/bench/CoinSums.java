@@ -0,0 +1,23 @@
+/* The ways to make SIZE pence out of British coins, as tests/CoinSums counts
+ * them */
+public class CoinSums {
+    static final int SIZE = 500; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        System.out.println(waysToMake(SIZE, 200));
+    }
+
+    public static int waysToMake(int target, int maxCoin) {
+        if (maxCoin == 1) return 1;
+
+        int nextCoin = maxCoin == 5 || maxCoin == 50
+                       ? maxCoin * 2 / 5
+                       : maxCoin / 2;
+        int ways = 0;
+        while (target >= 0) {
+            ways += waysToMake(target, nextCoin);
+            target -= maxCoin;
+        }
+        return ways;
+    }
+}
@@ -0,0 +1,24 @@
+/* The start below SIZE of the longest Collatz sequence, as tests/Collatz
+ * finds it, with the values kept in a long */
+public class Collatz {
+    static final int SIZE = 200000; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        int longestStart = 0;
+        int longestLength = 0;
+        for (int initial = 1; initial < SIZE; initial++) {
+            int length = 0;
+            long current = initial;
+            while (current > 1) {
+                length++;
+                current = current % 2 == 0 ? current / 2 : current * 3 + 1;
+            }
+            if (length > longestLength) {
+                longestStart = initial;
+                longestLength = length;
+            }
+        }
+        System.out.println(longestStart);
+        System.out.println(longestLength);
+    }
+}
@@ -0,0 +1,52 @@
+/* The first SIZE lexicographic permutations of the digits 0 to 8, each found
+ * on its own as tests/DigitPermutations finds one, summed up */
+public class DigitPermutations {
+    static final int SIZE = 100000; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        long checksum = 0;
+        for (int permutation = 0; permutation < SIZE; permutation++) {
+            checksum = (checksum * 31 + find(permutation)) % 1_000_000_007;
+        }
+        System.out.println(checksum);
+    }
+
+    /* the permutation after skipping the given number of them, as digits */
+    public static int find(int permutationsToSkip) {
+        int digits = 876543210;
+        int permutation = 0;
+        for (int remainingDigits = 8; remainingDigits >= 0; remainingDigits--) {
+            int possibilities = factorial(remainingDigits);
+            int index = permutationsToSkip / possibilities;
+            permutationsToSkip -= index * possibilities;
+            permutation = permutation * 10 + getDigit(digits, index);
+            digits = removeDigit(digits, index);
+        }
+        return permutation;
+    }
+
+    public static int factorial(int n) {
+        int product = 1;
+        while (n > 0) {
+            product *= n--;
+        }
+        return product;
+    }
+
+    public static int getDigit(int digits, int index) {
+        while (index > 0) {
+            digits /= 10;
+            index--;
+        }
+        return digits % 10;
+    }
+
+    public static int removeDigit(int digits, int index) {
+        int powerOfTen = 1;
+        while (index > 0) {
+            powerOfTen *= 10;
+            index--;
+        }
+        return digits / powerOfTen / 10 * powerOfTen + digits % powerOfTen;
+    }
+}
@@ -0,0 +1,37 @@
+/* The odd composites below SIZE which are not a prime and twice a square, as
+ * tests/Goldbach looks for them */
+public class Goldbach {
+    static final int SIZE = 200000; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        int counterexamples = 0;
+        int last = 0;
+        testExample: for (int test = 9; test < SIZE; test += 2) {
+            if (isPrime(test)) {
+                continue;
+            }
+            for (int squareRoot = 1; ; squareRoot++) {
+                int rest = test - squareRoot * squareRoot * 2;
+                if (rest <= 0) {
+                    counterexamples++;
+                    last = test;
+                    continue testExample;
+                }
+                if (isPrime(rest)) {
+                    continue testExample;
+                }
+            }
+        }
+        System.out.println(counterexamples);
+        System.out.println(last);
+    }
+
+    public static boolean isPrime(int n) {
+        for (int test = 2; test * test <= n; test++) {
+            if (n % test == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,36 @@
+/* The largest palindrome made from the product of two factors from 100 up to
+ * SIZE, as tests/PalindromeProduct finds it, checking every product */
+public class PalindromeProduct {
+    static final int SIZE = 2000; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        int maxPalindrome = 0;
+        int palindromes = 0;
+        for (int i = 100; i <= SIZE; i++) {
+            for (int j = i; j <= SIZE; j++) {
+                int product = i * j;
+                if (isPalindrome(product)) {
+                    palindromes++;
+                    if (product > maxPalindrome) {
+                        maxPalindrome = product;
+                    }
+                }
+            }
+        }
+        System.out.println(maxPalindrome);
+        System.out.println(palindromes);
+    }
+
+    public static int reverse(int n) {
+        int reversed = 0;
+        while (n != 0) {
+            reversed = reversed * 10 + n % 10;
+            n /= 10;
+        }
+        return reversed;
+    }
+
+    public static boolean isPalindrome(int n) {
+        return n == reverse(n);
+    }
+}
@@ -0,0 +1,58 @@
+/* Primes below SIZE by trial division, as bench/Primes finds them, on THREADS
+ * threads: its time against that of Primes of the same size is the scaling */
+public class ParallelPrimes {
+    static final int SIZE = 30000; /* bench.py sets the size */
+    static final int THREADS = 4;
+
+    public static void main(String[] args) {
+        ParallelPrimesWorker[] workers = new ParallelPrimesWorker[THREADS];
+        for (int i = 0; i < THREADS; i++) {
+            workers[i] = new ParallelPrimesWorker(i, THREADS, SIZE);
+            workers[i].start();
+        }
+
+        int count = 0;
+        for (int i = 0; i < THREADS; i++) {
+            workers[i].join();
+            count += workers[i].count;
+        }
+        System.out.println(count);
+    }
+}
+
+/* counts the primes among every step-th number from start on, so that the
+ * threads get about as much work each */
+class ParallelPrimesWorker extends Thread {
+    int start;
+    int step;
+    int size;
+    int count;
+
+    ParallelPrimesWorker(int start, int step, int size) {
+        this.start = start;
+        this.step = step;
+        this.size = size;
+    }
+
+    public void run() {
+        for (int n = start; n < size; n += step) {
+            if (isPrime(n)) {
+                count++;
+            }
+        }
+    }
+
+    static boolean isPrime(int n) {
+        if (n < 2) {
+            return false;
+        }
+
+        for (int testFactor = 2; testFactor < n; testFactor++) {
+            if (n % testFactor == 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,28 @@
+/* Primes below SIZE by trial division, as tests/Primes finds them */
+public class Primes {
+    static final int SIZE = 30000; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        int count = 0;
+        for (int n = 0; n < SIZE; n++) {
+            if (isPrime(n)) {
+                count++;
+            }
+        }
+        System.out.println(count);
+    }
+
+    public static boolean isPrime(int n) {
+        if (n < 2) {
+            return false;
+        }
+
+        for (int testFactor = 2; testFactor < n; testFactor++) {
+            if (n % testFactor == 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,23 @@
+/* The Pythagorean triplets with a perimeter of at most SIZE, found the way
+ * tests/PythagoreanTriplet finds the one with a perimeter of 1000 */
+public class PythagoreanTriplet {
+    static final int SIZE = 1500; /* bench.py sets the size */
+
+    public static void main(String[] args) {
+        int triplets = 0;
+        long products = 0;
+        for (int perimeter = 12; perimeter <= SIZE; perimeter += 12) {
+            for (int a = 1; a < perimeter / 3; a++) {
+                for (int b = a + 1; b < perimeter / 2; b++) {
+                    int c = perimeter - a - b;
+                    if (a * a + b * b == c * c) {
+                        triplets++;
+                        products += a * b * c;
+                    }
+                }
+            }
+        }
+        System.out.println(triplets);
+        System.out.println(products);
+    }
+}
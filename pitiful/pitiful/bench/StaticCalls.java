@@ -0,0 +1,21 @@
+/* Static calls and static fields: fib(27) by plain recursion, then SIZE
+ * updates of a static field, so that the time is spent in invokestatic,
+ * getstatic and putstatic */
+public class StaticCalls {
+    static final int SIZE = 2000000; /* bench.py sets the size */
+
+    static int total;
+
+    static int fib(int n) {
+        if (n < 2)
+            return n;
+        return fib(n - 1) + fib(n - 2);
+    }
+
+    public static void main(String[] args) {
+        System.out.println(fib(27));
+        for (int i = 0; i < SIZE; i++)
+            total += i % 7;
+        System.out.println(total);
+    }
+}
@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+"""Benchmarks of PitifulVM on the CPU-bound tests, with larger inputs.
+
+Each program in this directory is compiled with the size it is given, then
+run on every VM until the 95% confidence interval of its mean time is within
+the precision asked for, or the run limits are hit. The report gives the
+median and 95th percentile times, the bytecodes run per second, as counted
+once by `jvm -Xprof`, and the peak resident set size. HotSpot's interpreter
+(`java -Xint`) is the baseline when it is found and prints the same output.
+
+    bench.py --jvm ./jvm --output bench.json --size Primes=50000
+"""
+
+import argparse
+import datetime
+import json
+import math
+import os
+import platform
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+BENCHMARKS = [
+    "Primes",
+    "Collatz",
+    "CoinSums",
+    "Goldbach",
+    "PalindromeProduct",
+    "PythagoreanTriplet",
+    "DigitPermutations",
+    "ParallelPrimes",
+    "StaticCalls",
+    "AllocBench",
+]
+
+# run on several threads, of which the profiler only counts the main one
+MULTITHREADED = {"ParallelPrimes"}
+
+SIZE_PATTERN = re.compile(r"(static final int SIZE = )(\d+);")
+
+# two-sided 95% quantiles of Student's t distribution, by degrees of freedom
+T_95 = [
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+]
+
+
+def t_95(df):
+    return T_95[df - 1] if df <= len(T_95) else 1.96
+
+
+def percentile(values, fraction):
+    """The nearest-rank percentile"""
+    ordered = sorted(values)
+    rank = max(1, math.ceil(fraction * len(ordered)))
+    return ordered[rank - 1]
+
+
+def run(argv, cwd):
+    """Run a command, giving its output, wall time and peak RSS in KiB"""
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err:
+        start = time.perf_counter()
+        proc = subprocess.Popen(argv, cwd=cwd, stdout=out, stderr=err)
+        _, status, usage = os.wait4(proc.pid, 0)
+        elapsed = time.perf_counter() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        out.seek(0)
+        err.seek(0)
+        return (proc.returncode, out.read().decode(errors="replace"),
+                err.read().decode(errors="replace"), elapsed,
+                usage.ru_maxrss)
+
+
+def compile_benchmark(name, size, javac, work):
+    with open(os.path.join(BENCH_DIR, name + ".java")) as f:
+        source = f.read()
+    default = int(SIZE_PATTERN.search(source).group(2))
+    if size is None:
+        size = default
+    source = SIZE_PATTERN.sub(r"\g<1>%d;" % size, source)
+    with open(os.path.join(work, name + ".java"), "w") as f:
+        f.write(source)
+    subprocess.run([javac, name + ".java"], cwd=work, check=True)
+    return size
+
+
+def count_bytecodes(jvm, name, work):
+    """Instructions the program runs, as the profiler of pitiful counts them"""
+    code, _, err, _, _ = run([jvm, "-Xprof", name + ".class"], work)
+    match = re.search(r"Flat profile of \d+ \w+, (\d+) instructions", err)
+    return int(match.group(1)) if code == 0 and match else None
+
+
+def measure(argv, work, expected, args):
+    """Time a VM until the mean is known precisely enough, or give the reason
+    it was skipped"""
+    times, rss = [], 0
+    started = time.perf_counter()
+    while len(times) < args.max_runs:
+        code, out, err, elapsed, maxrss = run(argv, work)
+        if code != 0:
+            return {"skipped": "exit status %d: %s" % (code, err.strip()[:200])}
+        if expected is not None and out != expected:
+            return {"skipped": "output differs from pitiful"}
+        times.append(elapsed)
+        rss = max(rss, maxrss)
+        if len(times) < args.min_runs:
+            continue
+        mean = statistics.mean(times)
+        ci = t_95(len(times) - 1) * statistics.stdev(times) / math.sqrt(
+            len(times))
+        if ci <= args.precision * mean:
+            break
+        if time.perf_counter() - started > args.max_time:
+            break
+
+    mean = statistics.mean(times)
+    stdev = statistics.stdev(times) if len(times) > 1 else 0.0
+    return {
+        "runs": len(times),
+        "median_s": statistics.median(times),
+        "p95_s": percentile(times, 0.95),
+        "mean_s": mean,
+        "stdev_s": stdev,
+        "ci95_s": t_95(len(times) - 1) * stdev / math.sqrt(len(times))
+        if len(times) > 1 else None,
+        "min_s": min(times),
+        "peak_rss_kib": rss,
+        "times_s": times,
+    }
+
+
+def find_java(java):
+    """The java launcher, if it has the -Xint option"""
+    java = shutil.which(java) if java else shutil.which("java")
+    if not java:
+        return None
+    try:
+        check = subprocess.run([java, "-Xint", "-version"],
+                               stdout=subprocess.DEVNULL,
+                               stderr=subprocess.DEVNULL)
+    except OSError:
+        return None
+    return java if check.returncode == 0 else None
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "HEAD"], cwd=BENCH_DIR,
+                              capture_output=True, text=True,
+                              check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor() or None
+
+
+def parse_sizes(pairs):
+    sizes = {}
+    for pair in pairs:
+        name, _, size = pair.partition("=")
+        if name not in BENCHMARKS or not size.isdigit():
+            sys.exit("bad --size %s, expected one of %s with a number" %
+                     (pair, ", ".join(BENCHMARKS)))
+        sizes[name] = int(size)
+    return sizes
+
+
+def print_table(results, previous):
+    """A line for each benchmark and VM, with the change of the median since
+    the previous results, if any"""
+    before = {}
+    for bench in previous.get("benchmarks", []) if previous else []:
+        for vm, stats in bench["vms"].items():
+            if "median_s" in stats:
+                before[bench["name"], bench["size"], vm] = stats["median_s"]
+
+    print("%-19s %8s  %-14s %4s %9s %9s %10s %8s%s" %
+          ("benchmark", "size", "vm", "runs", "median", "p95", "Mbc/s",
+           "RSS MiB", "  change" if previous else ""))
+    for bench in results["benchmarks"]:
+        for vm, stats in bench["vms"].items():
+            if "skipped" in stats:
+                print("%-19s %8d  %-14s skipped: %s" %
+                      (bench["name"], bench["size"], vm, stats["skipped"]))
+                continue
+            rate = stats.get("bytecodes_per_s")
+            change = ""
+            old = before.get((bench["name"], bench["size"], vm))
+            if old:
+                change = " %+7.1f%%" % (100 * (stats["median_s"] / old - 1))
+            print("%-19s %8d  %-14s %4d %8.3fs %8.3fs %10s %8.1f%s" %
+                  (bench["name"], bench["size"], vm, stats["runs"],
+                   stats["median_s"], stats["p95_s"],
+                   "%.1f" % (rate / 1e6) if rate else "-",
+                   stats["peak_rss_kib"] / 1024, change))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark PitifulVM on the CPU-bound tests")
+    parser.add_argument("--jvm", default="./jvm",
+                        help="the pitiful executable (default: ./jvm)")
+    parser.add_argument("--javac", default="javac")
+    parser.add_argument("--java", default=None,
+                        help="the java launcher of the -Xint baseline "
+                        "(default: java, skipped when not found)")
+    parser.add_argument("--no-java", action="store_true",
+                        help="do not run the java -Xint baseline")
+    parser.add_argument("--size", action="append", default=[],
+                        metavar="NAME=SIZE",
+                        help="input size of a benchmark, e.g. Primes=50000")
+    parser.add_argument("--only", action="append", metavar="NAME",
+                        help="run only the named benchmarks")
+    parser.add_argument("--min-runs", type=int, default=5)
+    parser.add_argument("--max-runs", type=int, default=30)
+    parser.add_argument("--max-time", type=float, default=30.0,
+                        help="seconds to stop adding runs of a benchmark "
+                        "after, once it ran --min-runs times")
+    parser.add_argument("--precision", type=float, default=0.02,
+                        help="wanted 95%% confidence interval of the mean, "
+                        "relative to it (default: 0.02)")
+    parser.add_argument("--output", help="where to save the results as JSON")
+    parser.add_argument("--compare", metavar="JSON",
+                        help="previous results to compare the medians with")
+    args = parser.parse_args()
+    if args.min_runs < 2 or args.max_runs < args.min_runs:
+        sys.exit("need 2 <= --min-runs <= --max-runs")
+
+    sizes = parse_sizes(args.size)
+    names = args.only or BENCHMARKS
+    for name in names:
+        if name not in BENCHMARKS:
+            sys.exit("unknown benchmark %s" % name)
+    jvm = os.path.abspath(args.jvm)
+    java = None if args.no_java else find_java(args.java)
+    if not java and not args.no_java:
+        print("no java with -Xint found, running pitiful alone",
+              file=sys.stderr)
+    previous = None
+    if args.compare:
+        with open(args.compare) as f:
+            previous = json.load(f)
+
+    vms = [("pitiful", [jvm]), ("pitiful -Xint", [jvm, "-Xint"])]
+    if java:
+        vms.append(("java -Xint", [java, "-Xint", "-cp", "."]))
+
+    results = {
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(),
+        "commit": git_commit(),
+        "host": {
+            "machine": platform.machine(),
+            "system": platform.platform(),
+            "cpu": cpu_model(),
+        },
+        "java": java,
+        "settings": {
+            "min_runs": args.min_runs,
+            "max_runs": args.max_runs,
+            "max_time_s": args.max_time,
+            "precision": args.precision,
+        },
+        "benchmarks": [],
+    }
+
+    work = tempfile.mkdtemp(prefix="pitiful-bench-")
+    try:
+        for name in names:
+            size = compile_benchmark(name, sizes.get(name), args.javac, work)
+            code, expected, err, _, _ = run([jvm, name + ".class"], work)
+            if code != 0:
+                sys.exit("%s failed on pitiful: %s" % (name, err.strip()))
+            bytecodes = (None if name in MULTITHREADED else
+                         count_bytecodes(jvm, name, work))
+            bench = {
+                "name": name,
+                "size": size,
+                "output": expected,
+                "bytecodes": bytecodes,
+                "vms": {},
+            }
+            for vm, argv in vms:
+                print("running %s on %s..." % (name, vm), file=sys.stderr)
+                stats = measure(argv + [name if "java" in vm else
+                                        name + ".class"], work, expected,
+                                args)
+                if bytecodes and "median_s" in stats:
+                    stats["bytecodes_per_s"] = bytecodes / stats["median_s"]
+                bench["vms"][vm] = stats
+            results["benchmarks"].append(bench)
+    finally:
+        shutil.rmtree(work)
+
+    print_table(results, previous)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+        print("saved to %s" % args.output, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
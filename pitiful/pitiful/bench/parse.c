@@ -0,0 +1,80 @@
+/* for clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+/* Times reading and parsing class files, without linking or running them:
+ *
+ *     bench/parse [-n ROUNDS] CLASS_FILE...
+ *
+ * Every file is read and parsed, then freed, ROUNDS times over, and the mean
+ * time a class takes is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "classfile.h"
+
+#define DEFAULT_ROUNDS 2000
+
+static double now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* free what get_class() allocated, as free_class_heap() does for a class
+ * which was never linked */
+static void free_parsed_class(class_file_t *clazz)
+{
+    free(clazz->constant_pool.constant_pool);
+    free(clazz->constant_pool.values);
+    free(clazz->cp_cache);
+    free(clazz->info);
+    for (u2 i = 0; i < clazz->fields_count; i++)
+        free(clazz->fields[i].static_var);
+    free(clazz->fields);
+    free(clazz->methods);
+    if (clazz->bootstrap) {
+        for (u2 i = 0; i < clazz->bootstrap->num_bootstrap_methods; i++)
+            free(clazz->bootstrap->bootstrap_methods[i].bootstrap_arguments);
+        free(clazz->bootstrap->bootstrap_methods);
+        free(clazz->bootstrap);
+    }
+    free_class_file(clazz);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = DEFAULT_ROUNDS;
+    int first = 1;
+    if (argc > 2 && !strcmp(argv[1], "-n")) {
+        rounds = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [-n ROUNDS] CLASS_FILE...\n", argv[0]);
+        return 1;
+    }
+
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = first; i < argc; i++) {
+            class_reader_t class_file;
+            if (!read_class_file(argv[i], &class_file)) {
+                fprintf(stderr, "Failed to read %s\n", argv[i]);
+                return 1;
+            }
+            class_file_t clazz = get_class(&class_file);
+            free_parsed_class(&clazz);
+        }
+    }
+    double elapsed = now() - start;
+
+    int classes = argc - first;
+    printf("%d classes, %d rounds: %.2f us/class\n", classes, rounds,
+           elapsed * 1e6 / ((double) classes * rounds));
+    return 0;
+}
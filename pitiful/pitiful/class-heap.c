@@ -1,116 +1,314 @@
 #include "class-heap.h"
+#include "jit.h"
+#include "object-heap.h"
+#include "profiler.h"
+#include "thread.h"
 
-/* FIXME: use dynamic structure to grow heap size dynamically */
-#define MAX_HEAP_SIZE 100
+/* initial number of slots, always a power of two */
+#define INIT_HEAP_SIZE 64
 
 static class_heap_t class_heap;
 
+static class_table_t *create_table(u4 capacity)
+{
+    class_table_t *table =
+        calloc(1, sizeof(class_table_t) + sizeof(meta_class_t *) * capacity);
+    assert(table && "Failed to allocate class heap");
+    table->capacity = capacity;
+    return table;
+}
+
 void init_class_heap()
 {
-    /* max contain 100 class file */
-    class_heap.class_info = malloc(sizeof(meta_class_t *) * MAX_HEAP_SIZE);
+    class_heap.table = create_table(INIT_HEAP_SIZE);
     class_heap.length = 0;
+    init_recursive_mutex(&class_heap.lock);
+}
+
+/* FNV-1a hash of a class name */
+static u4 hash_class_name(const char *name)
+{
+    u4 hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (u1) *name;
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
-/* the name parameter should contain ".class" suffix and be cut in this function
+/* the slot of the class with the given name, or the empty slot to put it */
+static meta_class_t **find_slot(class_table_t *table, const char *name)
+{
+    u4 mask = table->capacity - 1;
+    u4 i = hash_class_name(name) & mask;
+    meta_class_t *meta_class;
+    while ((meta_class = LOAD_ACQUIRE(&table->class_info[i])) &&
+           strcmp(meta_class->name, name))
+        i = (i + 1) & mask;
+    return &table->class_info[i];
+}
+
+/* replace the table by one with twice the slots, with every class in its new
+ * slot */
+static void grow_class_heap()
+{
+    class_table_t *old = class_heap.table;
+    class_table_t *table = create_table(2 * old->capacity);
+    for (u4 i = 0; i < old->capacity; ++i) {
+        if (old->class_info[i])
+            *find_slot(table, old->class_info[i]->name) = old->class_info[i];
+    }
+    table->retired = old;
+    STORE_RELEASE(&class_heap.table, table);
+}
+
+/* The class is keyed on its binary name, e.g. "java/lang/Object", which is
+ * interned in its own constant pool. Other threads may find the class as soon
+ * as it is added, so it must be linked.
  */
-void add_class(class_file_t *clazz, char *name)
+void add_class(class_file_t *clazz)
 {
     meta_class_t *meta_class = malloc(sizeof(meta_class_t));
+    assert(meta_class && "Failed to allocate class heap");
     meta_class->clazz = clazz;
-    /* assume class file is in the same directory */
-    /* -6 mean clip ".class" in posfix */
-    meta_class->name = malloc((strlen(name) + 1 - 6));
-    strncpy(meta_class->name, name, strlen(name) - 6);
-    meta_class->name[strlen(name) - 6] = '\0';
-    class_heap.class_info[class_heap.length++] = meta_class;
+    meta_class->name = find_class_name_from_index(clazz->info->this_class, clazz);
+
+    lock_mutex(&class_heap.lock);
+    /* keep at most half of the slots used */
+    if (2 * (class_heap.length + 1) > class_heap.table->capacity)
+        grow_class_heap();
+    meta_class_t **slot = find_slot(class_heap.table, meta_class->name);
+    assert(!*slot && "Class loaded twice");
+    STORE_RELEASE(slot, meta_class);
+    class_heap.length++;
+    pthread_mutex_unlock(&class_heap.lock);
 }
 
+/* the loaded class with the given name, or NULL, found without locking */
 class_file_t *find_class_from_heap(char *value)
 {
-    for (int i = 0; i < class_heap.length; ++i) {
-        if (!strcmp(class_heap.class_info[i]->name, value))
-            return class_heap.class_info[i]->clazz;
-    }
-    return NULL;
+    meta_class_t *meta_class =
+        LOAD_ACQUIRE(find_slot(LOAD_ACQUIRE(&class_heap.table), value));
+    return meta_class ? meta_class->clazz : NULL;
+}
+
+/* the path of the file of a class on the class path, to be freed */
+char *class_file_path(const char *class_name, const char *prefix)
+{
+    char *path = malloc(strlen(prefix ? prefix : "") + strlen(class_name) +
+                        strlen(".class") + 1);
+    assert(path && "Failed to allocate class file path");
+    strcpy(path, prefix ? prefix : "");
+    strcat(path, class_name);
+    return strcat(path, ".class");
+}
+
+/**
+ * Read a class from the class path, then add it to the class heap and link it.
+ *
+ * @param class_name the binary name of the class
+ * @param prefix the class path
+ * @return the loaded class, or NULL if the class path has no such class
+ */
+class_file_t *load_class(char *class_name, char *prefix)
+{
+    char *path = class_file_path(class_name, prefix);
+    class_reader_t class_file;
+    bool found = read_class_file(path, &class_file);
+    free(path);
+    if (!found)
+        return NULL;
+
+    /* parse the class file */
+    class_file_t *clazz = malloc(sizeof(class_file_t));
+    *clazz = get_class(&class_file);
+    link_class(clazz, prefix);
+    add_class(clazz);
+    return clazz;
 }
 
 bool find_or_add_class_to_heap(char *class_name,
                                char *prefix,
                                class_file_t **target_class)
 {
-    bool added = false;
     *target_class = find_class_from_heap(class_name);
+    if (*target_class)
+        return false;
+
+    /* the class is not loaded in class heap yet, so read it from the class
+     * path and add it to the class heap, unless another thread did first */
+    lock_mutex(&class_heap.lock);
+    *target_class = find_class_from_heap(class_name);
+    bool loaded = !*target_class;
+    if (loaded)
+        *target_class = load_class(class_name, prefix);
+    pthread_mutex_unlock(&class_heap.lock);
+    assert(*target_class && "Failed to open file");
+
+    return loaded;
+}
+
+/* java.lang.Object and java.lang.Thread are built into the runtime rather than
+ * loaded, so classes extending them have no super class */
+bool is_builtin_class(const char *class_name)
+{
+    return !strcmp(class_name, "java/lang/Object") ||
+           !strcmp(class_name, "java/lang/Thread");
+}
+
+/* Give each virtual method of a class a slot in its vtable. The slots of the
+ * super class come first, and a method overriding one takes over its slot.
+ */
+static void build_vtable(class_file_t *clazz, class_file_t *super_class)
+{
+    u2 inherited = super_class ? super_class->vtable_length : 0;
+    u2 methods_count = 0;
+    while (clazz->methods[methods_count].name)
+        methods_count++;
+
+    clazz->vtable_length = inherited;
+    clazz->vtable =
+        malloc(sizeof(vtable_entry_t) * (inherited + methods_count));
+    assert(clazz->vtable && "Failed to allocate vtable");
+    if (inherited)
+        memcpy(clazz->vtable, super_class->vtable,
+               sizeof(vtable_entry_t) * inherited);
 
-    /* if class is not found, adding specific class path and finding
-     * again. This can be removed by recording path infomation in class
-     * heap
-     */
-    if (!*target_class && prefix) {
-        char *tmp = malloc(strlen(class_name) + strlen(prefix) + 1);
-        strcpy(tmp, prefix);
-        strcat(tmp, class_name);
-        *target_class = find_class_from_heap(tmp);
-
-        free(tmp);
+    for (method_t *method = clazz->methods; method->name; method++) {
+        if ((method->access_flags & (IS_STATIC | IS_PRIVATE)) ||
+            method->name[0] == '<')
+            continue;
+        u2 slot = 0;
+        while (slot < inherited &&
+               (strcmp(clazz->vtable[slot].method->name, method->name) ||
+                strcmp(clazz->vtable[slot].method->descriptor,
+                       method->descriptor)))
+            slot++;
+        if (slot == inherited)
+            slot = clazz->vtable_length++;
+        clazz->vtable[slot] =
+            (vtable_entry_t){.clazz = clazz, .method = method};
     }
+}
 
-    /* if class is still not found, meaning that this class is not
-     * loaded in class heap, so add it to the class heap. */
-    if (!*target_class) {
-        char *tmp;
-        if (prefix) {
-            tmp = malloc(
-                (strlen(class_name) + strlen(".class") + strlen(prefix) + 1));
-            strcpy(tmp, prefix);
-            strcat(tmp, class_name);
-        } else {
-            tmp = malloc(strlen(class_name) + strlen(".class") + 1);
-            strcpy(tmp, class_name);
-        }
-        /* attempt to read given class file */
-        FILE *class_file = fopen(strcat(tmp, ".class"), "r");
-        assert(class_file && "Failed to open file");
-
-        /* parse the class file */
-        *target_class = malloc(sizeof(class_file_t));
-        **target_class = get_class(class_file);
-        int error = fclose(class_file);
-        assert(!error && "Failed to close file");
-        add_class(*target_class, tmp);
-        free(tmp);
-        added = true;
+/**
+ * Find the vtable slot of a method
+ *
+ * @param clazz the class that declares the method
+ * @param method the method
+ * @return the slot, or NO_VTABLE_INDEX if the method is not virtual
+ */
+u2 find_vtable_index(class_file_t *clazz, method_t *method)
+{
+    for (u2 i = 0; i < clazz->vtable_length; i++) {
+        if (clazz->vtable[i].method == method)
+            return i;
     }
+    return NO_VTABLE_INDEX;
+}
 
-    return added;
+/**
+ * Lay out the instance fields of a class after the ones it inherits, so that
+ * an object is a header followed by all its fields at fixed offsets, and build
+ * its vtable.
+ *
+ * @param clazz the class to be linked
+ * @param prefix the class path to load its super classes from
+ */
+void link_class(class_file_t *clazz, char *prefix)
+{
+    u4 offset = sizeof(object_t);
+    class_file_t *super_class = NULL;
+
+    char *super_name =
+        find_class_name_from_index(clazz->info->super_class, clazz);
+    if (!is_builtin_class(super_name)) {
+        find_or_add_class_to_heap(super_name, prefix, &super_class);
+        assert(super_class && "Failed to load super class in link_class");
+        offset = super_class->instance_size;
+    }
+
+    /* reference fields are where the garbage collector looks for pointers */
+    u2 inherited = super_class ? super_class->ref_fields_count : 0;
+    clazz->ref_fields_count = inherited;
+    clazz->ref_offsets = malloc(sizeof(u4) * (inherited + clazz->fields_count));
+    assert(clazz->ref_offsets && "Failed to allocate reference offsets");
+    if (inherited)
+        memcpy(clazz->ref_offsets, super_class->ref_offsets,
+               sizeof(u4) * inherited);
+
+    field_t *field = clazz->fields;
+    for (u2 i = 0; i < clazz->fields_count; i++, field++) {
+        if (field->access_flags & IS_STATIC)
+            continue;
+        u4 size = get_field_size(field->descriptor);
+        offset = (offset + size - 1) & ~(size - 1);
+        field->offset = offset;
+        offset += size;
+        if (field->descriptor[0] == 'L' || field->descriptor[0] == '[')
+            clazz->ref_offsets[clazz->ref_fields_count++] = field->offset;
+    }
+    clazz->instance_size =
+        (offset + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    build_vtable(clazz, super_class);
+}
+
+/**
+ * Call a function on every loaded class
+ *
+ * @param func the function to be called
+ */
+void for_each_class(void (*func)(class_file_t *clazz))
+{
+    class_table_t *table = LOAD_ACQUIRE(&class_heap.table);
+    for (u4 i = 0; i < table->capacity; ++i) {
+        meta_class_t *meta_class = LOAD_ACQUIRE(&table->class_info[i]);
+        if (meta_class)
+            func(meta_class->clazz);
+    }
 }
 
 void free_class_heap()
 {
-    for (int i = 0; i < class_heap.length; ++i) {
-        const_pool_info *constant =
-            class_heap.class_info[i]->clazz->constant_pool.constant_pool;
-        for (u2 j = 0; j < class_heap.class_info[i]->clazz->constant_pool.count;
-             j++, constant++) {
-            free(constant->info);
+    meta_class_t **class_info = class_heap.table->class_info;
+    for (u4 i = 0; i < class_heap.table->capacity; ++i) {
+        if (!class_info[i])
+            continue;
+        for (method_t *method = class_info[i]->clazz->methods;
+             method->name; method++) {
+            free(method->insns);
+            free(method->ref_maps);
+            free(method->stack_depths);
+            jit_free(method->jit);
+            free(method->inline_caches);
+            for (u4 j = 0; j < method->concat_sites; j++)
+                free(method->concat_plans[j]);
+            free(method->concat_plans);
+            profile_free(method->profile);
+        }
+        /* the archive holds all of a shared class */
+        if (class_info[i]->clazz->shared) {
+            free(class_info[i]);
+            continue;
         }
-        free(class_heap.class_info[i]->clazz->constant_pool.constant_pool);
-        free(class_heap.class_info[i]->clazz->info);
+        free(class_info[i]->clazz->constant_pool.constant_pool);
+        free(class_info[i]->clazz->constant_pool.values);
+        free(class_info[i]->clazz->cp_cache);
+        free(class_info[i]->clazz->ref_offsets);
+        free(class_info[i]->clazz->vtable);
+        free(class_info[i]->clazz->info);
 
-        field_t *field = class_heap.class_info[i]->clazz->fields;
-        for (u2 j = 0; j < class_heap.class_info[i]->clazz->fields_count;
+        field_t *field = class_info[i]->clazz->fields;
+        for (u2 j = 0; j < class_info[i]->clazz->fields_count;
              j++, field++)
             free(field->static_var);
-        free(class_heap.class_info[i]->clazz->fields);
+        free(class_info[i]->clazz->fields);
 
-        for (method_t *method = class_heap.class_info[i]->clazz->methods;
-             method->name; method++) {
-            free(method->code.code);
-        }
-        free(class_heap.class_info[i]->clazz->methods);
+        free(class_info[i]->clazz->methods);
 
         bootmethods_attr_t *bootstrap =
-            class_heap.class_info[i]->clazz->bootstrap;
+            class_info[i]->clazz->bootstrap;
         if (bootstrap) {
             for (u2 j = 0; j < bootstrap->num_bootstrap_methods; j++)
                 free(bootstrap->bootstrap_methods[j].bootstrap_arguments);
@@ -118,9 +316,15 @@ void free_class_heap()
             free(bootstrap);
         }
 
-        free(class_heap.class_info[i]->clazz);
-        free(class_heap.class_info[i]->name);
-        free(class_heap.class_info[i]);
+        /* the names and code of the class point into its file */
+        free_class_file(class_info[i]->clazz);
+        free(class_info[i]->clazz);
+        free(class_info[i]);
+    }
+    for (class_table_t *table = class_heap.table; table;) {
+        class_table_t *retired = table->retired;
+        free(table);
+        table = retired;
     }
-    free(class_heap.class_info);
+    pthread_mutex_destroy(&class_heap.lock);
 }
@@ -1,19 +1,40 @@
 #pragma once
 
+#include <pthread.h>
+
 #include "classfile.h"
 
+/* Open addressing hash table of the loaded classes, keyed on class name.
+ * Classes are looked up without locking: a class is only put in the table
+ * once linked, and a larger copy of the table replaces it as it fills up. The
+ * replaced tables are kept until the classes are freed, for the threads that
+ * may still look classes up in them.
+ */
+typedef struct class_table {
+    u4 capacity; /* always a power of two */
+    struct class_table *retired;
+    meta_class_t *class_info[];
+} class_table_t;
+
 typedef struct {
-    u2 length;
-    meta_class_t **class_info;
+    u4 length;
+    class_table_t *table;
+    pthread_mutex_t lock; /* held to load classes */
 } class_heap_t;
 
 void init_class_heap();
 void free_class_heap();
-void add_class(class_file_t *clazz, char *name);
+void add_class(class_file_t *clazz);
 class_file_t *find_class_from_heap(char *value);
+char *class_file_path(const char *class_name, const char *prefix);
+class_file_t *load_class(char *class_name, char *prefix);
 bool find_or_add_class_to_heap(char *class_name,
                                char *prefix,
                                class_file_t **target_class);
+bool is_builtin_class(const char *class_name);
+void link_class(class_file_t *clazz, char *prefix);
+u2 find_vtable_index(class_file_t *clazz, method_t *method);
+void for_each_class(void (*func)(class_file_t *clazz));
 char *find_method_info_from_index(uint16_t idx,
                                   class_file_t *clazz,
                                   char **name_info,
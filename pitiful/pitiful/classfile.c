@@ -1,6 +1,13 @@
+/* for fstat() and read() */
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "classfile.h"
 
-class_header_t get_class_header(FILE *class_file)
+class_header_t get_class_header(class_reader_t *class_file)
 {
     return (class_header_t){
         .magic = read_u4(class_file),
@@ -9,7 +16,7 @@ class_header_t get_class_header(FILE *class_file)
     };
 }
 
-class_info_t *get_class_info(FILE *class_file)
+class_info_t *get_class_info(class_reader_t *class_file)
 {
     class_info_t *info = malloc(sizeof(class_info_t));
     info->access_flags = read_u2(class_file);
@@ -22,16 +29,25 @@ class_info_t *get_class_info(FILE *class_file)
 }
 
 /**
- * Get the number of parameters that a method takes.
- * Use the descriptor string of the method to determine its signature.
+ * Get the parameters of a method descriptor.
+ *
+ * @param descriptor the method descriptor, e.g. "([IJ)V"
+ * @param types if not NULL, filled with the first character of the type of
+ *              each parameter, e.g. "[J"
+ * @return the number of parameters
  */
-uint16_t get_number_of_parameters(method_t *method)
+uint16_t get_parameter_types(const char *descriptor, char *types)
 {
     uint16_t num_param = 0;
-    for (size_t i = 1; method->descriptor[i] != ')'; ++i) {
+    for (size_t i = 1; descriptor[i] != ')'; ++i) {
+        if (types)
+            types[num_param] = descriptor[i];
+        /* an array is one parameter whatever its dimensions */
+        while (descriptor[i] == '[')
+            i++;
         /* if type is reference, skip class name */
-        if (method->descriptor[i] == 'L') {
-            while (method->descriptor[++i] != ';')
+        if (descriptor[i] == 'L') {
+            while (descriptor[++i] != ';')
                 ;
         }
         num_param++;
@@ -39,11 +55,19 @@ uint16_t get_number_of_parameters(method_t *method)
     return num_param;
 }
 
+/**
+ * Get the number of parameters that a method takes.
+ * Use the descriptor string of the method to determine its signature.
+ */
+uint16_t get_number_of_parameters(method_t *method)
+{
+    return get_parameter_types(method->descriptor, NULL);
+}
+
 /**
  * Find the field with the given name and signature.
- * The difference between `find_field` and `object_heap:find_field_addr`
- * is that `find_field` is used to find class level field  (i.e. static field),
- * and `find_field_addr` is used to find object level field.
+ * Static fields are stored in the field itself, while instance fields are
+ * stored in objects at the offset of the field.
  *
  * @param name the field name
  * @param desc the field descriptor string, e.g. "(I)I"
@@ -60,6 +84,36 @@ field_t *find_field(const char *name, const char *desc, class_file_t *clazz)
     return NULL;
 }
 
+/**
+ * Get the number of bytes a field takes in an object.
+ *
+ * @param desc the field descriptor string, e.g. "I"
+ * @return the size of the field
+ */
+size_t get_field_size(const char *desc)
+{
+    switch (desc[0]) {
+    case 'B':
+    case 'Z':
+        return sizeof(int8_t);
+    case 'C':
+    case 'S':
+        return sizeof(int16_t);
+    case 'I':
+    case 'F':
+        return sizeof(int32_t);
+    case 'J':
+    case 'D':
+        return sizeof(int64_t);
+    case 'L':
+    case '[':
+        return sizeof(void *);
+    default:
+        assert(0 && "Unknown field descriptor");
+        return 0;
+    }
+}
+
 /**
  * Find the method with the given name and signature.
  * The descriptor is necessary because Java allows method overloading.
@@ -184,20 +238,36 @@ bootmethods_t *find_bootstrap_method(uint16_t idx, class_file_t *clazz)
                                         ->bootstrap_method_attr_index];
 }
 
-void read_field_attributes(FILE *class_file, field_info *info)
+/* the descriptor of the call site of an invokedynamic */
+char *find_invoke_dynamic_descriptor(uint16_t idx, class_file_t *clazz)
+{
+    const_pool_info *info = get_constant(&clazz->constant_pool, idx);
+    assert(info->tag == CONSTANT_InvokeDynamic && "Expected a InvokeDynanmic");
+    const_pool_info *name_and_type = get_constant(
+        &clazz->constant_pool,
+        ((CONSTANT_InvokeDynamic_info *) info->info)->name_and_type_index);
+    assert(name_and_type->tag == CONSTANT_NameAndType &&
+           "Expected a NameAndType");
+    const_pool_info *descriptor = get_constant(
+        &clazz->constant_pool,
+        ((CONSTANT_NameAndType_info *) name_and_type->info)->descriptor_index);
+    assert(descriptor->tag == CONSTANT_Utf8 && "Expected a UTF8");
+    return (char *) descriptor->info;
+}
+
+void read_field_attributes(class_reader_t *class_file, field_info *info)
 {
     for (u2 i = 0; i < info->attributes_count; i++) {
         attribute_info ainfo = {
             .attribute_name_index = read_u2(class_file),
             .attribute_length = read_u4(class_file),
         };
-        long attribute_end = ftell(class_file) + ainfo.attribute_length;
         /* Skip all the attribute */
-        fseek(class_file, attribute_end, SEEK_SET);
+        read_bytes(class_file, ainfo.attribute_length);
     }
 }
 
-void read_method_attributes(FILE *class_file,
+void read_method_attributes(class_reader_t *class_file,
                             method_info *info,
                             code_t *code,
                             constant_pool_t *cp)
@@ -208,7 +278,7 @@ void read_method_attributes(FILE *class_file,
             .attribute_name_index = read_u2(class_file),
             .attribute_length = read_u4(class_file),
         };
-        long attribute_end = ftell(class_file) + ainfo.attribute_length;
+        size_t attribute_end = class_file->pos + ainfo.attribute_length;
         const_pool_info *type_constant =
             get_constant(cp, ainfo.attribute_name_index);
         assert(type_constant->tag == CONSTANT_Utf8 && "Expected a UTF8");
@@ -219,20 +289,16 @@ void read_method_attributes(FILE *class_file,
             code->max_stack = read_u2(class_file);
             code->max_locals = read_u2(class_file);
             code->code_length = read_u4(class_file);
-            code->code = malloc(code->code_length);
-            assert(code->code && "Failed to allocate method code");
-            size_t bytes_read =
-                fread(code->code, 1, code->code_length, class_file);
-            assert(bytes_read == code->code_length &&
-                   "Failed to read method code");
+            /* run the code where it is in the file */
+            code->code = read_bytes(class_file, code->code_length);
         }
         /* Skip the rest of the attribute */
-        fseek(class_file, attribute_end, SEEK_SET);
+        read_bytes(class_file, attribute_end - class_file->pos);
     }
     assert(found_code && "Missing method code");
 }
 
-bootmethods_attr_t *read_bootstrap_attribute(FILE *class_file,
+bootmethods_attr_t *read_bootstrap_attribute(class_reader_t *class_file,
                                              constant_pool_t *cp)
 {
     u2 attributes_count = read_u2(class_file);
@@ -241,7 +307,7 @@ bootmethods_attr_t *read_bootstrap_attribute(FILE *class_file,
             .attribute_name_index = read_u2(class_file),
             .attribute_length = read_u4(class_file),
         };
-        long attribute_end = ftell(class_file) + ainfo.attribute_length;
+        size_t attribute_end = class_file->pos + ainfo.attribute_length;
         const_pool_info *type_constant =
             get_constant(cp, ainfo.attribute_name_index);
         assert(type_constant->tag == CONSTANT_Utf8 && "Expected a UTF8");
@@ -275,14 +341,14 @@ bootmethods_attr_t *read_bootstrap_attribute(FILE *class_file,
             return bootstrap;
         }
         /* Skip the rest of the attribute */
-        fseek(class_file, attribute_end, SEEK_SET);
+        read_bytes(class_file, attribute_end - class_file->pos);
     }
     return NULL;
 }
 
-#define IS_STATIC 0x0008
-
-field_t *get_fields(FILE *class_file, constant_pool_t *cp, class_file_t *clazz)
+field_t *get_fields(class_reader_t *class_file,
+                    constant_pool_t *cp,
+                    class_file_t *clazz)
 {
     u2 fields_count = read_u2(class_file);
     clazz->fields_count = fields_count;
@@ -304,7 +370,9 @@ field_t *get_fields(FILE *class_file, constant_pool_t *cp, class_file_t *clazz)
         const_pool_info *descriptor = get_constant(cp, info.descriptor_index);
         assert(descriptor->tag == CONSTANT_Utf8 && "Expected a UTF8");
         field->descriptor = (char *) descriptor->info;
-        field->static_var = malloc(sizeof(variable_t));
+        field->access_flags = info.access_flags;
+        field->offset = 0;
+        field->static_var = calloc(1, sizeof(variable_t));
 
         read_field_attributes(class_file, &info);
     }
@@ -314,7 +382,7 @@ field_t *get_fields(FILE *class_file, constant_pool_t *cp, class_file_t *clazz)
     return fields;
 }
 
-method_t *get_methods(FILE *class_file, constant_pool_t *cp)
+method_t *get_methods(class_reader_t *class_file, constant_pool_t *cp)
 {
     u2 method_count = read_u2(class_file);
     method_t *methods = malloc(sizeof(*methods) * (method_count + 1));
@@ -336,7 +404,18 @@ method_t *get_methods(FILE *class_file, constant_pool_t *cp)
         assert(descriptor->tag == CONSTANT_Utf8 && "Expected a UTF8");
         method->descriptor = (char *) descriptor->info;
 
+        method->access_flags = info.access_flags;
         read_method_attributes(class_file, &info, &method->code, cp);
+        method->insns = NULL;
+        method->insns_count = 0;
+        method->ref_maps = NULL;
+        method->stack_depths = NULL;
+        method->hotness = 0;
+        method->jit = NULL;
+        method->inline_caches = NULL;
+        method->concat_plans = NULL;
+        method->concat_sites = 0;
+        method->profile = NULL;
     }
 
     /* Mark end of array with NULL name */
@@ -344,20 +423,64 @@ method_t *get_methods(FILE *class_file, constant_pool_t *cp)
     return methods;
 }
 
+/**
+ * Read a whole class file into one buffer to be parsed in place. The UTF8
+ * constants and the code of the class are used where they are in the buffer.
+ *
+ * @param path the path of the class file
+ * @param class_file where to keep the buffer, to be read from its start
+ * @return whether the file could be opened and read
+ */
+bool read_class_file(const char *path, class_reader_t *class_file)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    u1 *data = NULL;
+    if (!fstat(fd, &st) && st.st_size > 0) {
+        data = malloc(st.st_size);
+        assert(data && "Failed to allocate class file");
+        if (read(fd, data, st.st_size) != st.st_size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+    if (!data)
+        return false;
+
+    class_file->data = data;
+    class_file->size = st.st_size;
+    class_file->pos = 0;
+    return true;
+}
+
+void free_class_file(class_file_t *clazz)
+{
+    free(clazz->file);
+}
+
 /**
  * Read an entire class file.
  * The end of the parsed methods array is marked by a method with a NULL name.
+ * The names, descriptors, UTF8 constants and code of the class point into the
+ * buffer of the file, which lives as long as the class.
  *
- * @param class_file the open file to read
+ * @param class_file the file to read
  * @return the parsed class file
  */
-class_file_t get_class(FILE *class_file)
+class_file_t get_class(class_reader_t *class_file)
 {
     /* Read the leading header of the class file */
     get_class_header(class_file);
 
     /* Read the constant pool */
     class_file_t clazz = {.constant_pool = get_constant_pool(class_file)};
+    clazz.cp_cache =
+        calloc(clazz.constant_pool.count + 1, sizeof(*clazz.cp_cache));
+    assert(clazz.cp_cache && "Failed to allocate constant pool cache");
 
     /* Read information about the class that was compiled. */
     clazz.info = get_class_info(class_file);
@@ -373,6 +496,9 @@ class_file_t get_class(FILE *class_file)
         read_bootstrap_attribute(class_file, &clazz.constant_pool);
 
     clazz.initialized = false;
+    clazz.shared = false;
+    clazz.file = class_file->data;
+    clazz.file_size = class_file->size;
 
     return clazz;
 }
\ No newline at end of file
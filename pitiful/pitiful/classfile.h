@@ -41,16 +41,87 @@ typedef struct {
     u1 *code;
 } code_t;
 
+/* An instruction decoded for the interpreter, with the operands it needs and
+ * branch targets as indices of instructions
+ */
 typedef struct {
+    const void *handler; /* where execute() runs the instruction */
+    int32_t operand;     /* local, constant, pool index or branch target */
+    int32_t operand2;    /* iinc increment, multianewarray dimensions, inline
+                          * cache of invokevirtual or plan of invokedynamic */
+} insn_t;
+
+/* The receiver classes an invokevirtual has seen, and the methods it ran on
+ * them. Once full, the call site looks its methods up in vtables.
+ */
+#define INLINE_CACHE_SIZE 4
+
+typedef struct {
+    struct class_file *clazz; /* class that declares the method */
+    struct method *method;
+} vtable_entry_t;
+
+typedef struct {
+    u4 count;
+    struct class_file *receivers[INLINE_CACHE_SIZE];
+    vtable_entry_t targets[INLINE_CACHE_SIZE];
+} inline_cache_t;
+
+/* A piece of the string a concatenation builds: constant characters, or the
+ * next argument of the call site */
+typedef struct {
+    const char *chars; /* the constant characters, or NULL */
+    u4 length;         /* of the constant characters */
+    char type; /* descriptor type of an argument, or 'O' for a reference whose
+                * type is not String, but which may lead to a string */
+} concat_part_t;
+
+/* An invokedynamic call site of makeConcatWithConstants, linked once into the
+ * pieces of the string it builds. Adjacent constants are merged, and their
+ * characters are kept right after the pieces.
+ */
+typedef struct {
+    u2 args_count;
+    u2 parts_count;
+    u4 constant_length; /* of all the constant characters */
+    concat_part_t parts[];
+} concat_plan_t;
+
+typedef struct method {
     char *name;
     char *descriptor;
+    u2 access_flags;
     code_t code;
+    insn_t *insns; /* decoded on the first invocation */
+    u4 insns_count;
+    u1 *ref_maps;      /* which slots hold references before each instruction */
+    int *stack_depths; /* operand stack depth before each instruction, or -1 */
+    u4 hotness;        /* invocations and loop iterations interpreted so far */
+    struct jit_code *jit; /* compiled once hot */
+    inline_cache_t *inline_caches;  /* one for each invokevirtual */
+    concat_plan_t **concat_plans;   /* one for each invokedynamic, if linked */
+    u4 concat_sites;                /* invokedynamic instructions */
+    struct method_profile *profile; /* with -Xprof, once decoded */
 } method_t;
 
+#define IS_PRIVATE 0x0002
+#define IS_STATIC 0x0008
+#define IS_SYNCHRONIZED 0x0020
+
+/* The reference map of an instruction has a bit for each local and then for
+ * each operand stack slot, set if the slot holds a reference whichever way
+ * the instruction is reached.
+ */
+#define REF_MAP_SIZE(method) \
+    (((method)->code.max_locals + (method)->code.max_stack + 7) / 8)
+#define IS_REF_SLOT(map, slot) ((map)[(slot) / 8] >> ((slot) % 8) & 1)
+
 typedef struct {
     char *class_name;
     char *name;
     char *descriptor;
+    u2 access_flags;
+    u4 offset;              /* byte offset of an instance field in objects */
     variable_t *static_var; /* store static fields in the class */
 } field_t;
 
@@ -67,14 +138,42 @@ typedef struct {
     bootmethods_t *bootstrap_methods;
 } bootmethods_attr_t;
 
+/* A Methodref, Fieldref or String resolved on first execution. Once resolved,
+ * the instruction using it is rewritten to its quick form, which reads this
+ * entry instead of looking the class and member up by name again.
+ */
+typedef struct {
+    bool resolved;
+    struct class_file *clazz; /* class that declares the member */
+    method_t *method;
+    field_t *field;
+    uint16_t num_params;
+    uint16_t vtable_index; /* of a virtual method, or NO_VTABLE_INDEX */
+    char *string;          /* the interned string of a String */
+    const struct intrinsic *intrinsic; /* a method built into the VM, whose
+                                        * class is not loaded */
+} cp_cache_t;
+
+#define NO_VTABLE_INDEX UINT16_MAX
+
 typedef struct class_file {
     constant_pool_t constant_pool;
+    cp_cache_t *cp_cache; /* indexed like the constant pool */
     class_info_t *info;
     method_t *methods;
     field_t *fields;
     u2 fields_count;
+    u4 instance_size; /* object size, including inherited fields */
+    u4 *ref_offsets;  /* offsets of reference fields, including inherited */
+    u2 ref_fields_count;
+    vtable_entry_t *vtable; /* the virtual methods, including inherited */
+    u2 vtable_length;
     bootmethods_attr_t *bootstrap;
     bool initialized;
+    struct java_thread *initializer; /* running the static initializer */
+    bool shared; /* mapped from a class-data-sharing archive */
+    u1 *file;    /* the content of the class file */
+    size_t file_size;
     struct class_file *next;
     struct class_file *prev;
 } class_file_t;
@@ -84,26 +183,33 @@ typedef struct {
     char *name;
 } meta_class_t;
 
-class_header_t get_class_header(FILE *class_file);
-class_info_t *get_class_info(FILE *class_file);
-method_t *get_methods(FILE *class_file, constant_pool_t *cp);
-void read_method_attributes(FILE *class_file,
+class_header_t get_class_header(class_reader_t *class_file);
+class_info_t *get_class_info(class_reader_t *class_file);
+method_t *get_methods(class_reader_t *class_file, constant_pool_t *cp);
+void read_method_attributes(class_reader_t *class_file,
                             method_info *info,
                             code_t *code,
                             constant_pool_t *cp);
+uint16_t get_parameter_types(const char *descriptor, char *types);
 uint16_t get_number_of_parameters(method_t *method);
 field_t *find_field(const char *name, const char *desc, class_file_t *clazz);
+size_t get_field_size(const char *desc);
 method_t *find_method(const char *name, const char *desc, class_file_t *clazz);
 method_t *find_method_from_index(uint16_t idx, class_file_t *clazz);
-class_file_t get_class(FILE *class_file);
+bool read_class_file(const char *path, class_reader_t *class_file);
+void free_class_file(class_file_t *clazz);
+class_file_t get_class(class_reader_t *class_file);
 char *find_class_name_from_index(uint16_t idx, class_file_t *clazz);
 CONSTANT_FieldOrMethodRef_info *get_fieldref(constant_pool_t *cp, u2 idx);
 char *find_field_info_from_index(uint16_t idx,
                                  class_file_t *clazz,
                                  char **name_info,
                                  char **descriptor_info);
-void read_field_attributes(FILE *class_file, field_info *info);
+void read_field_attributes(class_reader_t *class_file, field_info *info);
 bootmethods_t *find_bootstrap_method(uint16_t idx, class_file_t *clazz);
-bootmethods_attr_t *read_bootstrap_attribute(FILE *class_file,
+char *find_invoke_dynamic_descriptor(uint16_t idx, class_file_t *clazz);
+bootmethods_attr_t *read_bootstrap_attribute(class_reader_t *class_file,
                                              constant_pool_t *cp);
-field_t *get_fields(FILE *class_file, constant_pool_t *cp, class_file_t *clazz);
\ No newline at end of file
+field_t *get_fields(class_reader_t *class_file,
+                    constant_pool_t *cp,
+                    class_file_t *clazz);
\ No newline at end of file
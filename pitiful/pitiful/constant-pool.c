@@ -1,21 +1,32 @@
 #include "constant-pool.h"
 
 /* Read unsigned big-endian integers */
-u1 read_u1(FILE *class_file)
+u1 read_u1(class_reader_t *class_file)
 {
-    int result = fgetc(class_file);
-    assert(result != EOF && "Reached end of file prematurely");
-    return result;
+    return *read_bytes(class_file, 1);
 }
 
-u2 read_u2(FILE *class_file)
+u2 read_u2(class_reader_t *class_file)
 {
-    return (u2) read_u1(class_file) << 8 | read_u1(class_file);
+    u1 *bytes = read_bytes(class_file, 2);
+    return (u2) bytes[0] << 8 | bytes[1];
 }
 
-u4 read_u4(FILE *class_file)
+u4 read_u4(class_reader_t *class_file)
 {
-    return (u4) read_u2(class_file) << 16 | read_u2(class_file);
+    u1 *bytes = read_bytes(class_file, 4);
+    return (u4) bytes[0] << 24 | (u4) bytes[1] << 16 | (u4) bytes[2] << 8 |
+           bytes[3];
+}
+
+/* Skip the given number of bytes, returning where they are in the file */
+u1 *read_bytes(class_reader_t *class_file, size_t length)
+{
+    assert(length <= class_file->size - class_file->pos &&
+           "Reached end of file prematurely");
+    u1 *bytes = class_file->data + class_file->pos;
+    class_file->pos += length;
+    return bytes;
 }
 
 /**
@@ -65,103 +76,80 @@ char *get_string_utf(constant_pool_t *cp, u2 idx)
     return (char *) utf8->info;
 }
 
-constant_pool_t get_constant_pool(FILE *class_file)
+/**
+ * Parse the constant pool of a class file. The UTF8 constants stay in the
+ * buffer of the file, and the other constants share one allocation.
+ */
+constant_pool_t get_constant_pool(class_reader_t *class_file)
 {
     constant_pool_t cp = {
         /* Constant pool count includes unused constant at index 0 */
         .count = read_u2(class_file) - 1,
         .constant_pool = malloc(sizeof(const_pool_info) * cp.count),
+        .values = malloc(sizeof(const_pool_value_t) * cp.count),
     };
-    assert(cp.constant_pool && "Failed to allocate constant pool");
+    assert(cp.constant_pool && cp.values && "Failed to allocate constant pool");
 
     const_pool_info *constant = cp.constant_pool;
     for (u2 i = 0; i < cp.count; i++, constant++) {
+        const_pool_value_t *value = &cp.values[i];
         constant->tag = read_u1(class_file);
+        constant->info = (u1 *) value;
         switch (constant->tag) {
         case CONSTANT_Utf8: {
             u2 length = read_u2(class_file);
-            char *value = malloc(length + 1);
-            assert(value && "Failed to allocate UTF8 constant");
-            size_t bytes_read = fread(value, 1, length, class_file);
-            assert(bytes_read == length && "Failed to read UTF8 constant");
-            value[length] = '\0';
-            constant->info = (u1 *) value;
+            u1 *bytes = read_bytes(class_file, length);
+            /* move the characters over their length, which has been read, to
+             * have room for the terminating NUL */
+            char *utf8 = (char *) bytes - sizeof(u2);
+            memmove(utf8, bytes, length);
+            utf8[length] = '\0';
+            constant->info = (u1 *) utf8;
             break;
         }
 
-        case CONSTANT_Integer: {
-            CONSTANT_Integer_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate integer constant");
-            value->bytes = read_u4(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_Integer:
+            value->integer_info.bytes = read_u4(class_file);
             break;
-        }
 
-        case CONSTANT_Long: {
-            CONSTANT_LongOrDouble_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate long constant");
-            value->high_bytes = read_u4(class_file);
-            value->low_bytes = read_u4(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_Long:
+            value->long_info.high_bytes = read_u4(class_file);
+            value->long_info.low_bytes = read_u4(class_file);
             constant++;
             constant->info = NULL;
             i++;
             break;
-        }
 
-        case CONSTANT_Class: {
-            CONSTANT_Class_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate class constant");
-            value->string_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_Class:
+            value->class_info.string_index = read_u2(class_file);
             break;
-        }
 
         case CONSTANT_MethodRef:
-        case CONSTANT_FieldRef: {
-            CONSTANT_FieldOrMethodRef_info *value = malloc(sizeof(*value));
-            assert(value &&
-                   "Failed to allocate FieldRef or MethodRef constant");
-            value->class_index = read_u2(class_file);
-            value->name_and_type_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_FieldRef:
+            value->ref_info.class_index = read_u2(class_file);
+            value->ref_info.name_and_type_index = read_u2(class_file);
             break;
-        }
 
-        case CONSTANT_NameAndType: {
-            CONSTANT_NameAndType_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate NameAndType constant");
-            value->name_index = read_u2(class_file);
-            value->descriptor_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_NameAndType:
+            value->name_and_type_info.name_index = read_u2(class_file);
+            value->name_and_type_info.descriptor_index = read_u2(class_file);
             break;
-        }
 
-        case CONSTANT_String: {
-            CONSTANT_String_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate String constant");
-            value->string_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_String:
+            value->string_info.string_index = read_u2(class_file);
             break;
-        }
 
-        case CONSTANT_InvokeDynamic: {
-            CONSTANT_InvokeDynamic_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate InvokeDynamic constant");
-            value->bootstrap_method_attr_index = read_u2(class_file);
-            value->name_and_type_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_InvokeDynamic:
+            value->invoke_dynamic_info.bootstrap_method_attr_index =
+                read_u2(class_file);
+            value->invoke_dynamic_info.name_and_type_index =
+                read_u2(class_file);
             break;
-        }
 
-        case CONSTANT_MethodHandle: {
-            CONSTANT_MethodHandle_info *value = malloc(sizeof(*value));
-            assert(value && "Failed to allocate MethodHandle constant");
-            value->reference_kind = read_u1(class_file);
-            value->reference_index = read_u2(class_file);
-            constant->info = (u1 *) value;
+        case CONSTANT_MethodHandle:
+            value->method_handle_info.reference_kind = read_u1(class_file);
+            value->method_handle_info.reference_index = read_u2(class_file);
             break;
-        }
 
         default:
             fprintf(stderr, "Unknown constant type %d\n", constant->tag);
@@ -63,16 +63,37 @@ typedef struct {
     u1 *info;
 } const_pool_info;
 
+/* room for the value of any constant but a UTF8 one */
+typedef union {
+    CONSTANT_Class_info class_info;
+    CONSTANT_FieldOrMethodRef_info ref_info;
+    CONSTANT_Integer_info integer_info;
+    CONSTANT_LongOrDouble_info long_info;
+    CONSTANT_NameAndType_info name_and_type_info;
+    CONSTANT_String_info string_info;
+    CONSTANT_InvokeDynamic_info invoke_dynamic_info;
+    CONSTANT_MethodHandle_info method_handle_info;
+} const_pool_value_t;
+
 typedef struct {
     u2 count;
     const_pool_info *constant_pool;
+    const_pool_value_t *values; /* indexed like the constant pool */
 } constant_pool_t;
 
-u1 read_u1(FILE *class_file);
-u2 read_u2(FILE *class_file);
-u4 read_u4(FILE *class_file);
+/* The content of a class file, and how far it has been parsed */
+typedef struct {
+    u1 *data;
+    size_t size;
+    size_t pos;
+} class_reader_t;
+
+u1 read_u1(class_reader_t *class_file);
+u2 read_u2(class_reader_t *class_file);
+u4 read_u4(class_reader_t *class_file);
+u1 *read_bytes(class_reader_t *class_file, size_t length);
 const_pool_info *get_constant(constant_pool_t *constant_pool, u2 index);
-constant_pool_t get_constant_pool(FILE *class_file);
+constant_pool_t get_constant_pool(class_reader_t *class_file);
 CONSTANT_FieldOrMethodRef_info *get_methodref(constant_pool_t *cp, u2 idx);
 CONSTANT_Class_info *get_class_name(constant_pool_t *cp, u2 idx);
 CONSTANT_MethodHandle_info *get_method_handle(constant_pool_t *cp, u2 idx);
@@ -0,0 +1,99 @@
+#include "frame.h"
+
+#define INIT_MAX_DEPTH 256
+#define INIT_MAX_SLOTS 4096
+
+void init_java_stack(java_stack_t *stack)
+{
+    stack->depth = 0;
+    stack->max_depth = INIT_MAX_DEPTH;
+    stack->frames = malloc(sizeof(frame_t) * stack->max_depth);
+    stack->max_slots = INIT_MAX_SLOTS;
+    stack->slots = malloc(sizeof(value_t) * stack->max_slots);
+    assert(stack->frames && stack->slots && "Failed to allocate Java stack");
+}
+
+void free_java_stack(java_stack_t *stack)
+{
+    free(stack->frames);
+    free(stack->slots);
+}
+
+/* grow the slot region, moving the locals and operand stacks of all frames */
+static void grow_slots(java_stack_t *stack, size_t needed)
+{
+    size_t max_slots = stack->max_slots;
+    while (max_slots < needed)
+        max_slots *= 2;
+
+    value_t *slots = realloc(stack->slots, sizeof(value_t) * max_slots);
+    assert(slots && "Failed to grow Java stack");
+    for (int i = 0; i < stack->depth; i++) {
+        frame_t *frame = &stack->frames[i];
+        frame->locals = slots + (frame->locals - stack->slots);
+        frame->op_stack.store = slots + (frame->op_stack.store - stack->slots);
+    }
+    stack->slots = slots;
+    stack->max_slots = max_slots;
+}
+
+/**
+ * Push the frame of a method to be invoked
+ *
+ * @param stack
+ *  the Java stack
+ * @param method
+ *  the method to be invoked
+ * @param clazz
+ *  the class the method belongs to
+ * @param num_args
+ *  number of entries on top of the caller's operand stack, including the
+ *  object itself for instance methods, which become the first locals
+ * @return the new frame. Pointers to former frames and their slots are
+ *         invalidated.
+ */
+frame_t *push_frame(java_stack_t *stack,
+                    method_t *method,
+                    class_file_t *clazz,
+                    uint16_t num_args)
+{
+    size_t base = 0;
+    if (stack->depth) {
+        stack_frame_t *caller = &stack->frames[stack->depth - 1].op_stack;
+        assert(caller->size >= num_args && "Missing arguments for method");
+        caller->size -= num_args;
+        base = caller->store + caller->size - stack->slots;
+    }
+    assert(method->code.max_locals >= num_args &&
+           "Too many arguments for method");
+
+    size_t top = base + method->code.max_locals + method->code.max_stack;
+    if (top > stack->max_slots)
+        grow_slots(stack, top);
+    if (stack->depth == stack->max_depth) {
+        stack->max_depth *= 2;
+        stack->frames =
+            realloc(stack->frames, sizeof(frame_t) * stack->max_depth);
+        assert(stack->frames && "Failed to grow Java stack");
+    }
+
+    frame_t *frame = &stack->frames[stack->depth++];
+    frame->method = method;
+    frame->clazz = clazz;
+    frame->pc = 0;
+    /* the other locals are not cleared: the reference maps of the method
+     * tell which of them hold references */
+    frame->locals = stack->slots + base;
+
+    frame->op_stack.max_size = method->code.max_stack;
+    frame->op_stack.size = 0;
+    frame->op_stack.store = frame->locals + method->code.max_locals;
+    return frame;
+}
+
+/* the slots of the frame are given back to the operand stack of its caller */
+void pop_frame(java_stack_t *stack)
+{
+    assert(stack->depth > 0 && "Java stack underflow");
+    stack->depth--;
+}
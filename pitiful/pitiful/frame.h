@@ -0,0 +1,35 @@
+#pragma once
+
+#include "classfile.h"
+#include "stack.h"
+
+/* activation record of a Java method */
+typedef struct {
+    method_t *method;
+    class_file_t *clazz;
+    uint32_t pc; /* past the instruction being run, where callees return */
+    local_variable_t *locals;
+    stack_frame_t op_stack;
+    void *monitor; /* the object a synchronized method holds */
+} frame_t;
+
+/* The Java stack. The locals and the operand stack of every frame live in one
+ * contiguous region of slots, each frame right above its caller. The arguments
+ * on top of the caller's operand stack become the first locals of the callee
+ * in place.
+ */
+typedef struct {
+    int depth;
+    int max_depth;
+    frame_t *frames;
+    size_t max_slots;
+    value_t *slots;
+} java_stack_t;
+
+void init_java_stack(java_stack_t *stack);
+void free_java_stack(java_stack_t *stack);
+frame_t *push_frame(java_stack_t *stack,
+                    method_t *method,
+                    class_file_t *clazz,
+                    uint16_t num_args);
+void pop_frame(java_stack_t *stack);
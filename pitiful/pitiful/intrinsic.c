@@ -0,0 +1,250 @@
+/* for clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intrinsic.h"
+#include "object-heap.h"
+#include "thread.h"
+
+/* fail with an exception the program does not catch, as Java reports it */
+static void throw_exception(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "Exception in thread \"%s\" java.lang.",
+            current_thread->name);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
+
+/* the receiver of a String method, which must not be null */
+static char *string_receiver(value_t *args)
+{
+    char *str = args[0].ptr_value;
+    if (!str)
+        throw_exception("NullPointerException");
+    return str;
+}
+
+/* Math.abs(I)I, which leaves Integer.MIN_VALUE as it is */
+static int64_t math_abs_int(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    int32_t a = args[0].long_value;
+    return a < 0 ? (int32_t) -(u4) a : a;
+}
+
+/* Math.abs(J)J, which leaves Long.MIN_VALUE as it is */
+static int64_t math_abs_long(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    int64_t a = args[0].long_value;
+    return a < 0 ? (int64_t) -(u8) a : a;
+}
+
+/* Math.min and Math.max, on ints and longs alike as slots keep both */
+static int64_t math_min(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    int64_t a = args[0].long_value, b = args[1].long_value;
+    return a < b ? a : b;
+}
+
+static int64_t math_max(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    int64_t a = args[0].long_value, b = args[1].long_value;
+    return a > b ? a : b;
+}
+
+/* Integer.parseInt(Ljava/lang/String;)I, in decimal */
+static int64_t integer_parse_int(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    const char *str = args[0].ptr_value;
+    if (!str)
+        throw_exception("NumberFormatException: Cannot parse null string: "
+                        "null");
+
+    u4 length = STRING_LENGTH(str);
+    bool negative = length && str[0] == '-';
+    u4 i = length && (str[0] == '-' || str[0] == '+');
+    int64_t value = 0;
+    if (i == length)
+        goto invalid;
+    for (; i < length; i++) {
+        if (str[i] < '0' || str[i] > '9')
+            goto invalid;
+        value = value * 10 + (str[i] - '0');
+        /* one more for Integer.MIN_VALUE */
+        if (value > (int64_t) INT32_MAX + negative)
+            goto invalid;
+    }
+    return negative ? -value : value;
+
+invalid:
+    throw_exception("NumberFormatException: For input string: \"%s\"", str);
+    return 0;
+}
+
+/* Integer.toString(I)Ljava/lang/String; */
+static int64_t integer_to_string(value_t *args, class_file_t *clazz)
+{
+    char chars[sizeof("-2147483648")];
+    int length = snprintf(chars, sizeof(chars), "%" PRId32,
+                          (int32_t) args[0].long_value);
+    char *str = memcpy(allocate_string(clazz, length), chars, length);
+    return (intptr_t) str;
+}
+
+/* String.length()I, in bytes, which are the characters of ASCII strings */
+static int64_t string_length(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    return STRING_LENGTH(string_receiver(args));
+}
+
+/* String.charAt(I)C */
+static int64_t string_char_at(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    char *str = string_receiver(args);
+    int64_t index = (int32_t) args[1].long_value;
+    /* one unsigned compare also rejects negative indices */
+    if ((uint64_t) index >= STRING_LENGTH(str))
+        throw_exception("StringIndexOutOfBoundsException: Index %" PRId64
+                        " out of bounds for length %" PRIu32,
+                        index, STRING_LENGTH(str));
+    return (u1) str[index];
+}
+
+/* String.equals(Ljava/lang/Object;)Z. The argument is taken to be a string,
+ * as the references do not tell the objects they point to. */
+static int64_t string_equals(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    char *str = string_receiver(args);
+    char *other = args[1].ptr_value;
+    if (str == other)
+        return true;
+    return other && STRING_LENGTH(str) == STRING_LENGTH(other) &&
+           !memcmp(str, other, STRING_LENGTH(str));
+}
+
+/* String.hashCode()I, which the header of the string keeps once computed */
+static int64_t string_hash_code(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    return (int32_t) string_hash(string_receiver(args));
+}
+
+/* System.arraycopy(Ljava/lang/Object;ILjava/lang/Object;II)V, which copies
+ * between overlapping ranges as if through a temporary array. Arrays of
+ * references are not checked element by element. */
+static int64_t system_arraycopy(value_t *args, class_file_t *clazz)
+{
+    (void) clazz;
+    u1 *src = args[0].ptr_value;
+    int64_t src_pos = (int32_t) args[1].long_value;
+    u1 *dest = args[2].ptr_value;
+    int64_t dest_pos = (int32_t) args[3].long_value;
+    int64_t length = (int32_t) args[4].long_value;
+    if (!src || !dest)
+        throw_exception("NullPointerException");
+
+    array_header_t *from = ARRAY_HEADER(src), *to = ARRAY_HEADER(dest);
+    if (from->element_size != to->element_size || from->is_ref != to->is_ref)
+        throw_exception("ArrayStoreException: arraycopy: type mismatch");
+    if (length < 0)
+        throw_exception("ArrayIndexOutOfBoundsException: arraycopy: length "
+                        "%" PRId64 " is negative",
+                        length);
+    if (src_pos < 0 || src_pos + length > from->length)
+        throw_exception("ArrayIndexOutOfBoundsException: arraycopy: last "
+                        "source index %" PRId64 " out of bounds for length "
+                        "%" PRIu32,
+                        src_pos + length, from->length);
+    if (dest_pos < 0 || dest_pos + length > to->length)
+        throw_exception("ArrayIndexOutOfBoundsException: arraycopy: last "
+                        "destination index %" PRId64 " out of bounds for "
+                        "length %" PRIu32,
+                        dest_pos + length, to->length);
+
+    size_t size = to->element_size;
+    memmove(dest + dest_pos * size, src + src_pos * size, length * size);
+    return 0;
+}
+
+/* System.nanoTime()J, from a clock which only goes forward */
+static int64_t system_nano_time(value_t *args, class_file_t *clazz)
+{
+    (void) args;
+    (void) clazz;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* System.currentTimeMillis()J, since the epoch */
+static int64_t system_current_time_millis(value_t *args, class_file_t *clazz)
+{
+    (void) args;
+    (void) clazz;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static const intrinsic_t intrinsics[] = {
+    {"java/lang/Math", "abs", "(I)I", math_abs_int, 1, true, false},
+    {"java/lang/Math", "abs", "(J)J", math_abs_long, 1, true, false},
+    {"java/lang/Math", "min", "(II)I", math_min, 2, true, false},
+    {"java/lang/Math", "min", "(JJ)J", math_min, 2, true, false},
+    {"java/lang/Math", "max", "(II)I", math_max, 2, true, false},
+    {"java/lang/Math", "max", "(JJ)J", math_max, 2, true, false},
+    {"java/lang/Integer", "parseInt", "(Ljava/lang/String;)I",
+     integer_parse_int, 1, true, false},
+    {"java/lang/Integer", "toString", "(I)Ljava/lang/String;",
+     integer_to_string, 1, true, true},
+    {"java/lang/String", "length", "()I", string_length, 1, true, false},
+    {"java/lang/String", "charAt", "(I)C", string_char_at, 2, true, false},
+    {"java/lang/String", "equals", "(Ljava/lang/Object;)Z", string_equals, 2,
+     true, false},
+    {"java/lang/String", "hashCode", "()I", string_hash_code, 1, true, false},
+    {"java/lang/System", "arraycopy",
+     "(Ljava/lang/Object;ILjava/lang/Object;II)V", system_arraycopy, 5, false,
+     false},
+    {"java/lang/System", "nanoTime", "()J", system_nano_time, 0, true, false},
+    {"java/lang/System", "currentTimeMillis", "()J",
+     system_current_time_millis, 0, true, false},
+};
+
+/**
+ * Find the intrinsic of a method
+ *
+ * @param class_name the name of the class, e.g. java/lang/Math
+ * @param name the name of the method
+ * @param descriptor the descriptor of the method
+ * @return the intrinsic, or NULL if the method has none
+ */
+const intrinsic_t *find_intrinsic(const char *class_name,
+                                  const char *name,
+                                  const char *descriptor)
+{
+    for (size_t i = 0; i < sizeof(intrinsics) / sizeof(intrinsics[0]); i++) {
+        const intrinsic_t *intrinsic = &intrinsics[i];
+        if (!strcmp(intrinsic->class_name, class_name) &&
+            !strcmp(intrinsic->name, name) &&
+            !strcmp(intrinsic->descriptor, descriptor))
+            return intrinsic;
+    }
+    return NULL;
+}
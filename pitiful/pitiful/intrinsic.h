@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "classfile.h"
+#include "type.h"
+
+/* Methods of the class library the VM runs natively, since their classes are
+ * not there to be loaded. A Methodref naming one of them is bound to it when
+ * it is resolved, and the call site then calls it directly, as compiled code
+ * does too.
+ */
+
+/* run an intrinsic on its arguments, the receiver first, in the operand stack
+ * slots they were pushed to. The value it returns, if any, is kept as a slot
+ * keeps it. clazz is the class of the call site, which owns the strings it
+ * creates. */
+typedef int64_t (*intrinsic_func_t)(value_t *args, class_file_t *clazz);
+
+typedef struct intrinsic {
+    const char *class_name;
+    const char *name;
+    const char *descriptor;
+    intrinsic_func_t func;
+    u1 args;        /* slots the arguments take, the receiver included */
+    bool returns;   /* whether the method returns a value */
+    bool allocates; /* whether it allocates, so the garbage collector may run */
+} intrinsic_t;
+
+const intrinsic_t *find_intrinsic(const char *class_name,
+                                  const char *name,
+                                  const char *descriptor);
@@ -0,0 +1,562 @@
+/* for MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "class-heap.h"
+#include "constant-pool.h"
+#include "intrinsic.h"
+#include "jit.h"
+#include "opcode.h"
+#include "thread.h"
+
+/* the registers the templates use. rbx holds the locals of the frame, and the
+ * operand stack right above them. */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+/* condition codes of jcc and setcc */
+enum {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+};
+
+/* the prefix of instructions on 64 bits */
+#define REX_W 0x48
+
+/* the most bytes an instruction is compiled into */
+#define MAX_TEMPLATE_SIZE 48
+
+/* push rbx; mov rbx, rdi; jmp rsi */
+#define PROLOGUE_SIZE 6
+
+/* the safepoint poll in front of a loop header */
+#define POLL_SIZE 22
+
+/* a method being compiled */
+typedef struct {
+    method_t *method;
+    class_file_t *clazz;
+    jit_invoke_t invoke;
+    u1 *p;             /* where the next byte of code goes */
+    u1 **branches;     /* the offsets of branches, to be patched */
+    uint32_t *targets; /* the instructions the branches go to */
+    uint32_t branches_count;
+} compiler_t;
+
+static void emit_u1(compiler_t *c, u1 byte)
+{
+    *c->p++ = byte;
+}
+
+static void emit_u4(compiler_t *c, u4 value)
+{
+    memcpy(c->p, &value, sizeof(value));
+    c->p += sizeof(value);
+}
+
+static void emit_u8(compiler_t *c, u8 value)
+{
+    memcpy(c->p, &value, sizeof(value));
+    c->p += sizeof(value);
+}
+
+/* the ModRM byte and displacement of a slot, i.e. [rbx + slot * 8] */
+static void emit_slot(compiler_t *c, int reg, int slot)
+{
+    emit_u1(c, 0x80 | reg << 3 | RBX);
+    emit_u4(c, slot * sizeof(value_t));
+}
+
+/* an instruction on a register and a slot, e.g. add eax, [slot] */
+static void emit_op(compiler_t *c, bool wide, u2 opcode, int reg, int slot)
+{
+    if (wide)
+        emit_u1(c, REX_W);
+    if (opcode > 0xff)
+        emit_u1(c, opcode >> 8);
+    emit_u1(c, opcode);
+    emit_slot(c, reg, slot);
+}
+
+/* mov reg, [slot] */
+static void emit_load(compiler_t *c, bool wide, int reg, int slot)
+{
+    emit_op(c, wide, 0x8b, reg, slot);
+}
+
+/* mov [slot], reg */
+static void emit_store(compiler_t *c, int slot, int reg)
+{
+    emit_op(c, true, 0x89, reg, slot);
+}
+
+/* mov qword [slot], imm32, sign-extended like every integer in a slot */
+static void emit_store_imm(compiler_t *c, int slot, int32_t value)
+{
+    emit_op(c, true, 0xc7, 0, slot);
+    emit_u4(c, value);
+}
+
+/* movsxd to, from: sign-extend an int result as slots keep it */
+static void emit_sign_extend(compiler_t *c, int to, int from)
+{
+    emit_u1(c, REX_W);
+    emit_u1(c, 0x63);
+    emit_u1(c, 0xc0 | to << 3 | from);
+}
+
+/* jmp, or jcc if cc is not negative, to an instruction */
+static void emit_branch(compiler_t *c, int cc, uint32_t target)
+{
+    if (cc < 0) {
+        emit_u1(c, 0xe9);
+    } else {
+        emit_u1(c, 0x0f);
+        emit_u1(c, 0x80 | cc);
+    }
+    c->branches[c->branches_count] = c->p;
+    c->targets[c->branches_count++] = target;
+    emit_u4(c, 0);
+}
+
+/* leave the frame to the interpreter, from the instruction at index */
+static void emit_exit(compiler_t *c, uint32_t index)
+{
+    emit_u1(c, 0xb8 | RAX); /* mov eax, index */
+    emit_u4(c, index);
+    emit_u1(c, 0x58 | RBX); /* pop rbx */
+    emit_u1(c, 0xc3);       /* ret */
+}
+
+/* Leave the frame to the interpreter at a loop header if the garbage collector
+ * waits for the thread, so that loops running compiled reach a safepoint.
+ */
+static void emit_poll(compiler_t *c, uint32_t index)
+{
+    emit_u1(c, REX_W); /* mov rax, &safepoint_pending */
+    emit_u1(c, 0xb8 | RAX);
+    emit_u8(c, (uintptr_t) &safepoint_pending);
+    emit_u1(c, 0x83); /* cmp dword [rax], 0 */
+    emit_u1(c, 7 << 3 | RAX);
+    emit_u1(c, 0);
+    emit_u1(c, 0x74); /* je past the exit */
+    emit_u1(c, 7);
+    emit_exit(c, index);
+}
+
+/* the instructions backward branches go to, which start loops */
+static bool *find_loop_headers(method_t *method, uint32_t *headers_count)
+{
+    uint32_t count = method->insns_count;
+    bool *headers = calloc(count + 1, sizeof(bool));
+    assert(headers && "Failed to allocate loop headers");
+    *headers_count = 0;
+    u4 pc = 0;
+    for (uint32_t i = 0; i < count;
+         pc += insn_length(method->code.code[pc]), i++) {
+        uint32_t target = method->insns[i].operand;
+        switch (method->code.code[pc]) {
+        case i_ifeq ... i_if_acmpne:
+        case i_goto:
+        case i_ifnull:
+        case i_ifnonnull:
+            if (target <= i && !headers[target]) {
+                headers[target] = true;
+                (*headers_count)++;
+            }
+            break;
+        }
+    }
+    return headers;
+}
+
+/* int arithmetic on the two slots on top of the operand stack */
+static void emit_int_op(compiler_t *c, u2 opcode, int top)
+{
+    emit_load(c, false, RAX, top - 2);
+    emit_op(c, false, opcode, RAX, top - 1);
+    emit_sign_extend(c, RAX, RAX);
+    emit_store(c, top - 2, RAX);
+}
+
+/* long arithmetic on the two slots on top of the operand stack */
+static void emit_long_op(compiler_t *c, u2 opcode, int top)
+{
+    emit_load(c, true, RAX, top - 2);
+    emit_op(c, true, opcode, RAX, top - 1);
+    emit_store(c, top - 2, RAX);
+}
+
+/* idiv, keeping the quotient or the remainder */
+static void emit_division(compiler_t *c, bool wide, int result, int top)
+{
+    emit_load(c, wide, RAX, top - 2);
+    if (wide)
+        emit_u1(c, REX_W);
+    emit_u1(c, 0x99); /* cdq or cqo */
+    emit_op(c, wide, 0xf7, 7, top - 1);
+    if (!wide)
+        emit_sign_extend(c, result, result);
+    emit_store(c, top - 2, result);
+}
+
+/* the conditions of ifeq to ifle, and of if_icmpeq to if_icmple */
+static const u1 conditions[] = {CC_E, CC_NE, CC_L, CC_GE, CC_G, CC_LE};
+
+/**
+ * Compile an instruction with its template
+ *
+ * @param c the compiler
+ * @param index the index of the instruction
+ * @param code the instruction and its operands in the bytecode
+ * @return false if the instruction is left to the interpreter
+ */
+static bool compile_insn(compiler_t *c, uint32_t index, const u1 *code)
+{
+    int depth = c->method->stack_depths[index];
+    int32_t operand = c->method->insns[index].operand;
+    /* the slot right above the top of the operand stack */
+    int top = c->method->code.max_locals + depth;
+
+    /* never reached, so the depth is unknown */
+    if (depth < 0)
+        return false;
+
+    switch (code[0]) {
+    case i_aconst_null:
+        emit_store_imm(c, top, 0);
+        return true;
+    case i_iconst_m1 ... i_lconst_1:
+    case i_bipush:
+    case i_sipush:
+        emit_store_imm(c, top, operand);
+        return true;
+    case i_ldc: {
+        /* integer constants were decoded into the operand */
+        const_pool_info *info =
+            get_constant(&c->clazz->constant_pool, code[1]);
+        if (info->tag == CONSTANT_Integer) {
+            emit_store_imm(c, top, operand);
+            return true;
+        }
+        /* strings once interpreted, which interns them */
+        char *string = c->clazz->cp_cache[code[1]].string;
+        if (info->tag != CONSTANT_String || !string)
+            return false;
+        emit_u1(c, REX_W); /* mov rax, string */
+        emit_u1(c, 0xb8 | RAX);
+        emit_u8(c, (uintptr_t) string);
+        emit_store(c, top, RAX);
+        return true;
+    }
+    case i_ldc2_w: {
+        CONSTANT_LongOrDouble_info *info =
+            (CONSTANT_LongOrDouble_info *) get_constant(
+                &c->clazz->constant_pool, operand)
+                ->info;
+        emit_u1(c, REX_W); /* mov rax, imm64 */
+        emit_u1(c, 0xb8 | RAX);
+        emit_u8(c, (u8) info->high_bytes << 32 | info->low_bytes);
+        emit_store(c, top, RAX);
+        return true;
+    }
+    case i_iload:
+    case i_lload:
+    case i_aload:
+    case i_iload_0 ... i_lload_3:
+    case i_aload_0 ... i_aload_3:
+        emit_load(c, true, RAX, operand);
+        emit_store(c, top, RAX);
+        return true;
+    case i_istore:
+    case i_lstore:
+    case i_astore:
+    case i_istore_0 ... i_lstore_3:
+    case i_astore_0 ... i_astore_3:
+        emit_load(c, true, RAX, top - 1);
+        emit_store(c, operand, RAX);
+        return true;
+    case i_pop:
+    case i_i2l:
+        /* ints are kept sign-extended to longs already */
+        return true;
+    case i_dup:
+        emit_load(c, true, RAX, top - 1);
+        emit_store(c, top, RAX);
+        return true;
+    case i_iadd:
+        emit_int_op(c, 0x03, top);
+        return true;
+    case i_isub:
+        emit_int_op(c, 0x2b, top);
+        return true;
+    case i_imul:
+        emit_int_op(c, 0x0faf, top);
+        return true;
+    case i_ladd:
+        emit_long_op(c, 0x03, top);
+        return true;
+    case i_lsub:
+        emit_long_op(c, 0x2b, top);
+        return true;
+    case i_lmul:
+        emit_long_op(c, 0x0faf, top);
+        return true;
+    case i_idiv:
+    case i_ldiv:
+        emit_division(c, code[0] == i_ldiv, RAX, top);
+        return true;
+    case i_irem:
+    case i_lrem:
+        emit_division(c, code[0] == i_lrem, RDX, top);
+        return true;
+    case i_ineg:
+        emit_load(c, false, RAX, top - 1);
+        emit_u1(c, 0xf7); /* neg eax */
+        emit_u1(c, 0xd8);
+        emit_sign_extend(c, RAX, RAX);
+        emit_store(c, top - 1, RAX);
+        return true;
+    case i_iinc:
+        emit_load(c, false, RAX, operand);
+        emit_u1(c, 0x05); /* add eax, imm32 */
+        emit_u4(c, c->method->insns[index].operand2);
+        emit_sign_extend(c, RAX, RAX);
+        emit_store(c, operand, RAX);
+        return true;
+    case i_l2i:
+        emit_load(c, false, RAX, top - 1);
+        emit_sign_extend(c, RAX, RAX);
+        emit_store(c, top - 1, RAX);
+        return true;
+    case i_lcmp:
+        /* (value1 > value2) - (value1 < value2) */
+        emit_load(c, true, RAX, top - 2);
+        emit_u1(c, 0x31); /* xor ecx, ecx */
+        emit_u1(c, 0xc9);
+        emit_u1(c, 0x31); /* xor edx, edx */
+        emit_u1(c, 0xd2);
+        emit_op(c, true, 0x3b, RAX, top - 1);
+        emit_u1(c, 0x0f); /* setg cl */
+        emit_u1(c, 0x90 | CC_G);
+        emit_u1(c, 0xc0 | RCX);
+        emit_u1(c, 0x0f); /* setl dl */
+        emit_u1(c, 0x90 | CC_L);
+        emit_u1(c, 0xc0 | RDX);
+        emit_u1(c, 0x29); /* sub ecx, edx */
+        emit_u1(c, 0xc0 | RDX << 3 | RCX);
+        emit_sign_extend(c, RCX, RCX);
+        emit_store(c, top - 2, RCX);
+        return true;
+    case i_ifeq ... i_ifle:
+        emit_op(c, false, 0x83, 7, top - 1); /* cmp dword [slot], 0 */
+        emit_u1(c, 0);
+        emit_branch(c, conditions[code[0] - i_ifeq], operand);
+        return true;
+    case i_if_icmpeq ... i_if_icmple:
+        emit_load(c, false, RAX, top - 2);
+        emit_op(c, false, 0x3b, RAX, top - 1);
+        emit_branch(c, conditions[code[0] - i_if_icmpeq], operand);
+        return true;
+    case i_if_acmpeq:
+    case i_if_acmpne:
+        emit_load(c, true, RAX, top - 2);
+        emit_op(c, true, 0x3b, RAX, top - 1);
+        emit_branch(c, code[0] == i_if_acmpeq ? CC_E : CC_NE, operand);
+        return true;
+    case i_ifnull:
+    case i_ifnonnull:
+        emit_op(c, true, 0x83, 7, top - 1); /* cmp qword [slot], 0 */
+        emit_u1(c, 0);
+        emit_branch(c, code[0] == i_ifnull ? CC_E : CC_NE, operand);
+        return true;
+    case i_goto:
+        emit_branch(c, -1, operand);
+        return true;
+    case i_ireturn:
+    case i_lreturn:
+    case i_areturn:
+        emit_load(c, true, RDX, top - 1);
+        /* fall through */
+    case i_return:
+        emit_exit(c, JIT_RETURNED);
+        return true;
+    case i_invokestatic:
+    case i_invokevirtual: {
+        char *name, *descriptor;
+        bool is_virtual = code[0] == i_invokevirtual;
+        char *class_name = find_method_info_from_index(operand, c->clazz,
+                                                       &name, &descriptor);
+        int args = get_parameter_types(descriptor, NULL);
+        if (is_virtual) {
+            /* the interpreter has the output stream built in */
+            if (!strcmp(class_name, "java/io/PrintStream"))
+                return false;
+            args++; /* the receiver */
+        }
+
+        /* intrinsics are called right away on the arguments in place, unless
+         * the garbage collector may run, which needs the frame saved */
+        const intrinsic_t *intrinsic =
+            find_intrinsic(class_name, name, descriptor);
+        if (intrinsic && !intrinsic->allocates) {
+            assert(intrinsic->args == args &&
+                   "Intrinsic takes other arguments");
+            emit_op(c, true, 0x8d, RDI, top - args); /* lea rdi, [args] */
+            emit_u1(c, REX_W); /* mov rsi, clazz */
+            emit_u1(c, 0xb8 | RSI);
+            emit_u8(c, (uintptr_t) c->clazz);
+            emit_u1(c, REX_W); /* mov rax, func */
+            emit_u1(c, 0xb8 | RAX);
+            emit_u8(c, (uintptr_t) intrinsic->func);
+            emit_u1(c, 0xff); /* call rax */
+            emit_u1(c, 0xd0 | RAX);
+            if (intrinsic->returns)
+                emit_store(c, top - args, RAX);
+            return true;
+        }
+
+        emit_u1(c, 0xb8 | RDI); /* mov edi, index */
+        emit_u4(c, index);
+        emit_u1(c, 0xb8 | RSI); /* mov esi, is_virtual */
+        emit_u4(c, is_virtual);
+        emit_u1(c, REX_W); /* mov rax, invoke */
+        emit_u1(c, 0xb8 | RAX);
+        emit_u8(c, (uintptr_t) c->invoke);
+        emit_u1(c, 0xff); /* call rax */
+        emit_u1(c, 0xd0 | RAX);
+        /* mov rbx, rdx: the locals may have moved */
+        emit_u1(c, REX_W);
+        emit_u1(c, 0x89);
+        emit_u1(c, 0xc0 | RDX << 3 | RBX);
+        if (strchr(descriptor, ')')[1] != 'V')
+            emit_store(c, top - args, RAX);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+ * Compile a decoded method into native code. Loop headers poll for a pending
+ * safepoint first.
+ *
+ * @param method the method to be compiled
+ * @param clazz the class the method belongs to
+ * @param invoke how compiled code invokes methods
+ * @return the compiled code, or NULL if it could not be mapped
+ */
+jit_code_t *jit_compile(method_t *method,
+                        class_file_t *clazz,
+                        jit_invoke_t invoke)
+{
+    uint32_t count = method->insns_count;
+    uint32_t headers_count;
+    bool *headers = find_loop_headers(method, &headers_count);
+    size_t size = PROLOGUE_SIZE + (count + 1) * MAX_TEMPLATE_SIZE +
+                  headers_count * POLL_SIZE;
+
+    /* writable while it is written, and only executable afterwards */
+    u1 *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(headers);
+        return NULL;
+    }
+
+    jit_code_t *jit = malloc(sizeof(jit_code_t));
+    const u1 **entries = calloc(count + 1, sizeof(u1 *));
+    u1 **natives = malloc(sizeof(u1 *) * (count + 1));
+    compiler_t c = {
+        .method = method,
+        .clazz = clazz,
+        .invoke = invoke,
+        .p = code,
+        .branches = malloc(sizeof(u1 *) * (count + 1)),
+        .targets = malloc(sizeof(uint32_t) * (count + 1)),
+    };
+    assert(jit && entries && natives && c.branches && c.targets &&
+           "Failed to allocate compiled code");
+
+    /* jit_run() enters with the locals and where to start */
+    emit_u1(&c, 0x50 | RBX); /* push rbx */
+    emit_u1(&c, REX_W);      /* mov rbx, rdi */
+    emit_u1(&c, 0x89);
+    emit_u1(&c, 0xc0 | RDI << 3 | RBX);
+    emit_u1(&c, 0xff); /* jmp rsi */
+    emit_u1(&c, 0xe0 | RSI);
+
+    u4 pc = 0;
+    for (uint32_t i = 0; i < count; pc += insn_length(method->code.code[pc]),
+                  i++) {
+        natives[i] = c.p;
+        if (headers[i])
+            emit_poll(&c, i);
+        if (compile_insn(&c, i, &method->code.code[pc]))
+            entries[i] = natives[i];
+        else
+            emit_exit(&c, i);
+        assert(c.p - natives[i] <=
+                   MAX_TEMPLATE_SIZE + (headers[i] ? POLL_SIZE : 0) &&
+               "Instruction compiled into too much code");
+    }
+    /* branches past the last instruction end the method */
+    natives[count] = c.p;
+    emit_exit(&c, count);
+
+    for (uint32_t i = 0; i < c.branches_count; i++) {
+        int32_t offset = natives[c.targets[i]] - (c.branches[i] + 4);
+        memcpy(c.branches[i], &offset, sizeof(offset));
+    }
+    free(c.targets);
+    free(c.branches);
+    free(natives);
+    free(headers);
+
+    if (mprotect(code, size, PROT_READ | PROT_EXEC)) {
+        munmap(code, size);
+        free(entries);
+        free(jit);
+        return NULL;
+    }
+    jit->code = code;
+    jit->size = size;
+    jit->entries = entries;
+    return jit;
+}
+
+/**
+ * Run compiled code on a frame, until it returns or reaches an instruction
+ * which is left to the interpreter
+ *
+ * @param jit the compiled code of the method of the frame
+ * @param locals the locals of the frame
+ * @param index the instruction to start at, which must have an entry
+ * @return the index of the instruction the interpreter goes on with, where the
+ *         operand stack has the depth the method gives it, or JIT_RETURNED
+ *         and the return value. The frame is not popped.
+ */
+jit_exit_t jit_run(jit_code_t *jit, value_t *locals, uint32_t index)
+{
+    jit_exit_t (*enter)(value_t *locals, const u1 *entry) = (void *) jit->code;
+    assert(jit->entries[index] && "Instruction was not compiled");
+    return enter(locals, jit->entries[index]);
+}
+
+void jit_free(jit_code_t *jit)
+{
+    if (!jit)
+        return;
+    munmap(jit->code, jit->size);
+    free(jit->entries);
+    free(jit);
+}
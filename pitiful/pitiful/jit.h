@@ -0,0 +1,42 @@
+#pragma once
+
+#include "classfile.h"
+#include "stack.h"
+
+/* A baseline compiler of hot methods into x86-64 code. Each instruction is
+ * translated on its own by a template, which works on the locals and the
+ * operand stack of the frame in place, at the depth the instruction runs at.
+ * Compiled code can thus be entered at any instruction it has a template for,
+ * and leaves the frame to the interpreter at any other one.
+ */
+
+/* what the runtime gives back to compiled code invoking a method */
+typedef struct {
+    int64_t value;   /* the return value, if any */
+    value_t *locals; /* the locals of the caller, which may have moved */
+} jit_call_t;
+
+/* invoke the method of an instruction of the frame on top of the Java stack,
+ * given the index of the instruction and whether it is an invokevirtual */
+typedef jit_call_t (*jit_invoke_t)(uint32_t index, bool is_virtual);
+
+/* where compiled code left a frame */
+typedef struct {
+    uint32_t index; /* the instruction to interpret, or JIT_RETURNED */
+    int64_t value;  /* the return value, if the method returned */
+} jit_exit_t;
+
+#define JIT_RETURNED UINT32_MAX
+
+typedef struct jit_code {
+    u1 *code;
+    size_t size;
+    /* native code of each instruction, or NULL if left to the interpreter */
+    const u1 **entries;
+} jit_code_t;
+
+jit_code_t *jit_compile(method_t *method,
+                        class_file_t *clazz,
+                        jit_invoke_t invoke);
+jit_exit_t jit_run(jit_code_t *jit, value_t *locals, uint32_t index);
+void jit_free(jit_code_t *jit);
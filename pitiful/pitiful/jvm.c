@@ -10,135 +10,213 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "archive.h"
 #include "class-heap.h"
 #include "classfile.h"
 #include "constant-pool.h"
+#include "frame.h"
+#include "intrinsic.h"
+#include "jit.h"
 #include "list.h"
+#include "monitor.h"
 #include "object-heap.h"
+#include "opcode.h"
+#include "profiler.h"
 #include "stack.h"
-
-typedef enum {
-    i_iconst_m1 = 0x2,
-    i_iconst_0 = 0x3,
-    i_iconst_1 = 0x4,
-    i_iconst_2 = 0x5,
-    i_iconst_3 = 0x6,
-    i_iconst_4 = 0x7,
-    i_iconst_5 = 0x8,
-    i_lconst_0 = 0x9,
-    i_lconst_1 = 0xa,
-    i_bipush = 0x10,
-    i_sipush = 0x11,
-    i_ldc = 0x12,
-    i_ldc2_w = 0x14,
-    i_iload = 0x15,
-    i_lload = 0x16,
-    i_aload = 0x19,
-    i_iload_0 = 0x1a,
-    i_iload_1 = 0x1b,
-    i_iload_2 = 0x1c,
-    i_iload_3 = 0x1d,
-    i_lload_0 = 0x1e,
-    i_lload_1 = 0x1f,
-    i_lload_2 = 0x20,
-    i_lload_3 = 0x21,
-    i_aload_0 = 0x2a,
-    i_aload_1 = 0x2b,
-    i_aload_2 = 0x2c,
-    i_aload_3 = 0x2d,
-    i_iaload = 0x2e,
-    i_laload = 0x2f,
-    i_aaload = 0x32,
-    i_baload = 0x33,
-    i_caload = 0x34,
-    i_saload = 0x35,
-    i_istore = 0x36,
-    i_lstore = 0x37,
-    i_astore = 0x3a,
-    i_istore_0 = 0x3b,
-    i_istore_1 = 0x3c,
-    i_istore_2 = 0x3d,
-    i_istore_3 = 0x3e,
-    i_lstore_0 = 0x3f,
-    i_lstore_1 = 0x40,
-    i_lstore_2 = 0x41,
-    i_lstore_3 = 0x42,
-    i_astore_0 = 0x4b,
-    i_astore_1 = 0x4c,
-    i_astore_2 = 0x4d,
-    i_astore_3 = 0x4e,
-    i_iastore = 0x4f,
-    i_lastore = 0x50,
-    i_aastore = 0x53,
-    i_bastore = 0x54,
-    i_castore = 0x55,
-    i_sastore = 0x56,
-    i_pop = 0x57,
-    i_dup = 0x59,
-    i_iadd = 0x60,
-    i_ladd = 0x61,
-    i_isub = 0x64,
-    i_lsub = 0x65,
-    i_imul = 0x68,
-    i_lmul = 0x69,
-    i_idiv = 0x6c,
-    i_ldiv = 0x6d,
-    i_irem = 0x70,
-    i_lrem = 0x71,
-    i_ineg = 0x74,
-    i_iinc = 0x84,
-    i_i2l = 0x85,
-    i_l2i = 0x88,
-    i_lcmp = 0x94,
-    i_ifeq = 0x99,
-    i_ifne = 0x9a,
-    i_iflt = 0x9b,
-    i_ifge = 0x9c,
-    i_ifgt = 0x9d,
-    i_ifle = 0x9e,
-    i_if_icmpeq = 0x9f,
-    i_if_icmpne = 0xa0,
-    i_if_icmplt = 0xa1,
-    i_if_icmpge = 0xa2,
-    i_if_icmpgt = 0xa3,
-    i_if_icmple = 0xa4,
-    i_goto = 0xa7,
-    i_ireturn = 0xac,
-    i_lreturn = 0xad,
-    i_areturn = 0xb0,
-    i_return = 0xb1,
-    i_getstatic = 0xb2,
-    i_putstatic = 0xb3,
-    i_getfield = 0xb4,
-    i_putfield = 0xb5,
-    i_invokevirtual = 0xb6,
-    i_invokespecial = 0xb7,
-    i_invokestatic = 0xb8,
-    i_invokedynamic = 0xba,
-    i_new = 0xbb,
-    i_newarray = 0xbc,
-    i_anewarray = 0xbd,
-    i_multianewarray = 0xc5,
-} jvm_opcode_t;
+#include "thread.h"
 
 /* TODO: add -cp arg to achieve class path select */
 static char *prefix = NULL;
 
-static inline void bipush(stack_frame_t *op_stack,
-                          uint32_t pc,
-                          uint8_t *code_buf) {
-    int8_t param = code_buf[pc + 1];
+/* invocations and loop iterations of a method before it is compiled */
+#define JIT_THRESHOLD 1000
+
+/* Compiled code calls methods on the C stack, where each call nests another
+ * run of compiled code or of execute(). Past this many nested runs of
+ * compiled code, a thread only interprets, with its frames on the Java stack.
+ */
+#define MAX_JIT_DEPTH 256
+
+static bool jit_enabled = true;
+static u4 jit_threshold = JIT_THRESHOLD;
+static bool profiling;
+
+/* runs of compiled code the current thread is nested in */
+static __thread u4 jit_depth;
+
+/* held to decode and compile methods and to fill inline caches, none of
+ * which blocks, so threads wait for it without letting the garbage collector
+ * go on */
+static pthread_mutex_t runtime_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* held to change which thread initializes a class, and signalled then */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t init_done = PTHREAD_COND_INITIALIZER;
+
+stack_entry_t execute(java_stack_t *stack);
+
+/**
+ * Run the static initializer of a class once. Other threads using the class
+ * meanwhile wait until it is done, but not the thread running it, as the
+ * initializer may use its own class.
+ *
+ * @param clazz
+ *  the class to be initialized
+ * @return whether the class is initialized, which it is not yet while the
+ *         current thread runs its initializer
+ */
+static bool initialize_class(class_file_t *clazz)
+{
+    if (LOAD_ACQUIRE(&clazz->initialized))
+        return true;
+
+    lock_mutex(&init_lock);
+    while (clazz->initializer && clazz->initializer != current_thread)
+        wait_cond(&init_done, &init_lock);
+    bool run = !clazz->initialized && !clazz->initializer;
+    if (run)
+        clazz->initializer = current_thread;
+    pthread_mutex_unlock(&init_lock);
+    if (!run)
+        return clazz->initialized;
+
+    method_t *method = find_method("<clinit>", "()V", clazz);
+    if (method) {
+        push_frame(&current_thread->stack, method, clazz, 0);
+        stack_entry_t exec_res = execute(&current_thread->stack);
+        assert(exec_res.type == STACK_ENTRY_NONE &&
+               "<clinit> must not return a value");
+    }
+
+    lock_mutex(&init_lock);
+    clazz->initializer = NULL;
+    STORE_RELEASE(&clazz->initialized, true);
+    pthread_cond_broadcast(&init_done);
+    pthread_mutex_unlock(&init_lock);
+    return true;
+}
+
+/**
+ * Fill a constant pool cache entry in and publish it, unless another thread
+ * resolving the same entry got there first
+ *
+ * @param entry the entry, which is read once resolved is seen set
+ * @param resolved what to fill the entry in with
+ */
+static void publish_entry(cp_cache_t *entry, const cp_cache_t *resolved)
+{
+    pthread_mutex_lock(&runtime_lock);
+    if (!entry->resolved) {
+        entry->clazz = resolved->clazz;
+        entry->method = resolved->method;
+        entry->field = resolved->field;
+        entry->num_params = resolved->num_params;
+        entry->vtable_index = resolved->vtable_index;
+        entry->string = resolved->string;
+        entry->intrinsic = resolved->intrinsic;
+        STORE_RELEASE(&entry->resolved, true);
+    }
+    pthread_mutex_unlock(&runtime_lock);
+}
+
+/**
+ * Resolve a Methodref and remember the result in the constant pool cache
+ *
+ * @param index
+ *  index of the Methodref in the constant pool
+ * @param clazz
+ *  the class the constant pool belongs to
+ * @return the cache entry of the Methodref. Methods of java.lang.Thread, which
+ *         is built in, are resolved to a NULL method and class, and those of
+ *         the class library the VM runs natively to their intrinsic. Threads
+ *         resolving the same Methodref at once find it alike, and the first
+ *         to finish fills the entry in.
+ */
+static cp_cache_t *resolve_method(uint16_t index, class_file_t *clazz)
+{
+    cp_cache_t *entry = &clazz->cp_cache[index];
+    if (LOAD_ACQUIRE(&entry->resolved))
+        return entry;
+
+    char *method_name, *method_descriptor, *class_name;
+    method_t *method = NULL;
+    class_file_t *target_class = NULL;
+    cp_cache_t resolved = {.vtable_index = NO_VTABLE_INDEX};
+
+    /* intrinsics are called without loading their class */
+    class_name = find_method_info_from_index(index, clazz, &method_name,
+                                             &method_descriptor);
+    resolved.num_params = get_parameter_types(method_descriptor, NULL);
+    resolved.intrinsic =
+        find_intrinsic(class_name, method_name, method_descriptor);
+    if (resolved.intrinsic) {
+        publish_entry(entry, &resolved);
+        return entry;
+    }
+
+    /* recursively find method from child to parent */
+    while (!method) {
+        if (!target_class)
+            class_name = find_method_info_from_index(
+                index, clazz, &method_name, &method_descriptor);
+        else
+            class_name = find_class_name_from_index(
+                target_class->info->super_class, target_class);
+        if (!strcmp(class_name, "java/lang/Thread"))
+            break;
+        find_or_add_class_to_heap(class_name, prefix, &target_class);
+        assert(target_class && "Failed to load class in resolve_method");
+        method = find_method(method_name, method_descriptor, target_class);
+    }
 
-    push_byte(op_stack, param);
+    if (method) {
+        resolved.clazz = target_class;
+        resolved.method = method;
+        resolved.vtable_index = find_vtable_index(target_class, method);
+    }
+    publish_entry(entry, &resolved);
+    return entry;
 }
 
-static inline void sipush(stack_frame_t *op_stack,
-                          uint32_t pc,
-                          uint8_t *code_buf) {
-    uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-    int16_t res = ((param1 << 8) | param2);
+/**
+ * Resolve a Fieldref and remember the result in the constant pool cache
+ *
+ * @param index
+ *  index of the Fieldref in the constant pool
+ * @param clazz
+ *  the class the constant pool belongs to
+ * @return the cache entry of the Fieldref. Fields of java.lang.System are
+ *         resolved to a NULL field, in order to support java print method
+ */
+static cp_cache_t *resolve_field(uint16_t index, class_file_t *clazz)
+{
+    cp_cache_t *entry = &clazz->cp_cache[index];
+    if (LOAD_ACQUIRE(&entry->resolved))
+        return entry;
+
+    char *field_name, *field_descriptor, *class_name;
+    field_t *field = NULL;
+    class_file_t *target_class = NULL;
+
+    class_name = find_field_info_from_index(index, clazz, &field_name,
+                                            &field_descriptor);
+    if (!strcmp(class_name, "java/lang/System")) {
+        publish_entry(entry, &(cp_cache_t) {.field = NULL});
+        return entry;
+    }
+
+    while (!field) {
+        if (target_class)
+            class_name = find_class_name_from_index(
+                target_class->info->super_class, target_class);
+        find_or_add_class_to_heap(class_name, prefix, &target_class);
+        assert(target_class && "Failed to load class in resolve_field");
+        field = find_field(field_name, field_descriptor, target_class);
+    }
 
-    push_short(op_stack, res);
+    publish_entry(entry,
+                  &(cp_cache_t) {.clazz = target_class, .field = field});
+    return entry;
 }
 
 static inline void iadd(stack_frame_t *op_stack) {
@@ -182,160 +260,1464 @@ static inline void ineg(stack_frame_t *op_stack) {
     push_int(op_stack, -op1);
 }
 
-static inline void iconst(stack_frame_t *op_stack, uint8_t current) {
-    push_int(op_stack, current - i_iconst_0);
+/* the exceptions the program does not catch, as Java reports them */
+static void null_pointer_error()
+{
+    fprintf(stderr,
+            "Exception in thread \"%s\" java.lang.NullPointerException\n",
+            current_thread->name);
+    exit(1);
+}
+
+static void array_access_error(void *arr, int64_t idx)
+{
+    if (!arr)
+        null_pointer_error();
+    fprintf(stderr,
+            "Exception in thread \"%s\" "
+            "java.lang.ArrayIndexOutOfBoundsException: Index %" PRId64
+            " out of bounds for length %" PRIu32 "\n",
+            current_thread->name, idx, ARRAY_LENGTH(arr));
+    exit(1);
+}
+
+/* one unsigned compare also rejects negative indices */
+static inline void check_array_index(void *arr, int64_t idx)
+{
+    if (!arr || (uint64_t) idx >= ARRAY_LENGTH(arr))
+        array_access_error(arr, idx);
 }
 
 /**
- * Execute the opcode instructions of a method until it returns.
- *
- * @param method the method to run
- * @param locals the array of local variables, including the method parameters.
- *               Except for parameters, the locals are uninitialized.
- * @param clazz the class file the method belongs to
- * @return stack_entry that contain the method return value and its type. Is a
- *         heap-allocated pointer which should be free from the caller
+ * Find the method an invokevirtual runs on an object: in the inline cache of
+ * the call site, or else in the vtable of the class of the object. The cache
+ * keeps what is found while it has room, and its entries are filled in before
+ * they are counted, for the threads reading it meanwhile.
  *
+ * @param cache the inline cache of the call site
+ * @param entry the resolved Methodref the call site invokes
+ * @param receiver the class of the object
+ * @return the method and the class that declares it
  */
-stack_entry_t *execute(method_t *method,
-                       local_variable_t *locals,
-                       class_file_t *clazz)
+static inline vtable_entry_t find_virtual_method(inline_cache_t *cache,
+                                                 cp_cache_t *entry,
+                                                 class_file_t *receiver)
 {
-    code_t code = method->code;
-    stack_frame_t *op_stack = malloc(sizeof(stack_frame_t));
-    init_stack(op_stack, code.max_stack);
+    u4 count = LOAD_ACQUIRE(&cache->count);
+    for (u4 i = 0; i < count; i++) {
+        if (cache->receivers[i] == receiver)
+            return cache->targets[i];
+    }
 
-    /* position at the program to be run */
-    uint32_t pc = 0;
-    uint8_t *code_buf = code.code;
+    /* private methods are not overridden */
+    vtable_entry_t target = {.clazz = entry->clazz, .method = entry->method};
+    if (entry->vtable_index != NO_VTABLE_INDEX)
+        target = receiver->vtable[entry->vtable_index];
+    if (count < INLINE_CACHE_SIZE) {
+        pthread_mutex_lock(&runtime_lock);
+        /* unless another thread filled the entry in meanwhile */
+        if (cache->count == count) {
+            cache->receivers[count] = receiver;
+            cache->targets[count] = target;
+            STORE_RELEASE(&cache->count, count + 1);
+        }
+        pthread_mutex_unlock(&runtime_lock);
+    }
+    return target;
+}
 
-    int loop_count = 0;
-    while (pc < code.code_length) {
-        loop_count += 1;
-        uint8_t current = code_buf[pc];
+/**
+ * Set the type of an argument of a concatenation from its descriptor. A
+ * reference of another type than String, such as Object, may still lead to a
+ * string, which is only told apart from objects and arrays when run.
+ *
+ * @param part the piece of the plan the argument is
+ * @param descriptor the descriptor of the argument, among the others
+ * @return the descriptor of the next argument
+ */
+static const char *link_concat_arg(concat_part_t *part, const char *descriptor)
+{
+    const char *end = descriptor;
+    while (*end == '[')
+        end++;
+    if (*end == 'L')
+        end = strchr(end, ';');
+    end++;
+
+    size_t length = end - descriptor;
+    bool string = length == strlen("Ljava/lang/String;") &&
+                  !memcmp(descriptor, "Ljava/lang/String;", length);
+    part->type = descriptor[0];
+    if (!string && (part->type == 'L' || part->type == '['))
+        part->type = 'O';
+    return end;
+}
 
-        /* Reference:
-         * https://en.wikipedia.org/wiki/Java_bytecode_instruction_listings
-         */
-        switch (current) {
-        /* Return int from method */
-        case i_ireturn: {
-            stack_entry_t *ret = malloc(sizeof(stack_entry_t));
-            ret->entry.int_value = (int32_t) pop_int(op_stack);
-            ret->type = STACK_ENTRY_INT;
+/**
+ * Link an invokedynamic of makeConcatWithConstants into the plan of the
+ * string it builds. Each character of the recipe, its first bootstrap
+ * argument, is either
+ *   \1 (Unicode point 0001): the next argument of the call site,
+ *   \2 (Unicode point 0002): the next of the other bootstrap arguments,
+ *   or a character copied as it is.
+ *
+ * @param index the constant pool index of the InvokeDynamic
+ * @param clazz the class of the call site
+ * @return the plan, to be freed with the method
+ */
+static concat_plan_t *link_concat(uint16_t index, class_file_t *clazz)
+{
+    bootmethods_t *bootstrap_method = find_bootstrap_method(index, clazz);
+    CONSTANT_MethodHandle_info *handle = get_method_handle(
+        &clazz->constant_pool, bootstrap_method->bootstrap_method_ref);
+
+    char *method_name, *method_descriptor;
+    find_method_info_from_index(handle->reference_index, clazz, &method_name,
+                                &method_descriptor);
+    if (strcmp(method_name, "makeConcatWithConstants"))
+        assert(0 && "Only support makeConcatWithConstants");
+
+    /* the descriptor of the call site tells the types of the arguments */
+    char *descriptor = find_invoke_dynamic_descriptor(index, clazz);
+    uint16_t args_count = get_parameter_types(descriptor, NULL);
+    char *recipe = get_string_utf(&clazz->constant_pool,
+                                  bootstrap_method->bootstrap_arguments[0]);
+
+    size_t constant_length = 0;
+    u2 constant = 1;
+    for (char *iter = recipe; *iter; iter++) {
+        if (*iter == 2) {
+            constant_length += strlen(get_string_utf(
+                &clazz->constant_pool,
+                bootstrap_method->bootstrap_arguments[constant++]));
+        } else if (*iter != 1) {
+            constant_length++;
+        }
+    }
 
-            free(op_stack->store);
-            free(op_stack);
+    /* at most one run of constants around each argument */
+    u2 max_parts = 2 * args_count + 1;
+    concat_plan_t *plan = malloc(sizeof(concat_plan_t) +
+                                 sizeof(concat_part_t) * max_parts +
+                                 constant_length);
+    assert(plan && "Failed to allocate concatenation plan");
+    plan->args_count = args_count;
+    plan->parts_count = 0;
+    plan->constant_length = constant_length;
+
+    char *chars = (char *) &plan->parts[max_parts];
+    concat_part_t *part = NULL;
+    const char *arg_descriptor = descriptor + 1;
+    u2 arg = 0;
+    constant = 1;
+    for (char *iter = recipe; *iter; iter++) {
+        if (*iter == 1) {
+            part = &plan->parts[plan->parts_count++];
+            part->chars = NULL;
+            arg_descriptor = link_concat_arg(part, arg_descriptor);
+            arg++;
+            part = NULL;
+            continue;
+        }
+
+        char *src = iter;
+        size_t length = 1;
+        if (*iter == 2) {
+            src = get_string_utf(
+                &clazz->constant_pool,
+                bootstrap_method->bootstrap_arguments[constant++]);
+            length = strlen(src);
+        }
+        /* merged into the constants right before, if any */
+        if (!part) {
+            part = &plan->parts[plan->parts_count++];
+            part->chars = chars;
+            part->length = 0;
+        }
+        memcpy(chars, src, length);
+        chars += length;
+        part->length += length;
+    }
+    assert(arg == args_count && "Recipe does not match the call site");
+    return plan;
+}
 
-            return ret;
-        }
+/* characters of an integer in decimal */
+static inline u4 decimal_length(int64_t value)
+{
+    uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    u4 length = value < 0;
+    do {
+        length++;
+        magnitude /= 10;
+    } while (magnitude);
+    return length;
+}
 
-        /* Return long from method */
-        case i_lreturn: {
-            stack_entry_t *ret = malloc(sizeof(stack_entry_t));
-            ret->entry.long_value = (int64_t) pop_int(op_stack);
-            ret->type = STACK_ENTRY_LONG;
+static inline void write_decimal(char *dest, int64_t value, u4 length)
+{
+    uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    if (value < 0)
+        *dest = '-';
+    char *digit = dest + length;
+    do {
+        *--digit = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+}
 
-            free(op_stack->store);
-            free(op_stack);
+/* bytes of a char in modified UTF-8, where U+0000 takes two */
+static inline u4 char_length(u2 c)
+{
+    return c && c < 0x80 ? 1 : c < 0x800 ? 2 : 3;
+}
+
+static inline void write_char(char *dest, u2 c, u4 length)
+{
+    switch (length) {
+    case 1:
+        dest[0] = c;
+        break;
+    case 2:
+        dest[0] = 0xc0 | c >> 6;
+        dest[1] = 0x80 | (c & 0x3f);
+        break;
+    default:
+        dest[0] = 0xe0 | c >> 12;
+        dest[1] = 0x80 | (c >> 6 & 0x3f);
+        dest[2] = 0x80 | (c & 0x3f);
+        break;
+    }
+}
 
-            return ret;
+/**
+ * Convert an object or array argument of a concatenation to a string, by the
+ * toString() method of its class or else as Object.toString() does, with the
+ * address of the object for its hash
+ *
+ * @param stack the Java stack, where toString() runs
+ * @param ref the object or array, which is not NULL
+ * @param clazz the class of the call site
+ * @return the string, which may be NULL if toString() returns it
+ */
+static char *concat_to_string(java_stack_t *stack,
+                              void *ref,
+                              class_file_t *clazz)
+{
+    /* the name of the class, between a prefix and suffix for arrays */
+    const char *prefix = "", *name, *suffix = "";
+    size_t name_length;
+    if (REF_KIND(ref) == OBJECT_REF) {
+        object_t *obj = ref;
+        for (u2 i = 0; i < obj->class->vtable_length; i++) {
+            vtable_entry_t *entry = &obj->class->vtable[i];
+            if (strcmp(entry->method->name, "toString") ||
+                strcmp(entry->method->descriptor, "()Ljava/lang/String;"))
+                continue;
+            push_frame(stack, entry->method, entry->clazz, 0)
+                ->locals[0]
+                .ptr_value = obj;
+            return execute(stack).entry.ptr_value;
+        }
+        name = find_class_name_from_index(obj->class->info->this_class,
+                                          obj->class);
+        name_length = strlen(name);
+    } else {
+        /* the elements have a primitive type, an array type, a class type
+         * or are named by their class */
+        array_header_t *header = ARRAY_HEADER(ref);
+        name = header->element;
+        name_length = header->is_ref ? strlen(name) : 1;
+        prefix = "[";
+        if (header->is_ref && name[0] != '[' && name[name_length - 1] != ';') {
+            prefix = "[L";
+            suffix = ";";
         }
+    }
 
-        /* Return long from method */
-        case i_areturn: {
-            stack_entry_t *ret = malloc(sizeof(stack_entry_t));
-            ret->entry.ptr_value = pop_ref(op_stack);
-            ret->type = STACK_ENTRY_REF;
+    /* the low bits of an address are the same for every allocation */
+    char hash[sizeof(u4) * 2 + 1];
+    int hash_length = snprintf(hash, sizeof(hash), "%" PRIx32,
+                               (u4) (((uintptr_t) ref >> 3) * 2654435761u));
+    size_t prefix_length = strlen(prefix), suffix_length = strlen(suffix);
+    char *str = allocate_string(clazz, prefix_length + name_length +
+                                           suffix_length + 1 + hash_length);
+    char *dest = str;
+    memcpy(dest, prefix, prefix_length);
+    dest += prefix_length;
+    for (size_t i = 0; i < name_length; i++)
+        *dest++ = name[i] == '/' ? '.' : name[i];
+    memcpy(dest, suffix, suffix_length);
+    dest += suffix_length;
+    *dest++ = '@';
+    memcpy(dest, hash, hash_length);
+    return str;
+}
 
-            free(op_stack->store);
-            free(op_stack);
+/**
+ * Build the string of a concatenation plan from the arguments on the operand
+ * stack of the frame on top of the Java stack, which are popped. The exact
+ * length is computed first, so that the string is written straight into its
+ * single allocation.
+ *
+ * @param plan the plan of the call site
+ * @param stack the Java stack, whose frames toString() methods may move
+ * @param clazz the class of the call site
+ * @return the characters of the new string
+ */
+static char *run_concat(concat_plan_t *plan,
+                        java_stack_t *stack,
+                        class_file_t *clazz)
+{
+    /* objects are replaced by their strings first, in the slots where the
+     * collector finds them */
+    u2 index = 0;
+    for (concat_part_t *part = plan->parts;
+         part < plan->parts + plan->parts_count; part++) {
+        if (part->chars)
+            continue;
+        u2 arg = index++;
+        if (part->type != 'O')
+            continue;
+        stack_frame_t *op_stack = &stack->frames[stack->depth - 1].op_stack;
+        void *ref = op_stack->store[op_stack->size - plan->args_count + arg]
+                        .ptr_value;
+        if (!ref || REF_KIND(ref) == STRING_REF)
+            continue;
+        char *str = concat_to_string(stack, ref, clazz);
+        op_stack = &stack->frames[stack->depth - 1].op_stack;
+        op_stack->store[op_stack->size - plan->args_count + arg].ptr_value =
+            str;
+    }
 
-            return ret;
+    /* the arguments stay on the stack, where the collector finds them */
+    stack_frame_t *op_stack = &stack->frames[stack->depth - 1].op_stack;
+    value_t *args = &op_stack->store[op_stack->size - plan->args_count];
+    size_t length = plan->constant_length;
+    value_t *arg = args;
+    for (concat_part_t *part = plan->parts;
+         part < plan->parts + plan->parts_count; part++) {
+        if (part->chars)
+            continue;
+        switch (part->type) {
+        case 'L':
+        case 'O': {
+            char *str = (arg++)->ptr_value;
+            length += str ? STRING_LENGTH(str) : strlen("null");
+            break;
         }
+        case 'C':
+            length += char_length((arg++)->long_value);
+            break;
+        case 'Z':
+            length += (arg++)->long_value ? strlen("true") : strlen("false");
+            break;
+        default:
+            length += decimal_length((int64_t) (arg++)->long_value);
+            break;
+        }
+    }
 
-        /* Return void from method */
-        case i_return: {
-            stack_entry_t *ret = malloc(sizeof(stack_entry_t));
-            ret->type = STACK_ENTRY_NONE;
+    char *result = allocate_string(clazz, length);
+    char *dest = result;
+    arg = args;
+    for (concat_part_t *part = plan->parts;
+         part < plan->parts + plan->parts_count; part++) {
+        if (part->chars) {
+            memcpy(dest, part->chars, part->length);
+            dest += part->length;
+            continue;
+        }
+        switch (part->type) {
+        case 'L':
+        case 'O': {
+            char *str = (arg++)->ptr_value;
+            size_t length = str ? STRING_LENGTH(str) : strlen("null");
+            memcpy(dest, str ? str : "null", length);
+            dest += length;
+            break;
+        }
+        case 'C': {
+            u2 c = (arg++)->long_value;
+            u4 length = char_length(c);
+            write_char(dest, c, length);
+            dest += length;
+            break;
+        }
+        case 'Z': {
+            const char *value = (arg++)->long_value ? "true" : "false";
+            memcpy(dest, value, strlen(value));
+            dest += strlen(value);
+            break;
+        }
+        default: {
+            int64_t value = (int64_t) (arg++)->long_value;
+            u4 digits = decimal_length(value);
+            write_decimal(dest, value, digits);
+            dest += digits;
+            break;
+        }
+        }
+    }
 
-            free(op_stack->store);
-            free(op_stack);
+    op_stack->size -= plan->args_count;
+    return result;
+}
 
-            return ret;
-        }
+/* the type of the value a method returns */
+static stack_entry_type_t return_type(method_t *method)
+{
+    switch (strchr(method->descriptor, ')')[1]) {
+    case 'V':
+        return STACK_ENTRY_NONE;
+    case 'J':
+        return STACK_ENTRY_LONG;
+    case 'L':
+    case '[':
+        return STACK_ENTRY_REF;
+    default:
+        return STACK_ENTRY_INT;
+    }
+}
 
-        /* Invoke a class (static) method */
-        case i_invokestatic: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+/**
+ * Pop the frame of a returning method and push its return value onto the
+ * operand stack of the caller
+ *
+ * @param stack the Java stack
+ * @param ret the return value and its type
+ */
+static void return_from_frame(java_stack_t *stack, stack_entry_t ret)
+{
+    pop_frame(stack);
+    stack_frame_t *op_stack = &stack->frames[stack->depth - 1].op_stack;
+    switch (ret.type) {
+    case STACK_ENTRY_BYTE:
+    case STACK_ENTRY_SHORT:
+    case STACK_ENTRY_INT:
+    case STACK_ENTRY_LONG:
+    case STACK_ENTRY_REF:
+        op_stack->store[op_stack->size++] = ret.entry;
+        break;
+    case STACK_ENTRY_NONE:
+        /* nothing */
+        break;
+    default:
+        assert(0 && "unknown return type");
+    }
+}
 
-            /* the method to be called */
-            char *method_name, *method_descriptor, *class_name;
-            method_t *own_method = NULL;
-            class_file_t *target_class = NULL;
+/* the types of slots that matter to the garbage collector */
+enum { SLOT_NONE = -1, SLOT_VALUE, SLOT_REF };
 
-            /* recursively find method from child to parent */
-            while (!own_method) {
-                if (!target_class)
-                    class_name = find_method_info_from_index(
-                        index, clazz, &method_name, &method_descriptor);
-                else
-                    class_name = find_class_name_from_index(
-                        target_class->info->super_class, target_class);
-                find_or_add_class_to_heap(class_name, prefix, &target_class);
-                assert(target_class &&
-                       "Failed to load class in i_invokestatic");
-                own_method =
-                    find_method(method_name, method_descriptor, target_class);
-            }
+/* the type of the slot of a value of a descriptor, e.g. "I" or "[J" */
+static int descriptor_slot(const char *descriptor)
+{
+    switch (descriptor[0]) {
+    case 'V':
+        return SLOT_NONE;
+    case 'L':
+    case '[':
+        return SLOT_REF;
+    default:
+        return SLOT_VALUE;
+    }
+}
 
-            /* call static initialization. Only the class that contains this
-             * method should do static initialization */
-            if (!target_class->initialized) {
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
-            }
+/**
+ * Get how an instruction changes the operand stack, the way execute() runs
+ * it. Instructions moving slots between locals and the operand stack, whose
+ * type depends on the slot, are left to the caller.
+ *
+ * @param code the instruction and its operands
+ * @param clazz the class the instruction belongs to
+ * @param pops set to the number of slots the instruction pops
+ * @return the type of the slot it pushes, or SLOT_NONE
+ */
+static int stack_effect(const u1 *code, class_file_t *clazz, int *pops)
+{
+    uint16_t index = insn_length(code[0]) >= 3 ? code[1] << 8 | code[2] : 0;
+    char *name, *descriptor, *class_name;
+
+    *pops = 0;
+    switch (code[0]) {
+    case i_aconst_null:
+    case i_new:
+    case i_new_quick:
+        return SLOT_REF;
+    case i_iconst_m1 ... i_lconst_1:
+    case i_bipush:
+    case i_sipush:
+    case i_ldc2_w:
+    case i_iload:
+    case i_lload:
+    case i_iload_0 ... i_lload_3:
+        return SLOT_VALUE;
+    case i_ldc:
+    case i_ldc_quick: {
+        const_pool_info *info = get_constant(&clazz->constant_pool, code[1]);
+        return info->tag == CONSTANT_String ? SLOT_REF : SLOT_VALUE;
+    }
+    case i_iaload:
+    case i_laload:
+    case i_baload:
+    case i_caload:
+    case i_saload:
+        *pops = 2;
+        return SLOT_VALUE;
+    case i_aaload:
+        *pops = 2;
+        return SLOT_REF;
+    case i_istore:
+    case i_lstore:
+    case i_astore:
+    case i_istore_0 ... i_lstore_3:
+    case i_astore_0 ... i_astore_3:
+    case i_pop:
+    case i_ifeq ... i_ifle:
+    case i_ifnull:
+    case i_ifnonnull:
+    case i_ireturn:
+    case i_lreturn:
+    case i_areturn:
+    case i_athrow:
+    case i_monitorenter:
+    case i_monitorexit:
+        *pops = 1;
+        return SLOT_NONE;
+    case i_iastore:
+    case i_lastore:
+    case i_aastore:
+    case i_bastore:
+    case i_castore:
+    case i_sastore:
+        *pops = 3;
+        return SLOT_NONE;
+    case i_iadd:
+    case i_ladd:
+    case i_isub:
+    case i_lsub:
+    case i_imul:
+    case i_lmul:
+    case i_idiv:
+    case i_ldiv:
+    case i_irem:
+    case i_lrem:
+    case i_lcmp:
+        *pops = 2;
+        return SLOT_VALUE;
+    case i_ineg:
+    case i_i2l:
+    case i_l2i:
+    case i_arraylength:
+        *pops = 1;
+        return SLOT_VALUE;
+    case i_if_icmpeq ... i_if_acmpne:
+        *pops = 2;
+        return SLOT_NONE;
+    case i_getstatic:
+    case i_getstatic_quick:
+        /* java.lang.System is not there to push */
+        class_name = find_field_info_from_index(index, clazz, &name,
+                                                &descriptor);
+        if (!strcmp(class_name, "java/lang/System"))
+            return SLOT_NONE;
+        return descriptor_slot(descriptor);
+    case i_putstatic:
+    case i_putstatic_quick:
+        class_name = find_field_info_from_index(index, clazz, &name,
+                                                &descriptor);
+        *pops = strcmp(class_name, "java/lang/System") ? 1 : 0;
+        return SLOT_NONE;
+    case i_getfield:
+    case i_getfield_quick:
+        find_field_info_from_index(index, clazz, &name, &descriptor);
+        *pops = 1;
+        return descriptor_slot(descriptor);
+    case i_putfield:
+    case i_putfield_quick:
+        *pops = 2;
+        return SLOT_NONE;
+    case i_invokevirtual:
+    case i_invokevirtual_quick:
+    case i_invokespecial:
+    case i_invokespecial_quick:
+    case i_invokestatic:
+    case i_invokestatic_quick:
+        class_name = find_method_info_from_index(index, clazz, &name,
+                                                 &descriptor);
+        *pops = get_parameter_types(descriptor, NULL);
+        /* the print methods take no object, which is not pushed */
+        if (code[0] == i_invokevirtual &&
+            !strcmp(class_name, "java/io/PrintStream"))
+            return SLOT_NONE;
+        if (code[0] != i_invokestatic && code[0] != i_invokestatic_quick)
+            *pops += 1;
+        return descriptor_slot(strchr(descriptor, ')') + 1);
+    case i_invokedynamic:
+    case i_invokedynamic_quick:
+        descriptor = find_invoke_dynamic_descriptor(index, clazz);
+        *pops = get_parameter_types(descriptor, NULL);
+        return SLOT_REF;
+    case i_newarray:
+    case i_anewarray:
+        *pops = 1;
+        return SLOT_REF;
+    case i_multianewarray:
+        *pops = code[3];
+        return SLOT_REF;
+    default:
+        return SLOT_NONE;
+    }
+}
 
-            uint16_t num_params = get_number_of_parameters(own_method);
-            local_variable_t own_locals[own_method->code.max_locals];
-            for (int i = num_params - 1; i >= 0; i--)
-                pop_to_local(op_stack, &own_locals[i]);
+static inline void set_ref_slot(u1 *map, int slot, bool is_ref)
+{
+    if (is_ref)
+        map[slot / 8] |= 1 << (slot % 8);
+    else
+        map[slot / 8] &= ~(1 << (slot % 8));
+}
 
-            stack_entry_t *exec_res =
-                execute(own_method, own_locals, target_class);
-            switch (exec_res->type) {
-            case STACK_ENTRY_INT:
-                push_int(op_stack, exec_res->entry.int_value);
+/* Merge the state after an instruction into the state before one it goes on
+ * with. A slot holds a reference only if it does on every way there.
+ */
+static bool merge_ref_map(u1 *to,
+                          int *to_depth,
+                          const u1 *from,
+                          int depth,
+                          size_t size)
+{
+    if (*to_depth < 0) {
+        memcpy(to, from, size);
+        *to_depth = depth;
+        return true;
+    }
+    assert(*to_depth == depth && "Operand stack depths differ on merge");
+
+    bool changed = false;
+    for (size_t i = 0; i < size; i++) {
+        if ((to[i] & from[i]) != to[i]) {
+            to[i] &= from[i];
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Infer which locals and operand stack slots hold references before each
+ * instruction of a decoded method, by following the types the instructions
+ * leave along every path through the code until nothing changes. A slot that
+ * holds a reference only on some paths is not read again by verified code, so
+ * the garbage collector can ignore it. The depth of the operand stack before
+ * each instruction is kept as well.
+ *
+ * @param method the method
+ * @param clazz the class the method belongs to
+ * @param insns the instructions the method is decoded into
+ * @param count the number of decoded instructions
+ * @param handlers the handlers of execute(), indexed by opcode
+ */
+static void infer_ref_maps(method_t *method,
+                           class_file_t *clazz,
+                           insn_t *insns,
+                           uint32_t count,
+                           const void *const *handlers)
+{
+    int max_locals = method->code.max_locals;
+    size_t map_size = REF_MAP_SIZE(method);
+
+    /* one more map for the end of the method, which branches may target */
+    u1 *maps = calloc(count + 1, map_size);
+    int *depths = malloc(sizeof(int) * (count + 1));
+    u1 *map = malloc(map_size);
+    assert(maps && depths && map && "Failed to allocate reference maps");
+    for (uint32_t i = 0; i <= count; i++)
+        depths[i] = -1;
+
+    /* the arguments are the first locals, one slot each */
+    int local = 0;
+    if (!(method->access_flags & IS_STATIC))
+        set_ref_slot(maps, local++, true);
+    char types[256];
+    uint16_t num_params = get_parameter_types(method->descriptor, types);
+    for (uint16_t i = 0; i < num_params; i++, local++)
+        set_ref_slot(maps, local, types[i] == 'L' || types[i] == '[');
+    depths[0] = 0;
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        u4 pc = 0;
+        for (uint32_t i = 0; i < count;
+             pc += insn_length(method->code.code[pc]), i++) {
+            /* not reached yet, or not supported, so nowhere to go on */
+            if (depths[i] < 0 || insns[i].handler == handlers[i_unknown])
+                continue;
+
+            u1 *code = &method->code.code[pc];
+            int depth = depths[i];
+            memcpy(map, maps + i * map_size, map_size);
+            bool top_is_ref = depth && IS_REF_SLOT(map, max_locals + depth - 1);
+
+            int pops, push = stack_effect(code, clazz, &pops);
+            switch (code[0]) {
+            case i_aload:
+            case i_aload_0 ... i_aload_3:
+                push = IS_REF_SLOT(map, insns[i].operand) ? SLOT_REF
+                                                          : SLOT_VALUE;
+                break;
+            case i_dup:
+                push = top_is_ref ? SLOT_REF : SLOT_VALUE;
                 break;
-            case STACK_ENTRY_LONG:
-                push_long(op_stack, exec_res->entry.long_value);
+            case i_astore:
+            case i_astore_0 ... i_astore_3:
+                set_ref_slot(map, insns[i].operand, top_is_ref);
                 break;
-            case STACK_ENTRY_REF:
-                push_ref(op_stack, exec_res->entry.ptr_value);
+            case i_istore:
+            case i_lstore:
+            case i_istore_0 ... i_lstore_3:
+                set_ref_slot(map, insns[i].operand, false);
                 break;
-            case STACK_ENTRY_NONE:
-                /* nothing */
+            }
+            depth -= pops;
+            assert(depth >= 0 && "Operand stack underflow");
+            if (push != SLOT_NONE)
+                set_ref_slot(map, max_locals + depth++, push == SLOT_REF);
+            assert(depth <= method->code.max_stack && "Operand stack overflow");
+
+            /* merge into the instructions this one goes on with */
+            uint32_t target = insns[i].operand;
+            switch (code[0]) {
+            case i_goto:
+                changed |= merge_ref_map(maps + target * map_size,
+                                         &depths[target], map, depth,
+                                         map_size);
                 break;
+            case i_ireturn:
+            case i_lreturn:
+            case i_areturn:
+            case i_return:
+            case i_athrow:
+                break;
+            case i_ifeq ... i_if_acmpne:
+            case i_ifnull:
+            case i_ifnonnull:
+                changed |= merge_ref_map(maps + target * map_size,
+                                         &depths[target], map, depth,
+                                         map_size);
+                /* fall through */
             default:
-                assert(0 && "unknown return type");
+                changed |= merge_ref_map(maps + (i + 1) * map_size,
+                                         &depths[i + 1], map, depth,
+                                         map_size);
+                break;
             }
+        }
+    }
 
-            free(exec_res);
-            pc += 3;
+    free(map);
+    method->ref_maps = maps;
+    method->stack_depths = depths;
+}
+
+/**
+ * Decode the bytecode of a method into instructions, each with the handler
+ * which runs it in execute(). Decoding stops at the first opcode which is not
+ * supported, which fails only if it is run. The instructions are published
+ * last, with all they need, as other threads run them as soon as they see
+ * them.
+ *
+ * @param method the method to be decoded
+ * @param clazz the class the method belongs to
+ * @param handlers the handlers of execute(), indexed by opcode
+ */
+static void decode_method(method_t *method,
+                          class_file_t *clazz,
+                          const void *const *handlers)
+{
+    u1 *code = method->code.code;
+    u4 code_length = method->code.code_length;
+
+    pthread_mutex_lock(&runtime_lock);
+    /* another thread may have decoded it meanwhile */
+    if (method->insns) {
+        pthread_mutex_unlock(&runtime_lock);
+        return;
+    }
+
+    /* the index of the instruction starting at each offset of the code */
+    uint32_t *index = malloc(sizeof(uint32_t) * code_length);
+    assert(index && "Failed to allocate instruction indices");
+    for (uint32_t pc = 0; pc < code_length; pc++)
+        index[pc] = UINT32_MAX;
+    uint32_t count = 0;
+    for (uint32_t pc = 0; pc < code_length; pc += insn_length(code[pc])) {
+        index[pc] = count++;
+        /* the rest of the code cannot be decoded */
+        if (!handlers[code[pc]] || pc + insn_length(code[pc]) > code_length)
+            break;
+    }
+
+    /* the last instruction reports that the method has no return */
+    insn_t *insns = calloc(count + 1, sizeof(insn_t));
+    assert(insns && "Failed to allocate decoded instructions");
+    insns[count].handler = handlers[i_end];
+
+    /* each invokevirtual has its own inline cache, and each invokedynamic its
+     * own concatenation plan */
+    uint32_t call_sites = 0, concat_sites = 0;
+    uint32_t pc = 0;
+    for (insn_t *insn = insns; insn < insns + count; insn++) {
+        u1 opcode = code[pc], *operands = &code[pc + 1];
+        insn->handler = handlers[opcode];
+        if (!insn->handler || pc + insn_length(opcode) > code_length) {
+            insn->handler = handlers[i_unknown];
+            insn->operand = opcode;
+            break;
+        }
+        uint16_t operand16 =
+            insn_length(opcode) >= 3 ? (operands[0] << 8) | operands[1] : 0;
+
+        switch (opcode) {
+        case i_iconst_m1 ... i_iconst_5:
+            insn->operand = opcode - i_iconst_0;
+            break;
+        case i_lconst_0:
+        case i_lconst_1:
+            insn->operand = opcode - i_lconst_0;
+            break;
+        case i_iload_0 ... i_iload_3:
+            insn->operand = opcode - i_iload_0;
+            break;
+        case i_lload_0 ... i_lload_3:
+            insn->operand = opcode - i_lload_0;
+            break;
+        case i_aload_0 ... i_aload_3:
+            insn->operand = opcode - i_aload_0;
+            break;
+        case i_istore_0 ... i_istore_3:
+            insn->operand = opcode - i_istore_0;
+            break;
+        case i_lstore_0 ... i_lstore_3:
+            insn->operand = opcode - i_lstore_0;
+            break;
+        case i_astore_0 ... i_astore_3:
+            insn->operand = opcode - i_astore_0;
             break;
+        case i_bipush:
+            insn->operand = (int8_t) operands[0];
+            break;
+        case i_sipush:
+            insn->operand = (int16_t) operand16;
+            break;
+        case i_ldc: {
+            /* integer constants are pushed like iconst */
+            const_pool_info *info =
+                get_constant(&clazz->constant_pool, operands[0]);
+            if (info->tag == CONSTANT_Integer) {
+                insn->handler = handlers[i_iconst_0];
+                insn->operand =
+                    (int32_t) ((CONSTANT_Integer_info *) info->info)->bytes;
+            } else {
+                insn->operand = operands[0];
+            }
+            break;
+        }
+        case i_iload:
+        case i_lload:
+        case i_aload:
+        case i_istore:
+        case i_lstore:
+        case i_astore:
+        case i_newarray:
+            insn->operand = operands[0];
+            break;
+        case i_iinc:
+            insn->operand = operands[0];
+            insn->operand2 = (int8_t) operands[1];
+            break;
+        case i_ifeq ... i_if_acmpne:
+        case i_goto:
+        case i_ifnull:
+        case i_ifnonnull: {
+            /* a target in between instructions ends the method */
+            int64_t target = (int64_t) pc + (int16_t) operand16;
+            insn->operand = count;
+            if (target >= 0 && target < code_length &&
+                index[target] != UINT32_MAX)
+                insn->operand = index[target];
+            break;
+        }
+        case i_multianewarray:
+            insn->operand = operand16;
+            insn->operand2 = operands[2];
+            break;
+        case i_invokevirtual:
+            insn->operand = operand16;
+            insn->operand2 = call_sites++;
+            break;
+        case i_invokedynamic:
+            insn->operand = operand16;
+            insn->operand2 = concat_sites++;
+            break;
+        case i_ireturn:
+        case i_lreturn:
+        case i_areturn:
+        case i_return:
+            /* which go on with the return once the monitor is let go */
+            if (method->access_flags & IS_SYNCHRONIZED) {
+                insn->handler = handlers[i_sync_return];
+                insn->operand = opcode;
+            }
+            break;
+        default:
+            /* a constant pool index, if the instruction has operands */
+            if (insn_length(opcode) > 1)
+                insn->operand = operand16;
+            break;
+        }
+        pc += insn_length(opcode);
+    }
+
+    free(index);
+    method->insns_count = count;
+    method->inline_caches = calloc(call_sites, sizeof(inline_cache_t));
+    assert((method->inline_caches || !call_sites) &&
+           "Failed to allocate inline caches");
+    method->concat_plans = calloc(concat_sites, sizeof(concat_plan_t *));
+    assert((method->concat_plans || !concat_sites) &&
+           "Failed to allocate concatenation plans");
+    method->concat_sites = concat_sites;
+    infer_ref_maps(method, clazz, insns, count, handlers);
+    if (profiling)
+        profile_method(method, insns, clazz, handlers[i_profile]);
+    STORE_RELEASE(&method->insns, insns);
+    pthread_mutex_unlock(&runtime_lock);
+}
+
+/* Take the monitor a synchronized method holds until it returns: the one of
+ * its object, or of its class if static.
+ */
+static void enter_synchronized(frame_t *frame)
+{
+    frame->monitor = frame->method->access_flags & IS_STATIC
+                         ? (void *) frame->clazz
+                         : frame->locals[0].ptr_value;
+    monitor_enter(frame->monitor);
+}
+
+/* Cache the state of the current frame in the interpreter. Needed after a
+ * frame is pushed or popped, and after running a static initializer, which
+ * may move the frames.
+ */
+#define LOAD_FRAME()                                       \
+    do {                                                   \
+        frame = &stack->frames[stack->depth - 1];          \
+        op_stack = &frame->op_stack;                       \
+        locals = frame->locals;                            \
+        clazz = frame->clazz;                              \
+        if (!LOAD_ACQUIRE(&frame->method->insns))          \
+            decode_method(frame->method, clazz, handlers); \
+        insns = frame->method->insns;                      \
+    } while (0)
+
+/* Let the garbage collector know the instruction the frame runs, before
+ * anything which may allocate or run a static initializer. In frames calling
+ * a method, it is the call.
+ */
+#define SAVE_PC() (frame->pc = ip + 1 - insns)
+
+/* run the decoded instruction at ip, in the form another thread may have
+ * rewritten it to */
+#define DISPATCH() goto *LOAD_ACQUIRE(&ip->handler)
+
+/* switch the instruction at ip to a quick form, which the hook of the
+ * profiler goes on with when profiling. Other threads may run it in its quick
+ * form as soon as they see it, so what it reads is set up first. */
+#define REWRITE(quick)                                                   \
+    do {                                                                 \
+        if (frame->method->profile)                                      \
+            STORE_RELEASE(&frame->method->profile->handlers[ip - insns], \
+                          (quick));                                      \
+        else                                                             \
+            STORE_RELEASE(&ip->handler, (quick));                        \
+    } while (0)
+
+/* go on with the next instruction */
+#define NEXT()          \
+    do {                \
+        ip++;           \
+        DISPATCH();     \
+    } while (0)
+
+/* Count a time a method is entered or one of its loops goes round in the
+ * interpreter. Threads running it at once may lose counts, which only puts
+ * off compiling it.
+ */
+static inline u4 count_hotness(method_t *method)
+{
+    u4 hotness = __atomic_load_n(&method->hotness, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(&method->hotness, hotness, __ATOMIC_RELAXED);
+    return hotness;
+}
+
+/* Whether a method is hot enough to run compiled */
+#define IS_HOT(method)                   \
+    (LOAD_ACQUIRE(&(method)->jit) ||     \
+     count_hotness(method) >= jit_threshold)
+
+/* park the thread at the instruction at ip if the garbage collector waits
+ * for it */
+#define SAFEPOINT()                \
+    do {                           \
+        if (SAFEPOINT_PENDING()) { \
+            SAVE_PC();             \
+            park_thread();         \
+        }                          \
+    } while (0)
+
+/* go on with the instruction at an index of the method. Backward branches
+ * are safepoints, and enter compiled code once the method is hot. */
+#define JUMP(index)                                        \
+    do {                                                   \
+        uint32_t target = (index);                         \
+        bool backward = target <= (uint32_t) (ip - insns); \
+        ip = insns + target;                               \
+        if (backward) {                                    \
+            SAFEPOINT();                                   \
+            if (IS_HOT(frame->method))                     \
+                goto run_compiled;                         \
+        }                                                  \
+        DISPATCH();                                        \
+    } while (0)
+
+/* start running the frame just pushed, at a safepoint */
+#define START_FRAME()                                      \
+    do {                                                   \
+        ip = insns;                                        \
+        SAFEPOINT();                                       \
+        if (frame->method->access_flags & IS_SYNCHRONIZED) \
+            enter_synchronized(frame);                     \
+        if (IS_HOT(frame->method))                         \
+            goto run_compiled;                             \
+        DISPATCH();                                        \
+    } while (0)
+
+/* a method of the class library which is not there */
+static void unsupported_method(uint16_t index, class_file_t *clazz)
+{
+    char *method_name, *method_descriptor;
+    char *class_name = find_method_info_from_index(index, clazz, &method_name,
+                                                   &method_descriptor);
+    fprintf(stderr, "Unsupported method %s.%s%s\n", class_name, method_name,
+            method_descriptor);
+    exit(1);
+}
+
+/* run the run() method of the object of a started thread, if it has one */
+static void run_thread(java_thread_t *thread)
+{
+    class_file_t *clazz = thread->object->class;
+    for (u2 i = 0; i < clazz->vtable_length; i++) {
+        vtable_entry_t *entry = &clazz->vtable[i];
+        if (strcmp(entry->method->name, "run") ||
+            strcmp(entry->method->descriptor, "()V"))
+            continue;
+        push_frame(&thread->stack, entry->method, entry->clazz, 0)
+            ->locals[0]
+            .ptr_value = thread->object;
+        execute(&thread->stack);
+        return;
+    }
+}
+
+/**
+ * Run a method of java.lang.Thread, which is built in: start() runs the run()
+ * method of the object on a thread of its own, and join() waits until it is
+ * done. The current frame must be saved, as join() blocks.
+ *
+ * @param index the constant pool index of the Methodref
+ * @param clazz the class of the call site
+ * @param op_stack the operand stack, with the object on top
+ */
+static void invoke_thread_method(uint16_t index,
+                                 class_file_t *clazz,
+                                 stack_frame_t *op_stack)
+{
+    char *method_name, *method_descriptor;
+    find_method_info_from_index(index, clazz, &method_name, &method_descriptor);
+    bool start = !strcmp(method_name, "start");
+    if ((!start && strcmp(method_name, "join")) ||
+        strcmp(method_descriptor, "()V"))
+        unsupported_method(index, clazz);
+
+    object_t *obj = pop_ref(op_stack);
+    if (!obj)
+        null_pointer_error();
+    if (start)
+        start_thread(obj, run_thread);
+    else
+        join_thread(obj);
+}
+
+/**
+ * Invoke the method of an instruction from compiled code, which left the
+ * arguments on the operand stack of the frame on top of the Java stack
+ *
+ * @param index the index of the instruction in its method
+ * @param is_virtual whether the instruction is an invokevirtual
+ * @return the return value, and the locals of the frame, which may have moved
+ */
+static jit_call_t invoke_from_compiled(uint32_t index, bool is_virtual)
+{
+    java_stack_t *stack = &current_thread->stack;
+    frame_t *frame = &stack->frames[stack->depth - 1];
+    method_t *method = frame->method;
+    insn_t *insn = &method->insns[index];
+
+    /* leave the frame as the interpreter does when it invokes a method */
+    frame->pc = index + 1;
+    frame->op_stack.size = method->stack_depths[index];
+    cp_cache_t *entry = resolve_method(insn->operand, frame->clazz);
+    const intrinsic_t *intrinsic = entry->intrinsic;
+    if (intrinsic) {
+        int64_t value = intrinsic->func(
+            &frame->op_stack.store[frame->op_stack.size - intrinsic->args],
+            frame->clazz);
+        return (jit_call_t) {.value = value, .locals = frame->locals};
+    }
+    if (entry->clazz)
+        initialize_class(entry->clazz);
+    else if (!is_virtual)
+        unsupported_method(insn->operand, frame->clazz);
+
+    vtable_entry_t target = {.clazz = entry->clazz, .method = entry->method};
+    uint16_t num_args = entry->num_params;
+    if (is_virtual) {
+        stack_frame_t *op_stack = &frame->op_stack;
+        object_t *obj =
+            op_stack->store[op_stack->size - num_args - 1].ptr_value;
+        if (!obj)
+            null_pointer_error();
+        target = find_virtual_method(&method->inline_caches[insn->operand2],
+                                     entry, obj->class);
+        if (!target.method) {
+            invoke_thread_method(insn->operand, frame->clazz, &frame->op_stack);
+            return (jit_call_t) {.locals = frame->locals};
+        }
+        num_args++;
+    }
+    frame = push_frame(stack, target.method, target.clazz, num_args);
+    method = target.method;
+
+    /* compiled methods are called right away, at a safepoint, and interpreted
+     * from where their compiled code stops, if it does before returning */
+    jit_exit_t exit = {.index = 0};
+    jit_code_t *jit = LOAD_ACQUIRE(&method->jit);
+    if (jit && jit->entries[0] && jit_depth < MAX_JIT_DEPTH) {
+        safepoint_poll();
+        jit_depth++;
+        exit = jit_run(jit, frame->locals, 0);
+        jit_depth--;
+        if (exit.index != JIT_RETURNED) {
+            frame->pc = exit.index;
+            frame->op_stack.size = method->stack_depths[exit.index];
+        }
+    }
+    if (exit.index == JIT_RETURNED)
+        pop_frame(stack);
+    else
+        exit.value = execute(stack).entry.long_value;
+
+    frame = &stack->frames[stack->depth - 1];
+    return (jit_call_t) {.value = exit.value, .locals = frame->locals};
+}
+
+/* compile a method once, whichever thread gets to it first */
+static jit_code_t *compile_method(method_t *method, class_file_t *clazz)
+{
+    pthread_mutex_lock(&runtime_lock);
+    jit_code_t *jit = method->jit;
+    if (!jit) {
+        jit = jit_compile(method, clazz, invoke_from_compiled);
+        STORE_RELEASE(&method->jit, jit);
+    }
+    pthread_mutex_unlock(&runtime_lock);
+    return jit;
+}
+
+/**
+ * Execute the instructions of the method on top of the Java stack until it
+ * returns. Methods it invokes are run in the same loop, with their frames
+ * pushed to the Java stack rather than the C stack. Each method is decoded on
+ * its first invocation, and every handler jumps straight to the handler of the
+ * next instruction. Hot methods are compiled, and run in compiled code from
+ * their entry and their loops on.
+ *
+ * @param stack the Java stack. The top frame is the method to run, with its
+ *              parameters as the first locals. It starts at pc, if compiled
+ *              code stopped short of an instruction there.
+ * @return stack_entry that contain the method return value and its type
+ *
+ */
+stack_entry_t execute(java_stack_t *stack)
+{
+    int depth = stack->depth;
+    frame_t *frame;
+    stack_frame_t *op_stack;
+    local_variable_t *locals;
+    class_file_t *clazz;
+    insn_t *insns;
+
+    /* Reference:
+     * https://en.wikipedia.org/wiki/Java_bytecode_instruction_listings
+     */
+    static const void *const handlers[] = {
+        [i_aconst_null] = &&do_aconst_null,
+        [i_iconst_m1] = &&do_iconst,
+        [i_iconst_0] = &&do_iconst,
+        [i_iconst_1] = &&do_iconst,
+        [i_iconst_2] = &&do_iconst,
+        [i_iconst_3] = &&do_iconst,
+        [i_iconst_4] = &&do_iconst,
+        [i_iconst_5] = &&do_iconst,
+        [i_lconst_0] = &&do_lconst,
+        [i_lconst_1] = &&do_lconst,
+        [i_bipush] = &&do_bipush,
+        [i_sipush] = &&do_sipush,
+        [i_ldc] = &&do_ldc,
+        [i_ldc2_w] = &&do_ldc2_w,
+        [i_iload] = &&do_iload,
+        [i_lload] = &&do_lload,
+        [i_aload] = &&do_aload,
+        [i_iload_0] = &&do_iload,
+        [i_iload_1] = &&do_iload,
+        [i_iload_2] = &&do_iload,
+        [i_iload_3] = &&do_iload,
+        [i_lload_0] = &&do_lload,
+        [i_lload_1] = &&do_lload,
+        [i_lload_2] = &&do_lload,
+        [i_lload_3] = &&do_lload,
+        [i_aload_0] = &&do_aload,
+        [i_aload_1] = &&do_aload,
+        [i_aload_2] = &&do_aload,
+        [i_aload_3] = &&do_aload,
+        [i_iaload] = &&do_iaload,
+        [i_laload] = &&do_laload,
+        [i_aaload] = &&do_aaload,
+        [i_baload] = &&do_baload,
+        [i_caload] = &&do_baload,
+        [i_saload] = &&do_saload,
+        [i_istore] = &&do_istore,
+        [i_lstore] = &&do_lstore,
+        [i_astore] = &&do_astore,
+        [i_istore_0] = &&do_istore,
+        [i_istore_1] = &&do_istore,
+        [i_istore_2] = &&do_istore,
+        [i_istore_3] = &&do_istore,
+        [i_lstore_0] = &&do_lstore,
+        [i_lstore_1] = &&do_lstore,
+        [i_lstore_2] = &&do_lstore,
+        [i_lstore_3] = &&do_lstore,
+        [i_astore_0] = &&do_astore,
+        [i_astore_1] = &&do_astore,
+        [i_astore_2] = &&do_astore,
+        [i_astore_3] = &&do_astore,
+        [i_iastore] = &&do_iastore,
+        [i_lastore] = &&do_lastore,
+        [i_aastore] = &&do_aastore,
+        [i_bastore] = &&do_bastore,
+        [i_castore] = &&do_bastore,
+        [i_sastore] = &&do_sastore,
+        [i_pop] = &&do_pop,
+        [i_dup] = &&do_dup,
+        [i_iadd] = &&do_iadd,
+        [i_ladd] = &&do_ladd,
+        [i_isub] = &&do_isub,
+        [i_lsub] = &&do_lsub,
+        [i_imul] = &&do_imul,
+        [i_lmul] = &&do_lmul,
+        [i_idiv] = &&do_idiv,
+        [i_ldiv] = &&do_ldiv,
+        [i_irem] = &&do_irem,
+        [i_lrem] = &&do_lrem,
+        [i_ineg] = &&do_ineg,
+        [i_iinc] = &&do_iinc,
+        [i_i2l] = &&do_i2l,
+        [i_l2i] = &&do_l2i,
+        [i_lcmp] = &&do_lcmp,
+        [i_ifeq] = &&do_ifeq,
+        [i_ifne] = &&do_ifne,
+        [i_iflt] = &&do_iflt,
+        [i_ifge] = &&do_ifge,
+        [i_ifgt] = &&do_ifgt,
+        [i_ifle] = &&do_ifle,
+        [i_if_icmpeq] = &&do_if_icmpeq,
+        [i_if_icmpne] = &&do_if_icmpne,
+        [i_if_icmplt] = &&do_if_icmplt,
+        [i_if_icmpge] = &&do_if_icmpge,
+        [i_if_icmpgt] = &&do_if_icmpgt,
+        [i_if_icmple] = &&do_if_icmple,
+        [i_if_acmpeq] = &&do_if_acmpeq,
+        [i_if_acmpne] = &&do_if_acmpne,
+        [i_goto] = &&do_goto,
+        [i_ireturn] = &&do_ireturn,
+        [i_lreturn] = &&do_lreturn,
+        [i_areturn] = &&do_areturn,
+        [i_return] = &&do_return,
+        [i_getstatic] = &&do_getstatic,
+        [i_putstatic] = &&do_putstatic,
+        [i_getfield] = &&do_getfield,
+        [i_putfield] = &&do_putfield,
+        [i_invokevirtual] = &&do_invokevirtual,
+        [i_invokespecial] = &&do_invokespecial,
+        [i_invokestatic] = &&do_invokestatic,
+        [i_invokedynamic] = &&do_invokedynamic,
+        [i_new] = &&do_new,
+        [i_newarray] = &&do_newarray,
+        [i_anewarray] = &&do_anewarray,
+        [i_arraylength] = &&do_arraylength,
+        [i_athrow] = &&do_athrow,
+        [i_monitorenter] = &&do_monitorenter,
+        [i_monitorexit] = &&do_monitorexit,
+        [i_multianewarray] = &&do_multianewarray,
+        [i_ifnull] = &&do_ifnull,
+        [i_ifnonnull] = &&do_ifnonnull,
+        [i_getstatic_quick] = &&do_getstatic_quick,
+        [i_putstatic_quick] = &&do_putstatic_quick,
+        [i_invokevirtual_quick] = &&do_invokevirtual_quick,
+        [i_invokespecial_quick] = &&do_invokespecial_quick,
+        [i_invokestatic_quick] = &&do_invokestatic_quick,
+        [i_getfield_quick] = &&do_getfield_quick,
+        [i_putfield_quick] = &&do_putfield_quick,
+        [i_new_quick] = &&do_new_quick,
+        [i_invokedynamic_quick] = &&do_invokedynamic_quick,
+        [i_ldc_quick] = &&do_ldc_quick,
+        [i_unknown] = &&do_unknown,
+        [i_end] = &&do_end,
+        [i_profile] = &&do_profile,
+        [i_sync_return] = &&do_sync_return,
+        [i_invoke_intrinsic] = &&do_invoke_intrinsic,
+    };
+    LOAD_FRAME();
+
+    /* position at the program to be run */
+    insn_t *ip = insns + frame->pc;
+    if (frame->pc)
+        DISPATCH();
+    START_FRAME();
+
+    /* every handler ends by running the next instruction */
+    {
+        /* Return int from method */
+        do_ireturn: {
+            stack_entry_t ret = {.type = STACK_ENTRY_INT};
+            ret.entry.long_value = (int32_t) pop_int(op_stack);
+
+            if (stack->depth == depth) {
+                pop_frame(stack);
+                return ret;
+            }
+            return_from_frame(stack, ret);
+            LOAD_FRAME();
+            ip = insns + frame->pc;
+            DISPATCH();
+        }
+
+        /* Return long from method */
+        do_lreturn: {
+            stack_entry_t ret = {.type = STACK_ENTRY_LONG};
+            ret.entry.long_value = (int64_t) pop_int(op_stack);
+
+            if (stack->depth == depth) {
+                pop_frame(stack);
+                return ret;
+            }
+            return_from_frame(stack, ret);
+            LOAD_FRAME();
+            ip = insns + frame->pc;
+            DISPATCH();
+        }
+
+        /* Return long from method */
+        do_areturn: {
+            stack_entry_t ret = {.type = STACK_ENTRY_REF};
+            ret.entry.ptr_value = pop_ref(op_stack);
+
+            if (stack->depth == depth) {
+                pop_frame(stack);
+                return ret;
+            }
+            return_from_frame(stack, ret);
+            LOAD_FRAME();
+            ip = insns + frame->pc;
+            DISPATCH();
+        }
+
+        /* Return void from method */
+        do_return: {
+            stack_entry_t ret = {.type = STACK_ENTRY_NONE};
+
+            if (stack->depth == depth) {
+                pop_frame(stack);
+                return ret;
+            }
+            return_from_frame(stack, ret);
+            LOAD_FRAME();
+            ip = insns + frame->pc;
+            DISPATCH();
+        }
+
+        /* Invoke a class (static) method */
+        do_invokestatic: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
+
+            /* call static initialization. Only the class that contains this
+             * method should do static initialization */
+            cp_cache_t *entry = resolve_method(index, clazz);
+            if (entry->intrinsic) {
+                REWRITE(&&do_invoke_intrinsic);
+                goto do_invoke_intrinsic;
+            }
+            if (!entry->clazz)
+                unsupported_method(index, clazz);
+            bool initialized = initialize_class(entry->clazz);
+            LOAD_FRAME();
+            if (initialized)
+                REWRITE(&&do_invokestatic_quick);
+        }
+            /* fall through */
+
+        /* Invoke a class (static) method resolved before */
+        do_invokestatic_quick: {
+            uint16_t index = ip->operand;
+            cp_cache_t *entry = &clazz->cp_cache[index];
+
+            SAVE_PC();
+            push_frame(stack, entry->method, entry->clazz, entry->num_params);
+            LOAD_FRAME();
+            START_FRAME();
+        }
+
+        /* Invoke a method built into the VM, resolved before. The arguments
+         * stay on the operand stack, where the garbage collector finds them,
+         * until it returns. */
+        do_invoke_intrinsic: {
+            SAVE_PC();
+            const intrinsic_t *intrinsic =
+                clazz->cp_cache[ip->operand].intrinsic;
+            int64_t value = intrinsic->func(
+                &op_stack->store[op_stack->size - intrinsic->args], clazz);
+            op_stack->size -= intrinsic->args;
+            if (intrinsic->returns)
+                push_long(op_stack, value);
+            NEXT();
         }
 
         /* Compare long */
-        case i_lcmp: {
+        do_lcmp: {
             int64_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
             if (op1 < op2) {
                 push_int(op_stack, 1);
@@ -344,801 +1726,630 @@ stack_entry_t *execute(method_t *method,
             } else {
                 push_int(op_stack, -1);
             }
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if equals */
-        case i_ifeq: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_ifeq: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional == 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional == 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if not equals */
-        case i_ifne: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_ifne: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional != 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional != 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if less than 0 */
-        case i_iflt: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_iflt: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional < 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional < 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if >= 0 */
-        case i_ifge: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_ifge: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional >= 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional >= 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if greater than 0 */
-        case i_ifgt: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_ifgt: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional > 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional > 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison with zero succeeds: if <= 0 */
-        case i_ifle: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_ifle: {
             int32_t conditional = pop_int(op_stack);
-            pc += 3;
-            if (conditional <= 0) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (conditional <= 0)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if equals */
-        case i_if_icmpeq: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmpeq: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 == op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 == op1)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if not equals */
-        case i_if_icmpne: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmpne: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 != op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 != op1)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if less than */
-        case i_if_icmplt: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmplt: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 < op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 < op1)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if greater than or equal to */
-        case i_if_icmpge: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmpge: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 >= op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 >= op1)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if greater than */
-        case i_if_icmpgt: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmpgt: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 > op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 > op1)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch if int comparison succeeds: if less than or equal to */
-        case i_if_icmple: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
+        do_if_icmple: {
             int32_t op1 = pop_int(op_stack), op2 = pop_int(op_stack);
-            pc += 3;
-            if (op2 <= op1) {
-                int16_t res = ((param1 << 8) | param2);
-                pc += res - 3;
-            }
-            break;
+            if (op2 <= op1)
+                JUMP(ip->operand);
+            NEXT();
+        }
+
+        /* Branch if reference comparison succeeds: if equals */
+        do_if_acmpeq: {
+            void *op1 = pop_ref(op_stack), *op2 = pop_ref(op_stack);
+            if (op2 == op1)
+                JUMP(ip->operand);
+            NEXT();
+        }
+
+        /* Branch if reference comparison succeeds: if not equals */
+        do_if_acmpne: {
+            void *op1 = pop_ref(op_stack), *op2 = pop_ref(op_stack);
+            if (op2 != op1)
+                JUMP(ip->operand);
+            NEXT();
+        }
+
+        /* Branch if reference is null */
+        do_ifnull: {
+            void *ref = pop_ref(op_stack);
+            if (!ref)
+                JUMP(ip->operand);
+            NEXT();
+        }
+
+        /* Branch if reference is not null */
+        do_ifnonnull: {
+            void *ref = pop_ref(op_stack);
+            if (ref)
+                JUMP(ip->operand);
+            NEXT();
         }
 
         /* Branch always */
-        case i_goto: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            int16_t res = ((param1 << 8) | param2);
-            pc += res;
-            break;
+        do_goto: {
+            JUMP(ip->operand);
         }
 
         /* Push item from run-time constant pool */
-        case i_ldc: {
+        do_ldc: {
+            SAVE_PC();
             constant_pool_t constant_pool = clazz->constant_pool;
 
-            /* find the parameter which will be the index from which we retrieve
-             * constant in the constant pool.
-             */
-            int16_t param = code_buf[pc + 1];
-
-            const_pool_info *info = get_constant(&constant_pool, param);
+            /* integer constants were decoded into pushing them */
+            const_pool_info *info = get_constant(&constant_pool, ip->operand);
             switch (info->tag) {
-            case CONSTANT_Integer: {
-                push_int(op_stack, ((CONSTANT_Integer_info *) info->info)->bytes);
-                break;
-            }
             case CONSTANT_String: {
+                /* the same string each time, as for any equal literal */
                 char *src =
                     (char *) get_constant(
                         &constant_pool,
                         ((CONSTANT_String_info *) info->info)->string_index)
                         ->info;
-                char *dest = create_string(clazz, src);
-                push_ref(op_stack, dest);
+                publish_entry(
+                    &clazz->cp_cache[ip->operand],
+                    &(cp_cache_t) {.string = intern_string(clazz, src)});
+                REWRITE(&&do_ldc_quick);
                 break;
             }
             default:
                 assert(0 && "ldc only support int and string");
                 break;
             }
-            pc += 2;
-            break;
+        }
+            /* fall through */
+
+        /* Push a String constant resolved before */
+        do_ldc_quick: {
+            push_ref(op_stack, clazz->cp_cache[ip->operand].string);
+            NEXT();
         }
 
         /* Push long or double from run-time constant pool (wide index) */
-        case i_ldc2_w: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_ldc2_w: {
+            uint16_t index = ip->operand;
 
             uint64_t high = ((CONSTANT_LongOrDouble_info *) get_constant(&clazz->constant_pool, index) ->info) ->high_bytes;
             uint64_t low = ((CONSTANT_LongOrDouble_info *) get_constant(&clazz->constant_pool, index) ->info) ->low_bytes;
             int64_t value = high << 32 | low;
             push_long(op_stack, value);
-            pc += 3;
-            break;
+            NEXT();
         }
 
+        /* FIXME: this implementation has some bugs.
+         * In standard JVM, one stack entry only store four
+         * bytes data, so in some method descriptor (e.g (JJ)V)
+         * the long value will store in locals[0] and locals[2]
+         * rather than locals[0] and locals[1].
+         */
         /* Load long from local variable */
-        case i_lload: {
-            int32_t param = code_buf[pc + 1];
+        do_lload: {
+            int32_t param = ip->operand;
             int64_t loaded;
-            loaded = locals[param].entry.long_value;
+            loaded = locals[param].long_value;
             push_long(op_stack, loaded);
 
-            pc += 2;
-            break;
+            NEXT();
         }
 
         /* Load int from an array */
-        case i_iaload: {
+        do_iaload: {
             int64_t idx = pop_int(op_stack);
             int32_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             push_int(op_stack, arr[idx]);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Load long from an array */
-        case i_laload: {
+        do_laload: {
             int64_t idx = pop_int(op_stack);
             int64_t *arr = pop_ref(op_stack);
-
-            push_int(op_stack, arr[idx]);
-            pc += 1;
-            break;
+            check_array_index(arr, idx);
+
+            push_long(op_stack, arr[idx]);
+            NEXT();
         }
 
         /* Load reference from array */
-        case i_aaload: {
+        do_aaload: {
             int64_t index = pop_int(op_stack);
             void **addr = pop_ref(op_stack);
+            check_array_index(addr, index);
 
             push_ref(op_stack, *(addr + index));
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Load byte/char from an array */
-        case i_baload:
-        case i_caload: {
+        do_baload: {
             int64_t idx = pop_int(op_stack);
             int8_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             push_int(op_stack, arr[idx]);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Load short from an array */
-        case i_saload: {
+        do_saload: {
             int64_t idx = pop_int(op_stack);
             int16_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             push_int(op_stack, arr[idx]);
-            pc += 1;
-            break;
-        }
-
-        /* FIXME: this implementation has some bugs.
-         * In standard JVM, one stack entry only store four
-         * bytes data, so in some method descriptor (e.g (JJ)V)
-         * the long value will store in locals[0] and locals[2]
-         * rather than locals[0] and locals[1].
-         */
-        /* Load long from local variable */
-        case i_lload_0:
-        case i_lload_1:
-        case i_lload_2:
-        case i_lload_3: {
-            int64_t param = current - i_lload_0;
-            int64_t loaded;
-            loaded = locals[param].entry.long_value;
-            push_long(op_stack, loaded);
-
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Load object from local variable */
-        case i_aload: {
-            int32_t param = code_buf[pc + 1];
-            object_t *obj = locals[param].entry.ptr_value;
-
-            push_ref(op_stack, obj);
-            pc += 2;
-        } break;
+        do_aload: {
+            int32_t param = ip->operand;
+            object_t *obj = locals[param].ptr_value;
 
-        /* Load object from local variable */
-        case i_aload_0:
-        case i_aload_1:
-        case i_aload_2:
-        case i_aload_3: {
-            int32_t param = current - i_aload_0;
-            object_t *obj = locals[param].entry.ptr_value;
             push_ref(op_stack, obj);
-            pc += 1;
-            break;
-        }
-
-        /* Load int from local variable */
-        case i_iload_0:
-        case i_iload_1:
-        case i_iload_2:
-        case i_iload_3: {
-            int32_t param = current - i_iload_0;
-            int32_t loaded;
-
-            loaded = locals[param].entry.int_value;
-            push_int(op_stack, loaded);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Load int from local variable */
-        case i_iload: {
-            int32_t param = code_buf[pc + 1];
+        do_iload: {
+            int32_t param = ip->operand;
             int32_t loaded;
 
-            loaded = locals[param].entry.int_value;
+            loaded = locals[param].long_value;
             push_int(op_stack, loaded);
 
-            pc += 2;
-            break;
+            NEXT();
         }
 
         /* Store long into local variable */
-        case i_lstore: {
-            int32_t param = code_buf[pc + 1];
+        do_lstore: {
+            int32_t param = ip->operand;
             int64_t stored = pop_int(op_stack);
-            locals[param].entry.long_value = stored;
-            locals[param].type = STACK_ENTRY_LONG;
+            locals[param].long_value = stored;
 
-            pc += 2;
-            break;
+            NEXT();
         }
 
         /* Store object from local variable */
-        case i_astore: {
-            int32_t param = code_buf[pc + 1];
-            locals[param].entry.ptr_value = pop_ref(op_stack);
-            locals[param].type = STACK_ENTRY_REF;
-            pc += 2;
-            break;
+        do_astore: {
+            int32_t param = ip->operand;
+            locals[param].ptr_value = pop_ref(op_stack);
+            NEXT();
         }
 
         /* Store into int array */
-        case i_iastore: {
+        do_iastore: {
             int32_t value = pop_int(op_stack);
             int64_t idx = pop_int(op_stack);
             int32_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             arr[idx] = value;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Store into long array */
-        case i_lastore: {
+        do_lastore: {
             int64_t value = pop_int(op_stack);
             int64_t idx = pop_int(op_stack);
             int64_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             arr[idx] = value;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Store into reference array */
-        case i_aastore: {
+        do_aastore: {
             void *value = pop_ref(op_stack);
             int64_t idx = pop_int(op_stack);
             void **arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             arr[idx] = value;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Store int byte/char array */
-        case i_bastore:
-        case i_castore: {
+        do_bastore: {
             int64_t value = pop_int(op_stack);
             int64_t idx = pop_int(op_stack);
             int8_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             arr[idx] = value;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Store into short array */
-        case i_sastore: {
+        do_sastore: {
             int64_t value = pop_int(op_stack);
             int64_t idx = pop_int(op_stack);
             int16_t *arr = pop_ref(op_stack);
+            check_array_index(arr, idx);
 
             arr[idx] = value;
-            pc += 1;
-            break;
-        }
-
-        /* Store long into local variable */
-        case i_lstore_0:
-        case i_lstore_1:
-        case i_lstore_2:
-        case i_lstore_3: {
-            int32_t param = current - i_lstore_0;
-            int64_t stored = pop_int(op_stack);
-            locals[param].entry.long_value = stored;
-            locals[param].type = STACK_ENTRY_LONG;
-
-            pc += 1;
-            break;
-        }
-
-        /* Store int into local variable */
-        case i_istore: {
-            int32_t param = code_buf[pc + 1];
-            int32_t stored = pop_int(op_stack);
-            locals[param].entry.int_value = stored;
-            locals[param].type = STACK_ENTRY_INT;
-            pc += 2;
-            break;
+            NEXT();
         }
 
         /* Store int into local variable */
-        case i_istore_0:
-        case i_istore_1:
-        case i_istore_2:
-        case i_istore_3: {
-            int32_t param = current - i_istore_0;
+        do_istore: {
+            int32_t param = ip->operand;
             int32_t stored = pop_int(op_stack);
-            locals[param].entry.int_value = stored;
-            locals[param].type = STACK_ENTRY_INT;
-            pc += 1;
-            break;
-        }
-
-        /* Store object from local variable */
-        case i_astore_0:
-        case i_astore_1:
-        case i_astore_2:
-        case i_astore_3: {
-            int32_t param = current - i_astore_0;
-            locals[param].entry.ptr_value = pop_ref(op_stack);
-            locals[param].type = STACK_ENTRY_REF;
-            pc += 1;
-            break;
+            locals[param].long_value = stored;
+            NEXT();
         }
 
         /* discard the top value on the stack */
-        case i_pop: {
+        do_pop: {
             op_stack->size--;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* duplicate the value on top of the stack */
-        case i_dup: {
+        do_dup: {
             op_stack->store[op_stack->size] = op_stack->store[op_stack->size - 1];
             op_stack->size++;
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Increment local variable by constant */
-        case i_iinc: {
-            uint8_t i = code_buf[pc + 1];
-            int8_t b = code_buf[pc + 2]; /* signed value */
-            locals[i].entry.int_value += b;
-            pc += 3;
-            break;
+        do_iinc: {
+            int32_t i = ip->operand;
+            int32_t b = ip->operand2; /* signed value */
+            locals[i].long_value = (int32_t) (locals[i].long_value + b);
+            NEXT();
         }
 
         /* Convert int to long */
-        case i_i2l: {
+        do_i2l: {
             int32_t stored = pop_int(op_stack);
             push_long(op_stack, (int64_t) stored);
 
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Convert int to char */
-        case i_l2i: {
+        do_l2i: {
             int64_t stored = pop_int(op_stack);
             push_int(op_stack, (int32_t) stored);
 
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Push byte */
-        case i_bipush:
-            bipush(op_stack, pc, code_buf);
-            pc += 2;
-            break;
+        do_bipush:
+            push_byte(op_stack, ip->operand);
+            NEXT();
 
         /* Add int */
-        case i_iadd:
+        do_iadd:
             iadd(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Add long */
-        case i_ladd: {
+        do_ladd: {
             int64_t op1 = pop_int(op_stack);
             int64_t op2 = pop_int(op_stack);
 
             push_long(op_stack, op1 + op2);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Subtract int */
-        case i_isub:
+        do_isub:
             isub(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Subtract long */
-        case i_lsub: {
+        do_lsub: {
             int64_t op1 = pop_int(op_stack);
             int64_t op2 = pop_int(op_stack);
 
             push_long(op_stack, op2 - op1);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Multiply int */
-        case i_imul:
+        do_imul:
             imul(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Multiply long */
-        case i_lmul: {
+        do_lmul: {
             int64_t op1 = pop_int(op_stack);
             int64_t op2 = pop_int(op_stack);
 
             push_long(op_stack, op1 * op2);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Divide int */
-        case i_idiv:
+        do_idiv:
             idiv(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Divide long */
-        case i_ldiv: {
+        do_ldiv: {
             int64_t op1 = pop_int(op_stack);
             int64_t op2 = pop_int(op_stack);
 
             push_long(op_stack, op2 / op1);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Remainder int */
-        case i_irem:
+        do_irem:
             irem(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Remainder long */
-        case i_lrem: {
+        do_lrem: {
             int64_t op1 = pop_int(op_stack);
             int64_t op2 = pop_int(op_stack);
 
             push_long(op_stack, op2 % op1);
-            pc += 1;
-            break;
+            NEXT();
         }
 
         /* Negate int */
-        case i_ineg:
+        do_ineg:
             ineg(op_stack);
-            pc += 1;
-            break;
+            NEXT();
 
         /* Get static field from class */
-        case i_getstatic: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_getstatic: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
-            char *field_name, *field_descriptor, *class_name;
-            field_t *field = NULL;
-            class_file_t *target_class = NULL;
+            /* call static initialization. Only the class that contains this
+             * field should do static initialization */
+            cp_cache_t *entry = resolve_field(index, clazz);
+            bool initialized = !entry->clazz || initialize_class(entry->clazz);
+            LOAD_FRAME();
+            if (initialized)
+                REWRITE(&&do_getstatic_quick);
+        }
+            /* fall through */
+
+        /* Get static field resolved before */
+        do_getstatic_quick: {
+            uint16_t index = ip->operand;
+            cp_cache_t *entry = &clazz->cp_cache[index];
 
-            class_name = find_field_info_from_index(index, clazz, &field_name, &field_descriptor);
             /* skip java.lang.System in order to support java print
              * method */
-            if (!strcmp(class_name, "java/lang/System")) {
-                pc += 3;
-                break;
-            }
-
-            while (!field) {
-                if (target_class)
-                    class_name = find_class_name_from_index(
-                        target_class->info->super_class, target_class);
-
-                find_or_add_class_to_heap(class_name, prefix, &target_class);
-                assert(target_class && "Failed to load class in i_getstatic");
-
-                field = find_field(field_name, field_descriptor, target_class);
-            }
-
-            /* call static initialization. Only the class that contains this
-             * field should do static initialization */
-            if (!target_class->initialized) {
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
+            if (!entry->field) {
+                NEXT();
             }
 
-            switch (field_descriptor[0]) {
+            switch (entry->field->descriptor[0]) {
             case 'B':
                 /* signed byte */
-                push_byte(op_stack, field->static_var->value.char_value);
+                push_byte(op_stack, entry->field->static_var->value.char_value);
                 break;
             case 'C':
                 /* FIXME: complete Unicode handling */
                 /* unicode character code */
-                push_short(op_stack, field->static_var->value.short_value);
+                push_short(op_stack, entry->field->static_var->value.short_value);
                 break;
             case 'I':
                 /* integer */
-                push_int(op_stack, field->static_var->value.int_value);
+                push_int(op_stack, entry->field->static_var->value.int_value);
                 break;
             case 'J':
                 /* long integer */
-                push_long(op_stack, field->static_var->value.long_value);
+                push_long(op_stack, entry->field->static_var->value.long_value);
                 break;
             case 'S':
                 /* signed short */
-                push_short(op_stack, field->static_var->value.short_value);
+                push_short(op_stack, entry->field->static_var->value.short_value);
                 break;
             case 'Z':
                 /* true or false */
-                push_byte(op_stack, field->static_var->value.char_value);
+                push_byte(op_stack, entry->field->static_var->value.char_value);
                 break;
             case 'L':
                 /* an instance of class */
-                push_ref(op_stack, field->static_var->value.ptr_value);
+                push_ref(op_stack, entry->field->static_var->value.ptr_value);
                 break;
             case '[':
-                push_ref(op_stack, field->static_var->value.ptr_value);
+                push_ref(op_stack, entry->field->static_var->value.ptr_value);
                 break;
             default:
-                fprintf(stderr, "Unknown field descriptor %c\n", field_descriptor[0]);
+                fprintf(stderr, "Unknown field descriptor %c\n", entry->field->descriptor[0]);
                 exit(1);
             }
-            pc += 3;
-            break;
+            NEXT();
         }
 
         /* Put static field to class */
-        case i_putstatic: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_putstatic: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
-            char *field_name, *field_descriptor, *class_name;
-            field_t *field = NULL;
-            class_file_t *target_class = NULL;
-            class_name = find_field_info_from_index(index, clazz, &field_name, &field_descriptor);
+            /* call static initialization. Only the class that contains this
+             * field should do static initialization */
+            cp_cache_t *entry = resolve_field(index, clazz);
+            bool initialized = !entry->clazz || initialize_class(entry->clazz);
+            LOAD_FRAME();
+            if (initialized)
+                REWRITE(&&do_putstatic_quick);
+        }
+            /* fall through */
+
+        /* Put static field resolved before */
+        do_putstatic_quick: {
+            uint16_t index = ip->operand;
+            cp_cache_t *entry = &clazz->cp_cache[index];
 
             /* skip java.lang.System in order to support java print
              * method */
-            if (!strcmp(class_name, "java/lang/System")) {
-                pc += 3;
-                break;
-            }
-
-            while (!field) {
-                if (target_class)
-                    class_name = find_class_name_from_index(
-                        target_class->info->super_class, target_class);
-
-                find_or_add_class_to_heap(class_name, prefix, &target_class);
-                assert(target_class && "Failed to load class in i_putstatic");
-
-                field = find_field(field_name, field_descriptor, target_class);
-            }
-
-            /* call static initialization. Only the class that contains this
-             * field should do static initialization */
-            if (!target_class->initialized) {
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
+            if (!entry->field) {
+                NEXT();
             }
 
-            switch (field_descriptor[0]) {
+            switch (entry->field->descriptor[0]) {
             case 'B':
                 /* signed byte */
-                field->static_var->value.char_value = (u1) pop_int(op_stack);
-                field->static_var->type = VAR_BYTE;
+                entry->field->static_var->value.char_value = (u1) pop_int(op_stack);
+                entry->field->static_var->type = VAR_BYTE;
                 break;
             case 'C':
                 /* FIXME: complete Unicode handling */
                 /* unicode character code */
-                field->static_var->value.char_value = (u2) pop_int(op_stack);
-                field->static_var->type = VAR_SHORT;
+                entry->field->static_var->value.char_value = (u2) pop_int(op_stack);
+                entry->field->static_var->type = VAR_SHORT;
                 break;
             case 'I':
                 /* integer */
-                field->static_var->value.int_value = (u4) pop_int(op_stack);
-                field->static_var->type = VAR_INT;
+                entry->field->static_var->value.int_value = (u4) pop_int(op_stack);
+                entry->field->static_var->type = VAR_INT;
                 break;
             case 'J':
                 /* long integer */
-                field->static_var->value.long_value = (u8) pop_int(op_stack);
-                field->static_var->type = VAR_LONG;
+                entry->field->static_var->value.long_value = (u8) pop_int(op_stack);
+                entry->field->static_var->type = VAR_LONG;
                 break;
             case 'S':
                 /* signed short */
-                field->static_var->value.short_value = (u2) pop_int(op_stack);
-                field->static_var->type = VAR_SHORT;
+                entry->field->static_var->value.short_value = (u2) pop_int(op_stack);
+                entry->field->static_var->type = VAR_SHORT;
                 break;
             case 'Z':
                 /* true or false */
-                field->static_var->value.char_value = (u1) pop_int(op_stack);
-                field->static_var->type = VAR_BYTE;
+                entry->field->static_var->value.char_value = (u1) pop_int(op_stack);
+                entry->field->static_var->type = VAR_BYTE;
                 break;
             case 'L':
                 /* an instance of class ClassName */
-                field->static_var->value.ptr_value = pop_ref(op_stack);
-                field->static_var->type = VAR_PTR;
+                entry->field->static_var->value.ptr_value = pop_ref(op_stack);
+                entry->field->static_var->type = VAR_PTR;
                 break;
             case '[':
-                field->static_var->value.ptr_value = pop_ref(op_stack);
-                field->static_var->type = VAR_ARRAY_PTR;
+                entry->field->static_var->value.ptr_value = pop_ref(op_stack);
+                entry->field->static_var->type = VAR_ARRAY_PTR;
                 break;
             default:
                 fprintf(stderr, "Unknown field descriptor %c\n",
-                        field_descriptor[0]);
+                        entry->field->descriptor[0]);
                 exit(1);
             }
-            pc += 3;
-            break;
+            NEXT();
         }
 
         /* Invoke instance method; dispatch based on class */
-        case i_invokevirtual: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_invokevirtual: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
             /* the method to be called */
             char *method_name, *method_descriptor, *class_name;
-            class_file_t *target_class = NULL;
-            method_t *method = NULL;
-
             class_name = find_method_info_from_index(index, clazz, &method_name, &method_descriptor);
 
             /* to handle print method */
             if (!strcmp(class_name, "java/io/PrintStream")) {
-                stack_entry_t element = top(op_stack);
-
-                switch (element.type) {
-                /* integer */
-                case STACK_ENTRY_INT:
-                case STACK_ENTRY_SHORT:
-                case STACK_ENTRY_BYTE:
-                case STACK_ENTRY_LONG: {
-                    int64_t op = pop_int(op_stack);
-                    printf("%ld\n", op);
+                /* the descriptor tells the type of the argument */
+                switch (method_descriptor[1]) {
+                /* no argument */
+                case ')':
+                    printf("\n");
                     break;
-                }
                 /* string */
-                case STACK_ENTRY_REF: {
+                case 'L':
+                case '[': {
                     void *op = pop_ref(op_stack);
                     if (!op)
                         printf("null\n");
@@ -1146,209 +2357,189 @@ stack_entry_t *execute(method_t *method,
                         printf("%s\n", (char *) op);
                     break;
                 }
-                default:
-                    printf("print type (%d) is not supported\n", element.type);
+                case 'D':
+                case 'F':
+                    op_stack->size--;
+                    printf("print type (%c) is not supported\n",
+                           method_descriptor[1]);
+                    break;
+                /* integer */
+                default: {
+                    int64_t op = pop_int(op_stack);
+                    printf("%ld\n", op);
                     break;
                 }
-                pc += 3;
-                break;
-            }
-
-            /* FIXME: consider method modifier */
-            /* recursively find method from child to parent */
-            while (!method) {
-                if (target_class)
-                    class_name = find_class_name_from_index(
-                        target_class->info->super_class, target_class);
-                find_or_add_class_to_heap(class_name, prefix, &target_class);
-                assert(target_class &&
-                       "Failed to load class in i_invokevirtual");
-                method =
-                    find_method(method_name, method_descriptor, target_class);
+                }
+                NEXT();
             }
 
             /* call static initialization. Only the class that contains this
              * method should do static initialization */
-            if (!target_class->initialized) {
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
+            cp_cache_t *entry = resolve_method(index, clazz);
+            if (entry->intrinsic) {
+                REWRITE(&&do_invoke_intrinsic);
+                goto do_invoke_intrinsic;
             }
-
-            uint16_t num_params = get_number_of_parameters(method);
-            local_variable_t own_locals[method->code.max_locals];
-            memset(own_locals, 0, sizeof(own_locals));
-            for (int i = num_params; i >= 1; i--) {
-                pop_to_local(op_stack, &own_locals[i]);
+            bool initialized = !entry->clazz || initialize_class(entry->clazz);
+            LOAD_FRAME();
+            if (initialized)
+                REWRITE(&&do_invokevirtual_quick);
+        }
+            /* fall through */
+
+        /* Invoke instance method resolved before */
+        do_invokevirtual_quick: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
+            cp_cache_t *entry = &clazz->cp_cache[index];
+
+            /* dispatch on the class of the object, below the arguments */
+            object_t *obj =
+                op_stack->store[op_stack->size - entry->num_params - 1]
+                    .ptr_value;
+            if (!obj)
+                null_pointer_error();
+            vtable_entry_t target = find_virtual_method(
+                &frame->method->inline_caches[ip->operand2], entry,
+                obj->class);
+            if (!target.method) {
+                invoke_thread_method(index, clazz, op_stack);
+                NEXT();
             }
-            object_t *obj = pop_ref(op_stack);
 
             /* first argument is this pointer */
-            own_locals[0].entry.ptr_value = obj;
-            own_locals[0].type = STACK_ENTRY_REF;
-
-            stack_entry_t *exec_res = execute(method, own_locals, target_class);
-            switch (exec_res->type) {
-            case STACK_ENTRY_BYTE:
-                push_int(op_stack, exec_res->entry.char_value);
-                break;
-            case STACK_ENTRY_SHORT:
-                push_int(op_stack, exec_res->entry.short_value);
-                break;
-            case STACK_ENTRY_INT:
-                push_int(op_stack, exec_res->entry.int_value);
-                break;
-            case STACK_ENTRY_LONG:
-                push_long(op_stack, exec_res->entry.long_value);
-                break;
-            case STACK_ENTRY_REF:
-                push_ref(op_stack, exec_res->entry.ptr_value);
-                break;
-            case STACK_ENTRY_NONE:
-                /* nothing */
-                break;
-            default:
-                assert(0 && "unknown return type");
-            }
-
-            free(exec_res);
-            pc += 3;
-            break;
+            push_frame(stack, target.method, target.clazz,
+                       entry->num_params + 1);
+            LOAD_FRAME();
+            START_FRAME();
         }
 
+        /* Push null */
+        do_aconst_null:
+            push_ref(op_stack, NULL);
+            NEXT();
+
         /* Push int constant */
-        case i_iconst_m1:
-        case i_iconst_0:
-        case i_iconst_1:
-        case i_iconst_2:
-        case i_iconst_3:
-        case i_iconst_4:
-        case i_iconst_5:
-            iconst(op_stack, current);
-            pc += 1;
-            break;
+        do_iconst:
+            push_int(op_stack, ip->operand);
+            NEXT();
 
         /* Push long constant */
-        case i_lconst_0:
-        case i_lconst_1: {
-            push_long(op_stack, current - i_lconst_0);
-            pc += 1;
-            break;
+        do_lconst: {
+            push_long(op_stack, ip->operand);
+            NEXT();
         }
 
         /* Push short */
-        case i_sipush:
-            sipush(op_stack, pc, code_buf);
-            pc += 3;
-            break;
+        do_sipush:
+            push_short(op_stack, ip->operand);
+            NEXT();
 
         /* Fetch field from object */
-        case i_getfield: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_getfield: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
-            object_t *obj = pop_ref(op_stack);
-            char *field_name, *field_descriptor;
-            find_field_info_from_index(index, clazz, &field_name, &field_descriptor);
+            resolve_field(index, clazz);
+            REWRITE(&&do_getfield_quick);
+        }
+            /* fall through */
 
-            variable_t *addr = NULL;
-            while (!addr) {
-                addr = find_field_addr(obj, field_name);
-                obj = obj->parent;
-            }
+        /* Fetch field resolved before from object */
+        do_getfield_quick: {
+            uint16_t index = ip->operand;
+            field_t *field = clazz->cp_cache[index].field;
+
+            object_t *obj = pop_ref(op_stack);
+            void *addr = OBJECT_FIELD(obj, field->offset);
 
-            switch (field_descriptor[0]) {
+            switch (field->descriptor[0]) {
+            case 'B':
+            case 'Z':
+                push_int(op_stack, *(int8_t *) addr);
+                break;
+            case 'C':
+                push_int(op_stack, *(uint16_t *) addr);
+                break;
+            case 'S':
+                push_int(op_stack, *(int16_t *) addr);
+                break;
             case 'I':
-                push_int(op_stack, addr->value.int_value);
+                push_int(op_stack, *(int32_t *) addr);
                 break;
             case 'J':
-                push_long(op_stack, addr->value.long_value);
+                push_long(op_stack, *(int64_t *) addr);
                 break;
             case 'L':
             case '[':
-                push_ref(op_stack, addr->value.ptr_value);
+                push_ref(op_stack, *(void **) addr);
                 break;
             default:
                 assert(0 && "Only support integer and reference field");
                 break;
             }
-            pc += 3;
-            break;
+            NEXT();
         }
 
         /* Set field in object */
-        case i_putfield: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
-            int64_t value = 0;
-            void *addr = NULL;
+        do_putfield: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
+
+            resolve_field(index, clazz);
+            REWRITE(&&do_putfield_quick);
+        }
+            /* fall through */
+
+        /* Set field resolved before in object */
+        do_putfield_quick: {
+            uint16_t index = ip->operand;
+            field_t *field = clazz->cp_cache[index].field;
 
             /* get prepared value from the stack */
-            stack_entry_t element = top(op_stack);
-            switch (element.type) {
-            /* integer */
-            case STACK_ENTRY_INT:
-            case STACK_ENTRY_SHORT:
-            case STACK_ENTRY_BYTE:
-            case STACK_ENTRY_LONG:
+            int64_t value = 0;
+            void *ref = NULL;
+            if (field->descriptor[0] == 'L' || field->descriptor[0] == '[')
+                ref = pop_ref(op_stack);
+            else
                 value = pop_int(op_stack);
-                break;
-            case STACK_ENTRY_REF:
-                addr = pop_ref(op_stack);
-                break;
-            default:
-                assert(0 && "Only support integer and reference field");
-                break;
-            }
-
-            object_t *obj = pop_ref(op_stack);
 
             /* update value into object's field */
-            char *field_name, *field_descriptor;
-            find_field_info_from_index(index, clazz, &field_name, &field_descriptor);
-
-            variable_t *var = NULL;
-            while (!var) {
-                var = find_field_addr(obj, field_name);
-                obj = obj->parent;
-            }
+            object_t *obj = pop_ref(op_stack);
+            void *addr = OBJECT_FIELD(obj, field->offset);
 
-            switch (field_descriptor[0]) {
+            switch (field->descriptor[0]) {
+            case 'B':
+            case 'Z':
+                *(int8_t *) addr = value;
+                break;
+            case 'C':
+                *(uint16_t *) addr = value;
+                break;
+            case 'S':
+                *(int16_t *) addr = value;
+                break;
             case 'I':
-                var->value.int_value = (int32_t) value;
-                var->type = VAR_INT;
+                *(int32_t *) addr = value;
                 break;
             case 'J':
-                var->value.long_value = value;
-                var->type = VAR_LONG;
+                *(int64_t *) addr = value;
                 break;
             case 'L':
-                var->value.ptr_value = addr;
-                var->type = VAR_PTR;
-                break;
             case '[':
-                var->value.ptr_value = addr;
-                var->type = VAR_ARRAY_PTR;
+                *(void **) addr = ref;
                 break;
             default:
                 assert(0 && "Only support integer and reference field");
                 break;
             }
-            pc += 3;
-            break;
+            NEXT();
         }
 
         /* create new object */
-        case i_new: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_new: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
             char *class_name = find_class_name_from_index(index, clazz);
             class_file_t *target_class;
@@ -1356,7 +2547,7 @@ stack_entry_t *execute(method_t *method,
             class_file_t *list = calloc(1, sizeof(class_file_t));
             init_list(list);
 
-            while (strcmp(class_name, "java/lang/Object")) {
+            while (!is_builtin_class(class_name)) {
                 find_or_add_class_to_heap(class_name, prefix, &target_class);
                 assert(target_class && "Failed to load class in i_new");
                 list_add(target_class, list);
@@ -1366,267 +2557,238 @@ stack_entry_t *execute(method_t *method,
 
             /* reversely call static initialization if class have not been
              * initialized */
-            list_for_each (target_class, list) {
-                if (target_class->initialized)
-                    continue;
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
-            }
-
-            object_t *object = create_object(list);
-            push_ref(op_stack, object);
+            bool initialized = true;
+            list_for_each (target_class, list)
+                initialized &= initialize_class(target_class);
+            LOAD_FRAME();
+
+            /* the class to be created was added first, so it is the last */
+            publish_entry(&clazz->cp_cache[index],
+                          &(cp_cache_t) {.clazz = list->prev});
             list_del(list);
             free(list);
 
-            pc += 3;
-            break;
+            if (initialized)
+                REWRITE(&&do_new_quick);
+        }
+            /* fall through */
+
+        /* create new object of a class resolved before */
+        do_new_quick: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
+
+            object_t *object = create_object(clazz->cp_cache[index].clazz);
+            push_ref(op_stack, object);
+
+            NEXT();
         }
 
         /* Invoke object constructor method */
-        case i_invokespecial: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_invokespecial: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
             /* the method to be called */
             char *method_name, *method_descriptor, *class_name;
             class_name = find_method_info_from_index(index, clazz, &method_name, &method_descriptor);
 
             /* java.lang.Object is the parent for every object, so every object
-             * will finally call java.lang.Object's constructor */
-            if (!strcmp(class_name, "java/lang/Object")) {
-                pop_ref(op_stack);
-                pc += 3;
-                break;
-            }
-
-            class_file_t *target_class;
-            find_or_add_class_to_heap(class_name, prefix, &target_class);
-            assert(target_class && "Failed to load class in i_invokespecial");
-
-            /* call static initialization */
-            if (!target_class->initialized) {
-                target_class->initialized = true;
-                method_t *method = find_method("<clinit>", "()V", target_class);
-                if (method) {
-                    local_variable_t own_locals[method->code.max_locals];
-                    stack_entry_t *exec_res =
-                        execute(method, own_locals, target_class);
-                    assert(exec_res->type == STACK_ENTRY_NONE &&
-                           "<clinit> must not return a value");
-                    free(exec_res);
-                }
+             * will finally call java.lang.Object's constructor. The methods of
+             * java.lang.Thread it calls, its constructors and run(), do
+             * nothing either. */
+            cp_cache_t *entry = &clazz->cp_cache[index];
+            bool initialized = true;
+            if (is_builtin_class(class_name)) {
+                publish_entry(entry,
+                              &(cp_cache_t) {
+                                  .num_params = get_parameter_types(
+                                      method_descriptor, NULL),
+                                  .vtable_index = NO_VTABLE_INDEX});
+            } else {
+                /* call static initialization */
+                resolve_method(index, clazz);
+                initialized = !entry->clazz || initialize_class(entry->clazz);
+                LOAD_FRAME();
             }
+            if (initialized)
+                REWRITE(&&do_invokespecial_quick);
+        }
+            /* fall through */
 
-            /* find constructor method from class */
-            method_t *constructor =
-                find_method(method_name, method_descriptor, target_class);
+        /* Invoke object constructor method resolved before */
+        do_invokespecial_quick: {
+            uint16_t index = ip->operand;
+            cp_cache_t *entry = &clazz->cp_cache[index];
 
-            /* prepare local variables */
-            uint16_t num_params = get_number_of_parameters(constructor);
-            local_variable_t own_locals[constructor->code.max_locals];
-            for (int i = num_params; i >= 1; i--) {
-                pop_to_local(op_stack, &own_locals[i]);
+            if (!entry->method) {
+                op_stack->size -= entry->num_params + 1;
+                NEXT();
             }
 
             /* first argument must be object itself */
-            object_t *obj = pop_ref(op_stack);
-            own_locals[0].entry.ptr_value = obj;
-            own_locals[0].type = STACK_ENTRY_REF;
-
-            stack_entry_t *exec_res =
-                execute(constructor, own_locals, target_class);
-            assert(exec_res->type == STACK_ENTRY_NONE &&
-                   "A constructor must not return a value.");
-            free(exec_res);
-
-            pc += 3;
-            break;
+            SAVE_PC();
+            push_frame(stack, entry->method, entry->clazz,
+                       entry->num_params + 1);
+            LOAD_FRAME();
+            START_FRAME();
         }
 
         /* Invokes a dynamic method */
-        case i_invokedynamic: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
-
-            bootmethods_t *bootstrap_method =
-                find_bootstrap_method(index, clazz);
-            CONSTANT_MethodHandle_info *handle = get_method_handle(
-                &clazz->constant_pool, bootstrap_method->bootstrap_method_ref);
-
-            char *method_name, *method_descriptor;
-            find_method_info_from_index(handle->reference_index, clazz,
-                                        &method_name, &method_descriptor);
-
-            if (strcmp(method_name, "makeConcatWithConstants"))
-                assert(0 && "Only support makeConcatWithConstants");
-
-            char *arg = NULL;
-            arg = get_string_utf(&clazz->constant_pool,
-                                 bootstrap_method->bootstrap_arguments[0]);
-
-            /* In the first argument string, there are three types of character
-             * \1 (Unicode point 0001): an ordinary argument.
-             * \2 (Unicode point 0002): a constant.
-             * Any other char value: a single character constant.
-             *
-             * \1 will be replaced by value in the stack
-             * \2 will be replaced by value in other bootstrap arguments
-             */
-            uint16_t num_params = 0;
-            uint16_t num_constant = 0;
-            char *iter = arg;
-            while (*iter != '\0') {
-                if (*iter == 1 || *iter == 2) {
-                    num_params++;
-                }
-                iter++;
-            }
-            num_constant = strlen(arg) - num_params;
-            char **recipe = calloc(sizeof(char *), num_params);
-            size_t max_len = 0;
-
-            iter = arg;
-            int curr = 0,
-                arg_num = bootstrap_method->num_bootstrap_arguments - 1;
-            while (*iter != '\0') {
-                if (*iter == 1) {
-                    stack_entry_t element = top(op_stack);
-                    switch (element.type) {
-                    /* integer */
-                    case STACK_ENTRY_INT:
-                    case STACK_ENTRY_SHORT:
-                    case STACK_ENTRY_BYTE:
-                    case STACK_ENTRY_LONG: {
-                        int64_t value = pop_int(op_stack);
-                        /* 20 is the maximal digits in 64 bits sign integer */
-                        char str[20];
-                        /* integer to string */
-                        snprintf(str, 20, "%ld", value);
-                        char *dest = create_string(clazz, str);
-                        recipe[curr] = dest;
-                        break;
-                    }
-                    /* string */
-                    case STACK_ENTRY_REF: {
-                        recipe[curr] = (char *) pop_ref(op_stack);
-                        break;
-                    }
-                    default: {
-                        printf("unknown stack top type (%d)\n", element.type);
-                        break;
-                    }
-                    }
-                    max_len += strlen(recipe[curr++]);
-                } else if (*iter == 2) {
-                    recipe[curr] = get_string_utf(
-                        &clazz->constant_pool,
-                        bootstrap_method->bootstrap_arguments[arg_num--]);
-                    max_len += strlen(recipe[curr++]);
-                }
-                iter++;
-            }
+        do_invokedynamic: {
+            /* link the call site the first time it runs, keeping the plan of
+             * another thread which linked it meanwhile */
+            concat_plan_t *plan = link_concat(ip->operand, clazz);
+            concat_plan_t *linked = NULL;
+            if (!__atomic_compare_exchange_n(
+                    &frame->method->concat_plans[ip->operand2], &linked, plan,
+                    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                free(plan);
+            REWRITE(&&do_invokedynamic_quick);
+        }
+            /* fall through */
+
+        /* Concatenate strings by the plan of the call site */
+        do_invokedynamic_quick: {
+            SAVE_PC();
+            concat_plan_t *plan =
+                LOAD_ACQUIRE(&frame->method->concat_plans[ip->operand2]);
+            char *dest = run_concat(plan, stack, clazz);
+            /* toString() methods may have moved the frames */
+            LOAD_FRAME();
+            push_ref(op_stack, dest);
+            NEXT();
+        }
 
-            max_len += num_constant;
-            char *result = calloc(max_len + 1, sizeof(char));
+        /* Get length of array */
+        do_arraylength: {
+            void *arr = pop_ref(op_stack);
+            if (!arr)
+                array_access_error(arr, 0);
 
-            iter = arg;
-            while (*iter != '\0') {
-                if (*iter == 1 || *iter == 2) {
-                    strcat(result, recipe[--num_params]);
-                } else {
-                    strncat(result, iter, 1);
-                }
-                iter++;
-            }
-            result[max_len] = '\0';
+            push_int(op_stack, ARRAY_LENGTH(arr));
+            NEXT();
+        }
 
-            char *dest = create_string(clazz, result);
-            push_ref(op_stack, dest);
-            free(recipe);
-            free(result);
+        /* Throw an exception, which nothing catches as exceptions are not
+         * supported */
+        do_athrow: {
+            object_t *obj = pop_ref(op_stack);
+            if (!obj)
+                null_pointer_error();
+            char *name =
+                find_class_name_from_index(obj->class->info->this_class,
+                                           obj->class);
+            fprintf(stderr, "Exception in thread \"%s\" ",
+                    current_thread->name);
+            for (; *name; name++)
+                fputc(*name == '/' ? '.' : *name, stderr);
+            fputc('\n', stderr);
+            exit(1);
+        }
 
-            /* two bytes values indicate the class in constant pool and the next
-             * two bytes are always zero, program counter should plus five.
-             */
-            pc += 5;
-            break;
+        /* Enter the monitor of an object, which stays on the operand stack
+         * meanwhile */
+        do_monitorenter: {
+            SAVE_PC();
+            void *ref = op_stack->store[op_stack->size - 1].ptr_value;
+            if (!ref)
+                null_pointer_error();
+            monitor_enter(ref);
+            pop_ref(op_stack);
+            NEXT();
+        }
+
+        /* Exit the monitor of an object */
+        do_monitorexit: {
+            void *ref = pop_ref(op_stack);
+            if (!ref)
+                null_pointer_error();
+            monitor_exit(ref);
+            NEXT();
         }
 
         /* Create new array */
-        case i_newarray: {
-            uint8_t index = code_buf[pc + 1];
+        do_newarray: {
+            SAVE_PC();
+            uint8_t index = ip->operand;
 
             size_t element_size = 0;
+            const char *element = NULL;
             switch (index) {
             case T_BOOLEN:
+                element_size = sizeof(int8_t);
+                element = "Z";
+                break;
             case T_CHAR:
+                element_size = sizeof(int8_t);
+                element = "C";
+                break;
             case T_BYTE:
                 element_size = sizeof(int8_t);
+                element = "B";
                 break;
             case T_SHORT:
                 element_size = sizeof(int16_t);
+                element = "S";
                 break;
             case T_INT:
                 element_size = sizeof(int32_t);
+                element = "I";
                 break;
             case T_LONG:
                 element_size = sizeof(int64_t);
+                element = "J";
                 break;
             case T_FLOAT:
                 element_size = sizeof(float);
+                element = "F";
                 break;
             case T_DOUBLE:
                 element_size = sizeof(double);
+                element = "D";
                 break;
             }
 
             int count = pop_int(op_stack);
-            int *dimensions = malloc(sizeof(int));
-            dimensions[0] = count;
-            void *arr = create_array(clazz, 1, dimensions, element_size);
+            int dimensions[1] = {count};
+            void *arr =
+                create_array(element, 1, dimensions, element_size, false);
 
             push_ref(op_stack, arr);
-            pc += 2;
-            break;
+            NEXT();
         }
 
         /* Create new array of reference */
-        case i_anewarray: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
+        do_anewarray: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
 
             int count = pop_int(op_stack);
-            int *dimensions = malloc(sizeof(int));
+            int dimensions[1] = {count};
             class_file_t *target_class = NULL;
 
             /* FIXME: if clazz is string, then it cannot be found in the class
              * heap. */
             char *class_name = find_class_name_from_index(index, clazz);
-            dimensions[0] = count;
 
-            find_or_add_class_to_heap(class_name, prefix, &target_class);
+            /* the elements may be arrays themselves, which have no class */
+            if (class_name[0] != '[')
+                find_or_add_class_to_heap(class_name, prefix, &target_class);
             void *arr =
-                create_array(target_class, 1, dimensions, sizeof(void *));
+                create_array(class_name, 1, dimensions, sizeof(void *), true);
 
             push_ref(op_stack, arr);
-            pc += 3;
-            break;
+            NEXT();
         }
 
         /* Create new multidimensional array */
-        case i_multianewarray: {
-            uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
-            uint16_t index = ((param1 << 8) | param2);
-            uint8_t dimension = code_buf[pc + 3];
+        do_multianewarray: {
+            SAVE_PC();
+            uint16_t index = ip->operand;
+            uint8_t dimension = ip->operand2;
             size_t type_size = 0;
+            class_file_t *target_class = NULL;
 
             char *class_name = find_class_name_from_index(index, clazz);
             char *last = strrchr(class_name, '[') + 1;
@@ -1652,7 +2814,6 @@ stack_entry_t *execute(method_t *method,
                 char *class_name = malloc(strlen(last + 1));
                 strncpy(class_name, last + 1, strlen(last + 1) - 1);
                 class_name[strlen(last + 1) - 1] = '\0';
-                class_file_t *target_class = NULL;
 
                 /* FIXME: if clazz is string, then it cannot be found in the
                  * class heap. */
@@ -1667,51 +2828,191 @@ stack_entry_t *execute(method_t *method,
                 exit(1);
                 break;
             }
-            int *dimensions = malloc(sizeof(int) * dimension);
+            /* with fewer dimensions than the type has, the last dimension
+             * holds references to arrays */
+            bool is_ref = *last == 'L' || last - class_name > dimension;
+            if (is_ref)
+                type_size = sizeof(void *);
+
+            int dimensions[dimension];
             for (int i = dimension - 1; i >= 0; --i) {
                 dimensions[i] = pop_int(op_stack);
             }
 
-            void *arr = create_array(clazz, dimension, dimensions, type_size);
+            void *arr = create_array(class_name + 1, dimension, dimensions,
+                                     type_size, is_ref);
             push_ref(op_stack, arr);
-            pc += 4;
-            break;
+            NEXT();
+        }
+
+        /* Run the compiled code of the method from the instruction at ip,
+         * compiling the method first */
+        run_compiled: {
+            method_t *method = frame->method;
+            jit_code_t *jit = LOAD_ACQUIRE(&method->jit);
+            /* synchronized methods are left to the interpreter, which holds
+             * their monitor */
+            if (!jit && jit_enabled &&
+                !(method->access_flags & IS_SYNCHRONIZED))
+                jit = compile_method(method, clazz);
+            if (!jit) {
+                /* not now, so count from scratch */
+                __atomic_store_n(&method->hotness, 0, __ATOMIC_RELAXED);
+                DISPATCH();
+            }
+            /* deep in compiled calls, the C stack is not to grow further */
+            if (!jit->entries[ip - insns] || jit_depth >= MAX_JIT_DEPTH)
+                DISPATCH();
+
+            jit_depth++;
+            jit_exit_t exit = jit_run(jit, locals, ip - insns);
+            jit_depth--;
+            if (exit.index != JIT_RETURNED) {
+                LOAD_FRAME();
+                op_stack->size = method->stack_depths[exit.index];
+                ip = insns + exit.index;
+                /* compiled code stops at loops for the garbage collector */
+                SAFEPOINT();
+                DISPATCH();
+            }
+
+            stack_entry_t ret = {.type = return_type(method)};
+            ret.entry.long_value = exit.value;
+            if (stack->depth == depth) {
+                pop_frame(stack);
+                return ret;
+            }
+            return_from_frame(stack, ret);
+            LOAD_FRAME();
+            ip = insns + frame->pc;
+            DISPATCH();
         }
 
-        default:
-            fprintf(stderr, "Unknown instruction %x\n", current);
+        /* An opcode which is not supported */
+        do_unknown:
+            fprintf(stderr, "Unknown instruction %x\n", ip->operand);
             exit(1);
-        }
+
+        /* Past the last instruction of the method */
+        do_end:
+            fprintf(stderr, "Fell off the end of method %s\n",
+                    frame->method->name);
+            exit(1);
+
+        /* Count the instruction at ip before running it, with -Xprof */
+        do_profile:
+            goto *profile_insn(stack, frame->method, ip - insns);
+
+        /* Return from a synchronized method, letting its monitor go */
+        do_sync_return:
+            monitor_exit(frame->monitor);
+            goto *handlers[ip->operand];
     }
-    return NULL;
+}
+
+/* how the class-data-sharing archive of the main class is used */
+typedef enum {
+    SHARE_AUTO, /* map the archive if it is there and up to date */
+    SHARE_ON,   /* fail without a usable archive */
+    SHARE_OFF,
+    SHARE_DUMP, /* write the archive instead of running */
+} share_mode_t;
+
+/* a file next to the class file of the main class, e.g. Foo.jsa for the
+ * archive */
+static char *get_output_path(const char *class_path, const char *extension)
+{
+    size_t length = strlen(class_path);
+    if (length > strlen(".class") &&
+        !strcmp(class_path + length - strlen(".class"), ".class"))
+        length -= strlen(".class");
+    char *path = malloc(length + strlen(extension) + 1);
+    assert(path && "Failed to allocate output path");
+    memcpy(path, class_path, length);
+    strcpy(path + length, extension);
+    return path;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2)
+    share_mode_t share = SHARE_AUTO;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "-Xshare:auto")) {
+            share = SHARE_AUTO;
+        } else if (!strcmp(argv[arg], "-Xshare:on")) {
+            share = SHARE_ON;
+        } else if (!strcmp(argv[arg], "-Xshare:off")) {
+            share = SHARE_OFF;
+        } else if (!strcmp(argv[arg], "-Xshare:dump")) {
+            share = SHARE_DUMP;
+        } else if (!strcmp(argv[arg], "-Xint")) {
+            /* interpret only */
+            jit_enabled = false;
+        } else if (!strcmp(argv[arg], "-Xcomp")) {
+            /* compile methods on their first invocation */
+            jit_threshold = 0;
+        } else if (!strcmp(argv[arg], "-Xprof")) {
+            /* profile the interpreter, which runs every method */
+            profiling = true;
+            jit_enabled = false;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (arg >= argc)
         return -1;
+    char *class_path = argv[arg];
 
-    /* attempt to read given class file */
-    FILE *class_file = fopen(argv[1], "r");
-    assert(class_file && "Failed to open file");
-
-    /* parse the class file */
-    class_file_t *clazz = malloc(sizeof(class_file_t));
-    *clazz = get_class(class_file);
-
-    int error = fclose(class_file);
-    assert(!error && "Failed to close file");
+    char *match = strrchr(class_path, '/');
+    if (match != NULL) {
+        /* get the prefix from path */
+        prefix = malloc((match - class_path + 2));
+        strncpy(prefix, class_path, match - class_path + 1);
+        prefix[match - class_path + 1] = '\0';
+    }
 
+    init_threads();
     init_class_heap();
     init_object_heap();
+    init_monitors();
+
+    class_file_t *clazz = NULL;
+    char *archive_path = get_output_path(class_path, ".jsa");
+    if (share == SHARE_AUTO || share == SHARE_ON) {
+        clazz = map_archive(archive_path, prefix);
+        if (!clazz && share == SHARE_ON) {
+            fprintf(stderr, "Failed to map archive %s\n", archive_path);
+            exit(1);
+        }
+    }
 
-    add_class(clazz, argv[1]);
-    char *match = strrchr(argv[1], '/');
-    if (match != NULL) {
-        /* get the prefix from path */
-        prefix = malloc((match - argv[1] + 2));
-        strncpy(prefix, argv[1], match - argv[1] + 1);
-        prefix[match - argv[1] + 1] = '\0';
+    if (!clazz) {
+        /* attempt to read given class file */
+        class_reader_t class_file;
+        bool found = read_class_file(class_path, &class_file);
+        assert(found && "Failed to open file");
+
+        /* parse the class file */
+        clazz = malloc(sizeof(class_file_t));
+        *clazz = get_class(&class_file);
+        link_class(clazz, prefix);
+        add_class(clazz);
+    }
+
+    if (share == SHARE_DUMP) {
+        bool dumped = dump_archive(archive_path, clazz, prefix);
+        if (!dumped)
+            fprintf(stderr, "Failed to write archive %s\n", archive_path);
+        free(archive_path);
+        free_object_heap();
+        free_class_heap();
+        free_monitors();
+        free_threads();
+        free(prefix);
+        return dumped ? 0 : 1;
     }
+    free(archive_path);
 
     /* execute the main method if found */
     method_t *main_method =
@@ -1719,15 +3020,26 @@ int main(int argc, char *argv[]) {
     assert(main_method && "Missing main() method");
 
     /* FIXME: locals[0] contains a reference to String[] args, but right now
-     * we lack of the support for java.lang.Object. Leave it uninitialized.
+     * we lack of the support for java.lang.Object. Leave it null.
      */
-    local_variable_t locals[main_method->code.max_locals];
-    stack_entry_t *result = execute(main_method, locals, clazz);
-    assert(result->type == STACK_ENTRY_NONE && "main() should return void");
-    free(result);
+    java_stack_t *stack = &current_thread->stack;
+    push_frame(stack, main_method, clazz, 0)->locals[0].ptr_value = NULL;
+    stack_entry_t result = execute(stack);
+    assert(result.type == STACK_ENTRY_NONE && "main() should return void");
+    /* the program goes on until every thread it started is done */
+    join_all_threads();
+    if (profiling) {
+        /* the folded stacks are for flame graphs */
+        char *folded_path = get_output_path(class_path, ".folded");
+        profile_report(stderr, folded_path);
+        free(folded_path);
+    }
 
     free_object_heap();
     free_class_heap();
+    free_monitors();
+    free_threads();
+    unmap_archive();
     free(prefix);
 
     return 0;
@@ -0,0 +1,220 @@
+/* for sched_yield() */
+#define _XOPEN_SOURCE 700
+
+#include <sched.h>
+#include <stdio.h>
+
+#include "monitor.h"
+#include "thread.h"
+
+/* initial number of slots, always a power of two */
+#define INIT_MONITORS 64
+
+/* times a thread tries to take a monitor before it blocks on it */
+#define SPIN_LIMIT 64
+
+/* open addressing hash table of the monitors, keyed on the object. A larger
+ * copy replaces it as it fills up, and the replaced ones are kept until the
+ * world is stopped, for the threads that may still look monitors up in them.
+ */
+typedef struct monitor_table {
+    u4 capacity;
+    struct monitor_table *retired;
+    monitor_t *slots[];
+} monitor_table_t;
+
+static monitor_table_t *table;
+static u4 monitors_length;
+
+/* held to add monitors */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static monitor_table_t *create_table(u4 capacity)
+{
+    monitor_table_t *t =
+        calloc(1, sizeof(monitor_table_t) + sizeof(monitor_t *) * capacity);
+    assert(t && "Failed to allocate monitors");
+    t->capacity = capacity;
+    return t;
+}
+
+void init_monitors()
+{
+    table = create_table(INIT_MONITORS);
+    monitors_length = 0;
+}
+
+/* the slot of the monitor of an object, or the empty slot to put it */
+static monitor_t **find_slot(monitor_table_t *t, void *object)
+{
+    u4 mask = t->capacity - 1;
+    /* the low bits of an address are the same for every allocation */
+    u4 i = (u4) (((uintptr_t) object >> 3) * 2654435761u) & mask;
+    monitor_t *monitor;
+    while ((monitor = LOAD_ACQUIRE(&t->slots[i])) && monitor->object != object)
+        i = (i + 1) & mask;
+    return &t->slots[i];
+}
+
+/* the monitor of an object, or NULL if it never had one */
+static monitor_t *find_monitor(void *object)
+{
+    return LOAD_ACQUIRE(find_slot(LOAD_ACQUIRE(&table), object));
+}
+
+/* put every monitor of the table in a new one of the given capacity */
+static monitor_table_t *copy_table(monitor_table_t *old, u4 capacity)
+{
+    monitor_table_t *t = create_table(capacity);
+    for (u4 i = 0; i < old->capacity; i++) {
+        if (old->slots[i])
+            *find_slot(t, old->slots[i]->object) = old->slots[i];
+    }
+    return t;
+}
+
+/* the monitor of an object, created the first time */
+static monitor_t *get_monitor(void *object)
+{
+    monitor_t *monitor = find_monitor(object);
+    if (monitor)
+        return monitor;
+
+    pthread_mutex_lock(&table_lock);
+    monitor_t **slot = find_slot(table, object);
+    if (!*slot) {
+        /* keep at most half of the slots used */
+        if (2 * (monitors_length + 1) > table->capacity) {
+            monitor_table_t *t = copy_table(table, 2 * table->capacity);
+            t->retired = table;
+            STORE_RELEASE(&table, t);
+            slot = find_slot(table, object);
+        }
+        monitor = calloc(1, sizeof(monitor_t));
+        assert(monitor && "Failed to allocate monitor");
+        monitor->object = object;
+        pthread_mutex_init(&monitor->mutex, NULL);
+        pthread_cond_init(&monitor->released, NULL);
+        STORE_RELEASE(slot, monitor);
+        monitors_length++;
+    }
+    monitor = *slot;
+    pthread_mutex_unlock(&table_lock);
+    return monitor;
+}
+
+static bool try_enter(monitor_t *monitor, java_thread_t *self)
+{
+    java_thread_t *owner = NULL;
+    return __atomic_compare_exchange_n(&monitor->owner, &owner, self, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Enter the monitor of an object, once the thread holding it lets it go. The
+ * frames of the current thread must be saved, as it may block.
+ *
+ * @param object the object, which is not NULL
+ */
+void monitor_enter(void *object)
+{
+    java_thread_t *self = current_thread;
+    monitor_t *monitor = get_monitor(object);
+
+    for (int i = 0; i < SPIN_LIMIT; i++) {
+        if (try_enter(monitor, self))
+            return;
+        if (__atomic_load_n(&monitor->owner, __ATOMIC_RELAXED) == self) {
+            monitor->count++;
+            return;
+        }
+        sched_yield();
+    }
+
+    /* inflate the monitor: its owner signals the waiters when it exits */
+    __atomic_add_fetch(&monitor->waiters, 1, __ATOMIC_SEQ_CST);
+    block_thread();
+    pthread_mutex_lock(&monitor->mutex);
+    while (!try_enter(monitor, self))
+        pthread_cond_wait(&monitor->released, &monitor->mutex);
+    pthread_mutex_unlock(&monitor->mutex);
+    __atomic_sub_fetch(&monitor->waiters, 1, __ATOMIC_SEQ_CST);
+    unblock_thread();
+}
+
+/**
+ * Exit the monitor of an object, which the current thread holds
+ *
+ * @param object the object, which is not NULL
+ */
+void monitor_exit(void *object)
+{
+    monitor_t *monitor = find_monitor(object);
+    if (!monitor ||
+        __atomic_load_n(&monitor->owner, __ATOMIC_RELAXED) != current_thread) {
+        fprintf(stderr,
+                "Exception in thread \"%s\" "
+                "java.lang.IllegalMonitorStateException\n",
+                current_thread->name);
+        exit(1);
+    }
+    if (monitor->count) {
+        monitor->count--;
+        return;
+    }
+
+    __atomic_store_n(&monitor->owner, NULL, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&monitor->waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&monitor->mutex);
+        pthread_cond_signal(&monitor->released);
+        pthread_mutex_unlock(&monitor->mutex);
+    }
+}
+
+static void free_monitor(monitor_t *monitor)
+{
+    pthread_mutex_destroy(&monitor->mutex);
+    pthread_cond_destroy(&monitor->released);
+    free(monitor);
+}
+
+static void free_retired(monitor_table_t *t)
+{
+    while (t) {
+        monitor_table_t *retired = t->retired;
+        free(t);
+        t = retired;
+    }
+}
+
+/* Free the monitors no thread holds or waits for, and the replaced tables.
+ * The world is stopped, so no thread is in between finding a monitor and
+ * entering it. */
+void prune_monitors()
+{
+    monitor_table_t *t = create_table(table->capacity);
+    monitors_length = 0;
+    for (u4 i = 0; i < table->capacity; i++) {
+        monitor_t *monitor = table->slots[i];
+        if (!monitor)
+            continue;
+        if (!monitor->owner && !monitor->waiters) {
+            free_monitor(monitor);
+            continue;
+        }
+        *find_slot(t, monitor->object) = monitor;
+        monitors_length++;
+    }
+    free_retired(table);
+    table = t;
+}
+
+void free_monitors()
+{
+    for (u4 i = 0; i < table->capacity; i++) {
+        if (table->slots[i])
+            free_monitor(table->slots[i]);
+    }
+    free_retired(table);
+    table = NULL;
+}
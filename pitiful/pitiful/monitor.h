@@ -0,0 +1,28 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "type.h"
+
+/* The monitor of an object programs synchronize on. References to strings and
+ * arrays point past their headers, so monitors are kept in a table keyed on
+ * the reference rather than in the objects, and are looked up without locking
+ * once there. A thread takes a free monitor with a compare-and-swap of its
+ * owner, and only blocks on the mutex of the monitor when another thread
+ * holds it: the monitor is then inflated, and its owner wakes a waiter up
+ * when it lets it go.
+ */
+typedef struct monitor {
+    void *object;
+    struct java_thread *owner; /* NULL when free */
+    u4 count;                  /* times the owner entered it again */
+    u4 waiters;                /* threads blocked on the mutex */
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+} monitor_t;
+
+void init_monitors();
+void free_monitors();
+void monitor_enter(void *object);
+void monitor_exit(void *object);
+void prune_monitors();
@@ -1,176 +1,758 @@
+/* for posix_memalign() */
+#define _POSIX_C_SOURCE 200112L
+
+#include "class-heap.h"
+#include "monitor.h"
 #include "object-heap.h"
+#include "thread.h"
+
+/* initial number of objects and references the heap can hold */
+#define INIT_HEAP_SIZE 1024
+
+/* bytes to allocate before the first collection, and the least amount between
+ * two collections */
+#define MIN_GC_THRESHOLD (1 << 20)
+
+/* empty chunks kept for reuse rather than given back after a collection */
+#define MAX_FREE_CHUNKS 64
+
+#define ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+#define CHUNK_OF(obj) \
+    ((chunk_t *) ((uintptr_t) (obj) & ~((uintptr_t) CHUNK_SIZE - 1)))
 
-/* FIXME: use dynamic structure to grow heap size dynamically */
-#define MAX_HEAP_SIZE 5000
+/* the characters of a string object, after the headers */
+#define STRING_CHARS(obj) \
+    ((char *) OBJECT_FIELD(obj, sizeof(object_t) + sizeof(string_header_t)))
 
 static object_heap_t object_heap;
 
+/* objects found reachable but whose references are not traced yet */
+static object_t **mark_stack;
+static u4 mark_length, mark_capacity;
+
+/* what the object keeping an array holds after its header */
+typedef struct {
+    void *elements;    /* the outermost dimension */
+    uint8_t dimension; /* total dimensions in the array */
+    size_t size;       /* bytes taken by the object, with all dimensions */
+} array_info_t;
+
 void init_object_heap()
 {
-    /* max contain 5000 objects */
-    object_heap.objects = malloc(sizeof(object_t *) * MAX_HEAP_SIZE);
+    init_recursive_mutex(&object_heap.lock);
     object_heap.length = 0;
+    object_heap.capacity = INIT_HEAP_SIZE;
+    object_heap.objects = malloc(sizeof(object_t *) * object_heap.capacity);
+    object_heap.refs_length = 0;
+    object_heap.refs_capacity = 2 * INIT_HEAP_SIZE;
+    object_heap.refs = calloc(object_heap.refs_capacity, sizeof(heap_ref_t));
+    object_heap.chunks_length = 0;
+    object_heap.chunks_capacity = 16;
+    object_heap.chunks = malloc(sizeof(chunk_t *) * object_heap.chunks_capacity);
+    object_heap.free_chunks = NULL;
+    object_heap.free_ranges = NULL;
+    object_heap.strings_length = 0;
+    object_heap.strings_capacity = INIT_HEAP_SIZE;
+    object_heap.strings = calloc(object_heap.strings_capacity, sizeof(char *));
+    assert(object_heap.objects && object_heap.refs && object_heap.chunks &&
+           object_heap.strings && "Failed to allocate object heap");
+    object_heap.allocated = 0;
+    object_heap.threshold = MIN_GC_THRESHOLD;
+}
+
+/* the entry of the address, or the empty entry to put it */
+static heap_ref_t *find_ref(void *addr)
+{
+    u4 mask = object_heap.refs_capacity - 1;
+    /* the low bits of an address are the same for every allocation */
+    u4 i = (u4) (((uintptr_t) addr >> 4) * 2654435761u) & mask;
+    while (object_heap.refs[i].addr && object_heap.refs[i].addr != addr)
+        i = (i + 1) & mask;
+    return &object_heap.refs[i];
+}
+
+/* put the references of all objects in a new table of the given capacity */
+static void rebuild_refs(u4 capacity);
+
+/* let a reference to the address lead the collector to the object */
+static void add_ref(void *addr, object_t *object)
+{
+    if (!addr)
+        return;
+    /* keep at most half of the entries used */
+    if (2 * (object_heap.refs_length + 1) > object_heap.refs_capacity)
+        rebuild_refs(2 * object_heap.refs_capacity);
+    heap_ref_t *ref = find_ref(addr);
+    if (!ref->addr)
+        object_heap.refs_length++;
+    ref->addr = addr;
+    ref->object = object;
+}
+
+/* whether an array stored in another one is still its own sub-array, rather
+ * than an array put there by the program */
+static bool is_sub_array(object_t *obj, void *arr)
+{
+    array_info_t *info = OBJECT_FIELD(obj, sizeof(object_t));
+    return (u1 *) arr > (u1 *) obj && (u1 *) arr < (u1 *) obj + info->size;
+}
+
+/* add every dimension of the array to the references */
+static void add_array_refs(object_t *obj,
+                           uint8_t depth,
+                           uint8_t dimension,
+                           void **arr)
+{
+    add_ref(arr, obj);
+    if (depth == dimension - 1)
+        return;
+    for (u4 i = 0; i < ARRAY_LENGTH(arr); ++i) {
+        if (is_sub_array(obj, arr[i]))
+            add_array_refs(obj, depth + 1, dimension, arr[i]);
+    }
+}
+
+static void add_object_refs(object_t *obj)
+{
+    switch (obj->type) {
+    case VAR_STR_PTR:
+        add_ref(STRING_CHARS(obj), obj);
+        break;
+    case VAR_ARRAY_PTR: {
+        array_info_t *info = OBJECT_FIELD(obj, sizeof(object_t));
+        add_array_refs(obj, 0, info->dimension, info->elements);
+        break;
+    }
+    default:
+        add_ref(obj, obj);
+        break;
+    }
+}
+
+static void rebuild_refs(u4 capacity)
+{
+    free(object_heap.refs);
+    object_heap.refs_capacity = capacity;
+    object_heap.refs = calloc(capacity, sizeof(heap_ref_t));
+    assert(object_heap.refs && "Failed to grow object heap");
+    object_heap.refs_length = 0;
+    for (u4 i = 0; i < object_heap.length; ++i)
+        add_object_refs(object_heap.objects[i]);
+}
+
+/* the object owning the address of a reference, or NULL */
+static object_t *find_object(void *addr)
+{
+    if (!addr)
+        return NULL;
+    return find_ref(addr)->object;
+}
+
+/* keep track of a new object and of the bytes it takes, in its thread until
+ * the next collection */
+static void add_object(object_t *obj, size_t size)
+{
+    java_thread_t *self = current_thread;
+    if (self->allocations_length == self->allocations_capacity) {
+        self->allocations_capacity = self->allocations_capacity
+                                         ? 2 * self->allocations_capacity
+                                         : INIT_HEAP_SIZE;
+        self->allocations =
+            realloc(self->allocations,
+                    sizeof(object_t *) * self->allocations_capacity);
+        assert(self->allocations && "Failed to grow allocations");
+    }
+    obj->marked = false;
+    self->allocations[self->allocations_length++] = obj;
+    self->allocated += size;
+}
+
+/* move the objects a thread allocated to the object heap. The heap is locked,
+ * or the other threads are stopped. */
+static void take_allocations(java_thread_t *thread)
+{
+    if (object_heap.length + thread->allocations_length >
+        object_heap.capacity) {
+        while (object_heap.length + thread->allocations_length >
+               object_heap.capacity)
+            object_heap.capacity *= 2;
+        object_heap.objects = realloc(
+            object_heap.objects, sizeof(object_t *) * object_heap.capacity);
+        assert(object_heap.objects && "Failed to grow object heap");
+    }
+    if (thread->allocations_length)
+        memcpy(object_heap.objects + object_heap.length, thread->allocations,
+               sizeof(object_t *) * thread->allocations_length);
+    object_heap.length += thread->allocations_length;
+    thread->allocations_length = 0;
+    object_heap.allocated += thread->allocated;
+    thread->allocated = 0;
+    /* the collector may free the chunk the thread allocates from */
+    thread->tlab.top = thread->tlab.end = NULL;
 }
 
 /**
- * Create an java object.
+ * Give the objects a thread allocated to the object heap, before the thread
+ * goes away
  *
- * @param clazz the list of classes that contains the created class and all its
- * parent classess
- * @return the object that wanted to be created
+ * @param thread the current thread, whose frames are saved
  */
-object_t *create_object(class_file_t *clazz)
+void flush_allocations(java_thread_t *thread)
 {
-    object_t *new_obj = NULL, *parent = NULL;
-    class_file_t *pos;
-    list_for_each (pos, clazz) {
-        new_obj = malloc(sizeof(object_t));
-        new_obj->fields_count = pos->fields_count;
-        new_obj->value = calloc(sizeof(variable_t), new_obj->fields_count);
-        new_obj->parent = parent;
-        for (int i = 0; i < pos->fields_count; ++i) {
-            new_obj->value[i].type = VAR_NONE;
+    lock_mutex(&object_heap.lock);
+    take_allocations(thread);
+    pthread_mutex_unlock(&object_heap.lock);
+}
+
+/* start allocating from free lines with room for an object of the given
+ * size, or else from an empty chunk */
+static void refill_tlab(tlab_t *tlab, size_t size)
+{
+    /* the lines too few for the object are left until the next collection */
+    while (object_heap.free_ranges) {
+        free_range_t *range = object_heap.free_ranges;
+        object_heap.free_ranges = range->next;
+        u1 *end = range->end;
+        if ((size_t) (end - (u1 *) range) >= size) {
+            memset(range, 0, end - (u1 *) range);
+            tlab->top = (u1 *) range;
+            tlab->end = end;
+            return;
         }
-        new_obj->class = pos;
-        parent = new_obj;
     }
-    /* only store object that really is needed in object heap */
-    object_heap.objects[object_heap.length++] = new_obj;
 
-    return new_obj;
+    chunk_t *chunk = object_heap.free_chunks;
+    if (chunk) {
+        object_heap.free_chunks = chunk->next_free;
+    } else {
+        void *memory;
+        int error = posix_memalign(&memory, CHUNK_SIZE, CHUNK_SIZE);
+        assert(!error && "Failed to allocate chunk");
+        chunk = memory;
+
+        if (object_heap.chunks_length == object_heap.chunks_capacity) {
+            object_heap.chunks_capacity *= 2;
+            object_heap.chunks =
+                realloc(object_heap.chunks,
+                        sizeof(chunk_t *) * object_heap.chunks_capacity);
+            assert(object_heap.chunks && "Failed to grow object heap");
+        }
+        object_heap.chunks[object_heap.chunks_length++] = chunk;
+    }
+
+    /* zero the whole chunk at once rather than each object */
+    memset(chunk, 0, CHUNK_SIZE);
+    tlab->top = (u1 *) chunk + ALIGN(sizeof(chunk_t));
+    tlab->end = (u1 *) chunk + CHUNK_SIZE;
 }
 
-char *create_string(class_file_t *clazz, char *src)
+/* Large objects and refills of the allocation buffer, which lock the heap.
+ * The collector runs first if it is due, so that the new object is never
+ * collected. */
+static void *allocate_slow(size_t size)
 {
-    size_t len = strlen(src);
-    char *dest = calloc((len + 1), sizeof(char));
-    strncpy(dest, src, len);
-
-    object_t *str_obj = malloc(sizeof(object_t));
-    str_obj->value = malloc(sizeof(variable_t));
-    str_obj->value->type = VAR_STR_PTR;
-    str_obj->value->value.ptr_value = dest;
-    str_obj->class = clazz;
-    str_obj->parent = NULL;
-    str_obj->fields_count = 1;
+    java_thread_t *self = current_thread;
+    lock_mutex(&object_heap.lock);
+    object_heap.allocated += self->allocated;
+    self->allocated = 0;
+    if (object_heap.allocated >= object_heap.threshold)
+        collect_garbage();
 
-    object_heap.objects[object_heap.length++] = str_obj;
+    void *memory;
+    if (size > LARGE_OBJECT_SIZE) {
+        memory = calloc(1, size);
+        assert(memory && "Failed to allocate large object");
+    } else {
+        refill_tlab(&self->tlab, size);
+        memory = self->tlab.top;
+        self->tlab.top += size;
+    }
+    pthread_mutex_unlock(&object_heap.lock);
+    return memory;
+}
 
-    return dest;
+/* zeroed memory for an object, bumped from the allocation buffer of the
+ * current thread. The frames of the thread must be saved. */
+static inline void *allocate(size_t size)
+{
+    tlab_t *tlab = &current_thread->tlab;
+    size = ALIGN(size);
+    if (size <= LARGE_OBJECT_SIZE && size <= (size_t) (tlab->end - tlab->top)) {
+        void *memory = tlab->top;
+        tlab->top += size;
+        return memory;
+    }
+    return allocate_slow(size);
 }
 
 /**
- * Build an array recursively.
+ * Create an java object.
  *
- * @param depth the current dfs depth
- * @param dimension number of dimension in the array
- * @param n_elements the array represents number of element in each dimension
- * @param type_size element size of the array
- * @return the array that wanted be created
+ * @param clazz the linked class of the object, which gives the size of the
+ * object and the offsets of its fields
+ * @return the object that wanted to be created, with all fields zeroed
  */
-void **build_array(uint8_t depth,
-                   int dimension,
-                   int *n_elements,
-                   size_t type_size)
+object_t *create_object(class_file_t *clazz)
 {
-    void **arr;
-    if (depth == dimension - 1) {
-        arr = calloc(n_elements[depth], type_size);
-    } else {
-        arr = calloc(n_elements[depth], sizeof(void *));
-        for (int i = 0; i < n_elements[depth]; ++i) {
-            *(arr + i) =
-                build_array(depth + 1, dimension, n_elements, type_size);
-        }
+    size_t size = OBJECT_PREFIX + clazz->instance_size;
+    u1 *memory = allocate(size);
+    object_t *new_obj = (object_t *) (memory + OBJECT_PREFIX);
+    REF_KIND(new_obj) = OBJECT_REF;
+    new_obj->class = clazz;
+    new_obj->type = VAR_PTR;
+
+    add_object(new_obj, size);
+
+    return new_obj;
+}
+
+/* the characters follow the headers of the string, and the caller writes the
+ * given number of them */
+char *allocate_string(class_file_t *clazz, size_t length)
+{
+    size_t size = sizeof(object_t) + sizeof(string_header_t) + length + 1;
+    object_t *str_obj = allocate(size);
+    str_obj->class = clazz;
+    str_obj->type = VAR_STR_PTR;
+    char *dest = STRING_CHARS(str_obj);
+    STRING_LENGTH(dest) = length;
+    STRING_HEADER(dest)->kind = STRING_REF;
+    dest[length] = '\0';
+
+    add_object(str_obj, size);
+
+    return dest;
+}
+
+/* the hash of String.hashCode(), over bytes rather than UTF-16 units */
+static u4 hash_chars(const char *chars, size_t length)
+{
+    u4 hash = 0;
+    for (size_t i = 0; i < length; i++)
+        hash = 31 * hash + (u1) chars[i];
+    return hash;
+}
+
+u4 string_hash(char *str)
+{
+    string_header_t *header = STRING_HEADER(str);
+    /* a hash of 0 is computed again each time, as in Java */
+    if (!header->hash)
+        header->hash = hash_chars(str, header->length);
+    return header->hash;
+}
+
+/* the entry of the interned string with the characters, or the empty entry to
+ * put it */
+static char **find_interned(const char *chars, size_t length, u4 hash)
+{
+    u4 mask = object_heap.strings_capacity - 1;
+    u4 i = hash & mask;
+    for (char *str; (str = object_heap.strings[i]); i = (i + 1) & mask) {
+        if (STRING_LENGTH(str) == length && string_hash(str) == hash &&
+            !memcmp(str, chars, length))
+            break;
     }
-    return arr;
+    return &object_heap.strings[i];
 }
 
 /**
- * Free the array recursively.
+ * Find the string with the given characters, which is created the first time.
+ * The interned strings live as long as the program.
  *
- * @param obj the object that contains the array
- * @param depth the current dfs depth
- * @param dimension number of dimension in the array
- * @return arr the array that will be freed
+ * @param clazz the class creating the string
+ * @param src the characters, NUL terminated
+ * @return the interned string
  */
-void free_array(object_t *obj, uint8_t depth, int dimension, void **arr)
+char *intern_string(class_file_t *clazz, char *src)
 {
-    if (depth != dimension - 1) {
-        for (int i = 0; i < ((int *) (obj->value[1].value.ptr_value))[depth];
-             ++i) {
-            free_array(obj, depth + 1, dimension, *(arr + i));
+    size_t length = strlen(src);
+    u4 hash = hash_chars(src, length);
+    lock_mutex(&object_heap.lock);
+    char **entry = find_interned(src, length, hash);
+    if (*entry) {
+        pthread_mutex_unlock(&object_heap.lock);
+        return *entry;
+    }
+
+    char *str = memcpy(allocate_string(clazz, length), src, length);
+    STRING_HEADER(str)->hash = hash;
+
+    /* keep at most half of the entries used */
+    if (2 * (object_heap.strings_length + 1) > object_heap.strings_capacity) {
+        char **strings = object_heap.strings;
+        u4 capacity = object_heap.strings_capacity;
+        object_heap.strings_capacity *= 2;
+        object_heap.strings =
+            calloc(object_heap.strings_capacity, sizeof(char *));
+        assert(object_heap.strings && "Failed to grow string table");
+        for (u4 i = 0; i < capacity; i++) {
+            if (strings[i])
+                *find_interned(strings[i], STRING_LENGTH(strings[i]),
+                               string_hash(strings[i])) = strings[i];
         }
+        free(strings);
+        entry = find_interned(src, length, hash);
+    }
+    *entry = str;
+    object_heap.strings_length++;
+    pthread_mutex_unlock(&object_heap.lock);
+    return str;
+}
+
+/* fail like the Java virtual machine when a dimension is negative */
+static void check_array_size(int count)
+{
+    if (count < 0) {
+        fprintf(stderr,
+                "Exception in thread \"%s\" "
+                "java.lang.NegativeArraySizeException: %d\n",
+                current_thread->name, count);
+        exit(1);
     }
-    free(arr);
+}
+
+/* bytes taken by each sub-array of the given dimension, with its header */
+static size_t sub_array_size(uint8_t depth,
+                             uint8_t dimension,
+                             int *n_elements,
+                             size_t type_size)
+{
+    size_t element_size = depth == dimension - 1 ? type_size : sizeof(void *);
+    return sizeof(array_header_t) + ALIGN(n_elements[depth] * element_size);
 }
 
 /**
- * Create an array object.
+ * Create an array object. The header of the object is followed by every
+ * dimension of the array in turn, each sub-array preceded by its own
+ * array_header_t, so that a rectangular array takes a single allocation and
+ * the rows of its last dimension lie next to each other.
  *
- * @param clazz class of the element in the array, but only meaningful when
- * types are not primitive types
+ * @param element type of the elements of the outermost dimension: its
+ * descriptor, or the name of their class. Each sub-array has the type one
+ * dimension less deep, so a multi-dimensional array needs a descriptor.
  * @param dimension number of dimension in the array
  * @param n_elements the array represents number of element in each dimension
  * @param type_size element size of the array
+ * @param is_ref whether the elements are references, to be traced by the
+ * garbage collector
  * @return the array that wanted be created
  */
-void *create_array(class_file_t *clazz,
+void *create_array(const char *element,
                    uint8_t dimension,
                    int *n_elements,
-                   size_t type_size)
-{
-    void *arr = build_array(0, dimension, n_elements, type_size);
-    object_t *arr_obj = malloc(sizeof(object_t));
-    arr_obj->value = malloc(sizeof(variable_t) * 3);
-    /* element 0: array memory
-     * element 1: number of elements in each dimension
-     * element 2: total dimensions in the array
-     */
-    arr_obj->value[0].type = VAR_ARRAY_PTR;
-    arr_obj->value[0].value.ptr_value = arr;
-    arr_obj->value[1].type = VAR_PTR;
-    arr_obj->value[1].value.ptr_value = n_elements;
-    arr_obj->value[2].type = VAR_BYTE;
-    arr_obj->value[2].value.char_value = dimension;
-    arr_obj->class = clazz;
-    arr_obj->parent = NULL;
-    arr_obj->fields_count = 1;
-
-    object_heap.objects[object_heap.length++] = arr_obj;
-
-    return (void *) arr;
-}
-
-variable_t *find_field_addr(object_t *obj, char *name)
-{
-    field_t *field = obj->class->fields;
-    for (u2 i = 0; i < obj->class->fields_count; i++, field++) {
-        if (!strcmp(field->name, name)) {
-            return &obj->value[i];
+                   size_t type_size,
+                   bool is_ref)
+{
+    for (int i = 0; i < dimension; ++i)
+        check_array_size(n_elements[i]);
+
+    size_t size = sizeof(object_t) + ALIGN(sizeof(array_info_t));
+    size_t count = 1;
+    for (int i = 0; i < dimension; ++i) {
+        size += count * sub_array_size(i, dimension, n_elements, type_size);
+        count *= n_elements[i];
+    }
+
+    object_t *arr_obj = allocate(size);
+    arr_obj->class = NULL;
+    arr_obj->type = VAR_ARRAY_PTR;
+    array_info_t *info = OBJECT_FIELD(arr_obj, sizeof(object_t));
+    info->dimension = dimension;
+    info->size = size;
+
+    u1 *memory = OBJECT_FIELD(info, ALIGN(sizeof(array_info_t)));
+    u1 *parents = NULL;
+    size_t parent_stride = 0;
+    count = 1;
+    for (int i = 0; i < dimension; ++i) {
+        bool last = i == dimension - 1;
+        size_t stride = sub_array_size(i, dimension, n_elements, type_size);
+        for (size_t j = 0; j < count; ++j) {
+            array_header_t *header = (array_header_t *) (memory + j * stride);
+            header->element = element + i;
+            header->length = n_elements[i];
+            header->element_size = last ? type_size : sizeof(void *);
+            header->is_ref = last ? is_ref : true;
+            header->kind = ARRAY_REF;
+
+            /* the j-th sub-array is an element of the previous dimension */
+            if (i == 0) {
+                info->elements = header + 1;
+            } else {
+                void **parent = (void **) (parents +
+                                           j / n_elements[i - 1] *
+                                               parent_stride +
+                                           sizeof(array_header_t));
+                parent[j % n_elements[i - 1]] = header + 1;
+            }
         }
+        parents = memory;
+        parent_stride = stride;
+        memory += count * stride;
+        count *= n_elements[i];
     }
-    return NULL;
+
+    add_object(arr_obj, size);
+
+    return info->elements;
 }
 
-void free_object_heap()
+static size_t object_size(object_t *obj)
+{
+    switch (obj->type) {
+    case VAR_STR_PTR:
+        return sizeof(object_t) + sizeof(string_header_t) +
+               STRING_LENGTH(STRING_CHARS(obj)) + 1;
+    case VAR_ARRAY_PTR:
+        return ((array_info_t *) OBJECT_FIELD(obj, sizeof(object_t)))->size;
+    default:
+        return OBJECT_PREFIX + obj->class->instance_size;
+    }
+}
+
+/* where the memory of an object starts, in front of its header */
+static void *object_start(object_t *obj)
+{
+    return obj->type == VAR_PTR ? (u1 *) obj - OBJECT_PREFIX : (u1 *) obj;
+}
+
+/* objects in chunks go with their chunk, the others are freed one by one */
+static void free_object(object_t *obj)
+{
+    if (ALIGN(object_size(obj)) > LARGE_OBJECT_SIZE)
+        free(object_start(obj));
+}
+
+/* mark the object a reference leads to, if not marked yet */
+static void mark(void *addr)
+{
+    object_t *obj = find_object(addr);
+    if (!obj || obj->marked)
+        return;
+    obj->marked = true;
+
+    if (mark_length == mark_capacity) {
+        mark_capacity = mark_capacity ? 2 * mark_capacity : INIT_HEAP_SIZE;
+        mark_stack = realloc(mark_stack, sizeof(object_t *) * mark_capacity);
+        assert(mark_stack && "Failed to grow mark stack");
+    }
+    mark_stack[mark_length++] = obj;
+}
+
+/* mark the references in the last dimension of an array, and the arrays the
+ * program put in place of its own sub-arrays */
+static void mark_array(object_t *obj,
+                       uint8_t depth,
+                       uint8_t dimension,
+                       void **arr)
+{
+    if (!ARRAY_HEADER(arr)->is_ref)
+        return;
+    for (u4 i = 0; i < ARRAY_LENGTH(arr); ++i) {
+        if (depth != dimension - 1 && is_sub_array(obj, arr[i]))
+            mark_array(obj, depth + 1, dimension, arr[i]);
+        else
+            mark(arr[i]);
+    }
+}
+
+/* mark the objects the fields and elements of an object refer to */
+static void trace(object_t *obj)
 {
-    for (int i = 0; i < object_heap.length; ++i) {
-        /* free object and all its parent */
-        for (object_t *cur = object_heap.objects[i], *next; cur; cur = next) {
-            next = cur->parent;
-            if (cur->value) {
-                if (cur->value->type == VAR_STR_PTR) {
-                    free(cur->value->value.ptr_value);
-                } else if (cur->value->type == VAR_ARRAY_PTR) {
-                    free_array(cur, 0, cur->value[2].value.char_value,
-                               cur->value[0].value.ptr_value);
-                    free(cur->value[1].value.ptr_value);
-                }
+    switch (obj->type) {
+    case VAR_STR_PTR:
+        break;
+    case VAR_ARRAY_PTR: {
+        array_info_t *info = OBJECT_FIELD(obj, sizeof(object_t));
+        mark_array(obj, 0, info->dimension, info->elements);
+        break;
+    }
+    default:
+        for (u2 i = 0; i < obj->class->ref_fields_count; ++i)
+            mark(*(void **) OBJECT_FIELD(obj, obj->class->ref_offsets[i]));
+        break;
+    }
+}
+
+static void mark_static_fields(class_file_t *clazz)
+{
+    field_t *field = clazz->fields;
+    for (u2 i = 0; i < clazz->fields_count; i++, field++) {
+        if ((field->access_flags & IS_STATIC) &&
+            (field->descriptor[0] == 'L' || field->descriptor[0] == '['))
+            mark(field->static_var->value.ptr_value);
+    }
+}
+
+/* a frame pushed but not run yet, as its method is not decoded, only has the
+ * arguments of the method in its first locals */
+static void mark_arguments(frame_t *frame)
+{
+    method_t *method = frame->method;
+    int local = 0;
+    if (!(method->access_flags & IS_STATIC))
+        mark(frame->locals[local++].ptr_value);
+    char types[256];
+    uint16_t num_params = get_parameter_types(method->descriptor, types);
+    for (uint16_t i = 0; i < num_params; i++, local++) {
+        if (types[i] == 'L' || types[i] == '[')
+            mark(frame->locals[local].ptr_value);
+    }
+}
+
+/* mark the Thread object of a thread, and the references in the locals and
+ * operand stacks of its frames, as the reference map of the instruction each
+ * frame runs tells */
+static void mark_thread(java_thread_t *thread)
+{
+    mark(thread->object);
+    java_stack_t *stack = &thread->stack;
+    for (int i = 0; i < stack->depth; ++i) {
+        frame_t *frame = &stack->frames[i];
+        method_t *method = frame->method;
+        if (!method->insns) {
+            mark_arguments(frame);
+            continue;
+        }
+        /* the instruction being run is the one before pc */
+        u4 insn = frame->pc ? frame->pc - 1 : 0;
+        u1 *map = method->ref_maps + insn * REF_MAP_SIZE(method);
+        int slots = method->code.max_locals + frame->op_stack.size;
+        for (int slot = 0; slot < slots; ++slot) {
+            if (IS_REF_SLOT(map, slot))
+                mark(frame->locals[slot].ptr_value);
+        }
+    }
+}
+
+/* mark the lines of its chunk an object in a chunk takes */
+static void mark_lines(u1 *start, size_t size)
+{
+    chunk_t *chunk = CHUNK_OF(start);
+    size_t offset = start - (u1 *) chunk;
+    size_t last = (offset + size - 1) / LINE_SIZE;
+    for (size_t line = offset / LINE_SIZE; line <= last; ++line)
+        chunk->lines[line] = true;
+}
+
+/* put the runs of lines no live object takes in a chunk with live objects to
+ * the free ranges, and return how many lines the live objects take */
+static size_t add_free_ranges(chunk_t *chunk)
+{
+    size_t used = 0;
+    for (size_t line = 0; line < CHUNK_LINES; ++line)
+        used += chunk->lines[line];
+    if (!used)
+        return 0;
+
+    /* the lines of the header of the chunk are never free */
+    size_t line = (sizeof(chunk_t) + LINE_SIZE - 1) / LINE_SIZE;
+    while (line < CHUNK_LINES) {
+        if (chunk->lines[line]) {
+            line++;
+            continue;
+        }
+        free_range_t *range = (void *) ((u1 *) chunk + line * LINE_SIZE);
+        while (line < CHUNK_LINES && !chunk->lines[line])
+            line++;
+        range->end = (u1 *) chunk + line * LINE_SIZE;
+        range->next = object_heap.free_ranges;
+        object_heap.free_ranges = range;
+    }
+    return used;
+}
+
+/**
+ * Free every object that can not be reached from the threads, the static
+ * fields of the loaded classes or the interned strings. The heap is locked,
+ * and the other threads are stopped meanwhile.
+ */
+void collect_garbage()
+{
+    stop_the_world();
+    for_each_thread(take_allocations);
+    u4 capacity = INIT_HEAP_SIZE * 2;
+    while (capacity < 2 * object_heap.length)
+        capacity *= 2;
+    rebuild_refs(capacity);
+
+    mark_length = 0;
+    for_each_thread(mark_thread);
+    for_each_class(mark_static_fields);
+    for (u4 i = 0; i < object_heap.strings_capacity; ++i)
+        mark(object_heap.strings[i]);
+    while (mark_length)
+        trace(mark_stack[--mark_length]);
+
+    /* sweep, marking the lines of the chunks live objects take */
+    for (u4 i = 0; i < object_heap.chunks_length; ++i)
+        memset(object_heap.chunks[i]->lines, 0,
+               sizeof(object_heap.chunks[i]->lines));
+    size_t occupied = 0;
+    u4 length = 0;
+    for (u4 i = 0; i < object_heap.length; ++i) {
+        object_t *obj = object_heap.objects[i];
+        if (!obj->marked) {
+            free_object(obj);
+            continue;
+        }
+        obj->marked = false;
+        size_t size = ALIGN(object_size(obj));
+        if (size <= LARGE_OBJECT_SIZE)
+            mark_lines(object_start(obj), size);
+        else
+            occupied += size;
+        object_heap.objects[length++] = obj;
+    }
+    object_heap.length = length;
+
+    /* reuse the chunks without live objects, including the ones the threads
+     * were allocating from, and the free lines of the others */
+    object_heap.free_chunks = NULL;
+    object_heap.free_ranges = NULL;
+    u4 free_chunks = 0;
+    length = 0;
+    for (u4 i = 0; i < object_heap.chunks_length; ++i) {
+        chunk_t *chunk = object_heap.chunks[i];
+        size_t lines = add_free_ranges(chunk);
+        if (!lines) {
+            if (free_chunks == MAX_FREE_CHUNKS) {
+                free(chunk);
+                continue;
             }
-            free(cur->value);
-            free(cur);
+            chunk->next_free = object_heap.free_chunks;
+            object_heap.free_chunks = chunk;
+            free_chunks++;
         }
+        occupied += lines * LINE_SIZE;
+        object_heap.chunks[length++] = chunk;
     }
+    object_heap.chunks_length = length;
+
+    /* the monitors of objects freed are not held */
+    prune_monitors();
+
+    object_heap.allocated = 0;
+    /* partly used lines count in full, as they are not allocated from */
+    object_heap.threshold =
+        occupied > MIN_GC_THRESHOLD ? occupied : MIN_GC_THRESHOLD;
+    resume_the_world();
+}
+
+/* the other threads are done */
+void free_object_heap()
+{
+    take_allocations(current_thread);
+    for (u4 i = 0; i < object_heap.length; ++i)
+        free_object(object_heap.objects[i]);
+    for (u4 i = 0; i < object_heap.chunks_length; ++i)
+        free(object_heap.chunks[i]);
+    free(object_heap.chunks);
     free(object_heap.objects);
-}
\ No newline at end of file
+    free(object_heap.refs);
+    free(object_heap.strings);
+    free(mark_stack);
+    pthread_mutex_destroy(&object_heap.lock);
+}
@@ -1,33 +1,146 @@
 #pragma once
 
+#include <pthread.h>
 #include <string.h>
 
 #include "classfile.h"
+#include "frame.h"
 #include "list.h"
 
+/* Header of an object. The instance fields, including the inherited ones,
+ * follow it in the same allocation at the offsets given by their field_t.
+ */
 typedef struct object {
-    variable_t *value;
     class_file_t *class;
-    size_t fields_count;
-    struct object *parent;
+    variable_type_t type; /* VAR_PTR, or VAR_STR_PTR and VAR_ARRAY_PTR for the
+                           * objects keeping strings and arrays */
+    bool marked;          /* reachable in the current garbage collection */
 } object_t;
 
+/* address of the field at the given byte offset in an object */
+#define OBJECT_FIELD(obj, offset) ((void *) ((u1 *) (obj) + (offset)))
+
+/* What a reference leads to, kept in the byte right before it: the last byte
+ * of the header of a string or array, or of a word allocated in front of an
+ * object. It tells strings, arrays and objects apart where the type of a
+ * reference, such as Object, does not.
+ */
+typedef enum { OBJECT_REF = 1, STRING_REF, ARRAY_REF } ref_kind_t;
+
+#define REF_KIND(ref) (((u1 *) (ref))[-1])
+
+/* the word in front of an object, ending with its kind */
+#define OBJECT_PREFIX sizeof(void *)
+
+/* Header in front of the elements of every array, and of every sub-array of a
+ * multi-dimensional one. A reference to an array is the address of its first
+ * element, so the elements are indexed directly and the header is found right
+ * before them.
+ */
+typedef struct {
+    const char *element; /* type of the elements: its descriptor, or the name
+                          * of their class */
+    u4 length;
+    u2 element_size;
+    bool is_ref; /* the elements are references */
+    u1 kind;     /* ARRAY_REF */
+} array_header_t;
+
+#define ARRAY_HEADER(arr) ((array_header_t *) (arr) - 1)
+#define ARRAY_LENGTH(arr) (ARRAY_HEADER(arr)->length)
+
+/* Header in front of the characters of every string. A reference to a string
+ * is the address of its characters, which are also NUL terminated.
+ */
+typedef struct {
+    u4 length; /* in bytes of modified UTF-8 */
+    u4 hash;   /* as String.hashCode() gives it, or 0 until computed */
+    u1 unused[3];
+    u1 kind; /* STRING_REF */
+} string_header_t;
+
+#define STRING_HEADER(str) ((string_header_t *) (str) - 1)
+#define STRING_LENGTH(str) (STRING_HEADER(str)->length)
+
+/* A reference on the Java stack or in a field is the address of an object, of
+ * the characters of a string, or of the elements of an array (or of one of
+ * its sub-arrays). An entry maps such an address to the object owning it.
+ */
 typedef struct {
-    u2 length;
+    void *addr;
+    object_t *object;
+} heap_ref_t;
+
+/* Objects are bump allocated from chunks of CHUNK_SIZE bytes, aligned to their
+ * size, so that the chunk of an object is found from its address. Objects too
+ * large for a chunk are allocated on their own.
+ */
+#define CHUNK_SIZE (64 * 1024)
+#define LARGE_OBJECT_SIZE (CHUNK_SIZE / 8)
+
+/* Chunks are divided in lines. A collection marks the lines live objects take,
+ * and allocates from the runs of unmarked lines between them again, so that a
+ * few survivors do not keep a whole chunk from being reused.
+ */
+#define LINE_SIZE 256
+#define CHUNK_LINES (CHUNK_SIZE / LINE_SIZE)
+
+/* at the start of each chunk */
+typedef struct chunk {
+    struct chunk *next_free;
+    bool lines[CHUNK_LINES]; /* lines in use after the last collection */
+} chunk_t;
+
+/* a run of free lines in a chunk with live objects */
+typedef struct free_range {
+    u1 *end;
+    struct free_range *next;
+} free_range_t;
+
+/* Thread-local allocation buffer: the part of a chunk a thread allocates from
+ * without synchronization.
+ */
+typedef struct {
+    u1 *top;
+    u1 *end;
+} tlab_t;
+
+/* The objects threads allocate are kept by the threads until the next
+ * collection, which gives them to the heap. The references are only looked up
+ * by the collector, which adds them all first.
+ */
+typedef struct {
+    u4 length;
+    u4 capacity;
     object_t **objects;
+    u4 chunks_length;
+    u4 chunks_capacity;
+    chunk_t **chunks;
+    chunk_t *free_chunks;      /* chunks without live objects, for reuse */
+    free_range_t *free_ranges; /* free lines, allocated from before chunks */
+    u4 refs_length;
+    u4 refs_capacity; /* always a power of two */
+    heap_ref_t *refs;
+    u4 strings_length;
+    u4 strings_capacity; /* always a power of two */
+    char **strings;       /* the interned strings, found by their characters */
+    size_t allocated;     /* bytes allocated since the last collection */
+    size_t threshold;     /* bytes to allocate before collecting again */
+    pthread_mutex_t lock; /* held to refill allocation buffers and collect */
 } object_heap_t;
 
+struct java_thread;
+
 void init_object_heap();
 void free_object_heap();
+void collect_garbage();
+void flush_allocations(struct java_thread *thread);
 object_t *create_object(class_file_t *clazz);
-char *create_string(class_file_t *clazz, char *src);
-void **build_array(uint8_t depth,
-                   int dimension,
-                   int *n_elements,
-                   size_t type_size);
-void free_array(object_t *obj, uint8_t depth, int dimension, void **arr);
-void *create_array(class_file_t *clazz,
+char *allocate_string(class_file_t *clazz, size_t length);
+char *intern_string(class_file_t *clazz, char *src);
+u4 string_hash(char *str);
+void *create_array(const char *element,
                    uint8_t dimension,
                    int *dimensions,
-                   size_t type_size);
-variable_t *find_field_addr(object_t *obj, char *name);
\ No newline at end of file
+                   size_t type_size,
+                   bool is_ref);
\ No newline at end of file
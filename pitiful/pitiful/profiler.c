@@ -0,0 +1,375 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcode.h"
+#include "profiler.h"
+#include "thread.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES_UNIT "cycles"
+#else
+#include <time.h>
+#define CYCLES_UNIT "ns"
+#endif
+
+/* methods whose instructions the report lists */
+#define REPORT_METHODS 5
+
+/* names of the opcodes in the reports */
+static const char *const opcode_names[256] = {
+    "nop", "aconst_null", "iconst_m1", "iconst_0", "iconst_1", "iconst_2",
+    "iconst_3", "iconst_4", "iconst_5", "lconst_0", "lconst_1", "fconst_0",
+    "fconst_1", "fconst_2", "dconst_0", "dconst_1", "bipush", "sipush", "ldc",
+    "ldc_w", "ldc2_w", "iload", "lload", "fload", "dload", "aload", "iload_0",
+    "iload_1", "iload_2", "iload_3", "lload_0", "lload_1", "lload_2", "lload_3",
+    "fload_0", "fload_1", "fload_2", "fload_3", "dload_0", "dload_1", "dload_2",
+    "dload_3", "aload_0", "aload_1", "aload_2", "aload_3", "iaload", "laload",
+    "faload", "daload", "aaload", "baload", "caload", "saload", "istore",
+    "lstore", "fstore", "dstore", "astore", "istore_0", "istore_1", "istore_2",
+    "istore_3", "lstore_0", "lstore_1", "lstore_2", "lstore_3", "fstore_0",
+    "fstore_1", "fstore_2", "fstore_3", "dstore_0", "dstore_1", "dstore_2",
+    "dstore_3", "astore_0", "astore_1", "astore_2", "astore_3", "iastore",
+    "lastore", "fastore", "dastore", "aastore", "bastore", "castore", "sastore",
+    "pop", "pop2", "dup", "dup_x1", "dup_x2", "dup2", "dup2_x1", "dup2_x2",
+    "swap", "iadd", "ladd", "fadd", "dadd", "isub", "lsub", "fsub", "dsub",
+    "imul", "lmul", "fmul", "dmul", "idiv", "ldiv", "fdiv", "ddiv", "irem",
+    "lrem", "frem", "drem", "ineg", "lneg", "fneg", "dneg", "ishl", "lshl",
+    "ishr", "lshr", "iushr", "lushr", "iand", "land", "ior", "lor", "ixor",
+    "lxor", "iinc", "i2l", "i2f", "i2d", "l2i", "l2f", "l2d", "f2i", "f2l",
+    "f2d", "d2i", "d2l", "d2f", "i2b", "i2c", "i2s", "lcmp", "fcmpl", "fcmpg",
+    "dcmpl", "dcmpg", "ifeq", "ifne", "iflt", "ifge", "ifgt", "ifle",
+    "if_icmpeq", "if_icmpne", "if_icmplt", "if_icmpge", "if_icmpgt",
+    "if_icmple", "if_acmpeq", "if_acmpne", "goto", "jsr", "ret", "tableswitch",
+    "lookupswitch", "ireturn", "lreturn", "freturn", "dreturn", "areturn",
+    "return", "getstatic", "putstatic", "getfield", "putfield", "invokevirtual",
+    "invokespecial", "invokestatic", "invokeinterface", "invokedynamic", "new",
+    "newarray", "anewarray", "arraylength", "athrow", "checkcast", "instanceof",
+    "monitorenter", "monitorexit", "wide", "multianewarray", "ifnull",
+    "ifnonnull", "goto_w", "jsr_w",
+};
+
+/* A node of the calling context tree, one for each chain of methods calling
+ * each other that was seen, so that the time of a method is kept apart for
+ * each of the paths it is called along.
+ */
+typedef struct call_node {
+    method_t *method;
+    struct call_node *parent;
+    struct call_node *children; /* the first of them */
+    struct call_node *next;     /* sibling called by the same parent */
+    u8 cycles;                  /* in the method itself along this path */
+} call_node_t;
+
+/* a frame of the Java stack, as the profiler saw it entered */
+typedef struct {
+    method_t *method;
+    call_node_t *node;
+    u8 start;   /* cycles when entered */
+    u8 callees; /* cycles spent in the methods it called */
+} profile_frame_t;
+
+static struct {
+    call_node_t root;    /* calls the main method */
+    java_stack_t *stack; /* of the thread profiled */
+    int depth;
+    int max_depth;
+    profile_frame_t *frames;
+    u4 methods_length;
+    u4 methods_capacity;
+    method_t **methods; /* every method profiled */
+    u8 opcodes[256];    /* times each opcode ran */
+    u8 insns;           /* instructions run */
+} profiler;
+
+static inline u8 read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u8) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * Make the decoded instructions of a method run the hook of the profiler,
+ * which goes on with the handlers they had.
+ *
+ * @param method the method just decoded
+ * @param insns the instructions it was decoded into, which the other threads
+ *              do not run yet
+ * @param clazz the class the method belongs to
+ * @param hook where execute() runs profile_insn()
+ */
+void profile_method(method_t *method,
+                    insn_t *insns,
+                    class_file_t *clazz,
+                    const void *hook)
+{
+    method_profile_t *profile = calloc(1, sizeof(method_profile_t));
+    u4 count = method->insns_count;
+    assert(profile && "Failed to allocate method profile");
+    profile->clazz = clazz;
+    profile->insns_count = count;
+    profile->pcs = malloc(sizeof(u4) * count);
+    profile->hits = calloc(count, sizeof(u8));
+    profile->handlers = malloc(sizeof(void *) * count);
+    assert((!count || (profile->pcs && profile->hits && profile->handlers)) &&
+           "Failed to allocate method profile");
+
+    u4 pc = 0;
+    for (u4 i = 0; i < count; i++) {
+        profile->pcs[i] = pc;
+        pc += insn_length(method->code.code[pc]);
+        profile->handlers[i] = insns[i].handler;
+        insns[i].handler = hook;
+    }
+    method->profile = profile;
+
+    if (profiler.methods_length == profiler.methods_capacity) {
+        profiler.methods_capacity =
+            profiler.methods_capacity ? 2 * profiler.methods_capacity : 64;
+        profiler.methods = realloc(
+            profiler.methods, sizeof(method_t *) * profiler.methods_capacity);
+        assert(profiler.methods && "Failed to grow profiled methods");
+    }
+    profiler.methods[profiler.methods_length++] = method;
+}
+
+/* the node of a method called from another node, added the first time */
+static call_node_t *find_callee(call_node_t *caller, method_t *method)
+{
+    call_node_t *node = caller->children;
+    while (node && node->method != method)
+        node = node->next;
+    if (node)
+        return node;
+
+    node = calloc(1, sizeof(call_node_t));
+    assert(node && "Failed to allocate call tree");
+    node->method = method;
+    node->parent = caller;
+    node->next = caller->children;
+    caller->children = node;
+    return node;
+}
+
+static void enter(method_t *method, u8 now)
+{
+    if (profiler.depth == profiler.max_depth) {
+        profiler.max_depth = profiler.max_depth ? 2 * profiler.max_depth : 64;
+        profiler.frames = realloc(profiler.frames, sizeof(profile_frame_t) *
+                                                       profiler.max_depth);
+        assert(profiler.frames && "Failed to grow profiled frames");
+    }
+    call_node_t *caller = profiler.depth
+                              ? profiler.frames[profiler.depth - 1].node
+                              : &profiler.root;
+    profiler.frames[profiler.depth++] = (profile_frame_t){
+        .method = method,
+        .node = find_callee(caller, method),
+        .start = now,
+    };
+    method->profile->invocations++;
+    method->profile->active++;
+}
+
+static void leave(u8 now)
+{
+    profile_frame_t *frame = &profiler.frames[--profiler.depth];
+    u8 total = now - frame->start;
+    u8 self = total - frame->callees;
+    method_profile_t *profile = frame->method->profile;
+
+    frame->node->cycles += self;
+    profile->exclusive += self;
+    /* recursive invocations are counted in the outermost one */
+    if (!--profile->active)
+        profile->inclusive += total;
+    if (profiler.depth)
+        profiler.frames[profiler.depth - 1].callees += total;
+}
+
+/* follow the frames pushed and popped since the last instruction, which are
+ * the only times the clock is read */
+static void catch_up(java_stack_t *stack)
+{
+    u8 now = read_cycles();
+
+    /* frames gone, or replaced by others without running any instruction */
+    while (profiler.depth > stack->depth ||
+           (profiler.depth &&
+            profiler.frames[profiler.depth - 1].method !=
+                stack->frames[profiler.depth - 1].method))
+        leave(now);
+    while (profiler.depth < stack->depth)
+        enter(stack->frames[profiler.depth].method, now);
+}
+
+/**
+ * Count an instruction about to run
+ *
+ * @param stack the Java stack
+ * @param method the method of the frame on top of the stack
+ * @param index the index of the instruction in the method
+ * @return the handler the instruction runs
+ */
+const void *profile_insn(java_stack_t *stack, method_t *method, u4 index)
+{
+    if (stack != profiler.stack) {
+        if (profiler.stack)
+            return LOAD_ACQUIRE(&method->profile->handlers[index]);
+        profiler.stack = stack;
+    }
+    if (profiler.depth != stack->depth ||
+        profiler.frames[profiler.depth - 1].method != method)
+        catch_up(stack);
+
+    method_profile_t *profile = method->profile;
+    profile->hits[index]++;
+    profiler.opcodes[method->code.code[profile->pcs[index]]]++;
+    profiler.insns++;
+    return LOAD_ACQUIRE(&profile->handlers[index]);
+}
+
+static const char *class_name(method_t *method)
+{
+    class_file_t *clazz = method->profile->clazz;
+    return find_class_name_from_index(clazz->info->this_class, clazz);
+}
+
+/* most exclusive time first */
+static int compare_methods(const void *a, const void *b)
+{
+    u8 x = (*(method_t **) a)->profile->exclusive;
+    u8 y = (*(method_t **) b)->profile->exclusive;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* most run first */
+static int compare_opcodes(const void *a, const void *b)
+{
+    u8 x = profiler.opcodes[*(const u1 *) a];
+    u8 y = profiler.opcodes[*(const u1 *) b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static double percent(u8 part, u8 total)
+{
+    return total ? 100.0 * part / total : 0;
+}
+
+/* the methods from the main one down to the node, as flame graphs name them */
+static void write_path(FILE *out, call_node_t *node)
+{
+    if (node->parent->method) {
+        write_path(out, node->parent);
+        fputc(';', out);
+    }
+    fprintf(out, "%s.%s", class_name(node->method), node->method->name);
+}
+
+/* write a line of folded stacks for every node below, and free them */
+static void write_folded(FILE *out, call_node_t *node)
+{
+    for (call_node_t *child = node->children, *next; child; child = next) {
+        if (child->cycles && out) {
+            write_path(out, child);
+            fprintf(out, " %" PRIu64 "\n", child->cycles);
+        }
+        write_folded(out, child);
+        next = child->next;
+        free(child);
+    }
+}
+
+/**
+ * Report where the program spent its time and stop profiling. The frames still
+ * on the Java stack are counted up to now.
+ *
+ * @param out where the text report goes
+ * @param folded_path the file to write the folded stacks to, one line for each
+ *                    path of calls with the cycles spent at its end
+ */
+void profile_report(FILE *out, const char *folded_path)
+{
+    u8 now = read_cycles();
+    while (profiler.depth)
+        leave(now);
+
+    u8 total = 0;
+    for (u4 i = 0; i < profiler.methods_length; i++)
+        total += profiler.methods[i]->profile->exclusive;
+    qsort(profiler.methods, profiler.methods_length, sizeof(method_t *),
+          compare_methods);
+
+    fprintf(out, "Flat profile of %" PRIu64 " " CYCLES_UNIT ", %" PRIu64
+                 " instructions\n\n",
+            total, profiler.insns);
+    fprintf(out, "%8s %15s %15s %11s  %s\n", "self %", "self " CYCLES_UNIT,
+            "total " CYCLES_UNIT, "calls", "method");
+    for (u4 i = 0; i < profiler.methods_length; i++) {
+        method_t *method = profiler.methods[i];
+        method_profile_t *profile = method->profile;
+        if (!profile->invocations)
+            continue;
+        fprintf(out,
+                "%8.2f %15" PRIu64 " %15" PRIu64 " %11" PRIu64 "  %s.%s%s\n",
+                percent(profile->exclusive, total), profile->exclusive,
+                profile->inclusive, profile->invocations, class_name(method),
+                method->name, method->descriptor);
+    }
+
+    u1 opcodes[256];
+    for (int i = 0; i < 256; i++)
+        opcodes[i] = i;
+    qsort(opcodes, 256, sizeof(u1), compare_opcodes);
+    fprintf(out, "\nOpcodes\n\n%15s %7s  %s\n", "count", "%", "opcode");
+    for (int i = 0; i < 256 && profiler.opcodes[opcodes[i]]; i++) {
+        fprintf(out, "%15" PRIu64 " %7.2f  %s\n", profiler.opcodes[opcodes[i]],
+                percent(profiler.opcodes[opcodes[i]], profiler.insns),
+                opcode_names[opcodes[i]] ? opcode_names[opcodes[i]] : "?");
+    }
+
+    for (u4 i = 0; i < profiler.methods_length && i < REPORT_METHODS; i++) {
+        method_t *method = profiler.methods[i];
+        method_profile_t *profile = method->profile;
+        if (!profile->invocations)
+            break;
+        fprintf(out, "\n%s.%s%s\n\n%7s  %-16s %15s\n", class_name(method),
+                method->name, method->descriptor, "pc", "opcode", "hits");
+        for (u4 j = 0; j < profile->insns_count; j++) {
+            if (!profile->hits[j])
+                continue;
+            fprintf(out, "%7" PRIu32 "  %-16s %15" PRIu64 "\n",
+                    profile->pcs[j],
+                    opcode_names[method->code.code[profile->pcs[j]]],
+                    profile->hits[j]);
+        }
+    }
+
+    FILE *folded = fopen(folded_path, "w");
+    if (!folded)
+        fprintf(stderr, "Failed to write folded stacks %s\n", folded_path);
+    write_folded(folded, &profiler.root);
+    profiler.root.children = NULL;
+    if (folded)
+        fclose(folded);
+
+    free(profiler.frames);
+    free(profiler.methods);
+}
+
+void profile_free(method_profile_t *profile)
+{
+    if (!profile)
+        return;
+    free(profile->pcs);
+    free(profile->hits);
+    free(profile->handlers);
+    free(profile);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "classfile.h"
+#include "frame.h"
+
+/* A profiler of the interpreter, on with -Xprof. The decoded instructions of
+ * every method then run a hook first, which counts them and notices the frames
+ * entered and left from the depth of the Java stack, before going on with the
+ * handler they would have run. Without -Xprof no instruction runs the hook, so
+ * the interpreter pays nothing for it. Only the thread which runs first, the
+ * main one, is profiled, as the others run the same instructions.
+ */
+
+typedef struct method_profile {
+    class_file_t *clazz;
+    u8 invocations;
+    u8 inclusive; /* cycles in the method and its callees */
+    u8 exclusive; /* cycles in the method itself */
+    u4 active;    /* invocations of the method on the Java stack */
+    u4 insns_count;
+    u4 *pcs;               /* bytecode offset of each instruction */
+    u8 *hits;              /* times each instruction ran */
+    const void **handlers; /* what each instruction runs after the hook */
+} method_profile_t;
+
+void profile_method(method_t *method,
+                    insn_t *insns,
+                    class_file_t *clazz,
+                    const void *hook);
+const void *profile_insn(java_stack_t *stack, method_t *method, u4 index);
+void profile_report(FILE *out, const char *folded_path);
+void profile_free(method_profile_t *profile);
@@ -20,28 +20,55 @@ typedef enum {
     STACK_ENTRY_FLOAT
 } stack_entry_type_t;
 
+/* a value returned by a method, with its type */
 typedef struct {
     value_t entry;
     stack_entry_type_t type;
 } stack_entry_t;
 
+/* The slots of the operand stack carry no type, which the instructions using
+ * them know. Integers of every size are kept sign-extended to 64 bits, and
+ * the garbage collector finds references from the reference maps of methods.
+ */
 typedef struct {
     int max_size;
     int size;
-    stack_entry_t *store;
+    value_t *store;
 } stack_frame_t;
 
-typedef stack_entry_t local_variable_t;
-
-void init_stack(stack_frame_t *stack, size_t entry_size);
-void push_byte(stack_frame_t *stack, int8_t value);
-void push_short(stack_frame_t *stack, int16_t value);
-void push_int(stack_frame_t *stack, int32_t value);
-void push_long(stack_frame_t *stack, int64_t value);
-void push_ref(stack_frame_t *stack, void *addr);
-int64_t pop_int(stack_frame_t *stack);
-void *pop_ref(stack_frame_t *stack);
-void pop_to_local(stack_frame_t *stack, local_variable_t *locals);
-size_t get_type_size(stack_entry_type_t type);
-int64_t stack_to_int(value_t *entry, size_t size);
-stack_entry_t top(stack_frame_t *stack);
\ No newline at end of file
+typedef value_t local_variable_t;
+
+static inline void push_long(stack_frame_t *stack, int64_t value)
+{
+    stack->store[stack->size++].long_value = value;
+}
+
+static inline void push_byte(stack_frame_t *stack, int8_t value)
+{
+    push_long(stack, value);
+}
+
+static inline void push_short(stack_frame_t *stack, int16_t value)
+{
+    push_long(stack, value);
+}
+
+static inline void push_int(stack_frame_t *stack, int32_t value)
+{
+    push_long(stack, value);
+}
+
+static inline void push_ref(stack_frame_t *stack, void *addr)
+{
+    stack->store[stack->size++].ptr_value = addr;
+}
+
+static inline int64_t pop_int(stack_frame_t *stack)
+{
+    return (int64_t) stack->store[--stack->size].long_value;
+}
+
+static inline void *pop_ref(stack_frame_t *stack)
+{
+    return stack->store[--stack->size].ptr_value;
+}
@@ -0,0 +1,64 @@
+public class ArrayLength {
+    static int[][] grid = new int[3][];
+
+    static int sum(int[][] rows) {
+        int total = 0;
+        for (int i = 0; i < rows.length; i++) {
+            for (int j = 0; j < rows[i].length; j++)
+                total += rows[i][j];
+        }
+        return total;
+    }
+
+    public static void main(String[] args) {
+        int[] empty = new int[0];
+        System.out.println(empty.length);
+
+        long[][][] cube = new long[4][5][6];
+        System.out.println(cube.length);
+        System.out.println(cube[3].length);
+        System.out.println(cube[3][4].length);
+
+        /* longs keep their high bits in arrays */
+        long[] wide = new long[2];
+        wide[1] = 1099511627776L; /* 1L << 40 */
+        wide[0] = wide[1] + wide[1] - 1;
+        cube[3][4][5] = -5000000000L;
+        System.out.println(wide[1]);
+        System.out.println(wide[0]);
+        System.out.println(cube[3][4][5]);
+
+        int[][] matrix = new int[20][30];
+        for (int i = 0; i < matrix.length; i++) {
+            for (int j = 0; j < matrix[i].length; j++)
+                matrix[i][j] = i * j;
+        }
+        System.out.println(sum(matrix));
+
+        /* rows of different lengths, and a row replaced by a new array */
+        for (int i = 0; i < grid.length; i++) {
+            grid[i] = new int[i + 1];
+            grid[i][i] = i + 1;
+        }
+        System.out.println(sum(grid));
+        matrix[0] = new int[100];
+        for (int i = 0; i < 200000; i++) {
+            ArrayLengthNode node = new ArrayLengthNode();
+            node.next = node;
+        }
+        matrix[0][99] = 7;
+        System.out.println(matrix[0].length);
+        System.out.println(sum(matrix));
+
+        ArrayLengthNode[][] nodes = new ArrayLengthNode[2][3];
+        nodes[1][2] = new ArrayLengthNode();
+        nodes[1][2].value = 42;
+        System.out.println(nodes[1][2].value);
+        System.out.println(nodes[0].length);
+    }
+}
+
+class ArrayLengthNode {
+    ArrayLengthNode next;
+    int value;
+}
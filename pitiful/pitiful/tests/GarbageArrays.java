@@ -0,0 +1,47 @@
+public class GarbageArrays {
+    static GarbageArraysBox boxes[] = new GarbageArraysBox[10];
+
+    public static void main(String[] args) {
+        /* arrays and strings that are garbage right away */
+        long total = 0;
+        String text = "";
+        for (int i = 0; i < 20000; i++) {
+            int numbers[] = new int[100];
+            numbers[i % 100] = i;
+            total += numbers[i % 100];
+            long grid[][] = new long[4][8];
+            grid[i % 4][i % 8] = i;
+            total += grid[i % 4][i % 8];
+            text = "item " + i;
+        }
+        System.out.println(total);
+        System.out.println(text);
+
+        /* only reachable through arrays of references */
+        for (int i = 0; i < 20000; i++) {
+            GarbageArraysBox box = new GarbageArraysBox();
+            box.name = "box " + i;
+            box.values = new int[50];
+            box.values[49] = i;
+            boxes[i % 10] = box;
+        }
+        for (int i = 0; i < 10; i++)
+            System.out.println(boxes[i].name);
+        System.out.println(boxes[3].values[49]);
+
+        GarbageArraysBox grid[][] = new GarbageArraysBox[3][];
+        grid[1] = new GarbageArraysBox[2];
+        for (int i = 0; i < 20000; i++) {
+            GarbageArraysBox box = new GarbageArraysBox();
+            box.name = "grid " + i;
+            grid[1][i % 2] = box;
+        }
+        System.out.println(grid[1][0].name);
+        System.out.println(grid[1][1].name);
+    }
+}
+
+class GarbageArraysBox {
+    String name;
+    int values[];
+}
@@ -0,0 +1,59 @@
+public class GarbageCollection {
+    static GarbageCollectionNode kept;
+
+    static int sum(GarbageCollectionNode list) {
+        int total = 0;
+        while (list != null) {
+            total += list.value;
+            list = list.next;
+        }
+        return total;
+    }
+
+    public static void main(String[] args) {
+        /* reachable from a static field through every collection */
+        for (int i = 0; i < 1000; i++)
+            kept = new GarbageCollectionNode(i, kept);
+
+        /* 200000 objects that are garbage once each round is over */
+        long total = 0;
+        GarbageCollectionNode last = null;
+        for (int round = 0; round < 400; round++) {
+            GarbageCollectionNode list = null;
+            for (int i = 0; i < 500; i++)
+                list = new GarbageCollectionNode(round + i, list);
+            total += sum(list);
+            if (round == 123)
+                last = list;
+        }
+        System.out.println(total);
+        System.out.println(sum(kept));
+        System.out.println(sum(last));
+        System.out.println(kept.next.next.value);
+
+        /* one node out of 1000 survives, and the lines between the survivors
+         * are allocated from again */
+        GarbageCollectionNode sparse = null;
+        for (int i = 0; i < 200000; i++) {
+            GarbageCollectionNode node = new GarbageCollectionNode(i, null);
+            if (i % 1000 == 0) {
+                node.next = sparse;
+                sparse = node;
+            }
+        }
+        for (int i = 0; i < 200000; i++)
+            last = new GarbageCollectionNode(i % 10, last);
+        System.out.println(sum(sparse));
+        System.out.println(sum(last));
+    }
+}
+
+class GarbageCollectionNode {
+    int value;
+    GarbageCollectionNode next;
+
+    GarbageCollectionNode(int value, GarbageCollectionNode next) {
+        this.value = value;
+        this.next = next;
+    }
+}
@@ -0,0 +1,37 @@
+public class Intern {
+    static String pick(int i)
+    {
+        if (i % 2 == 0)
+            return "even";
+        return "odd";
+    }
+
+    public static void main(String args[])
+    {
+        String a = "hello";
+        String b = "hello";
+        /* equal literals are the same string */
+        System.out.println(a == b ? 1 : 0);
+        System.out.println(pick(2) == "even" ? 1 : 0);
+        System.out.println(Greeting.get() == a ? 1 : 0);
+        /* a concatenation makes a new string */
+        String c = a + "";
+        System.out.println(c == a ? 1 : 0);
+        System.out.println(c);
+
+        int same = 0;
+        for (int i = 0; i < 5000; i++) {
+            if (pick(i) == pick(i + 2))
+                same++;
+        }
+        System.out.println(same);
+        System.out.println(pick(same + 1));
+    }
+}
+
+class Greeting {
+    static String get()
+    {
+        return "hello";
+    }
+}
@@ -0,0 +1,71 @@
+public class Intrinsics {
+    /* a digit of a number, through its string */
+    static int digit(int n, int i)
+    {
+        String s = Integer.toString(n);
+        return s.charAt(i % s.length()) - '0';
+    }
+
+    public static void main(String args[])
+    {
+        System.out.println(Math.abs(-42));
+        System.out.println(Math.abs(Integer.MIN_VALUE));
+        System.out.println(Math.abs(-5000000000L));
+        System.out.println(Math.min(3, -7));
+        System.out.println(Math.max(3, -7));
+        System.out.println(Math.min(5000000000L, 7L));
+        System.out.println(Math.max(-5000000000L, 7L));
+
+        System.out.println(Integer.parseInt("12345") + 1);
+        System.out.println(Integer.parseInt("-2147483648"));
+        System.out.println(Integer.parseInt("+7"));
+        String min = Integer.toString(Integer.MIN_VALUE);
+        System.out.println(min);
+        System.out.println(min.length());
+
+        String hello = "hello";
+        String lo = "lo";
+        String built = "hel" + lo;
+        System.out.println(hello.length());
+        System.out.println((int) hello.charAt(1));
+        System.out.println(hello.hashCode());
+        System.out.println("".hashCode());
+        System.out.println(hello.equals(built) ? 1 : 0);
+        System.out.println(hello == built ? 1 : 0);
+        System.out.println(hello.equals("help") ? 1 : 0);
+        System.out.println(hello.equals(null) ? 1 : 0);
+        System.out.println(built.hashCode() == hello.hashCode() ? 1 : 0);
+
+        /* overlapping ranges are copied as if through another array */
+        int[] a = new int[10];
+        for (int i = 0; i < a.length; i++)
+            a[i] = i;
+        System.arraycopy(a, 0, a, 3, 5);
+        System.arraycopy(a, 6, a, 5, 4);
+        for (int i = 0; i < a.length; i++)
+            System.out.println(a[i]);
+        long[] big = new long[3];
+        big[0] = -1234567L;
+        long[] copy = new long[4];
+        System.arraycopy(big, 0, copy, 1, 3);
+        System.out.println(copy[1]);
+        long[][] rows = new long[3][];
+        rows[1] = copy;
+        long[][] moved = new long[2][];
+        System.arraycopy(rows, 0, moved, 0, 2);
+        System.out.println(moved[1][1]);
+
+        /* strings made in a loop, which the garbage collector frees */
+        long sum = 0;
+        for (int i = 0; i < 20000; i++) {
+            sum += Integer.parseInt(Integer.toString(i - 10000));
+            sum += digit(i, i) + Math.max(i, 19990) - Math.min(i, 10);
+        }
+        System.out.println(sum);
+
+        long start = System.nanoTime();
+        System.out.println(System.nanoTime() >= start ? 1 : 0);
+        System.out.println(System.currentTimeMillis() > 1500000000000L ? 1
+                                                                       : 0);
+    }
+}
@@ -6,6 +6,8 @@ public class Recursion {
         System.out.println(isOdd(1000) ? 1 : 0);
         System.out.println(isEven(1001) ? 1 : 0);
         System.out.println(isOdd(1001) ? 1 : 0);
+        /* deeper than compiled code nests calls on the C stack */
+        System.out.println(down(10000));
     }
 
     public static int factorial(int n) {
@@ -22,6 +24,10 @@ public class Recursion {
         return n < 2 ? n : fib(n - 2) + fib(n - 1);
     }
 
+    public static int down(int n) {
+        return n == 0 ? 0 : 1 + down(n - 1);
+    }
+
     public static boolean isEven(int n) {
         return n == 0 || isOdd(n - 1);
     }
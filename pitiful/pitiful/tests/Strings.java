@@ -19,5 +19,45 @@ public class Strings {
         System.out.println("1" + 2 + x + "3" + y + 0.8 + str2);
         /* test invokedynamic arguments */
         System.out.println("prefix \1" + str1 + "suffix \2");
+        /* test null and negative arguments */
+        String none = null;
+        long z = java.lang.Long.MIN_VALUE;
+        System.out.println(none + " " + -x + " " + z + str1);
+        /* test char and boolean arguments */
+        char c = 'q';
+        char e = '\u00e9';
+        boolean big = x > 50;
+        System.out.println("c=" + c + e + " " + big + " " + !big);
+        /* test arguments of other classes, which convert themselves */
+        StringsPoint p = new StringsPoint(3, -4);
+        StringsPoint nowhere = null;
+        System.out.println("p=" + p + " " + nowhere + " " + p.twice());
+        /* test Object arguments, which may be strings */
+        Object text = str1;
+        Object point = p;
+        Object nothing = null;
+        System.out.println("o=" + text + " " + point + " " + nothing);
+    }
+}
+
+class StringsPoint {
+    int x;
+    int y;
+
+    StringsPoint(int x, int y)
+    {
+        this.x = x;
+        this.y = y;
+    }
+
+    public String toString()
+    {
+        return "(" + x + ", " + y + ")";
+    }
+
+    /* a concatenation calling back into toString() */
+    String twice()
+    {
+        return this + "" + this;
     }
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+public class Threads {
+    static int total;
+
+    /* a static synchronized method holds the monitor of the class */
+    static synchronized void addTotal(int n)
+    {
+        total += n;
+    }
+
+    public static void main(String args[])
+    {
+        ThreadsCounter counter = new ThreadsCounter();
+        ThreadsWorker[] workers = new ThreadsWorker[4];
+        for (int i = 0; i < workers.length; i++)
+            workers[i] = new ThreadsWorker(2 + i * 5000, 2 + (i + 1) * 5000,
+                                           counter);
+        for (int i = 0; i < workers.length; i++)
+            workers[i].start();
+        for (int i = 0; i < workers.length; i++)
+            workers[i].join();
+
+        for (int i = 0; i < workers.length; i++)
+            System.out.println(workers[i].found);
+        System.out.println(counter.count);
+        System.out.println(counter.checked);
+        System.out.println(total);
+        System.out.println(workers[3].last);
+
+        /* a thread never started is done already */
+        ThreadsWorker idle = new ThreadsWorker(0, 0, counter);
+        idle.join();
+        System.out.println(idle.found);
+    }
+}
+
+class ThreadsCounter {
+    int count;
+    int checked;
+
+    synchronized void add(int n)
+    {
+        count += n;
+    }
+}
+
+class ThreadsWorker extends Thread {
+    int from;
+    int to;
+    int found;
+    String last;
+    ThreadsCounter counter;
+
+    ThreadsWorker(int from, int to, ThreadsCounter counter)
+    {
+        this.from = from;
+        this.to = to;
+        this.counter = counter;
+    }
+
+    static boolean isPrime(int n)
+    {
+        for (int d = 2; d * d <= n; d++) {
+            if (n % d == 0)
+                return false;
+        }
+        return true;
+    }
+
+    public void run()
+    {
+        for (int n = from; n < to; n++) {
+            if (isPrime(n)) {
+                found++;
+                counter.add(1);
+                /* garbage for collections while the other threads run */
+                last = "prime " + n;
+            }
+            synchronized (counter) {
+                counter.checked++;
+            }
+        }
+        Threads.addTotal(found);
+    }
+}
@@ -0,0 +1,112 @@
+class VirtualCallShape {
+    int size;
+
+    VirtualCallShape(int size) {
+        this.size = size;
+    }
+
+    int area() {
+        return 0;
+    }
+
+    int sides() {
+        return 0;
+    }
+
+    int describe() {
+        return area() * 10 + secret();
+    }
+
+    private int secret() {
+        return 1;
+    }
+}
+
+class VirtualCallSquare extends VirtualCallShape {
+    VirtualCallSquare(int size) {
+        super(size);
+    }
+
+    int area() {
+        return size * size;
+    }
+
+    int sides() {
+        return 4;
+    }
+}
+
+class VirtualCallCube extends VirtualCallSquare {
+    VirtualCallCube(int size) {
+        super(size);
+    }
+
+    int area() {
+        return 6 * super.area();
+    }
+}
+
+class VirtualCallTriangle extends VirtualCallShape {
+    VirtualCallTriangle(int size) {
+        super(size);
+    }
+
+    int area() {
+        return size * size / 2;
+    }
+
+    int sides() {
+        return 3;
+    }
+
+    private int secret() {
+        return 2;
+    }
+}
+
+class VirtualCallCircle extends VirtualCallShape {
+    VirtualCallCircle(int size) {
+        super(size);
+    }
+
+    int area() {
+        return 3 * size * size;
+    }
+}
+
+public class VirtualCall {
+    static int total(VirtualCallShape[] shapes) {
+        int sum = 0;
+        for (int i = 0; i < shapes.length; i++) {
+            /* one call site seeing more classes than its cache holds */
+            sum += shapes[i].area();
+        }
+        return sum;
+    }
+
+    public static void main(String[] args) {
+        VirtualCallShape[] shapes = new VirtualCallShape[5];
+        shapes[0] = new VirtualCallShape(1);
+        shapes[1] = new VirtualCallSquare(2);
+        shapes[2] = new VirtualCallCube(3);
+        shapes[3] = new VirtualCallTriangle(4);
+        shapes[4] = new VirtualCallCircle(5);
+
+        for (int i = 0; i < shapes.length; i++) {
+            System.out.println(shapes[i].area());
+            System.out.println(shapes[i].sides());
+            System.out.println(shapes[i].describe());
+        }
+
+        int sum = 0;
+        for (int i = 0; i < 1000; i++)
+            sum += total(shapes);
+        System.out.println(sum);
+
+        VirtualCallShape shape = null;
+        for (int i = 0; i < 5; i++) {
+            shape = shapes[4 - i];
+            System.out.println(shape.area());
+        }
+    }
+}
@@ -0,0 +1,263 @@
+/* for PTHREAD_MUTEX_RECURSIVE */
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+
+__thread java_thread_t *current_thread;
+
+int safepoint_pending;
+
+/* the threads alive, the main one first. The list and the states of the
+ * threads change with the lock held, and the condition is signalled then. */
+static java_thread_t *threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t threads_changed = PTHREAD_COND_INITIALIZER;
+
+/* threads started so far, which Java numbers as they are constructed
+ * instead. Both orders are the same unless a program starts its threads in
+ * another order than it creates them. */
+static unsigned threads_started;
+
+static java_thread_t *create_thread(object_t *object)
+{
+    java_thread_t *thread = calloc(1, sizeof(java_thread_t));
+    assert(thread && "Failed to allocate thread");
+    init_java_stack(&thread->stack);
+    thread->object = object;
+    return thread;
+}
+
+static void free_thread(java_thread_t *thread)
+{
+    free_java_stack(&thread->stack);
+    free(thread->allocations);
+    free(thread);
+}
+
+/* the main thread is the current one */
+void init_threads()
+{
+    threads = current_thread = create_thread(NULL);
+    strcpy(threads->name, "main");
+    threads->state = THREAD_RUNNING;
+}
+
+void free_threads()
+{
+    free_thread(threads);
+    threads = current_thread = NULL;
+}
+
+/* let the garbage collector go on without the current thread, whose frames
+ * are saved. The lock of the threads is held. */
+static void block_locked()
+{
+    current_thread->state = THREAD_BLOCKED;
+    pthread_cond_broadcast(&threads_changed);
+}
+
+/* go on running once the garbage collector is done. The lock of the threads
+ * is held. */
+static void unblock_locked()
+{
+    while (safepoint_pending)
+        pthread_cond_wait(&threads_changed, &threads_lock);
+    current_thread->state = THREAD_RUNNING;
+}
+
+/* wait with the thread blocked until the current one runs alone */
+void block_thread()
+{
+    pthread_mutex_lock(&threads_lock);
+    block_locked();
+    pthread_mutex_unlock(&threads_lock);
+}
+
+void unblock_thread()
+{
+    pthread_mutex_lock(&threads_lock);
+    unblock_locked();
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* stop at a safepoint until the garbage collector is done */
+void park_thread()
+{
+    pthread_mutex_lock(&threads_lock);
+    block_locked();
+    unblock_locked();
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/**
+ * Lock a mutex of the runtime, which other threads may hold while they wait
+ * for the garbage collector. The current thread counts as stopped while it
+ * waits for the mutex, so its frames must be saved.
+ *
+ * @param mutex the mutex to be locked
+ */
+void lock_mutex(pthread_mutex_t *mutex)
+{
+    if (!pthread_mutex_trylock(mutex))
+        return;
+    block_thread();
+    pthread_mutex_lock(mutex);
+    unblock_thread();
+}
+
+/* wait on a condition with the thread blocked, as lock_mutex() does */
+void wait_cond(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    block_thread();
+    pthread_cond_wait(cond, mutex);
+    unblock_thread();
+}
+
+/* the mutexes of the runtime may be locked again by their owner */
+void init_recursive_mutex(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * Wait until every thread but the current one is parked at a safepoint or
+ * blocked in the runtime, for the garbage collector. The threads blocked then
+ * stay so until resume_the_world().
+ */
+void stop_the_world()
+{
+    pthread_mutex_lock(&threads_lock);
+    __atomic_store_n(&safepoint_pending, 1, __ATOMIC_SEQ_CST);
+    for (java_thread_t *thread = threads; thread;) {
+        if (thread != current_thread && thread->state == THREAD_RUNNING) {
+            pthread_cond_wait(&threads_changed, &threads_lock);
+            /* threads may have gone meanwhile */
+            thread = threads;
+            continue;
+        }
+        thread = thread->next;
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+void resume_the_world()
+{
+    pthread_mutex_lock(&threads_lock);
+    __atomic_store_n(&safepoint_pending, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&threads_changed);
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* the thread of a java.lang.Thread, if started and not done yet. The lock of
+ * the threads is held. */
+static java_thread_t *find_thread(object_t *object)
+{
+    java_thread_t *thread = threads;
+    while (thread && thread->object != object)
+        thread = thread->next;
+    return thread;
+}
+
+static void *thread_main(void *arg)
+{
+    java_thread_t *thread = arg;
+    current_thread = thread;
+    unblock_thread();
+    thread->run(thread);
+
+    /* the objects the thread allocated outlive it */
+    flush_allocations(thread);
+    pthread_mutex_lock(&threads_lock);
+    java_thread_t **link = &threads;
+    while (*link != thread)
+        link = &(*link)->next;
+    *link = thread->next;
+    pthread_cond_broadcast(&threads_changed);
+    pthread_mutex_unlock(&threads_lock);
+    free_thread(thread);
+    return NULL;
+}
+
+/**
+ * Start running a java.lang.Thread on a native thread of its own. The object
+ * is kept alive by the thread until it is done.
+ *
+ * @param object the java.lang.Thread
+ * @param run what the thread runs
+ */
+void start_thread(object_t *object, void (*run)(java_thread_t *thread))
+{
+    java_thread_t *thread = create_thread(object);
+    thread->run = run;
+    /* blocked until it runs, with nothing on its stack yet */
+    thread->state = THREAD_BLOCKED;
+
+    pthread_mutex_lock(&threads_lock);
+    if (find_thread(object)) {
+        fprintf(stderr,
+                "Exception in thread \"%s\" "
+                "java.lang.IllegalThreadStateException\n",
+                current_thread->name);
+        exit(1);
+    }
+    snprintf(thread->name, sizeof(thread->name), "Thread-%u",
+             threads_started++);
+    thread->next = threads->next;
+    threads->next = thread;
+    pthread_mutex_unlock(&threads_lock);
+
+    pthread_attr_t attr;
+    pthread_t handle;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&handle, &attr, thread_main, thread)) {
+        fprintf(stderr, "Failed to create thread\n");
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Wait until a java.lang.Thread is done, which it is if it never started
+ *
+ * @param object the java.lang.Thread
+ */
+void join_thread(object_t *object)
+{
+    pthread_mutex_lock(&threads_lock);
+    block_locked();
+    while (find_thread(object))
+        pthread_cond_wait(&threads_changed, &threads_lock);
+    unblock_locked();
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* wait until the current thread is the only one left, as the program ends
+ * once all its threads are done */
+void join_all_threads()
+{
+    pthread_mutex_lock(&threads_lock);
+    block_locked();
+    while (threads->next)
+        pthread_cond_wait(&threads_changed, &threads_lock);
+    unblock_locked();
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/**
+ * Call a function on every thread alive. The other threads must be stopped.
+ *
+ * @param func the function to be called
+ */
+void for_each_thread(void (*func)(java_thread_t *thread))
+{
+    for (java_thread_t *thread = threads; thread; thread = thread->next)
+        func(thread);
+}
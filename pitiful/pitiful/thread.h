@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "frame.h"
+#include "object-heap.h"
+
+/* Java threads, each run by a native thread with its own Java stack and
+ * allocation buffer. The garbage collector stops them all at safepoints:
+ * running threads poll for a pending stop on method entries and backward
+ * branches, where their frames tell what they hold, and threads blocked in
+ * the runtime count as stopped already.
+ */
+
+typedef enum {
+    THREAD_RUNNING,
+    THREAD_BLOCKED, /* parked at a safepoint, or waiting in the runtime */
+} thread_state_t;
+
+typedef struct java_thread {
+    java_stack_t stack;
+    tlab_t tlab;
+    object_t **allocations; /* objects allocated since the last collection */
+    u4 allocations_length;
+    u4 allocations_capacity;
+    size_t allocated; /* bytes of them not yet counted in the object heap */
+    object_t *object; /* the java.lang.Thread, NULL for the main thread */
+    char name[sizeof("Thread-4294967295")]; /* "main", or Thread-N for the
+                                             * N-th thread started */
+    void (*run)(struct java_thread *thread);
+    thread_state_t state; /* changed with the lock of the threads */
+    struct java_thread *next;
+} java_thread_t;
+
+/* the Java thread the native thread runs */
+extern __thread java_thread_t *current_thread;
+
+/* set while the garbage collector waits for the threads to stop */
+extern int safepoint_pending;
+
+/* what threads publish to each other once it is set up */
+#define LOAD_ACQUIRE(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(ptr, value) \
+    __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+void init_threads();
+void free_threads();
+void start_thread(object_t *object, void (*run)(java_thread_t *thread));
+void join_thread(object_t *object);
+void join_all_threads();
+void for_each_thread(void (*func)(java_thread_t *thread));
+
+void park_thread();
+void block_thread();
+void unblock_thread();
+void lock_mutex(pthread_mutex_t *mutex);
+void init_recursive_mutex(pthread_mutex_t *mutex);
+void wait_cond(pthread_cond_t *cond, pthread_mutex_t *mutex);
+void stop_the_world();
+void resume_the_world();
+
+#define SAFEPOINT_PENDING() \
+    __builtin_expect(__atomic_load_n(&safepoint_pending, __ATOMIC_RELAXED), 0)
+
+/* Park the thread if the garbage collector waits for it. The frames of the
+ * thread must tell the instruction they run and their operand stack depth.
+ */
+static inline void safepoint_poll()
+{
+    if (SAFEPOINT_PENDING())
+        park_thread();
+}